@@ -20,6 +20,11 @@
 //**    HELP  => Displays this information to screen.                     **
 //**    KEYS  => Displays just the keys and command formats to screen.    **
 //**    LIST  => Lists maps and masks in memory, with original load name. **
+//**    STATS => Lists the map statistics (AVG, RMS, RFAC) kept from      **
+//**             earlier commands.  Every map and mask carries a          **
+//**             generation, renewed by any command that changes it, so   **
+//**             asking again for the statistics of an unchanged map and  **
+//**             mask costs nothing.  Also shows how often that happened. **
 //**                                                                      **
 //**    MAPIN X1 'name'                                                   **
 //**          => Input a map of name 'name' into variable location X1.    **
@@ -31,7 +36,151 @@
 //**             by the RsRf program is to input a map with the name given**
 //**             at the command line.  ALL OTHER MAPS AND MASKS INPUT TO  **
 //**             THE PROGRAM MUST HAVE THE SAME NUMBER OF ROWS, COLUMNS,  **
-//**             AND SECTIONS AS THIS FIRST COMMAND LINE INPUT MAP.       **
+//**             AND SECTIONS AS THIS FIRST COMMAND LINE INPUT MAP,       **
+//**             though the axis order (MAPC, MAPR, MAPS) may differ.     **
+//**             Maps are held with x fastest, whatever their axis order, **
+//**             and are written back in the axis order of the first map  **
+//**             (not so with -stream or -shm, where maps stay in the     **
+//**             order of their files and must all share it).             **
+//**    MAPBOX x y z nx ny nz                                             **
+//**          => Work on a box of the maps only.  From now on MAPIN and   **
+//**             MASKI read just the nx*ny*nz grid points starting at     **
+//**             grid point x y z (columns, rows, sections of the         **
+//**             principal map file, in the grid units of its header),    **
+//**             wrapping across unit cell edges.  The principal map is   **
+//**             read again as a box and all other maps and masks must be **
+//**             read again.  The box origin is kept in the map header, so**
+//**             written maps are boxes too.  SMEAR, ROUGH and INT take   **
+//**             points beyond the box from their symmetry or lattice     **
+//**             mates inside it, as for any map smaller than the cell    **
+//**             (see SMEAR).  MAPBOX 0 0 0 0 0 0 returns to whole maps.  **
+//**          => Example:  ?MAPBOX 30 -3 25 10 8 9                        **
+//**    MTZIN X1 'name' F PHI                                             **
+//**          => Calculate a map into location X1 from the amplitude and  **
+//**             phase (degrees) columns labelled F and PHI of the MTZ    **
+//**             file 'name', as the CCP4 program fft does.  The          **
+//**             reflections are expanded with the symmetry operators in  **
+//**             the file and transformed on the grid of the principal    **
+//**             map, and X1 covers the same part of the cell, with the   **
+//**             same axis order, as the principal map.  Reflections      **
+//**             finer than the grid are left out.  The last MTZ file is  **
+//**             kept in memory, so maps with other columns are fast.     **
+//**          => Example:  ?MTZIN 2 final.mtz FC PHIC                     **
+//**    MODELMAP X1 P1 B                                                  **
+//**          => Calculate the density of the atoms of PDB file P1 (read  **
+//**             with PDBIN) straight onto the grid of map X1, with no    **
+//**             structure factors.  Each atom is a sum of Gaussians for  **
+//**             its element (columns 77-78, or the atom name), blurred   **
+//**             by its B factor plus B, and weighted by its occupancy.   **
+//**             The map wraps around the unit cell, and is in e/A^3      **
+//**             with F000 included.  Much faster than sfall and fft for  **
+//**             a few residues.                                          **
+//**          => Example:  ?MODELMAP 3 1 0.0                              **
+//**    WINDOW X1 X2 P1 N R                                               **
+//**          => Real space R factor, sum |X1-X2| / sum |X1+X2|, and      **
+//**             correlation of map X1 against map X2 in windows of N     **
+//**             residues along PDB file P1, one window centred on each   **
+//**             residue and cut at chain ends.  A window holds the grid  **
+//**             points within R angstroms of its atoms (the radii of     **
+//**             the PDB data, as for OCCUP, when R is 0).  From one      **
+//**             window to the next only the points that come in or go    **
+//**             out are visited, so long chains cost little more than    **
+//**             the residues themselves.  Not in streaming mode.         **
+//**          => Example:  ?WINDOW 1 2 1 3 1.5                            **
+//**    PAINT Y1 P1 R                                                     **
+//**          => Make mask Y1 the grid points within R angstroms (the     **
+//**             radii of the PDB data when R is 0) of an atom of PDB     **
+//**             file P1 or of one of its symmetry or lattice mates.  The **
+//**             atoms are sorted once into a grid of cells over the unit **
+//**             cell, so each point only looks at the atoms of the cells **
+//**             around it, and large models cost little more than small  **
+//**             ones.  Mask memory must exist (read a mask with MASKI).  **
+//**          => Example:  ?PAINT 1 1 2.5                                 **
+//**    NEAR P1 A R                                                       **
+//**          => List the atoms of PDB file P1, and their symmetry mates, **
+//**             within R angstroms of atom A (counting from 1 in the     **
+//**             file), nearest first.  Uses the same cell list as PAINT. **
+//**          => Example:  ?NEAR 1 25 4.0                                 **
+//**    PARTITION P1 R YES/NO                                             **
+//**          => Give every grid point within R angstroms of an atom of   **
+//**             PDB file P1 (or a symmetry mate) to the nearest atom,    **
+//**             in one threaded pass using the cell list of PAINT.  With **
+//**             YES the distance less the atom radius of the PDB data    **
+//**             is used, so large atoms take more.  No point belongs to  **
+//**             two atoms.  Afterwards OCCUP on P1 sums the density of   **
+//**             the points of each atom instead of a sphere, and WINDOW  **
+//**             with R of -1 uses the points of the window's atoms.      **
+//**             Kept until P1 is read again.                             **
+//**          => Example:  ?PARTITION 1 3.0 NO                            **
+//**    DISTMAP X1 P1 A1 A2 D                                             **
+//**          => Put in map X1 the distance from each grid point to the   **
+//**             nearest of atoms A1 to A2 of PDB file P1 (0 0 for all),  **
+//**             or their symmetry mates, up to D angstroms (points       **
+//**             further away get just over D, so BELOW D leaves them     **
+//**             out).  For cells with right angles a distance transform  **
+//**             on the whole cell grid (even for a boxed map) gives each **
+//**             point a bound, and each point then searches the cell     **
+//**             list of PAINT within its bound for the exact distance;   **
+//**             other cells search up to D.  The searches are threaded   **
+//**             over sections and cost about as much as PAINT with the   **
+//**             bound as radius.  A mask of any radius is then one BELOW.**
+//**          => Example:  ?DISTMAP 3 1 0 0 8.0                           **
+//**    BELOW Y1 X1 V                                                     **
+//**          => Make mask Y1 the points where map X1 is at most V.       **
+//**          => Example:  ?BELOW 1 3 2.5 (with map 3 from DISTMAP, the   **
+//**             points within 2.5 angstroms of the atoms).               **
+//**    RFSWEEP X1 X2 X3 D N T                                            **
+//**          => R factor of type T (1 to 6, as for RFAC) of map X1       **
+//**             against map X2 inside radii D/N, 2D/N, ... D of the      **
+//**             atoms, where X3 is a distance map from DISTMAP.  One     **
+//**             threaded pass sorts the points into N shells by their    **
+//**             distance (a point at a radius is inside it, as for       **
+//**             PAINT), and the R factor for each radius comes from      **
+//**             the running sum of the shells, so the whole curve costs  **
+//**             one RFAC.  The R factor of each shell is also given.     **
+//**             Make X3 from one residue's atoms for its own curve.      **
+//**          => Example:  ?RFSWEEP 1 2 3 5.0 10 6                        **
+//**    CUTSWEEP X1 X2 IN/OUT/TOTAL Y1 MIN MAX N T                        **
+//**          => R factor of type T (1 to 6, as for RFAC) of map X1       **
+//**             against map X2, IN/OUT of mask Y1, over the points where **
+//**             X2 is at least each of N thresholds from MIN up to MAX,  **
+//**             both included (MIN alone when N is 1), as a mask cut     **
+//**             from X2 at that level would give.  One threaded pass     **
+//**             sorts the points into N bins by X2, and each threshold   **
+//**             takes the running sum of the bins above it, so any       **
+//**             number of thresholds costs one RFAC.                     **
+//**          => Example:  ?CUTSWEEP 1 2 TOTAL 0.1 0.5 8 6                **
+//**    LABEL MASK Y1 / MAP X2 V, C N X1 X3                               **
+//**          => Number the connected regions of the IN points of mask    **
+//**             Y1, or of the points of map X2 at or above V, with C     **
+//**             (6, 18 or 26) neighbours, into map X3 (0 outside).       **
+//**             Regions of fewer than N points are dropped.  Each        **
+//**             region is listed with its points, box, and the sum and   **
+//**             largest value of map X1.  The map wraps around along     **
+//**             each axis that covers the whole cell.  Threads join the  **
+//**             points of their own sections and the seams are joined    **
+//**             after, so the numbers, in order of each region's first   **
+//**             point, do not depend on the number of threads.  Write    **
+//**             X3 out to keep the regions.                              **
+//**          => Example:  ?LABEL MASK 1 6 10 1 3                         **
+//**          => Example:  ?LABEL MAP 2 0.5 26 1 1 3                      **
+//**    REGIONSTATS X1 X3                                                 **
+//**          => Points, average, RMS, least and largest value of map     **
+//**             X1 in every region numbered in map X3 by LABEL, in one   **
+//**             pass.                                                    **
+//**          => Example:  ?REGIONSTATS 1 3                               **
+//**    SYMMETRIC X1 YES/NO                                               **
+//**          => Say whether map X1 has the symmetry of the space group   **
+//**             of the principal map (ISPG in its header).  Maps from    **
+//**             MTZIN are marked YES, and maps read with MAPIN or        **
+//**             MODELMAP NO.  When the map covers one whole cell and its **
+//**             grid fits the group, TOTAL statistics (AVG, RMS, SCALE,  **
+//**             and RFAC of two such maps) only visit one point of each  **
+//**             set of symmetry related points, weighted by the size of  **
+//**             the set.  IN/OUT operations on the map, SMEAR and ROUGH  **
+//**             mark it NO.  PDB atoms outside the map are placed on a   **
+//**             symmetry mate that lies inside it.                       **
+//**          => Example:  ?SYMMETRIC 2 YES                               **
 //**    MASKI Y1 'name'                                                   **
 //**          => Input a mask of name 'name' into variable location Y1.   **
 //**             This mask will from then on be referenced by its number  **
@@ -63,11 +212,26 @@
 //**    SMEAR X1 X2 X3 N                                                  **
 //**          => Smooth map X1 by convolution with linear density         **
 //**             sphere and save in location X2.  Memory location X3 is   **
-//**             used for temporary calculations.                         **
+//**             used for temporary calculations.  Maps need not cover    **
+//**             the unit cell:  beyond the map edges (NCSTART etc. in    **
+//**             the header) density is taken from a symmetry or lattice  **
+//**             mate inside the map, and points with none are left out.  **
+//**             The same holds for ROUGH and INT.                        **
+//**             INTEGRATE and OCCUP sum density with INT, so they take   **
+//**             points beyond the map edges from their symmetry mates,   **
+//**             even for a whole-cell map.                               **
 //**          => Example:  ?SMEAR 1 3 4 3                                 **
 //**             Smooths map 1 by spreading out density in one pixel to   **
 //**             three additional pixels in all directions, and saves in  **
 //**             memory location 3.                                       **
+//**    BRICK n                                                           **
+//**          => SMEAR and ROUGH work through the maps in bricks of       **
+//**             n x n x n grid points, each copied out with the halo of  **
+//**             neighbours its points need, so that the points gathered  **
+//**             stay in cache however large the map.  Results are the    **
+//**             same as without.  BRICK 0 (the default) goes back to     **
+//**             the plain loops over whole maps.                         **
+//**          => Example:  ?BRICK 8                                       **
 //**                                                                      **
 //**    ZERO X1 IN/OUT/TOTAL Y1                                           **
 //**          => Assigns zero to all pixels in map X1 which are IN/OUT of **
@@ -144,6 +308,21 @@
 //**          => Example:  ?WRITE 3 out.map                               **
 //**    MASKO Y1 'name'                                                   **
 //**          => Write mask number Y1 to file named 'name'.               **
+//**    Compressed files:  MAPIN and MASKI (and the command line map)     **
+//**             also read maps and masks compressed with gzip or zstd,   **
+//**             known by their first bytes.  WRITE and MASKO compress    **
+//**             when the name ends in .gz or .zst.  The data passes      **
+//**             through a gzip (pigz if installed) or zstd process       **
+//**             straight into memory, with no temporary file.  Masks     **
+//**             compress very well.  Compressed files can not be used    **
+//**             with MAPBOX, -stream or -shm.                            **
+//**    SAVE 'name'                                                       **
+//**          => Save the whole workspace (all maps, masks, headers,      **
+//**             statistics, PDB files and names) to one binary file.     **
+//**    RESTORE 'name'                                                    **
+//**          => Restore a workspace written by SAVE.  The maps and masks **
+//**             are mapped from the file, not read, so this is immediate **
+//**             and a long preparation need only be run once.            **
 //**                                                                      **
 //**    GRAY 'name' n X1 X1Start X1Step ... Xn XnStart XnStep             **
 //**         x1 x2 y1 y2 z1 z2                                            **
@@ -168,6 +347,56 @@
 //**    END/QUIT/STOP                                                     **
 //**          => Quits program.                                           **
 //**                                                                      **
+//**    COMMAND LINE OPTIONS                                              **
+//**          => RsRf 'map' [maps] [masks] [-stream] [-slab N]            **
+//**                  [-server 'socket'] [-shm] [-box x y z nx ny nz]     **
+//**                  [-prefetch] [-quiet]                                **
+//**             'map' is the principal map, maps and masks are the       **
+//**             number of memory locations (default 3 and 1).            **
+//**    -stream  Streaming mode for maps larger than memory.  Maps and    **
+//**             masks are left on disk and RFAC, RMS, AVG, SCALE, ADD,   **
+//**             SUB, COMB, PLUS, MULT, CUT, ZERO, SMEAR, ROUGH, WRITE    **
+//**             and MASKO read them in slabs of Z sections, with the     **
+//**             next slab read while the current one is processed.       **
+//**             Modified maps are kept in scratch files (in $TMPDIR or   **
+//**             the current directory) which are removed on exit.  Other **
+//**             keywords are not available in this mode.                 **
+//**    -slab N  Number of Z sections in each streamed slab (default 16). **
+//**    -server 'socket'                                                  **
+//**             Server mode.  After the principal map is read RsRf waits **
+//**             for clients on the Unix domain socket 'socket'.  Each    **
+//**             client sends keywords exactly as on standard input, or   **
+//**             one JSON command per line, e.g.                          **
+//**                {"cmd":"RFAC","args":[1,2,"IN",1,6]}                  **
+//**             and reads the replies.  Maps, masks and PDB files stay   **
+//**             in memory between clients.  END/QUIT/STOP/EXIT (or       **
+//**             closing the connection) ends the client, SHUTDOWN stops  **
+//**             the server.                                              **
+//**    -shm     Shared maps.  MAPIN keeps each map file in a POSIX       **
+//**             shared memory segment (/dev/shm/rsrf-<hash>).  The       **
+//**             first RsRf on the node to read a map fills the segment,  **
+//**             later ones map it copy-on-write, so any number of RsRf   **
+//**             processes share one copy of start.map and model.map.     **
+//**             Segments outlive the processes; remove them with         **
+//**             rm /dev/shm/rsrf-*.                                      **
+//**    -box x y z nx ny nz                                               **
+//**             Read the principal map (and all later maps and masks) as **
+//**             a box, as for MAPBOX.  Not used with -stream.            **
+//**    -prefetch                                                         **
+//**             Read the whole keyword script from standard input first, **
+//**             then read every map and mask named by MAPIN and MASKI    **
+//**             (and the principal map) at the same time, in background  **
+//**             threads.  Each MAPIN or MASKI waits only for its own     **
+//**             file.  Plain files are read into the page cache, and     **
+//**             compressed ones decoded into memory, which is let go     **
+//**             once the script is past their MAPIN or MASKI.  Files     **
+//**             with a short header, or not the size of the principal    **
+//**             map, are left to MAPIN and MASKI.  Files also named by   **
+//**             WRITE, MASKO or SAVE are read when asked for.  Not used  **
+//**             with -stream or -server.                                 **
+//**    -quiet   No banner, principal map header or map size tables, for  **
+//**             short runs driven by another program.                    **
+//**                                                                      **
 //**************************************************************************
 //**************************************************************************
 
@@ -178,42 +407,64 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <complex>
+#include <new>
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdio_ext.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <float.h>
+#include <stdint.h>
 #include "stdio.h"
 using namespace std;
 
+typedef complex<double> cplx;         // Structure factors, FFT
+
+// Built with:  g++ -O2 -o RsRf RsRf.cc -lpthread
+
 //**************************************************************************
 //**                        DATA TYPE DECLARATIONS                        **
 //**************************************************************************
 
 // STRUCTURES
 
-struct   map_header
-   {
-
-   long  NC;
-   long  NR;
-   long  NS;
-   long  MODE;
-   long  NCSTART;
-   long  NRSTART;
-   long  NSSTART;
-   long  NX;
-   long  NY;
-   long  NZ;
+struct   map_header                   // CCP4 header:  56 four byte words
+   {                                    //    and LAB_LEN bytes of labels
+                                        //    (1024 bytes), then NSY bytes
+   int   NC;                            //    of symmetry records.
+   int   NR;
+   int   NS;
+   int   MODE;
+   int   NCSTART;
+   int   NRSTART;
+   int   NSSTART;
+   int   NX;
+   int   NY;
+   int   NZ;
    float CELL[6];
-   long  MAPC;
-   long  MAPR;
-   long  MAPS;
+   int   MAPC;
+   int   MAPR;
+   int   MAPS;
    float AMIN;
    float AMAX;
    float AMEAN;
-   long  ISPG;
-   long  NSY;
+   int   ISPG;
+   int   NSY;
    float REST[32];
    char  LAB[1000];
    char  SYM[10000];
@@ -245,6 +496,331 @@ struct   pdb_info
    float r;
    };
 
+struct   stat_sum                     // Statistics summed slab by slab
+   {
+   long   num;
+   double tot;
+   double var;                        // Sum of squared deviations
+   float  min;
+   float  max;
+   };
+
+struct   str_load                     // One slab read in the background
+   {
+   int    slot[4];                    // MAP_H numbers of the inputs
+   int    fd[4];                      // Their backing files (-1 = zeros)
+   long   off[4];                     // Offset of the voxels in each file
+   int    nslot;
+   int    z0;                         // First section, halo included
+   int    nz;                         // Number of sections, with halo
+   int    zlim;                       // Sections in the whole map
+   float  *map;                       // Slab buffer for map locations
+   char   *msk;                       // Slab buffer for mask locations
+   };
+
+struct   sym_op                       // Symmetry operator, fractional
+   {                                  //    x' = R x + t
+   int    R[3][3];
+   float  t[3];
+   };
+
+struct   mtz_data                     // Last MTZ file read by MTZIN
+   {
+   string         file;
+   long           mtime;
+   long           size;
+   int            ncol;
+   long           nref;
+   float          cell[6];
+   int            nan;                // Missing values are NaN
+   float          valm;               //    or else this number
+   vector<string> label;
+   vector<float>  data;               // nref records of ncol values
+   vector<sym_op> sym;
+   };
+
+struct   fft_job                      // Lines of one FFT3 axis (thread)
+   {
+   cplx        *A;                    // Half complex grid
+   float       *rho;                  // Real density out
+   int         n[3];
+   const cplx  *tw[3];                // Twiddles for each axis
+   int         axis;
+   int         tid;
+   int         nth;
+   };
+
+struct   model_atom                   // One atom for MODELMAP
+   {
+   double f[3];                       // Fractional position
+   double reach[3];                   // Cut off radius, in fractions
+   double amp[5];                     // Gaussian heights
+   double wid[5];                     //    and 4 pi^2 / (b + B)
+   double cut2;                       // Cut off radius squared
+   };
+
+struct   model_job                    // Sections z0 to z1 of MODELMAP
+   {
+   int               map1;
+   const model_atom  *atom;
+   long              num;
+   int               z0;
+   int               z1;
+   double            O[3][3];         // Orthogonalisation matrix
+   };
+
+struct   atom_cells                   // Cell list of the atoms of a PDB
+   {                                  //    file and their symmetry mates
+   int            pdb1;               // File it was made for, or -1
+   float          edge;               // Least cell size, angstroms
+   float          cell[6];            // Unit cell it was made for
+   int            ispg;               //    and space group
+   int            n[3];               // Cells along a, b and c
+   double         O[3][3];            // Orthogonalisation matrix
+   double         F[3][3];            //    and its inverse
+   double         len[3];             // Fractions of a, b, c per angstrom
+   vector<int>    start;              // First entry of each cell
+   vector<int>    atom;               // Atom number of each entry
+   vector<float>  f;                  // Fractional position, in the cell
+   };
+
+struct   cell_hit                     // One atom mate found in the list
+   {
+   int    atom;                       // Atom number (1 based)
+   double f[3];                       // Fractional position of the mate
+   double d;                          // Distance, angstroms
+   };
+
+struct   paint_job                    // Sections z0 to z1 of PAINT
+   {
+   const atom_cells  *cl;
+   int               msk1;
+   int               pdb1;
+   float             r;               // Radius, or 0 for PDB data radii
+   float             reach;           // Largest radius
+   int               z0;
+   int               z1;
+   long              num;             // Points painted
+   };
+
+struct   atom_parts                   // Grid points given to their
+   {                                  //    nearest atom by PARTITION
+   int               pdb1;            // File it was made for, or -1
+   float             r;               // Cut off, angstroms
+   int               weigh;           // Distance less the atom radius
+   vector<int>       lab;             // Atom of each point, or 0
+   vector<long>      start;           // First entry of each atom in vox
+   vector<uint32_t>  vox;             // Points, sorted by atom
+   };
+
+struct   part_job                     // Sections z0 to z1 of PARTITION
+   {
+   const atom_cells  *cl;
+   int               *lab;
+   int               pdb1;
+   float             r;
+   int               weigh;
+   int               z0;
+   int               z1;
+   long              num;             // Points given to an atom
+   };
+
+struct   dist_job                     // Lines of one DISTMAP axis (thread)
+   {
+   double      *d2;                   // Squared distances, whole cell
+   int         *lab;                  // Nearest mate + 1, or 0
+   const float *f;                    // Fractional positions of mates
+   int         n[3];                  // Cell grid
+   double      h[3];                  // Grid spacing, angstroms
+   int         axis;
+   int         tid;
+   int         nth;
+   };
+
+struct   dist_slab                    // Sections z0 to z1 of DISTMAP
+   {
+   const atom_cells  *cl;
+   const int         *lab;            // Mate the passes found + 1, or NULL
+   int               map1;
+   int               first;           // Atoms first to last
+   int               last;
+   float             dmax;
+   int               z0;
+   int               z1;
+   };
+
+struct   sweep_bin                    // RFAC sums of one bin of a sweep
+   {
+   double      num;
+   double      dif;                   // |map1 - map2|
+   double      s1;                    // map1 and map2
+   double      s2;
+   double      q1;                    // map1 and map2 squared
+   double      q2;
+   };
+
+struct   sweep_job                    // Every nth section of a sweep
+   {
+   const float *rho1;
+   const float *rho2;
+   const float *key;                  // Map the bins are chosen by
+   const char  *msk;
+   int         zone2;
+   float       lo;                    // Edges lo to hi in steps
+   float       hi;
+   int         steps;
+   int         nbin;
+   int         top;                   // Last bin takes all above it
+   int         upper;                 // Bins hold their upper edge
+   sweep_bin   *bins;                 // nbin bins for every section
+   int         tid;
+   int         nth;
+   };
+
+struct   label_job                    // Sections z0 to z1 of LABEL
+   {
+   const char  *in;                   // Points to be labelled
+   int         *up;                   // Union-find parent of each point
+   int         (*off)[3];             // Neighbours before a point
+   int         noff;
+   int         wrap[3];               // Axis covers the whole cell
+   int         z0;
+   int         z1;
+   };
+
+struct   region_sum                   // Values of map1 in one region
+   {
+   long        num;
+   double      s1;
+   double      q1;                    // Squared
+   float       min;
+   float       max;
+   };
+
+struct   sum_part                     // Statistics of one block of
+   {                                  //    voxels (a section, or part of
+   double tot;                        //    the asymmetric unit)
+   double sq;                         // Squared deviations from avg
+   double dif;                        // |map1 - map2|
+   long   num;
+   float  max;
+   float  min;
+   };
+
+struct   sum_job                      // Blocks b0 to b1 of a statistic
+   {
+   int       op;                      // SUM_PARMS, SUM_RMS or SUM_RFAC
+   int       map1;
+   int       map2;
+   int       zone2;                   // 0, 1 or 2 for TOTAL
+   int       msk1;
+   int       asu;                     // Blocks of asu_loc, not sections
+   long      nvox;                    // Entries in asu_loc or at
+   const uint32_t *at;                // Blocks of a msk_list, with the
+   const float    *g1;                //    values of map1 and map2
+   const float    *g2;                //    gathered
+   float     avg;                     // For SUM_RMS
+   long      b0;
+   long      b1;
+   sum_part  *part;
+   };
+
+struct   rfac_memo                    // One RFAC sum of differences,
+   {                                  //    for these map, map and mask
+   long   gen[3];                     //    generations and zone
+   int    zone;
+   double value;
+   };
+
+struct   msk_list                     // Voxels IN or OUT of a mask, so
+   {                                  //    the mask is scanned only once
+   long   gen;                        // msk_gen it was made for, or -1
+   int    big;                        // Too many voxels to be worth it
+   vector<uint32_t> at;               // Their locations, in order
+   };
+
+struct   map_gather                   // Values of a map at the voxels of
+   {                                  //    a msk_list, side by side
+   long   gen[2];                     // map_gen and msk_gen, -1 for none
+   int    zone2;
+   vector<float> v;
+   };
+
+struct   pre_job                      // One map or mask read ahead
+   {
+   char      file[256];               // Name given to MAPIN or MASKI
+   int       fd;                      // Its bytes (memfd), -1 on error
+   int       used;                    // Taken by ReadMap or ReadMsk
+   long      pos;                     // Script offset past its last name
+   pthread_t tid;
+   };
+
+struct   box_src                      // Where a MAPBOX box is in the file
+   {
+   int    n[3];                       // Columns, rows, sections in file
+   int    lo[3];                      // NCSTART, NRSTART, NSSTART
+   int    per[3];                     // Cell grid along the same axes
+   int    blo[3];                     // The box along the same axes,
+   int    bn[3];                      //    origin and size
+   long   data;                       // Offset of the first voxel
+   };
+
+struct   brick_buf                    // One brick of a map with a halo
+   {                                  //    round it, x fastest
+   int    lo[3];                      // First grid point inside (1 based)
+   int    in[3];                      // Grid points inside
+   int    h[3];                       // Halo on each side
+   int    n[3];                       // Grid points with the halo
+   vector<float> v;                   // Density
+   vector<char>  ok;                  // 0 where no mate is in the map
+   };
+
+struct   work_head                    // SAVE file:  this header, MAP_H,
+   {                                  //    statistics, names and PDB data,
+   int    magic;                      //    then MAP and MSK page aligned.
+   int    version;
+   int    X_LIM;
+   int    Y_LIM;
+   int    Z_LIM;
+   int    X_CELL;
+   int    Y_CELL;
+   int    Z_CELL;
+   int    map_mem;
+   int    msk_mem;
+   int    pdb_mem;
+   int    pdb_max;
+   int    msk_num_1;
+   int    DatNum;
+   float  X_GRID;
+   float  Y_GRID;
+   float  Z_GRID;
+   float  cel_vol;
+   float  map_vol;
+   float  vox_vol;
+   float  value;                      // Memory variable
+   long   pdb_num;                    // Entries in PDB
+   long   pdb_off;                    // File offsets of PDB, MAP, MSK
+   long   map_off;
+   long   msk_off;
+   long   len;                        // Length of the file
+   int    axis_on;                    // Layout of MAP and MSK
+   int    file_ax[3];
+   };
+
+// CLASSES
+
+class    cmd_buf : public streambuf   // Server input:  keyword lines are
+   {                                  //    passed through, JSON lines are
+   public:                            //    turned into keywords first.
+      void  attach(streambuf *src)  { source = src;  reset(); }
+      void  reset()                 { setg(0, 0, 0); }
+   protected:
+      int   underflow();
+   private:
+      streambuf *source;
+      string    line;
+   };
+
 //**************************************************************************
 //**                           GLOBAL VARIABLES                           **
 //**************************************************************************
@@ -254,6 +830,7 @@ const float DegToRad = ((2.0 * PI)/360);
 const float E        = 2.7182818;
 
 int         LAB_LEN  = 800;           // Length of the Header
+int         HEAD_LEN = 56;            // Header words before the labels
 
 map_header  MAP_H[21];                // Map Header Information
 
@@ -270,14 +847,14 @@ int         Z_LIM;                    // MAP SIZE:  Z sections
 int         Y_LIM;                    //            Y sections
 int         X_LIM;                    //            X sections
 
-int         XY_LIM;                   // X * Y (Needed by program)
-int         XYZ_LIM;                  // X * Y * Z (Total map size)
+long        XY_LIM;                   // X * Y (Needed by program)
+long        XYZ_LIM;                  // X * Y * Z (Total map size)
 
 int         Z_CELL;                   // Unit cell z-grid points
 int         Y_CELL;                   // Unit cell y-grid points
 int         X_CELL;                   // Unit cell x-grid points
 
-int         XYZ_CELL;                 // Unit cell x*y*z
+long        XYZ_CELL;                 // Unit cell x*y*z
 
 float       Z_GRID;                   // Angstrom size of z-grid
 float       Y_GRID;                   // Angstrom size of y-grid
@@ -291,7 +868,7 @@ float       map_max[21][5];           // Maximum electron density in map
 float       map_min[21][5];           // Minimum electron density in map
 float       map_avg[21][5];           // Average electron density in map
 float       map_tot[21][5];           // Sum of  electron density in map
-int         map_num[21][5];           // Number of pixels within map
+long        map_num[21][5];           // Number of pixels within map
 float       map_var[21][5];           // Variance of density of map
 float       map_rms[21][5];           // RMS density (i.e. standard deviation)
 
@@ -301,11 +878,126 @@ int         pdb_mem;                  // Space for number of PDB files
 
 int         pdb_max;                  // Maximum length of each PDB file
 int         pdb_len[10];              // Actual length of each PDB file
+atom_cells  cell_list;                // Cell list of the last PDB asked
+atom_parts  part_list;                // Last PARTITION of the grid
 
 int         msk_num_1;                // First mask loaded into memory
 
 float       temp;                     // Used to pass variables to functoins
 
+int         stream_on  = 0;           // Maps and masks streamed from disk
+int         stream_sec = 16;          // Z sections in each streamed slab
+int         stream_num = 0;           // Scratch files made so far
+
+char        str_file[21][256];        // Backing file of each map and mask
+long        str_off[21];              // Offset of the voxels in that file
+int         str_tmp[21];              // Backing file is a scratch file
+
+const int   S_STAT   = 1;             // Streamed passes:  statistics
+const int   S_ZERO   = 2;             //    ZERO
+const int   S_CUT    = 3;             //    CUT
+const int   S_MOD    = 4;             //    ADD, SUB, COMB
+const int   S_ADD    = 5;             //    PLUS
+const int   S_MULT   = 6;             //    MULT and SCALE
+const int   S_SMEAR  = 7;             //    SMEAR
+const int   S_ROUGH  = 8;             //    ROUGH
+const int   S_COPY   = 9;             //    WRITE, MASKO
+
+char        server_name[108] = "";    // Unix socket for server mode
+int         server_fd   = -1;         // Listening socket
+int         server_live = 0;          // A client is connected
+int         server_end  = 0;          // SHUTDOWN received
+int         server_in   = -1;         // Standard input and output, kept
+int         server_out  = -1;         //    while a client has them
+
+cmd_buf     server_buf;               // Client input, JSON translated
+
+int         shm_on     = 0;           // MAPIN through shared memory
+
+struct   shm_ctl                      // Start of a shared map segment
+   {
+   int    magic;                      // SHM_MAGIC
+   int    ready;                      // Set once the loader is done
+   long   nvox;                       // Voxels in the map
+   long   data;                       // Offset of the voxels
+   };
+
+const int   SHM_MAGIC = 0x52735266;   // "RsRf"
+
+const int   WORK_MAGIC = 0x57735266;  // "RsRW"
+
+char        *work_base = NULL;        // RESTORE file mapped in memory
+long        work_len   = 0;
+
+mtz_data    mtz_last;                 // Reflections kept for MTZIN
+
+int         quiet_on   = 0;           // No banner or map size tables
+
+int         pre_on     = 0;           // Script scanned, inputs read ahead
+int         pre_num    = 0;           // Files being read ahead
+const int   PRE_MAX    = 32;
+pre_job     pre_list[32];
+
+stringbuf   pre_buf;                  // The script, read from cin
+long        pre_vox    = 0;           // Voxels in the principal map file
+
+void        (*zip_pipe)(int) = SIG_DFL; // SIGPIPE while compressing
+
+int         box_on     = 0;           // Maps and masks read as a box
+int         box_lo[3];                // Box origin (grid units)
+int         box_n[3];                 // Box size (grid points)
+int         box_full[6];              // Whole principal map:  NC NR NS
+                                      //    (in the layout) and NX NY NZ
+
+int         axis_on    = 0;           // Maps held x fastest, whatever
+int         file_ax[3] = {1, 2, 3};   //    the file order; MAPC, MAPR and
+                                      //    MAPS of the principal map file,
+                                      //    used again for writing
+const int   AXIS_TILE  = 32;          // Block edge for the transpose
+
+const int   SUM_PARMS  = 0;           // What SumStats adds up:  max, min,
+const int   SUM_RMS    = 1;           //    total, number; deviations;
+const int   SUM_RFAC   = 2;           //    differences of two maps
+const long  SUM_BLOCK  = 65536;       // asu_loc entries in a block
+
+int         brick_n    = 0;           // SMEAR and ROUGH work brick by
+                                      //    brick of this edge, 0 for not
+
+vector<sym_op> sym_ops;               // Operators of the principal map
+int         sym_ispg   = -1;          //    space group, made for this
+const char  *sym_name  = "P 1";       //    number, and its name
+
+int         map_symm[21];             // Map has the space group symmetry
+
+long        gen_next   = 0;           // Last generation handed out; a
+long        map_gen[21];              //    map or mask gets a new one
+long        msk_gen[11];              //    whenever it may have changed
+long        stat_key[21][5][2];       // Map and mask generations that
+long        rms_key [21][5][2];       //    map_avg etc. and map_rms are
+                                      //    for, -1 for none
+long        stat_hit   = 0;           // Statistics found stored
+long        stat_miss  = 0;           //    or worked out
+vector<rfac_memo> rfac_seen;          // Last RFAC sums
+const int   RFAC_SEEN  = 16;
+
+msk_list    msk_idx[11][2];           // Voxels of each mask that are not
+                                      //    0 (IN) or not 1 (OUT)
+const int   GATHER_MAX = 8;           // Gathered maps kept, the oldest
+map_gather  gath[8];                  //    made again first
+int         gath_next  = 0;
+
+int         grid_ok    = -1;          // grid_M made, -1 not yet
+int         grid_all   = 0;           // Every operator fits the grid
+int         grid_n[3];                // Cell grid along a, b, c
+int         grid_ax[3];               // Cell axis of map axis i,
+int         grid_st[3];               //    and its start
+vector<int> grid_M;                   // Operators that fit the grid,
+vector<int> grid_T;                   //    in grid units
+
+int         asu_ok     = -1;          // asu_loc usable, -1 not yet known
+vector<long> asu_loc;                 // A grid point of each set of
+vector<int>  asu_wt;                  //    equivalent points, set size
+
 //**************************************************************************
 //**                         FUNCTION PROTOTYPES                          **
 //**************************************************************************
@@ -320,6 +1012,10 @@ int   ReadMap(const char *file, int map1, int mem); // Read map
 
 float ReadMsk(const char *file, int msk1, int mem); // Read mask
 
+int   ReadHead(FILE *read1, int map1);              // Read map header
+
+int   WriteHead(FILE *write1, int map1);            // Write map header
+
 int   ReadPDB(const char *file, int pdb1);          // Read pdb file
 
 int   WritePDB(const char *file, int pdb1);         // Write pdb file
@@ -332,6 +1028,8 @@ float Scale(int map1, int map2, int zone, int msk1);// Scales maps
 
 float Rfac(int map1, int map2, int zone, int msk1, int type);
                                       // Find map R factor
+float RfacOut(int map1, int map2, int zone, double value, int type);
+                                      // Print R factor table
 void  Smear(int map1, int map2, int map3, int N);   // Smooths map
 
 void  Rough(int map1, int map2, int N);             // Calculate map roughness
@@ -339,9 +1037,9 @@ void  Rough(int map1, int map2, int N);             // Calculate map roughness
 void  Shape(int msk1, int msk2, int msk3, int map1, float MinDif, int count1, int count2);
          // Modifies mask by expanding until inflection points in all directions
 
-int   Zero(int map1, int zone, int msk1);           // Sets to zero
+long  Zero(int map1, int zone, int msk1);           // Sets to zero
 
-int   Cut(int map1, int zone, int msk1, float min, float max);
+long  Cut(int map1, int zone, int msk1, float min, float max);
                                       // Cuts below min, above max
 
 void  MaxOf(int map1, int map2, int map3);
@@ -367,6 +1065,22 @@ float FindParms(int map1, int zone, int msk1);
 float FindRMS  (int map1, int zone, int msk1);
                                       // Finds map rms variance of density
 
+void  MapTouch (int map1);            // New generation:  map1 changed
+void  MskTouch (int msk1);            //    or mask msk1 changed
+int   StatSeen (long key[2], int map1, int zone, int msk1);
+                                      // 1 if stored statistics still hold
+void  StatList ();                    // STATS table
+
+const vector<uint32_t> *MskList(int msk1, int zone2);
+                                      // Voxels IN/OUT of msk1, or NULL
+int   MapGather(int map1, int msk1, int zone2, int avoid);
+                                      // gath slot of map1 on MskList
+
+void  *SumSlab (void *arg);           // Thread body for SumStats
+void  SumStats (int op, int map1, int map2, int zone2, int msk1, float avg,
+                sum_part *out);       // Threaded sums, same for any number
+                                      //    of threads
+
 void  MapAdd(int map1, int zone, int msk1, float value);
                                       // Adds value to map
 
@@ -381,6 +1095,194 @@ int   MakeGray(const char *file, int map1);
                                       // Display eveything to grayscale
 void  Integrate(int pdb1, int map1);  
                                       // Integrate pdb file densities
+void  ResVoxels(int pdb1, int first, int last, float r,
+                vector<uint32_t> &list);
+                                      // Grid points of some atoms
+void  Window(int map1, int map2, int pdb1, int N, float r);
+                                      // RSR over residue windows
+
+atom_cells *CellBuild(int pdb1, float edge);
+                                      // Cell list of atoms and mates
+int   CellBox(const atom_cells *cl, const double lo[3], const double hi[3],
+              vector<cell_hit> &hits);
+                                      // Atom mates in a fractional box
+int   CellSphere(const atom_cells *cl, const double f0[3], float r,
+                 vector<cell_hit> &hits);
+                                      // Atom mates within r of a point
+void  *PaintSlab(void *arg);          // Sections of PAINT (thread)
+long  Paint(int msk1, int pdb1, float r);
+                                      // Mask of points near atoms
+void  Near(int pdb1, int atom1, float r);
+                                      // Atoms near an atom
+void  *PartSlab(void *arg);           // Sections of PARTITION (thread)
+long  Partition(int pdb1, float r, int weigh);
+                                      // Points to their nearest atom
+void  *DistLines(void *arg);          // One axis of DISTMAP (thread)
+void  *DistSlab(void *arg);           // Sections of DISTMAP (thread)
+int   DistMap(int map1, int pdb1, int first, int last, float dmax);
+                                      // Distance to the nearest atom
+long  Below(int msk1, int map1, float value);
+                                      // Mask where a map is low
+void  *SweepSlab(void *arg);          // Sections of a sweep (thread)
+void  Sweep(int map1, int map2, int key, float lo, float hi, int steps,
+            int nbin, int top, int upper, int zone2, int msk1,
+            vector<sweep_bin> &out);
+                                      // RFAC sums in bins of a key map
+float SweepEdge(float lo, float hi, int steps, int k);
+                                      // Edge k of the bins of a sweep
+void  SweepAdd(sweep_bin *a, const sweep_bin *b);
+                                      // Adds bin b to bin a
+double SweepR(const sweep_bin *b, int type);
+                                      // R factor of a bin
+void  RfSweep(int map1, int map2, int dist, float dmax, int nbin, int type);
+                                      // R factor against mask radius
+void  CutSweep(int map1, int map2, int zone, int msk1, float min, float max,
+               int nbin, int type);
+                                      // R factor against threshold
+long  LabFind(int *up, long a);      // Root of a union-find set
+void  LabJoin(int *up, long a, long b);
+                                      // Joins two union-find sets
+void  *LabelSlab(void *arg);          // Sections of LABEL (thread)
+long  Label(const char *in, int map3, int conn, long least, int map1);
+                                      // Connected regions of points
+void  RegionStats(int map1, int map3);// Statistics of every region
+
+// STREAMING MODE
+
+long  StreamPass(int op, int map1, int map2, int map3, int zone, int msk1,
+                 float value1, float value2, int N, stat_sum *acc, int fd);
+                                      // One pass over slabs from disk
+void  *StreamLoad(void *arg);         // Reads one slab (background)
+
+double StreamStat(int map1, int map2, int zone, int msk1);
+                                      // Streamed AVG, RMS, RFAC sums
+float StreamScale(int map1, int map2, int zone, int msk1);
+                                      // Streamed SCALE
+float StreamWrite(const char *file, int slot);
+                                      // Streamed WRITE and MASKO
+int   StreamFile(const char *file, int slot, long offset);
+                                      // Sets backing file of a location
+int   StreamScratch(int slot);        // Opens new scratch file
+void  StreamClean();                  // Removes scratch files
+
+void  SlabStat(stat_sum *acc, int map1, int zone, int msk1,
+               long first, long last);// Adds slab to statistics
+int   NoStream(const char *input);    // Keyword not streamed
+
+// SHARED MEMORY
+
+int   ShmMap(const char *file, FILE *read1, int map1);
+                                      // Map from shared segment
+
+// COMPRESSED FILES
+
+int   ZipType(const char *file, int write);         // 0 plain, 1 gzip, 2 zstd
+FILE  *ZipOpen(const char *file, const char *mode, int *zip);
+                                      // fopen, or pipe through gzip/zstd
+int   ZipClose(FILE *file1, int zip, int write);
+                                      // fclose or pclose
+
+// RECIPROCAL SPACE
+
+int   SymParse(const char *text, sym_op *op);       // "X,-Y,Z+1/2" => op
+int   ReadMTZ(const char *file);      // Reflections into mtz_last
+void  swap4(unsigned char *b);        // Byte order of one word
+void  FFT(const cplx *in, long stride, cplx *out, int n, int step,
+          const cplx *tw, int N, cplx *tmp);
+                                      // Mixed radix 1D transform
+void  *FftLines(void *arg);           // One axis of FFT3 (thread)
+void  FFT3(cplx *A, float *rho, int NX, int NY, int NZ);
+                                      // Half complex grid => density
+int   MtzMap(const char *file, int map1, const char *fcol, const char *pcol);
+                                      // Map from MTZ F and PHI
+
+// MODEL DENSITY
+
+void  CellMatrix(const float *cell, double O[3][3], double F[3][3]);
+                                      // Fractional <=> orthogonal
+int   FormFactor(const pdb_file *atom, float a[5], float b[5]);
+                                      // Gaussians for element of atom
+void  *ModelSlab(void *arg);          // Sections of MODELMAP (thread)
+int   ModelMap(int map1, int pdb1, float badd);
+                                      // Map straight from atoms
+
+// AXIS ORDER
+
+int   AxisValid(const int ax[3]);     // MAPC, MAPR, MAPS a permutation
+void  AxisHead(map_header *head, const int ax[3]);
+                                      // Header to axis order ax
+void  AxisCopy(const char *in, int nc, int nr, long sc, long sr,
+               char *out, int elem);  // One section, blocked transpose
+void  AxisStride(const int ax[3], int n[3], long stride[3]);
+                                      // File axes in the x fastest layout
+int   ReadAxes(FILE *read1, const int ax[3], char *dest, int elem);
+                                      // File order => x fastest
+void  AxisLoad(const char *in, const int ax[3], char *dest, int elem);
+                                      // Same, from memory
+int   WriteAxes(FILE *write1, const int ax[3], const char *src, int elem);
+                                      // x fastest => file order
+
+// BRICKS
+
+void  BrickSet(brick_buf *b, int X, int Y, int Z, int hx, int hy, int hz);
+                                      // Brick at X, Y, Z with halo
+void  BrickFill(brick_buf *b, int map1);
+                                      // Copies in map1 and mates
+void  SmearBricks(int axis, int map2, int map3, int N, const float *mod);
+                                      // One SMEAR pass by bricks
+void  RoughBricks(int map1, int map2, int N, float *min_rough,
+                  float *max_rough);  // ROUGH by bricks
+
+// SYMMETRY
+
+int   SymGroup(int ispg, vector<sym_op> &ops);      // Operators of group
+int   SymSame(const sym_op &op1, const sym_op &op2);// Same operator
+void  SymLoad();                      // sym_ops of the principal map
+int   SymGrid();                      // Operators in grid units
+long  SymWrap(int X, int Y, int Z);   // Map point of a mate, or -1
+int   AsuBuild();                     // Asymmetric unit and weights
+int   SymInside(const double frac[3], int slot[3]);
+                                      // Grid point of a mate in the map
+
+// READ AHEAD
+
+void  PreScan();                      // Starts reads of script inputs
+int   PreAdd(const char *file, long pos);
+                                      // Starts one read ahead
+long  PreHead(FILE *read1, int *word);// Voxels a header says, or 0
+void  PreDrop();                      // Ends reads the script has passed
+void  *PreLoad(void *arg);            // Copies a file to memory (thread)
+FILE  *PreOpen(const char *file, int *zip);
+                                      // Read ahead copy, or ZipOpen
+
+// REGION OF INTEREST
+
+void  BoxHead(FILE *read1, int map1, box_src *src);
+                                      // Header of file => header of box
+int   BoxFull(int map1, const char *name, int mem);
+                                      // Whole file the size of principal
+int   BoxWrap(const box_src *src, int c, int g);
+                                      // File index of a box point
+int   ReadBox(int fd, const box_src *src, char *dest, int elem);
+                                      // Reads box rows with pread
+void  FreeMaps();                     // Releases MAP and MSK
+
+// WORKSPACE
+
+int   SaveWork(const char *file, char map[][50], char msk[][50],
+               char pdb[][50], float value);
+                                      // Writes all maps, masks, PDB
+int   RestWork(const char *file, char map[][50], char msk[][50],
+               char pdb[][50], float *value);
+                                      // Maps back a SAVE file
+
+// SERVER MODE
+
+int   ServerOpen(const char *name);   // Listens on Unix socket
+int   ServerAccept();                 // Waits for next client
+int   ServerNext(const char *input);  // Ends client, 1 => wait for next
+void  ServerClean();                  // Removes socket
+string Json2Key(const string &line);  // JSON command => keyword line
 
 // UTILITY
 
@@ -457,6 +1359,8 @@ main(int argc, char *argv[])
    int   count2;
    int   count3;
 
+   long  pixels;
+
    int   map1;
    int   map2;
    int   map3;
@@ -469,6 +1373,8 @@ main(int argc, char *argv[])
 
    int   zone;
 
+   long  pix;
+
    float min;  
    float max;  
    float value;
@@ -478,6 +1384,8 @@ main(int argc, char *argv[])
 
    char  file[50];
    char  input[20];
+   char  label1[31];
+   char  label2[31];
 
    float saved_value;
 
@@ -490,16 +1398,86 @@ main(int argc, char *argv[])
    cout.setf(ios::right);
 
    pdb_mem = 0;
+   cell_list.pdb1 = -1;
+   part_list.pdb1 = -1;
+
+   for (count1 = 1; count1 < argc; count1 ++)     // Before any printing
+      if (!(strcmp(argv[count1], "-quiet")))
+         quiet_on = 1;
+
+   if (!quiet_on)
+      cout  << "\n\n*********************************************************"
+            <<   "\n*       REAL SPACE R FACTR PROGRAM                      *"
+            <<   "\n*                by Alexei Soares                       *"
+            <<   "\n*            Version 1.0, November 2023                 *"
+            <<   "\n*********************************************************";
+
+   for (count1 = 1, count2 = 1; count1 < argc; count1 ++)
+      {                                            // Options out of argv
+      if      (!(strcmp(argv[count1], "-quiet")))
+         continue;
+      else if (!(strcmp(argv[count1], "-stream")))
+         stream_on = 1;
+      else if (!(strcmp(argv[count1], "-slab")) && (count1 + 1 < argc))
+         stream_sec = Ch2float(argv[++ count1]);
+      else if (!(strcmp(argv[count1], "-shm")))
+         shm_on = 1;
+      else if (!(strcmp(argv[count1], "-box")) && (count1 + 6 < argc))
+         {
+         for (count3 = 0; count3 <= 2; count3 ++)
+            box_lo[count3] = Ch2float(argv[++ count1]);
+         for (count3 = 0; count3 <= 2; count3 ++)
+            box_n[count3]  = Ch2float(argv[++ count1]);
+
+         box_on = ((box_n[0] > 0) && (box_n[1] > 0) && (box_n[2] > 0));
+         }
+      else if (!(strcmp(argv[count1], "-prefetch")))
+         pre_on = 1;
+      else if (!(strcmp(argv[count1], "-server")) && (count1 + 1 < argc))
+         {
+         strncpy(server_name, argv[++ count1], sizeof(server_name) - 1);
+         server_name[sizeof(server_name) - 1] = '\0';
+         }
+      else
+         argv[count2 ++] = argv[count1];
+      }
+
+   argc = count2;
 
-   cout  << "\n\n*********************************************************"
-         <<   "\n*       REAL SPACE R FACTR PROGRAM                      *"
-         <<   "\n*                by Alexei Soares                       *"
-         <<   "\n*            Version 1.0, November 2023                 *"
-         <<   "\n*********************************************************";
+   if (stream_sec < 1) stream_sec = 1;
+
+   if (stream_on && box_on)                        // Streams whole sections
+      {
+      cout  << "\n\n   MAIN  => -box is not used in streaming mode.";
+      box_on = 0;
+      }
+
+   if (stream_on) atexit(StreamClean);
+
+   if (pre_on && (stream_on || server_name[0]))   // No script to look ahead
+      {
+      cout  << "\n\n   MAIN  => -prefetch is not used with -stream or -server.";
+      pre_on = 0;
+      }
 
    if (argc < 2)  {  Help();    return 1;   }      // Not enough load files
                                                    // => print information
 
+   if (pre_on)                                     // Principal map first
+      {
+      FILE *read1 = ZipOpen(argv[1], "rb", &count1);
+      int  word[56];
+
+      if (read1)                                   // Size the others must
+         {                                         //    have
+         pre_vox = PreHead(read1, word);
+         ZipClose(read1, count1, 0);
+         }
+
+      PreAdd(argv[1], 0);
+      PreScan();
+      }
+
    for (count1=0; count1 <=9; count1 ++)
       strcpy(map[count1], "NO NAME");
 
@@ -521,17 +1499,29 @@ main(int argc, char *argv[])
          map_rms[count1][count2] = 0;
          }
 
+   memset(stat_key, -1, sizeof(stat_key));         // Nothing stored yet
+   memset(rms_key,  -1, sizeof(rms_key));
+
+   for (count1 = 0; count1 < 11; count1 ++)
+      msk_idx[count1][0].gen = msk_idx[count1][1].gen = -1;
+
+   for (count1 = 0; count1 < GATHER_MAX; count1 ++)
+      gath[count1].gen[0] = gath[count1].gen[1] = -1;
+
    map_mem = 3;   if (argc >= 3) map_mem = Ch2float(argv[2]);
    msk_mem = 1;   if (argc >= 4) msk_mem = Ch2float(argv[3]);
 
-   cout  << "\n\n*** Opening PRINCIPAL MAP *****************************\n\n";
-
-   cout  << "   MAPIN =>\n"
-         << "   MAPIN => **********************************\n"
-         << "   MAPIN => * MAP  STORED IN MEMORY LOCATION * " 
-         << " 1\n"
-         << "   MAPIN => **********************************\n"
-         << "   MAPIN =>\n";
+   if (!quiet_on)
+      {
+      cout  << "\n\n*** Opening PRINCIPAL MAP *****************************\n\n";
+
+      cout  << "   MAPIN =>\n"
+            << "   MAPIN => **********************************\n"
+            << "   MAPIN => * MAP  STORED IN MEMORY LOCATION * " 
+            << " 1\n"
+            << "   MAPIN => **********************************\n"
+            << "   MAPIN =>\n";
+      }
 
    count1 = (ReadMap(argv[1], 0, 1));              // Read PRINCIPAL MAP
 
@@ -544,7 +1534,13 @@ main(int argc, char *argv[])
       if (count1 == 3) return 1;
       }
 
-   MapHead(0);                                     // PRINCIPAL MAP header
+   if (!quiet_on) MapHead(0);                      // PRINCIPAL MAP header
+
+   if (server_name[0] && ServerOpen(server_name))
+      {
+      cout  << "\nERROR:  Cannot open socket  " << server_name << " !!!\n";
+      return 1;
+      }
 
 //**************************************************************************
 //**                         MAIN PROGRAM LOOP                            **
@@ -552,10 +1548,25 @@ main(int argc, char *argv[])
 
    do
       {
+      if (server_fd >= 0 && !server_live)         // Wait for next client
+         if (ServerAccept()) break;
+
+      if (pre_num) PreDrop();                      // Reads not used
+
       cout  << "   MAIN  => Awaiting Keyword? ";
       cin   >> input;                              // Input keyword from user
+
+      if (server_live && !cin)                     // Client hung up
+         strcpy(input, "QUIT");
+
       strcpy(input, upper(input));                 // Lower case => UPPER CASE
 
+      if (stream_on && NoStream(input))            // Needs the whole map
+         {
+         cin.ignore(10000, '\n');
+         continue;
+         }
+
       // *** HELP FUNCTION *************************************************
 
       if      (!(strncmp(input, "HELP", 4)))       // HELP KEYWORD
@@ -664,6 +1675,178 @@ main(int argc, char *argv[])
          cout.flush();
          }
 
+      // *** MAPBOX FUNCTION ***********************************************
+
+      else if (!(strncmp(input, "MAPBO", 5)))      // MAPBOX KEYWORD
+         {
+         cout  << "   MAPBOX=> Keyword recognized.\n";
+         cout  << "   MAPBOX=> Box origin in grid units (X Y Z)? ";
+         cin   >> box_lo[0] >> box_lo[1] >> box_lo[2];
+         cout  << "   MAPBOX=> Box size in grid points (X Y Z, 0 for all)? ";
+         cin   >> box_n[0]  >> box_n[1]  >> box_n[2];
+
+         box_on = ((box_n[0] > 0) && (box_n[1] > 0) && (box_n[2] > 0));
+
+         FreeMaps();                               // Start again with the
+                                                   //    principal map
+         for (count1 = 1; count1 < map_mem; count1 ++)
+            strcpy(map[count1], "NO NAME");
+
+         for (count1 = 0; count1 < msk_mem; count1 ++)
+            strcpy(msk[count1], "NO NAME");
+
+         mem    = 1;
+
+         count1 = ReadMap(map[0], 0, 1);
+
+         if (count1)                               // Back to the whole map
+            {
+            cout  << "   MAPBOX=> Cannot read that box of " << map[0]
+                  << ", reading the whole map.\n";
+
+            FreeMaps();
+
+            box_on = 0;
+            mem    = 1;
+            count1 = ReadMap(map[0], 0, 1);
+            }
+
+         if (count1)                               // Nothing left to use
+            {
+            cout  << "\nERROR:  Cannot open map  " << map[0] << " !!!\n";
+            cout.flush();
+            return 1;
+            }
+
+         MapHead(0);
+
+         cout  << "   MAPBOX=> All maps and masks are now " << X_LIM << " x "
+               << Y_LIM << " x " << Z_LIM << " grid points.\n";
+         cout  << "   MAPBOX=> Read maps and masks again with MAPIN and "
+               << "MASKI.\n";
+
+         cout.flush();
+         }
+
+      // *** MTZIN FUNCTION ************************************************
+
+      else if (!(strncmp(input, "MTZIN", 5)))      // MTZIN KEYWORD
+         {
+         cout  << "   MTZIN => Keyword recognized.\n";
+         cout  << "   MTZIN => Map  memory location (1 to "
+               << map_mem << ")? ";
+         cin   >> map1;   map1 --;
+         cout  << "   MTZIN => Name of MTZ file to read? ";
+         cin   >> file;
+         cout  << "   MTZIN => Amplitude and phase column labels? ";
+         cin   >> label1 >> label2;
+
+         if (MtzMap(file, map1, label1, label2))   // FFT into map1
+            {
+            cout  << "   MTZIN => NO MAP CALCULATED!\n";
+            continue;
+            }
+
+         cout  << "   MTZIN =>\n"
+               << "   MTZIN => **********************************\n"
+               << "   MTZIN => * MAP  STORED IN MEMORY LOCATION * "
+               << (map1+1) << "\n"
+               << "   MTZIN => **********************************\n"
+               << "   MTZIN =>\n";
+
+         strcpy (map[map1], file);
+
+         cout.flush();
+         }
+
+      // *** MODELMAP FUNCTION *********************************************
+
+      else if (!(strncmp(input, "MODEL", 5)))      // MODELMAP KEYWORD
+         {
+         cout  << "   MODEL => Keyword recognized.\n";
+         cout  << "   MODEL => Map  memory location (1 to "
+               << map_mem << ")? ";
+         cin   >> map1;   map1 --;
+         cout  << "   MODEL => PDB file memory location (1 to "
+               << pdb_mem << ")? ";
+         cin   >> pdb1;   pdb1 --;
+         cout  << "   MODEL => B factor added to every atom? ";
+         cin   >> value;
+
+         if (!pdb_mem || (pdb1 < 0) || (pdb1 >= pdb_mem))
+            {
+            cout  << "   MODEL => No PDB file in that location.\n";
+            continue;
+            }
+
+         ModelMap(map1, pdb1, value);              // Atoms onto map1
+
+         cout  << "   MODEL => " << pdb_len[pdb1] << " atoms of "
+               << pdb[pdb1] << " put in map " << (map1+1) << ".\n";
+
+         strcpy (map[map1], pdb[pdb1]);
+
+         cout.flush();
+         }
+
+      // *** SYMMETRIC FUNCTION ********************************************
+
+      else if (!(strncmp(input, "SYMME", 5)))      // SYMMETRIC KEYWORD
+         {
+         cout  << "   SYMME => Keyword recognized.\n";
+         cout  << "   SYMME => Map  memory location (1 to "
+               << map_mem << ")? ";
+         cin   >> map1;   map1 --;
+         cout  << "   SYMME => Map has the space group symmetry (YES/NO)? ";
+         cin   >> label1;
+
+         map_symm[map1] = (toupper(label1[0]) == 'Y');
+         MapTouch(map1);                           // Statistics taken anew
+
+         SymLoad();
+
+         cout  << "   SYMME => Map " << (map1+1)
+               << (map_symm[map1] ? " is" : " is not") << " taken to have "
+               << sym_name << " symmetry.\n";
+
+         if (map_symm[map1] && !AsuBuild())
+            cout  << "   SYMME => The map is not one whole cell on a grid "
+                  << "that fits the group:\n"
+                  << "   SYMME => statistics still use every grid point.\n";
+
+         cout.flush();
+         }
+
+      // *** BRICK FUNCTION ************************************************
+
+      else if (!(strncmp(input, "BRICK", 5)))      // BRICK KEYWORD
+         {
+         cout  << "   BRICK => Keyword recognized.\n";
+         cout  << "   BRICK => Brick edge in grid points (0 for none)? ";
+         cin   >> brick_n;
+
+         if (brick_n < 0) brick_n = 0;
+
+         if (brick_n)
+            cout  << "   BRICK => SMEAR and ROUGH work on " << brick_n
+                  << " x " << brick_n << " x " << brick_n << " bricks.\n";
+         else
+            cout  << "   BRICK => SMEAR and ROUGH work on whole maps.\n";
+
+         cout.flush();
+         }
+
+      // *** STATS FUNCTION ************************************************
+
+      else if (!(strncmp(input, "STATS", 5)))      // STATS KEYWORD
+         {
+         cout  << "   STATS => Keyword recognized.\n";
+
+         StatList();
+
+         cout.flush();
+         }
+
       // *** MASKI FUNCTION ************************************************
 
       else if (!(strncmp(input, "MASKI", 5)))      // MASKI KEYWORD
@@ -677,6 +1860,8 @@ main(int argc, char *argv[])
 
          value  = (ReadMsk(file, msk1, mem));      // Read mask
 
+         if (MSK) mem = 0;                         // Assigned, even if the
+                                                   //    read failed
          if (value < -.1) cout  << "   MASKI => CANNOT OPEN FILE!\n";
          if (value < -.1) continue;
 
@@ -738,6 +1923,9 @@ main(int argc, char *argv[])
 
          count1 = (ReadPDB(file, pdb1));           // Read PDB file
 
+         if (cell_list.pdb1 == pdb1) cell_list.pdb1 = -1;
+         if (part_list.pdb1 == pdb1) part_list.pdb1 = -1;
+
          if (count1) cout  << "   PDBIN => CANNOT OPEN FILE!\n";
          if (count1) continue;
 
@@ -826,7 +2014,8 @@ main(int argc, char *argv[])
             }
          else msk1 = 0;
 
-         value = Scale(map1, map2, zone, msk1);
+         if (stream_on) value = StreamScale(map1, map2, zone, msk1);
+         else           value = Scale(map1, map2, zone, msk1);
 
          cout  << "   SCALE => Scale factor is " << value << "\n";
          cout  << "   SCALE => Scale operation completed.\n";
@@ -866,7 +2055,11 @@ main(int argc, char *argv[])
 
          cin   >> count1;
 
-         value = Rfac(map1, map2, zone, msk1, count1);
+         if (stream_on)
+            value = RfacOut(map1, map2, zone,
+                            StreamStat(map1, map2, zone, msk1), count1);
+         else
+            value = Rfac(map1, map2, zone, msk1, count1);
 
          cout  << "   RFAC  => ********************************************\n"
                << "   RFAC  => * R FACTOR IS (ZONE " << zone 
@@ -895,7 +2088,13 @@ main(int argc, char *argv[])
             }
          else msk1 = 0;
 
-         value = FindRMS(map1, zone, msk1);
+         if (stream_on)
+            {
+            StreamStat(map1, -1, zone, msk1);
+            value = map_rms[map1][zone];
+            }
+         else
+            value = FindRMS(map1, zone, msk1);
 
          cout  << "   RMS   => ***********************************\n"
                << "   RMS   => * RMS VALUE IS (ZONE " << zone << ")";
@@ -922,7 +2121,10 @@ main(int argc, char *argv[])
          cout  << "   SMEAR => Smear to how many pixels to each side? ";
          cin   >> count1;
 
-         Smear(map1, map2, map3, count1);
+         if (stream_on)
+            StreamPass(S_SMEAR, map1, map2, map3, 2, 0, 0, 0, count1, NULL, -1);
+         else
+            Smear(map1, map2, map3, count1);
 
          cout  << "   SMEAR => Smoothing completed.\n";
 
@@ -944,6 +2146,10 @@ main(int argc, char *argv[])
                << map_mem << ")? ";
          cin   >> map1;   map1 --;
 
+         if (part_list.pdb1 == pdb1)
+            cout  << "   OCCUP => Each atom takes the points PARTITION gave "
+                  << "it.\n";
+
          Integrate(pdb1, map1);
 
          cout  << "   OCCUP => Occupancy calculated.\n";
@@ -951,31 +2157,433 @@ main(int argc, char *argv[])
          cout.flush();
          }
 
-      // *** ZERO FUNCTION *************************************************
+      // *** WINDOW FUNCTION ***********************************************
 
-      else if (!(strncmp(input, "ZERO", 4)))       // ZERO KEYWORD
+      else if (!(strncmp(input, "WINDO", 5)))      // WINDOW KEYWORD
          {
-         cout  << "   ZERO  => Keyword recognized.\n";
-         cout  << "   ZERO  => Set which map to zero (map location 1 to "
+         cout  << "   WINDO => Keyword recognized.\n";
+         cout  << "   WINDO => Map to be compared location (1 to "
                << map_mem << ")? ";
          cin   >> map1;   map1 --;
+         cout  << "   WINDO => Reference map memory location (1 to "
+               << map_mem << ")? ";
+         cin   >> map2;   map2 --;
+         cout  << "   WINDO => PDB file memory location (1 to "
+               << pdb_mem << ")? ";
+         cin   >> pdb1;   pdb1 --;
+         cout  << "   WINDO => Residues in each window (1 to 255)? ";
+         cin   >> count1;
+         cout  << "   WINDO => Atom radius (0 for the PDB data radii, -1 "
+               << "for PARTITION)? ";
+         cin   >> value;
 
-         zone = zone_find("ZERO  => ");
-
-         if (zone != 2)
+         if (!pdb_mem || (pdb1 < 0) || (pdb1 >= pdb_mem))
             {
-            cout  << "   ZERO  => Mask memory location (1 to "
+            cout  << "   WINDO => No PDB file in that location.\n";
+            continue;
+            }
+
+         if ((count1 < 1) || (count1 > 255))
+            {
+            cout  << "   WINDO => Windows must be 1 to 255 residues.\n";
+            continue;
+            }
+
+         if ((value < 0) && (part_list.pdb1 != pdb1))
+            {
+            cout  << "   WINDO => No PARTITION of that PDB file.\n";
+            continue;
+            }
+
+         Window(map1, map2, pdb1, count1, value);
+
+         cout.flush();
+         }
+
+      // *** PAINT FUNCTION ************************************************
+
+      else if (!(strncmp(input, "PAINT", 5)))      // PAINT KEYWORD
+         {
+         cout  << "   PAINT => Keyword recognized.\n";
+         cout  << "   PAINT => Which mask will be generated (location 1 to "
+               << msk_mem << ")? ";
+         cin   >> msk1;   msk1 --;
+         cout  << "   PAINT => PDB file memory location (1 to "
+               << pdb_mem << ")? ";
+         cin   >> pdb1;   pdb1 --;
+         cout  << "   PAINT => Atom radius (0 for the PDB data radii)? ";
+         cin   >> value;
+
+         if (!pdb_mem || (pdb1 < 0) || (pdb1 >= pdb_mem))
+            {
+            cout  << "   PAINT => No PDB file in that location.\n";
+            continue;
+            }
+
+         if (!MSK || (msk1 < 0) || (msk1 >= msk_mem))
+            {
+            cout  << "   PAINT => No mask memory:  read a mask with MASKI "
+                  << "first.\n";
+            continue;
+            }
+
+         pix = Paint(msk1, pdb1, value);
+
+         cout  << "   PAINT => " << pix << " points of mask " << (msk1+1)
+               << " are within reach of the atoms of " << pdb[pdb1]
+               << ".\n";
+
+         if (!(strcmp(msk[msk1], "NO NAME")))
+            strcpy(msk[msk1], "COMPUTER GENERATED");
+
+         cout.flush();
+         }
+
+      // *** NEAR FUNCTION *************************************************
+
+      else if (!(strncmp(input, "NEAR", 4)))       // NEAR KEYWORD
+         {
+         cout  << "   NEAR  => Keyword recognized.\n";
+         cout  << "   NEAR  => PDB file memory location (1 to "
+               << pdb_mem << ")? ";
+         cin   >> pdb1;   pdb1 --;
+         cout  << "   NEAR  => Atom number in the file? ";
+         cin   >> count1;
+         cout  << "   NEAR  => Distance, angstroms? ";
+         cin   >> value;
+
+         if (!pdb_mem || (pdb1 < 0) || (pdb1 >= pdb_mem))
+            {
+            cout  << "   NEAR  => No PDB file in that location.\n";
+            continue;
+            }
+
+         if ((count1 < 1) || (count1 > pdb_len[pdb1]))
+            {
+            cout  << "   NEAR  => No such atom.\n";
+            continue;
+            }
+
+         Near(pdb1, count1, value);
+
+         cout.flush();
+         }
+
+      // *** PARTITION FUNCTION ********************************************
+
+      else if (!(strncmp(input, "PARTI", 5)))      // PARTITION KEYWORD
+         {
+         cout  << "   PARTI => Keyword recognized.\n";
+         cout  << "   PARTI => PDB file memory location (1 to "
+               << pdb_mem << ")? ";
+         cin   >> pdb1;   pdb1 --;
+         cout  << "   PARTI => Cut off distance, angstroms? ";
+         cin   >> value;
+         cout  << "   PARTI => Take off the atom radii (YES/NO)? ";
+         cin   >> label1;
+
+         if (!pdb_mem || (pdb1 < 0) || (pdb1 >= pdb_mem))
+            {
+            cout  << "   PARTI => No PDB file in that location.\n";
+            continue;
+            }
+
+         if ((value <= 0) || (XYZ_LIM > (long) UINT32_MAX))
+            {
+            cout  << "   PARTI => Need a cut off above 0, and a map of "
+                  << "fewer than 2^32 points.\n";
+            continue;
+            }
+
+         pix = Partition(pdb1, value, toupper(label1[0]) == 'Y');
+
+         cout  << "   PARTI => " << pix << " points given to the "
+               << pdb_len[pdb1] << " atoms of " << pdb[pdb1] << ".\n";
+
+         cout.flush();
+         }
+
+      // *** DISTMAP FUNCTION **********************************************
+
+      else if (!(strncmp(input, "DISTM", 5)))      // DISTMAP KEYWORD
+         {
+         cout  << "   DISTM => Keyword recognized.\n";
+         cout  << "   DISTM => Map  memory location (1 to "
+               << map_mem << ")? ";
+         cin   >> map1;   map1 --;
+         cout  << "   DISTM => PDB file memory location (1 to "
+               << pdb_mem << ")? ";
+         cin   >> pdb1;   pdb1 --;
+         cout  << "   DISTM => First and last atom (0 0 for all)? ";
+         cin   >> count1;
+         cin   >> count2;
+         cout  << "   DISTM => Largest distance kept, angstroms? ";
+         cin   >> value;
+
+         if (!pdb_mem || (pdb1 < 0) || (pdb1 >= pdb_mem))
+            {
+            cout  << "   DISTM => No PDB file in that location.\n";
+            continue;
+            }
+
+         if (!count1 && !count2)
+            {
+            count1 = 1;
+            count2 = pdb_len[pdb1];
+            }
+
+         if (DistMap(map1, pdb1, count1, count2, value))
+            {
+            cout  << "   DISTM => The map header gives no cell grid.\n";
+            continue;
+            }
+
+         cout  << "   DISTM => Distances to atoms " << count1 << " to "
+               << count2 << " of " << pdb[pdb1] << " put in map "
+               << (map1+1) << ".\n";
+
+         strcpy (map[map1], "COMPUTER GENERATED");
+
+         cout.flush();
+         }
+
+      // *** BELOW FUNCTION ************************************************
+
+      else if (!(strncmp(input, "BELOW", 5)))      // BELOW KEYWORD
+         {
+         cout  << "   BELOW => Keyword recognized.\n";
+         cout  << "   BELOW => Which mask will be generated (location 1 to "
+               << msk_mem << ")? ";
+         cin   >> msk1;   msk1 --;
+         cout  << "   BELOW => Map memory location (1 to "
+               << map_mem << ")? ";
+         cin   >> map1;   map1 --;
+         cout  << "   BELOW => Highest value in the mask? ";
+         cin   >> value;
+
+         if (!MSK || (msk1 < 0) || (msk1 >= msk_mem))
+            {
+            cout  << "   BELOW => No mask memory:  read a mask with MASKI "
+                  << "first.\n";
+            continue;
+            }
+
+         pix = Below(msk1, map1, value);
+
+         cout  << "   BELOW => " << pix << " points of map " << (map1+1)
+               << " are at most " << value << ".\n";
+
+         if (!(strcmp(msk[msk1], "NO NAME")))
+            strcpy(msk[msk1], "COMPUTER GENERATED");
+
+         cout.flush();
+         }
+
+      // *** RFSWEEP FUNCTION **********************************************
+
+      else if (!(strncmp(input, "RFSWE", 5)))      // RFSWEEP KEYWORD
+         {
+         cout  << "   RFSWE => Keyword recognized.\n";
+         cout  << "   RFSWE => Map to be compared location (1 to "
+               << map_mem << ")? ";
+         cin   >> map1;   map1 --;
+         cout  << "   RFSWE => Reference map memory location (1 to "
+               << map_mem << ")? ";
+         cin   >> map2;   map2 --;
+         cout  << "   RFSWE => Distance map (from DISTMAP) location (1 to "
+               << map_mem << ")? ";
+         cin   >> map3;   map3 --;
+         cout  << "   RFSWE => Largest radius, angstroms? ";
+         cin   >> value;
+         cout  << "   RFSWE => Number of radii? ";
+         cin   >> count1;
+         cout  << "   RFSWE => Which r-factor (1 to 6, as for RFAC)? ";
+         cin   >> count2;
+
+         if ((value <= 0) || (count1 < 1))
+            {
+            cout  << "   RFSWE => Need a radius above 0 and at least one "
+                  << "radius.\n";
+            continue;
+            }
+
+         if ((count2 < 1) || (count2 > 6))
+            {
+            cout  << "   RFSWE => The r-factor must be 1 to 6.\n";
+            continue;
+            }
+
+         RfSweep(map1, map2, map3, value, count1, count2);
+
+         cout.flush();
+         }
+
+      // *** CUTSWEEP FUNCTION *********************************************
+
+      else if (!(strncmp(input, "CUTSW", 5)))      // CUTSWEEP KEYWORD
+         {
+         cout  << "   CUTSW => Keyword recognized.\n";
+         cout  << "   CUTSW => Map to be compared location (1 to "
+               << map_mem << ")? ";
+         cin   >> map1;   map1 --;
+         cout  << "   CUTSW => Reference map memory location (1 to "
+               << map_mem << ")? ";
+         cin   >> map2;   map2 --;
+
+         zone = zone_find("CUTSW => ");
+
+         if (zone != 2)
+            {
+            cout  << "   CUTSW => Mask memory location (1 to "
+                  << msk_mem << ")? ";
+            cin   >> msk1;   msk1 --;
+            }
+         else msk1 = 0;
+
+         cout  << "   CUTSW => Lowest and highest threshold? ";
+         cin   >> min;
+         cin   >> max;
+         cout  << "   CUTSW => Number of thresholds? ";
+         cin   >> count1;
+         cout  << "   CUTSW => Which r-factor (1 to 6, as for RFAC)? ";
+         cin   >> count2;
+
+         if ((max <= min) || (count1 < 1))
+            {
+            cout  << "   CUTSW => Need the highest threshold above the "
+                  << "lowest, and at least one.\n";
+            continue;
+            }
+
+         if ((count2 < 1) || (count2 > 6))
+            {
+            cout  << "   CUTSW => The r-factor must be 1 to 6.\n";
+            continue;
+            }
+
+         CutSweep(map1, map2, zone, msk1, min, max, count1, count2);
+
+         cout.flush();
+         }
+
+      // *** LABEL FUNCTION ************************************************
+
+      else if (!(strncmp(input, "LABEL", 5)))      // LABEL KEYWORD
+         {
+         cout  << "   LABEL => Keyword recognized.\n";
+         cout  << "   LABEL => Label a MASK, or a MAP at or above a level? ";
+         cin   >> label1;
+
+         if (toupper(label1[0]) == 'M' && toupper(label1[1]) == 'A' &&
+             toupper(label1[2]) == 'S')
+            {
+            cout  << "   LABEL => Mask memory location (1 to "
+                  << msk_mem << ")? ";
+            cin   >> msk1;   msk1 --;
+            map2 = -1;
+            }
+         else
+            {
+            cout  << "   LABEL => Map memory location (1 to "
+                  << map_mem << ")? ";
+            cin   >> map2;   map2 --;
+            cout  << "   LABEL => Level? ";
+            cin   >> value;
+            msk1 = -1;
+            }
+
+         cout  << "   LABEL => Neighbours (6, 18 or 26)? ";
+         cin   >> count1;
+         cout  << "   LABEL => Smallest region kept, points? ";
+         cin   >> pix;
+         cout  << "   LABEL => Map for the density sums location (1 to "
+               << map_mem << ")? ";
+         cin   >> map1;   map1 --;
+         cout  << "   LABEL => Map location for the region numbers (1 to "
+               << map_mem << ")? ";
+         cin   >> map3;   map3 --;
+
+         if ((map2 < 0) && (!MSK || (msk1 < 0) || (msk1 >= msk_mem)))
+            {
+            cout  << "   LABEL => No mask memory:  read a mask with MASKI "
+                  << "first.\n";
+            continue;
+            }
+
+         if (((count1 != 6) && (count1 != 18) && (count1 != 26)) ||
+             (XYZ_LIM > (long) INT_MAX) || (map3 == map1) || (map3 == map2))
+            {
+            cout  << "   LABEL => Need 6, 18 or 26 neighbours, a map of "
+                  << "fewer than 2^31 points, and\n"
+                  << "   LABEL => a map location for the numbers apart from "
+                  << "the others.\n";
+            continue;
+            }
+
+         if (map2 < 0)
+            pix = Label(MSK + (msk1 * XYZ_LIM), map3, count1, pix, map1);
+         else
+            {
+            vector<char> in(XYZ_LIM);
+
+            for (long LOC = 0; LOC < XYZ_LIM; LOC ++)
+               in[LOC] = (MAP[(map2 * XYZ_LIM) + LOC] >= value);
+
+            pix = Label(&in[0], map3, count1, pix, map1);
+            }
+
+         cout  << "   LABEL => " << pix << " regions numbered in map "
+               << map3 + 1 << ".\n";
+
+         cout.flush();
+         }
+
+      // *** REGIONSTATS FUNCTION ******************************************
+
+      else if (!(strncmp(input, "REGIO", 5)))      // REGIONSTATS KEYWORD
+         {
+         cout  << "   REGIO => Keyword recognized.\n";
+         cout  << "   REGIO => Map memory location (1 to "
+               << map_mem << ")? ";
+         cin   >> map1;   map1 --;
+         cout  << "   REGIO => Region numbers (from LABEL) location (1 to "
+               << map_mem << ")? ";
+         cin   >> map3;   map3 --;
+
+         RegionStats(map1, map3);
+
+         cout.flush();
+         }
+
+      // *** ZERO FUNCTION *************************************************
+
+      else if (!(strncmp(input, "ZERO", 4)))       // ZERO KEYWORD
+         {
+         cout  << "   ZERO  => Keyword recognized.\n";
+         cout  << "   ZERO  => Set which map to zero (map location 1 to "
+               << map_mem << ")? ";
+         cin   >> map1;   map1 --;
+
+         zone = zone_find("ZERO  => ");
+
+         if (zone != 2)
+            {
+            cout  << "   ZERO  => Mask memory location (1 to "
                   << msk_mem << ")? ";
             cin   >> msk1;   msk1 --;
             }
          else msk1 = 0;
 
-         count1 = Zero(map1, zone, msk1);
+         if (stream_on)
+            pixels = StreamPass(S_ZERO, map1, 0, 0, zone, msk1, 0, 0, 0,
+                                NULL, -1);
+         else
+            pixels = Zero(map1, zone, msk1);
 
          cout  << "   ZERO =>  Map set to zero.\n";
-         cout  << "   ZERO =>  Number of pixels changed: " << count1 << "\n";
+         cout  << "   ZERO =>  Number of pixels changed: " << pixels << "\n";
          cout  << "   ZERO =>  Percent of map changed:   " 
-               << ((count1 * 1.0)/(XYZ_LIM * 1.0)) << "\n";
+               << ((pixels * 1.0)/(XYZ_LIM * 1.0)) << "\n";
 
          cout.flush();
          }
@@ -1004,12 +2612,16 @@ main(int argc, char *argv[])
          cout  << "   CUT   => Maximum density cutoff? ";
          cin   >> max;
 
-         count1 = Cut(map1, zone, msk1, min, max);
+         if (stream_on)
+            pixels = StreamPass(S_CUT, map1, 0, 0, zone, msk1, min, max, 0,
+                                NULL, -1);
+         else
+            pixels = Cut(map1, zone, msk1, min, max);
 
          cout  << "   CUT   => Density cutoff applied.\n";
-         cout  << "   CUT   => Number of pixels changed: " << count1 << "\n"; 
+         cout  << "   CUT   => Number of pixels changed: " << pixels << "\n"; 
          cout  << "   CUT   => Percent of map changed:   " 
-               << ((count1 * 1.0)/(XYZ_LIM * 1.0)) << "\n";
+               << ((pixels * 1.0)/(XYZ_LIM * 1.0)) << "\n";
 
          cout.flush();
          }
@@ -1149,7 +2761,10 @@ main(int argc, char *argv[])
             }
          else msk1 = 0;
 
-         MapMod(map1, map2, zone, msk1, +1);
+         if (stream_on)
+            StreamPass(S_MOD, map1, map2, 0, zone, msk1, +1, 0, 0, NULL, -1);
+         else
+            MapMod(map1, map2, zone, msk1, +1);
 
          cout  << "   ADD   => Map addition completed.\n";
 
@@ -1181,7 +2796,10 @@ main(int argc, char *argv[])
             }
          else msk1 = 0;
 
-         MapMod(map1, map2, zone, msk1, -1);
+         if (stream_on)
+            StreamPass(S_MOD, map1, map2, 0, zone, msk1, -1, 0, 0, NULL, -1);
+         else
+            MapMod(map1, map2, zone, msk1, -1);
 
          cout  << "   SUB   => Map subtraction completed.\n";
 
@@ -1216,7 +2834,10 @@ main(int argc, char *argv[])
          cout  << "   COMB  => Multiplicative factor for combining maps? ";
          cin   >> value;
 
-         MapMod(map1, map2, zone, msk1, value);
+         if (stream_on)
+            StreamPass(S_MOD, map1, map2, 0, zone, msk1, value, 0, 0, NULL, -1);
+         else
+            MapMod(map1, map2, zone, msk1, value);
 
          cout  << "   SUB   => Maps combined successfully.\n";
 
@@ -1245,7 +2866,13 @@ main(int argc, char *argv[])
             }
          else msk1 = 0;
 
-         saved_value = FindParms(map1, zone, msk1);
+         if (stream_on)
+            {
+            StreamStat(map1, -1, zone, msk1);
+            saved_value = map_avg[map1][zone];
+            }
+         else
+            saved_value = FindParms(map1, zone, msk1);
 
          cout  << "   AVG   =>\n"
                << "   AVG   => ****************************************\n"
@@ -1378,7 +3005,10 @@ main(int argc, char *argv[])
          if (file[0] == 'V' || file[0] == 'v') value = saved_value;
          else value = Ch2float(file);
 
-         MapAdd(map1, zone, msk1, value);
+         if (stream_on)
+            StreamPass(S_ADD, map1, 0, 0, zone, msk1, value, 0, 0, NULL, -1);
+         else
+            MapAdd(map1, zone, msk1, value);
          
          cout  << "   PLUS  => Constant " << value << " added to map.\n";
 
@@ -1414,7 +3044,10 @@ main(int argc, char *argv[])
          if (file[0] == 'V' || file[0] == 'v') value = saved_value;
          else value = Ch2float(file);
 
-         MapMult(map1, zone, msk1, value);
+         if (stream_on)
+            StreamPass(S_MULT, map1, 0, 0, zone, msk1, value, 0, 0, NULL, -1);
+         else
+            MapMult(map1, zone, msk1, value);
 
          cout  << "   MULT  => Map multiplied by constant " << value << "\n";
 
@@ -1438,7 +3071,10 @@ main(int argc, char *argv[])
          cout  << "   ROUGH => Roughness callculation pixel radius (integer max 10)? ";
          cin   >> count1;
 
-         Rough(map1, map2, count1);
+         if (stream_on)
+            StreamPass(S_ROUGH, map1, map2, 0, 2, 0, 0, 0, count1, NULL, -1);
+         else
+            Rough(map1, map2, count1);
 
          cout  << "   ROUGH => Roughness calculated.\n";
 
@@ -1569,7 +3205,10 @@ main(int argc, char *argv[])
          cout  << "   WRITE => Filename for map? ";
          cin   >> file;
 
-         count1 = (WriteMap(file, map1));          // Write map 
+         if (stream_on)
+            count1 = (StreamWrite(file, map1) < 0);
+         else
+            count1 = (WriteMap(file, map1));       // Write map 
 
          if (count1) cout  << "   WRITE => Failed to write map.\n";
          if (count1) continue;
@@ -1593,7 +3232,8 @@ main(int argc, char *argv[])
          cout  << "   MASKO => Filename for mask? ";
          cin   >> file;
 
-         value = MaskOut(file, msk1);
+         if (stream_on) value = StreamWrite(file, map_mem + msk1);
+         else           value = MaskOut(file, msk1);
 
          if (value < -.1) cout  << "   MASKO => Failed to write mask.";
          if (value < -.1) continue;
@@ -1609,14 +3249,76 @@ main(int argc, char *argv[])
          cout.flush();
          }
 
-      // *** GRAY FUNCTION *************************************************
+      // *** SAVE FUNCTION *************************************************
 
-      else if (!(strncmp(input, "GRAY", 4)))       // GRAY KEYWORD
+      else if (!(strncmp(input, "SAVE", 4)))       // SAVE KEYWORD
          {
-         cout  << "   GRAY  => Keyword recognized.\n";
-         cout  << "   GRAY  => Filename to write to? ";
+         cout  << "   SAVE  => Keyword recognized.\n";
+         cout  << "   SAVE  => Name of workspace file? ";
          cin   >> file;
-         cout  << "   GRAY  => How many maps to write? ";
+
+         count1 = SaveWork(file, map, msk, pdb, saved_value);
+
+         if (count1) cout  << "   SAVE  => Failed to write workspace.\n";
+         if (count1) continue;
+
+         cout  << "   SAVE  => Maps, masks, PDB files and statistics "
+               << "saved to: " << file << "\n";
+
+         cout.flush();
+         }
+
+      // *** RESTORE FUNCTION **********************************************
+
+      else if (!(strncmp(input, "REST", 4)))       // RESTORE KEYWORD
+         {
+         cout  << "   REST  => Keyword recognized.\n";
+         cout  << "   REST  => Name of workspace file? ";
+         cin   >> file;
+
+         count1 = RestWork(file, map, msk, pdb, &saved_value);
+
+         if (count1) cout  << "   REST  => CANNOT RESTORE WORKSPACE!\n";
+         if (count1) continue;
+
+         mem = (MSK == NULL);                      // Masks already assigned
+
+         cout  << "   REST  => " << map_mem << " maps, " << msk_mem 
+               << " masks and " << pdb_mem << " PDB files restored from: "
+               << file << "\n";
+
+         for (count1 = 0; count1 < map_mem; count1 ++)
+            cout  << "   REST  => Map  " << (count1+1) << ": " 
+                  << map[count1] << "\n";
+
+         for (count1 = 0; count1 < msk_mem; count1 ++)
+            cout  << "   REST  => Mask " << (count1+1) << ": " 
+                  << msk[count1] << "\n";
+
+         cout.flush();
+         }
+
+      // *** SHUTDOWN FUNCTION *********************************************
+
+      else if (!(strncmp(input, "SHUTD", 5)))      // SHUTDOWN KEYWORD
+         {
+         cout  << "   SHUTD => Keyword recognized.\n";
+         cout  << "   SHUTD => Server will stop after this client.\n";
+
+         server_end = 1;
+         strcpy(input, "QUIT");
+
+         cout.flush();
+         }
+
+      // *** GRAY FUNCTION *************************************************
+
+      else if (!(strncmp(input, "GRAY", 4)))       // GRAY KEYWORD
+         {
+         cout  << "   GRAY  => Keyword recognized.\n";
+         cout  << "   GRAY  => Filename to write to? ";
+         cin   >> file;
+         cout  << "   GRAY  => How many maps to write? ";
          cin   >> map1;   map1 --;
 
          MakeGray(file, map1);
@@ -1628,10 +3330,10 @@ main(int argc, char *argv[])
 
       }
 
-   while ( (strncmp(input, "END" , 3)) && 
-           (strncmp(input, "QUIT", 4)) &&
-           (strncmp(input, "STOP", 4)) &&    
-           (strncmp(input, "EXIT", 4))    );
+   while ( ( (strncmp(input, "END" , 3)) && 
+             (strncmp(input, "QUIT", 4)) &&
+             (strncmp(input, "STOP", 4)) &&    
+             (strncmp(input, "EXIT", 4))    ) || ServerNext(input) );
 
    cout  << "\n\nALL DONE !!!\n\n";
 
@@ -1646,93 +3348,118 @@ main(int argc, char *argv[])
 int   ReadMap(const char *file, int map1, int mem)
    {
 
-   int   countz;
-   int   county;
-   int   countx;
+   long  count;
 
    float frac_vol;
 
+   int   zip;
+   int   plain;
+   int   fax[3];
+
+   const int xyz[3] = {1, 2, 3};
+
+   box_src src;
+
    cout.setf(ios::fixed);
    cout.setf(ios::right);
 
    FILE  *read1;
 
-   if ((read1 = fopen(file, "rb")) == NULL)        // Read failure
+   if ((read1 = PreOpen(file, &zip)) == NULL)       // Read failure
       return 1;
 
    // ********************   READ MAP HEADER ****************************
 
-   fread( &MAP_H[map1].NC     , sizeof(int) ,    1, read1);
-   fread( &MAP_H[map1].NR     , sizeof(int) ,    1, read1);
-   fread( &MAP_H[map1].NS     , sizeof(int) ,    1, read1);
+   if (ReadHead(read1, map1))                      // Short or damaged header
+      {
+      ZipClose(read1, zip, 0);
+      return 1;
+      }
 
-   fread( &MAP_H[map1].MODE   , sizeof(int) ,    1, read1);
+   if (zip && (box_on || stream_on || shm_on))     // All seek in the file
+      {
+      cout << "   MAPIN => Compressed maps can not be boxed, streamed or "
+           << "shared.\n";
+      ZipClose(read1, zip, 0);
+      return 1;
+      }
 
-   fread( &MAP_H[map1].NCSTART, sizeof(int) ,    1, read1);
-   fread( &MAP_H[map1].NRSTART, sizeof(int) ,    1, read1);
-   fread( &MAP_H[map1].NSSTART, sizeof(int) ,    1, read1);
+   fax[0] = MAP_H[map1].MAPC;                      // Axis order of file
+   fax[1] = MAP_H[map1].MAPR;
+   fax[2] = MAP_H[map1].MAPS;
 
-   fread( &MAP_H[map1].NX     , sizeof(int) ,    1, read1);
-   fread( &MAP_H[map1].NY     , sizeof(int) ,    1, read1);
-   fread( &MAP_H[map1].NZ     , sizeof(int) ,    1, read1);
+   if (mem)                                        // Held x fastest unless
+      {                                            //    the maps stay on
+      axis_on = !stream_on && !shm_on && AxisValid(fax);  // disk or shared
+      for (count = 0; count <= 2; count ++)
+         file_ax[count] = axis_on ? fax[count] : count + 1;
+      }
 
-   fread(  MAP_H[map1].CELL   , sizeof(float),   6, read1);
-   
-   fread( &MAP_H[map1].MAPC   , sizeof(int) ,    1, read1);
-   fread( &MAP_H[map1].MAPR   , sizeof(int) ,    1, read1);
-   fread( &MAP_H[map1].MAPS   , sizeof(int) ,    1, read1);
-   
-   fread( &MAP_H[map1].AMIN   , sizeof(int) ,    1, read1);
-   fread( &MAP_H[map1].AMAX   , sizeof(int) ,    1, read1);
-   fread( &MAP_H[map1].AMEAN  , sizeof(int) ,    1, read1);
+   plain = !axis_on || !AxisValid(fax) ||
+           ((fax[0] == 1) && (fax[1] == 2) && (fax[2] == 3));
 
-   fread( &MAP_H[map1].ISPG   , sizeof(int) ,    1, read1);
+   if (box_on && BoxFull(map1, "MAPIN", mem))      // Whole map differs
+      {
+      ZipClose(read1, zip, 0);
+      return 2;
+      }
 
-   fread( &MAP_H[map1].NSY    , sizeof(int) ,    1, read1);
+   if (box_on) BoxHead(read1, map1, &src);         // Only the box is read
 
-   fread(  MAP_H[map1].REST   , sizeof(float),   32, read1);
+   if (!plain) AxisHead(&MAP_H[map1], xyz);        // Header of the layout
 
-   fread(  MAP_H[map1].LAB    , sizeof(char) , LAB_LEN, read1);
-   fread(  MAP_H[map1].SYM    , sizeof(char) , MAP_H[map1].NSY, read1);
+   map_symm[map1] = 0;                             // Not known, see SYMME
+   MapTouch(map1);
+   if (map1 == 0) asu_ok = grid_ok = -1;           // Grid may have changed
 
    // *******IF FIRST CALL TO FUNCTION, ASSIGN MEMORY AND MAP SIZE *********
 
    if(mem)
       {
 
-      cout << "   MAPIN => Attempting to assign memory for all maps ...\n";
+      if (!quiet_on)
+         cout << "   MAPIN => Attempting to assign memory for all maps ...\n";
 
       X_LIM    = MAP_H[map1].NC;                   // MAP SIZE:  X Sections
       Y_LIM    = MAP_H[map1].NR;                   //            Y Sections
       Z_LIM    = MAP_H[map1].NS;                   //            Z Sections
 
-      XY_LIM   = (X_LIM * Y_LIM);
-      XYZ_LIM  = (X_LIM * Y_LIM * Z_LIM);
+      XY_LIM   = ((long) X_LIM * Y_LIM);
+      XYZ_LIM  = ((long) X_LIM * Y_LIM * Z_LIM);
 
       X_CELL   = MAP_H[map1].NX;                   // CELL SIZE: X Sections
       Y_CELL   = MAP_H[map1].NY;                   //            Y Sections
       Z_CELL   = MAP_H[map1].NZ;                   //            Z Sections
 
-      XYZ_CELL = (X_CELL * Y_CELL * Z_CELL);
+      XYZ_CELL = ((long) X_CELL * Y_CELL * Z_CELL);
 
       X_GRID   = MAP_H[map1].CELL[0]/X_CELL;       // GRID size, Angstroms
       Y_GRID   = MAP_H[map1].CELL[1]/Y_CELL;
       Z_GRID   = MAP_H[map1].CELL[2]/Z_CELL;
 
-      MAP = new float[(XYZ_LIM * map_mem) + map_mem];
+      if (stream_on)                               // Maps stay on disk
+         MAP = NULL;
+      else                                         // Zero pages, only made
+         {                                         //    real when written,
+         MAP = (float *) mmap(NULL,                //    and page aligned
+                              ((XYZ_LIM * map_mem) + map_mem) * sizeof(float),
+                              PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+         if (MAP == MAP_FAILED) MAP = NULL;        //    for -shm
+         }
 
-      if(!MAP)
+      if(!MAP && !stream_on)
          {                                         // Not enough memory
          cout  << "\nINSUFFICIENT MEMORY!!!\n";
+         ZipClose(read1, zip, 0);
          return 3;
          }
 
-      cout << "   MAPIN => Memory assigned ...\n";
-
-      cout << "   MAPIN => Setting all pixels to zero.\n";
-
-      for (countx = 0; countx < (XYZ_LIM * map_mem + map_mem); countx ++)
-         MAP[countx] = 0;
+      if (stream_on)
+         cout << "   MAPIN => Streaming maps from disk, "
+              << stream_sec << " sections at a time ...\n";
+      else if (!quiet_on)
+         cout << "   MAPIN => Memory assigned ...\n";
 
 
       // *********** CALCULATE UNIT CELL VOLUME, SHOULD ALL BE EQUAL *******
@@ -1750,52 +3477,58 @@ int   ReadMap(const char *file, int map1, int mem)
 
       vox_vol = cel_vol/XYZ_CELL;
 
-      cout.precision(4);
+      if (!quiet_on)                               // Size table
+         {
+         cout.precision(4);
 
-      cout  << "   MAPIN => Grid X size      = " << X_GRID   << "\n"
-            << "   MAPIN => Grid Y size      = " << Y_GRID   << "\n"
-            << "   MAPIN => Grid Z size      = " << Z_GRID   << "\n"
-            << "   MAPIN => Grid volume      = " << vox_vol  << "\n";
+         cout  << "   MAPIN => Grid X size      = " << X_GRID   << "\n"
+               << "   MAPIN => Grid Y size      = " << Y_GRID   << "\n"
+               << "   MAPIN => Grid Z size      = " << Z_GRID   << "\n"
+               << "   MAPIN => Grid volume      = " << vox_vol  << "\n";
 
-      cout  << "   MAPIN => ----------------------------------------------\n"
-            << "   MAPIN => | PARAMETER          | UNIT CELL |    MAP    |\n"
-            << "   MAPIN => |--------------------|-----------|-----------|\n";
+         cout  << "   MAPIN => ----------------------------------------------\n"
+               << "   MAPIN => | PARAMETER          | UNIT CELL |    MAP    |\n"
+               << "   MAPIN => |--------------------|-----------|-----------|\n";
 
-      cout  << "   MAPIN => | X in Grid Units    |";
-      cout.width(11);  cout << X_CELL                        << "|";
-      cout.width(11);  cout << X_LIM                         << "|\n";
+         cout  << "   MAPIN => | X in Grid Units    |";
+         cout.width(11);  cout << X_CELL                        << "|";
+         cout.width(11);  cout << X_LIM                         << "|\n";
 
-      cout  << "   MAPIN => | Y in Grid Units    |";
-      cout.width(11);  cout << Y_CELL                        << "|";
-      cout.width(11);  cout << Y_LIM                         << "|\n";
+         cout  << "   MAPIN => | Y in Grid Units    |";
+         cout.width(11);  cout << Y_CELL                        << "|";
+         cout.width(11);  cout << Y_LIM                         << "|\n";
 
-      cout  << "   MAPIN => | Z in Grid Units    |";
-      cout.width(11);  cout << Z_CELL                        << "|";
-      cout.width(11);  cout << Z_LIM                         << "|\n";
+         cout  << "   MAPIN => | Z in Grid Units    |";
+         cout.width(11);  cout << Z_CELL                        << "|";
+         cout.width(11);  cout << Z_LIM                         << "|\n";
 
-      cout  << "   MAPIN => | X in Angstroms     |";
-      cout.width(11);  cout << X_CELL * X_GRID               << "|";
-      cout.width(11);  cout << X_LIM  * X_GRID               <<"|\n";
+         cout  << "   MAPIN => | X in Angstroms     |";
+         cout.width(11);  cout << X_CELL * X_GRID               << "|";
+         cout.width(11);  cout << X_LIM  * X_GRID               <<"|\n";
 
-      cout  << "   MAPIN => | Y in Angstroms     |";
-      cout.width(11);  cout << Y_CELL * Y_GRID               << "|";
-      cout.width(11);  cout << Y_LIM  * Y_GRID               <<"|\n";
+         cout  << "   MAPIN => | Y in Angstroms     |";
+         cout.width(11);  cout << Y_CELL * Y_GRID               << "|";
+         cout.width(11);  cout << Y_LIM  * Y_GRID               <<"|\n";
 
-      cout  << "   MAPIN => | Z in Angstroms     |";
-      cout.width(11);  cout << Z_CELL * Z_GRID               << "|";
-      cout.width(11);  cout << Z_LIM  * Z_GRID               <<"|\n";
+         cout  << "   MAPIN => | Z in Angstroms     |";
+         cout.width(11);  cout << Z_CELL * Z_GRID               << "|";
+         cout.width(11);  cout << Z_LIM  * Z_GRID               <<"|\n";
 
-      cout.precision(0);
+         cout.precision(0);
 
-      cout  << "   MAPIN => | Voxel number       |";
-      cout.width(11);  cout << XYZ_CELL                      << "|";
-      cout.width(11);  cout << XYZ_LIM                       << "|\n";
+         cout  << "   MAPIN => | Voxel number       |";
+         cout.width(11);  cout << XYZ_CELL                      << "|";
+         cout.width(11);  cout << XYZ_LIM                       << "|\n";
 
-      cout  << "   MAPIN => | Volume             |";
-      cout.width(11);  cout << cel_vol                       << "|";
-      cout.width(11);  cout << map_vol                       << "|\n";
+         cout  << "   MAPIN => | Volume             |";
+         cout.width(11);  cout << cel_vol                       << "|";
+         cout.width(11);  cout << map_vol                       << "|\n";
 
-      cout  << "   MAPIN => ----------------------------------------------\n";
+         cout  << "   MAPIN => ----------------------------------------------\n";
+
+         }
+
+      cout.precision(0);
 
       cout.flush();
 
@@ -1823,20 +3556,67 @@ int   ReadMap(const char *file, int map1, int mem)
          cout.width(7); cout << Z_LIM << "     ";
          cout.width(7); cout << MAP_H[map1].NS  << "\n";
 
+         ZipClose(read1, zip, 0);
          return 2;
          }
       }
 
    // ************************** LOAD MAP **********************************
-   
-   for (countz = 1; countz <= Z_LIM; countz ++)
-      for (county = 1; county <= Y_LIM; county ++)
-         for (countx = 1; countx <= X_LIM; countx ++)
-            fread(&MAP[ ( countx-1)          + 
-                        ((county-1)*X_LIM )  + 
-                        ((countz-1)*XY_LIM)  +
-                        ( map1 * XYZ_LIM)      ],
-               sizeof(float), 1, read1);
+
+   if (stream_on)                                  // Only note where it is
+      {
+      StreamFile(file, map1, ftell(read1));
+      ZipClose(read1, zip, 0);
+      cout.unsetf(ios::fixed);
+      cout.unsetf(ios::right);
+      return 0;
+      }
+
+   if (box_on && !plain)                           // Box, then transposed
+      {
+      vector<char> tmp(XYZ_LIM * sizeof(float));
+
+      count = ReadBox(fileno(read1), &src, &tmp[0], sizeof(float));
+      AxisLoad(&tmp[0], fax, (char *) (MAP + (map1 * XYZ_LIM)), sizeof(float));
+      ZipClose(read1, zip, 0);
+      cout.unsetf(ios::fixed);
+      cout.unsetf(ios::right);
+      return (count != 0);
+      }
+
+   if (box_on)                                     // Rows of the box only
+      {
+      count = ReadBox(fileno(read1), &src, (char *) (MAP + (map1 * XYZ_LIM)),
+                      sizeof(float));
+      ZipClose(read1, zip, 0);
+      cout.unsetf(ios::fixed);
+      cout.unsetf(ios::right);
+      return (count != 0);
+      }
+
+   if (shm_on && !ShmMap(file, read1, map1))       // Shared with others
+      {
+      ZipClose(read1, zip, 0);
+      cout.unsetf(ios::fixed);
+      cout.unsetf(ios::right);
+      return 0;
+      }
+
+   if (plain)
+      count = (fread(MAP + (map1 * XYZ_LIM), sizeof(float), XYZ_LIM, read1)
+               != (size_t) XYZ_LIM);               // Same order as the file,
+                                                   //    so one read will do
+   else
+      count = ReadAxes(read1, fax, (char *) (MAP + (map1 * XYZ_LIM)),
+                       sizeof(float));
+
+   if (ZipClose(read1, zip, 0) || count)           // Short file, or the
+      {                                            //    decoder failed
+      cout << "   MAPIN => Map file is short or damaged.\n";
+      cout.unsetf(ios::fixed);
+      cout.unsetf(ios::right);
+      return 1;
+      }
 
    cout.unsetf(ios::fixed);
    cout.unsetf(ios::right);
@@ -1852,58 +3632,62 @@ int   ReadMap(const char *file, int map1, int mem)
 float ReadMsk(const char *file, int msk1, int mem)
    {
 
-   int      countz;
-   int      county;
-   int      countx;
+   long     count;
 
-   int      tot   = 0;
-   int      sum   = 0;
+   long     tot   = 0;
+   long     sum   = 0;
 
    float    frac  = 0;
 
    char     ch;
 
-   FILE     *read1;
-
-   if ((read1 = fopen(file, "rb")) == NULL)        // Read failure
-      return -1;
+   int      zip;
+   int      plain;
+   int      bad   = 0;
+   int      fax[3];
 
-   // ********************   READ MAP HEADER ****************************
+   const int xyz[3] = {1, 2, 3};
 
-   fread( &MAP_H[map_mem + msk1].NC     , sizeof(int) ,    1, read1);
+   box_src  src;
 
-   fread( &MAP_H[map_mem + msk1].NR     , sizeof(int) ,    1, read1);
-   fread( &MAP_H[map_mem + msk1].NS     , sizeof(int) ,    1, read1);
+   FILE     *read1;
 
-   fread( &MAP_H[map_mem + msk1].MODE   , sizeof(int) ,    1, read1);
+   if ((read1 = PreOpen(file, &zip)) == NULL)       // Read failure
+      return -1;
 
-   fread( &MAP_H[map_mem + msk1].NCSTART, sizeof(int) ,    1, read1);
-   fread( &MAP_H[map_mem + msk1].NRSTART, sizeof(int) ,    1, read1);
-   fread( &MAP_H[map_mem + msk1].NSSTART, sizeof(int) ,    1, read1);
+   MskTouch(msk1);
 
-   fread( &MAP_H[map_mem + msk1].NX     , sizeof(int) ,    1, read1);
-   fread( &MAP_H[map_mem + msk1].NY     , sizeof(int) ,    1, read1);
-   fread( &MAP_H[map_mem + msk1].NZ     , sizeof(int) ,    1, read1);
+   // ********************   READ MAP HEADER ****************************
 
-   fread(  MAP_H[map_mem + msk1].CELL   , sizeof(float),   6, read1);
+   if (ReadHead(read1, map_mem + msk1))            // Short or damaged header
+      {
+      ZipClose(read1, zip, 0);
+      return -1;
+      }
 
-   fread( &MAP_H[map_mem + msk1].MAPC   , sizeof(int) ,    1, read1);
-   fread( &MAP_H[map_mem + msk1].MAPR   , sizeof(int) ,    1, read1);
-   fread( &MAP_H[map_mem + msk1].MAPS   , sizeof(int) ,    1, read1);
+   if (zip && (box_on || stream_on))               // Both seek in the file
+      {
+      cout << "   MASKI => Compressed masks can not be boxed or streamed.\n";
+      ZipClose(read1, zip, 0);
+      return -1;
+      }
 
-   fread( &MAP_H[map_mem + msk1].AMIN   , sizeof(int) ,    1, read1);
-   fread( &MAP_H[map_mem + msk1].AMAX   , sizeof(int) ,    1, read1);
-   fread( &MAP_H[map_mem + msk1].AMEAN  , sizeof(int) ,    1, read1);
+   fax[0] = MAP_H[map_mem + msk1].MAPC;            // Axis order of file
+   fax[1] = MAP_H[map_mem + msk1].MAPR;
+   fax[2] = MAP_H[map_mem + msk1].MAPS;
 
-   fread( &MAP_H[map_mem + msk1].ISPG   , sizeof(int) ,    1, read1);
+   plain = !axis_on || !AxisValid(fax) ||
+           ((fax[0] == 1) && (fax[1] == 2) && (fax[2] == 3));
 
-   fread( &MAP_H[map_mem + msk1].NSY    , sizeof(int) ,    1, read1);
+   if (box_on && BoxFull(map_mem + msk1, "MASKI", 0))
+      {
+      ZipClose(read1, zip, 0);
+      return -1;
+      }
 
-   fread(  MAP_H[map_mem + msk1].REST   , sizeof(float),   32, read1);
+   if (box_on) BoxHead(read1, map_mem + msk1, &src);
 
-   fread(  MAP_H[map_mem + msk1].LAB    , sizeof(char) , LAB_LEN, read1);
-   fread(  MAP_H[map_mem + msk1].SYM    , sizeof(char) ,
-      MAP_H[map_mem + msk1].NSY, read1);
+   if (!plain) AxisHead(&MAP_H[map_mem + msk1], xyz);
 
    // ************** CHECK TO SEE IF MASK SIZE IS CORRECT ******************
 
@@ -1927,12 +3711,16 @@ float ReadMsk(const char *file, int msk1, int mem)
       cout.width(7); cout << Z_LIM << "     ";
       cout.width(7); cout << MAP_H[map_mem + msk1].NS << "\n";
 
+      ZipClose(read1, zip, 0);
       return -1;
       }
 
    // ****** IF FIRST CALL TO FUNCTION, ASSIGN MEMORY **********************
 
-   if(mem)
+   if(mem && stream_on)                            // Masks stay on disk
+      msk_num_1 = msk1;
+
+   else if(mem)
       {
 
       msk_num_1 = msk1;
@@ -1940,43 +3728,83 @@ float ReadMsk(const char *file, int msk1, int mem)
       cout << "   MASKI => Attempting to assign memory for " << msk_mem 
            << " masks.\n";
 
-      MSK = new char [(XYZ_LIM * msk_mem) + msk_mem];
+      MSK = (char *) mmap(NULL, (XYZ_LIM * msk_mem) + msk_mem,
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+      if (MSK == MAP_FAILED) MSK = NULL;           // Zero pages, as for MAP
 
       if(!MSK)
          {                                         // Not enough memory
          cout  << "\nINSUFFICIENT MEMORY!!!\n";
+         ZipClose(read1, zip, 0);
          return -1;
          }
 
       cout << "   MASKI => Memory assigned for " << msk_mem 
            << " masks.\n";
 
-      cout << "   MASKI => Setting all pixels to zero.\n";
-
-      for (countx = 0; countx < (XYZ_LIM * msk_mem + msk_mem); countx ++)
-         MSK[countx] = 0;
-
       cout.flush();
 
       }
 
    // ************************** LOAD MASK *********************************
 
-   for (countz = 1; countz <= Z_LIM; countz ++)
-      for (county = 1; county <= Y_LIM; county ++)
-         for (countx = 1; countx <= X_LIM; countx ++)
-            {
-            fread(&ch, sizeof(char), 1, read1);
+   if (stream_on)                                  // Count it, keep it on disk
+      StreamFile(file, map_mem + msk1, ftell(read1));
 
-            MSK[ ( countx-1)          +
-                 ((county-1)*X_LIM )  +
-                 ((countz-1)*XY_LIM)  +
-                 ( msk1 * XYZ_LIM)      ] = ch;
+   if (box_on)                                     // Rows of the box only
+      {
+      vector<char> tmp(plain ? 0 : XYZ_LIM);
 
-            sum = sum + ch;
-            tot ++;
+      if (ReadBox(fileno(read1), &src, plain ? MSK + (msk1 * XYZ_LIM)
+                                             : &tmp[0], sizeof(char)))
+         {
+         ZipClose(read1, zip, 0);
+         return -1;
+         }
+
+      if (!plain) AxisLoad(&tmp[0], fax, MSK + (msk1 * XYZ_LIM), sizeof(char));
+
+      for (count = 0; count < XYZ_LIM; count ++)
+         sum = sum + MSK[count + (msk1 * XYZ_LIM)];
+
+      tot = XYZ_LIM;
+      }
+
+   else if (!stream_on)                            // Same order as the file
+      {
+      if (plain)
+         bad = (fread(MSK + (msk1 * XYZ_LIM), sizeof(char), XYZ_LIM, read1)
+                != (size_t) XYZ_LIM);
+      else
+         bad = ReadAxes(read1, fax, MSK + (msk1 * XYZ_LIM), sizeof(char));
+
+      for (count = 0; count < XYZ_LIM; count ++)
+         sum = sum + MSK[count + (msk1 * XYZ_LIM)];
+
+      tot = XYZ_LIM;
+      }
+
+   else                                            // Streamed, only counted
+      for (count = 0; count < XYZ_LIM; count ++)
+         {
+         if (fread(&ch, sizeof(char), 1, read1) != 1)
+            {
+            bad = 1;
+            break;
             }
 
+         sum = sum + ch;
+         tot ++;
+         }
+
+   if (ZipClose(read1, zip, 0) || bad)             // Short file, or the
+      {                                            //    decoder failed
+      cout << "   MASKI => Mask file is short or damaged.\n";
+      return -1;
+      }
+
    cout  << "   MASKI => Total pixels in mask are " << tot << "\n";
    cout  << "   MASKI => Pixels with value 1 =>   " << sum << "\n";
    cout  << "   MASKI => Pixels with value 0 =>   " << (tot - sum) << "\n";
@@ -1987,6 +3815,135 @@ float ReadMsk(const char *file, int msk1, int mem)
 
    }
 
+//**************************************************************************
+//** READ HEADER function:  Reads the fixed 1024 byte CCP4 header (56     **
+//**    words and ten 80 character labels) plus the symmetry records.     **
+//**************************************************************************
+
+int   ReadHead(FILE *read1, int map1)
+   {
+
+   int   word[56];
+
+   int   len;
+
+   if (fread(word, sizeof(int), HEAD_LEN, read1) != (size_t) HEAD_LEN)
+      return 1;
+
+   MAP_H[map1].NC      = word[ 0];
+   MAP_H[map1].NR      = word[ 1];
+   MAP_H[map1].NS      = word[ 2];
+
+   MAP_H[map1].MODE    = word[ 3];
+
+   MAP_H[map1].NCSTART = word[ 4];
+   MAP_H[map1].NRSTART = word[ 5];
+   MAP_H[map1].NSSTART = word[ 6];
+
+   MAP_H[map1].NX      = word[ 7];
+   MAP_H[map1].NY      = word[ 8];
+   MAP_H[map1].NZ      = word[ 9];
+
+   memcpy( MAP_H[map1].CELL  , &word[10], 6 * sizeof(float));
+
+   MAP_H[map1].MAPC    = word[16];
+   MAP_H[map1].MAPR    = word[17];
+   MAP_H[map1].MAPS    = word[18];
+
+   memcpy(&MAP_H[map1].AMIN  , &word[19],     sizeof(float));
+   memcpy(&MAP_H[map1].AMAX  , &word[20],     sizeof(float));
+   memcpy(&MAP_H[map1].AMEAN , &word[21],     sizeof(float));
+
+   MAP_H[map1].ISPG    = word[22];
+
+   MAP_H[map1].NSY     = word[23];
+
+   memcpy( MAP_H[map1].REST  , &word[24], 32 * sizeof(float));
+
+   if (fread(MAP_H[map1].LAB, sizeof(char), LAB_LEN, read1) != (size_t) LAB_LEN)
+      return 1;
+
+   MAP_H[map1].LAB[LAB_LEN] = '\0';
+
+   // Symmetry records beyond the space kept in SYM are skipped, so that
+   // the voxel data always starts at 1024 + NSY bytes.
+
+   if ((MAP_H[map1].NSY < 0) || (MAP_H[map1].NX <= 0) ||
+       (MAP_H[map1].NY  <= 0) || (MAP_H[map1].NZ <= 0))
+      return 1;
+
+   len = MAP_H[map1].NSY;
+   if (len > (int) sizeof(MAP_H[map1].SYM)) len = sizeof(MAP_H[map1].SYM);
+
+   if (fread(MAP_H[map1].SYM, sizeof(char), len, read1) != (size_t) len)
+      return 1;
+
+   for (len = MAP_H[map1].NSY - len; len > 0; len --) // Read, as a pipe
+      if (fgetc(read1) == EOF)                     //    can not seek
+         return 1;
+
+   return 0;
+
+   }
+
+//**************************************************************************
+//** WRITE HEADER function:  Writes a header in the fixed CCP4 layout.    **
+//**************************************************************************
+
+int   WriteHead(FILE *write1, int map1)
+   {
+
+   int   word[56];
+
+   int   len;
+
+   map_header head = MAP_H[map1];
+
+   if (axis_on) AxisHead(&head, file_ax);          // Axis order of the
+                                                   //    principal map file
+
+   word[ 0] = head.NC;
+   word[ 1] = head.NR;
+   word[ 2] = head.NS;
+
+   word[ 3] = head.MODE;
+
+   word[ 4] = head.NCSTART;
+   word[ 5] = head.NRSTART;
+   word[ 6] = head.NSSTART;
+
+   word[ 7] = head.NX;
+   word[ 8] = head.NY;
+   word[ 9] = head.NZ;
+
+   memcpy(&word[10],  head.CELL  , 6 * sizeof(float));
+
+   word[16] = head.MAPC;
+   word[17] = head.MAPR;
+   word[18] = head.MAPS;
+
+   memcpy(&word[19], &head.AMIN  ,     sizeof(float));
+   memcpy(&word[20], &head.AMAX  ,     sizeof(float));
+   memcpy(&word[21], &head.AMEAN ,     sizeof(float));
+
+   word[22] = head.ISPG;
+
+   len = head.NSY;
+   if (len > (int) sizeof(head.SYM)) len = sizeof(head.SYM);
+
+   word[23] = len;
+
+   memcpy(&word[24],  head.REST  , 32 * sizeof(float));
+
+   fwrite(word, sizeof(int), HEAD_LEN, write1);
+
+   fwrite(head.LAB, sizeof(char), LAB_LEN, write1);
+   fwrite(head.SYM, sizeof(char), len    , write1);
+
+   return 0;
+
+   }
+
 //**************************************************************************
 //** READ PDB FILE function:  Reads a pdb file and stores it in *PDB      **
 //**************************************************************************
@@ -2001,32 +3958,43 @@ int   ReadPDB(const char *file, int pdb1)
 
    char  temp[100];
 
+   double   O[3][3];
+   double   F[3][3];
+   double   frac[3];
+
+   int      slot[3];
+   int      outside = 0;
+
    ifstream read1 (file);
 
    if (!read1) return 1;
 
    pdb_len[pdb1] = 0;
 
-   while(!(read1.eof()))         // Until end of file, read atom id's
-      {
+   CellMatrix(MAP_H[0].CELL, O, F);
+
+   // get() rather than getline() for the fixed width fields:  getline()
+   // sets failbit when the line goes on past the field, and every read
+   // after that failed (so eof was never reached).
 
-      read1 >> temp;
+   while ((pdb_len[pdb1] < pdb_max) && (read1 >> temp))
+      {                          // Until end of file, read atom id's
 
       if (   (strcmp(temp,   "ATOM")) &&
              (strcmp(temp, "HETATM"))    )
             {
-            read1.getline(temp, 100);
+            read1.ignore(10000, '\n');
             continue;
             }
 
       pdb_len[pdb1] ++;
 
-      LOC = (pdb_mem * pdb1) + pdb_len[pdb1];
+      LOC = (pdb_max * pdb1) + pdb_len[pdb1];
 
       read1 >> PDB[LOC].Num;
 
-      read1.getline (PDB[LOC].Nam, 6);
-      read1.getline (PDB[LOC].MID, 15);
+      read1.get (PDB[LOC].Nam, 6);                 // Columns 12 to 16
+      read1.get (PDB[LOC].MID, 15);                // Columns 17 to 30
 
       read1 >> PDB[LOC].x;
       read1 >> PDB[LOC].y;
@@ -2035,52 +4003,31 @@ int   ReadPDB(const char *file, int pdb1)
       read1 >> PDB[LOC].O;
       read1 >> PDB[LOC].B;
 
-      read1.getline (PDB[LOC].END, 20);
+      PDB[LOC].END[0] = '\0';
+      read1.get (PDB[LOC].END, 20);                // May be empty, which
+      read1.clear(read1.rdstate() & ios::eofbit);  //    sets failbit
+      read1.ignore(10000, '\n');
 
+      if (read1.fail()) break;
       }
 
    for (count1 = 1; count1 <= pdb_len[pdb1]; count1 ++)
       {
-      PDB[count1].Type = 0;
-      PDB[count1].Enum = 0;
-
-      LOC = (pdb_mem * pdb1) + count1;
-
-      PDB[LOC].X = C2C_X( 1                             ,
-                          PDB[LOC].x + MAP_H[0].CELL[0] , 
-                          PDB[LOC].y + MAP_H[0].CELL[1] ,
-                          PDB[LOC].z + MAP_H[0].CELL[2] ,
-                          MAP_H[0].CELL[0]              ,
-                          MAP_H[0].CELL[1]              ,
-                          MAP_H[0].CELL[2]              ,
-                          MAP_H[0].CELL[3]*DegToRad     ,
-                          MAP_H[0].CELL[4]*DegToRad     ,
-                          MAP_H[0].CELL[5]*DegToRad        )
-                   - X_CELL;
-
-      PDB[LOC].Y = C2C_Y( 1                             ,
-                          PDB[LOC].x + MAP_H[0].CELL[0] , 
-                          PDB[LOC].y + MAP_H[0].CELL[1] ,
-                          PDB[LOC].z + MAP_H[0].CELL[2] ,
-                          MAP_H[0].CELL[0]              ,
-                          MAP_H[0].CELL[1]              ,
-                          MAP_H[0].CELL[2]              ,
-                          MAP_H[0].CELL[3]*DegToRad     ,
-                          MAP_H[0].CELL[4]*DegToRad     ,
-                          MAP_H[0].CELL[5]*DegToRad        )
-                   - Y_CELL;
-
-      PDB[LOC].Z = C2C_Z( 1                             ,
-                          PDB[LOC].x + MAP_H[0].CELL[0] , 
-                          PDB[LOC].y + MAP_H[0].CELL[1] ,
-                          PDB[LOC].z + MAP_H[0].CELL[2] ,
-                          MAP_H[0].CELL[0]              ,
-                          MAP_H[0].CELL[1]              ,
-                          MAP_H[0].CELL[2]              ,
-                          MAP_H[0].CELL[3]*DegToRad     ,
-                          MAP_H[0].CELL[4]*DegToRad     ,
-                          MAP_H[0].CELL[5]*DegToRad        )
-                   - Z_CELL;
+      LOC = (pdb_max * pdb1) + count1;
+
+      PDB[LOC].Type = 0;
+      PDB[LOC].Enum = 0;
+
+      for (count2 = 0; count2 <= 2; count2 ++)     // Fractional
+         frac[count2] = F[count2][0] * PDB[LOC].x +
+                        F[count2][1] * PDB[LOC].y +
+                        F[count2][2] * PDB[LOC].z;
+
+      if (!SymInside(frac, slot)) outside ++;      // Grid point of the
+                                                   //    mate in the map
+      PDB[LOC].X = slot[0];
+      PDB[LOC].Y = slot[1];
+      PDB[LOC].Z = slot[2];
 
       for (count2 = 1; count2 <= DatNum; count2 ++)
          if (Same(PDBdat[count2].name, PDB[LOC].Nam))
@@ -2088,6 +4035,10 @@ int   ReadPDB(const char *file, int pdb1)
 
       }
 
+   if (outside)
+      cout  << "   PDBIN => " << outside << " atoms have no symmetry mate "
+            << "inside the map.\n";
+
    return 0;
 
    }
@@ -2174,7 +4125,7 @@ int   WriteDAT(const char *file, int pdb1)
    for (count1 = 1; count1 <= pdb_len[pdb1]; count1 ++)
       {
 
-      LOC = (pdb_mem * pdb1) + count1;
+      LOC = (pdb_max * pdb1) + count1;
 
       write1.width(5);   write1 << PDB[LOC].Num;
       write1.width(5);   write1 << PDB[LOC].Nam;
@@ -2225,7 +4176,7 @@ int   WritePDB(const char *file, int pdb1)
    for (count1 = 1; count1 <= pdb_len[pdb1]; count1 ++)
       {
 
-      LOC = (pdb_mem * pdb1) + count1;
+      LOC = (pdb_max * pdb1) + count1;
 
       write1 << "ATOM  ";
 
@@ -2269,50 +4220,24 @@ int   WriteMap(const char *file, int map1)
    float f1;
    float frac_vol;
 
+   int   zip;
+
    FILE  *write1;
 
-   if ((write1 = fopen(file, "wb")) == NULL)        // Write failure
+   if ((write1 = ZipOpen(file, "wb", &zip)) == NULL) // Write failure
       return -1;
 
 
    // ********************  WRITE MAP HEADER ****************************
 
-   fwrite( &MAP_H[0].NC     , sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[0].NR     , sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[0].NS     , sizeof(int) ,    1, write1);
-
-   fwrite( &MAP_H[0].MODE   , sizeof(int) ,    1, write1);
-
-   fwrite( &MAP_H[0].NCSTART, sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[0].NRSTART, sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[0].NSSTART, sizeof(int) ,    1, write1);
-
-   fwrite( &MAP_H[0].NX     , sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[0].NY     , sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[0].NZ     , sizeof(int) ,    1, write1);
-
-   fwrite(  MAP_H[0].CELL   , sizeof(float),   6, write1);
-
-   fwrite( &MAP_H[0].MAPC   , sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[0].MAPR   , sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[0].MAPS   , sizeof(int) ,    1, write1);
-
-   fwrite( &MAP_H[0].AMIN   , sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[0].AMAX   , sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[0].AMEAN  , sizeof(int) ,    1, write1);
-
-   fwrite( &MAP_H[0].ISPG   , sizeof(int) ,    1, write1);
-
-   fwrite( &MAP_H[0].NSY    , sizeof(int) ,    1, write1);
-
-   fwrite(  MAP_H[0].REST   , sizeof(float),   32, write1);
-
-   fwrite(  MAP_H[0].LAB    , sizeof(char) , LAB_LEN, write1);
-   fwrite(  MAP_H[0].SYM    , sizeof(char) , MAP_H[0].NSY, write1);
-
+   WriteHead(write1, 0);
 
    // ************************* WRITE MAP **********************************
  
+   if (axis_on)                                    // Back to the file order
+      WriteAxes(write1, file_ax, (const char *) (MAP + (map1 * XYZ_LIM)),
+                sizeof(float));
+   else
    for (countz = 1; countz <= Z_LIM; countz ++)
       for (county = 1; county <= Y_LIM; county ++)
          for (countx = 1; countx <= X_LIM; countx ++)
@@ -2324,6 +4249,9 @@ int   WriteMap(const char *file, int map1)
             fwrite(&f1, sizeof(float), 1, write1);
             }
 
+   if (ZipClose(write1, zip, 1))                  // Disk full, no gzip ...
+      return -1;
+
    return 0;
 
    }
@@ -2339,55 +4267,29 @@ float MaskOut(const char *file, int msk1)
    int      county;
    int      countx;
 
-   int      tot   = 0;
-   int      sum   = 0;
+   long     tot   = 0;
+   long     sum   = 0;
 
    float    frac  = 0;
 
    char     ch;
 
+   int      zip;
+
    FILE     *write1;
 
-   if ((write1 = fopen(file, "wb")) == NULL)        // Write failure
+   if ((write1 = ZipOpen(file, "wb", &zip)) == NULL) // Write failure
       return -1;
 
    // ********************  WRITE MASK HEADER ***************************
-  
-   fwrite( &MAP_H[map_mem + 0].NC     , sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[map_mem + 0].NR     , sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[map_mem + 0].NS     , sizeof(int) ,    1, write1);
- 
-   fwrite( &MAP_H[map_mem + 0].MODE   , sizeof(int) ,    1, write1);
 
-   fwrite( &MAP_H[map_mem + 0].NCSTART, sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[map_mem + 0].NRSTART, sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[map_mem + 0].NSSTART, sizeof(int) ,    1, write1);
-
-   fwrite( &MAP_H[map_mem + 0].NX     , sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[map_mem + 0].NY     , sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[map_mem + 0].NZ     , sizeof(int) ,    1, write1);
-
-   fwrite(  MAP_H[map_mem + 0].CELL   , sizeof(float),   6, write1);
- 
-   fwrite( &MAP_H[map_mem + 0].MAPC   , sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[map_mem + 0].MAPR   , sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[map_mem + 0].MAPS   , sizeof(int) ,    1, write1);
-
-   fwrite( &MAP_H[map_mem + 0].AMIN   , sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[map_mem + 0].AMAX   , sizeof(int) ,    1, write1);
-   fwrite( &MAP_H[map_mem + 0].AMEAN  , sizeof(int) ,    1, write1);
-
-   fwrite( &MAP_H[map_mem + 0].ISPG   , sizeof(int) ,    1, write1);
-
-   fwrite( &MAP_H[map_mem + 0].NSY    , sizeof(int) ,    1, write1);
-
-   fwrite(  MAP_H[map_mem + 0].REST   , sizeof(float),   32, write1);
-
-   fwrite(  MAP_H[map_mem + 0].LAB    , sizeof(char) , LAB_LEN, write1);
-   fwrite(  MAP_H[map_mem + 0].SYM    , sizeof(char) , MAP_H[map_mem + 0].NSY, write1);
+   WriteHead(write1, map_mem + 0);
 
    // ************************** LOAD MASK *********************************
  
+   if (axis_on)                                    // Back to the file order
+      WriteAxes(write1, file_ax, MSK + (msk1 * XYZ_LIM), sizeof(char));
+
    for (countz = 1; countz <= Z_LIM; countz ++)
       for (county = 1; county <= Y_LIM; county ++)
          for (countx = 1; countx <= X_LIM; countx ++)
@@ -2398,12 +4300,15 @@ float MaskOut(const char *file, int msk1)
                       ((countz-1)*XY_LIM)  +
                       ( msk1 * XYZ_LIM)      ];
 
-            fwrite(&ch, sizeof(char), 1, write1);
+            if (!axis_on) fwrite(&ch, sizeof(char), 1, write1);
 
             sum = sum + ch;
             tot ++;
             }
 
+   if (ZipClose(write1, zip, 1))                  // Disk full, no gzip ...
+      return -1;
+
    cout  << "   MASKO => Total pixels in mask are " << tot << "\n";
    cout  << "   MASKO => Pixels with value 1 =>   " << sum << "\n";
    cout  << "   MASKO => Pixels with value 0 =>   " << (tot - sum) << "\n";
@@ -2430,7 +4335,7 @@ int   MakeGray(const char *file, int map1)
    register int   countx;
    register int   map;
 
-   register int   LOC;
+   register long  LOC;
 
    register int   val;
 
@@ -2659,7 +4564,7 @@ float Scale(int map1, int map2, int zone, int msk1)
    register int   county;
    register int   countx;
 
-   register int   LOC;
+   register long  LOC;
 
    register float scale;
 
@@ -2686,6 +4591,8 @@ float Scale(int map1, int map2, int zone, int msk1)
             MAP[LOC] = MAP[LOC] * scale;
             }
 
+   MapTouch(map1);
+
    return scale;
 
    }
@@ -2697,17 +4604,15 @@ float Scale(int map1, int map2, int zone, int msk1)
 float Rfac(int map1, int map2, int zone, int msk1, int type)
    {
 
-   register int   countz;
-   register int   county;
-   register int   countx;
+   register double value = 0;
 
-   register int   LOC;
+   register float zone2;
 
-   register float  num;
+   long           count;
 
-   register double value = 0;
+   sum_part       sum;
 
-   register float zone2;
+   rfac_memo      memo;
 
    if (zone == 0) zone2 = 1;
    if (zone == 1) zone2 = 0;
@@ -2715,40 +4620,69 @@ float Rfac(int map1, int map2, int zone, int msk1, int type)
 
    // ********** FIND RFACTOR BETWEEN MAP1, MAP2 IN/OUT OF MSK1 ************
 
-   for (countz = 1; countz <= Z_LIM; countz ++)
-      for (county = 1; county <= Y_LIM; county ++)
-         for (countx = 1; countx <= X_LIM; countx ++)
-            {
-            LOC = ((countx - 1)          ) +
-                  ((county - 1) * X_LIM  ) +
-                  ((countz - 1) * XY_LIM );
+   for (count = 0; count < (long) rfac_seen.size(); count ++)
+      if ( (rfac_seen[count].gen[0] == map_gen[map1]) &&
+           (rfac_seen[count].gen[1] == map_gen[map2]) &&
+           (rfac_seen[count].gen[2] == ((zone == 2) ? 0 : msk_gen[msk1])) &&
+           (rfac_seen[count].zone   == zone) )
+         break;
 
-            if ( (zone2 != 2) &&
-                 (MSK[LOC + (msk1 * XYZ_LIM)] == zone2) )
-               continue;
+   if (count < (long) rfac_seen.size())            // Same maps and mask
+      {
+      value = rfac_seen[count].value;
+      stat_hit ++;
+      }
+   else
+      {
+      SumStats(SUM_RFAC, map1, map2, zone2, msk1, 0, &sum);
 
-            num = MAP[LOC + (map1 * XYZ_LIM)] -
-                  MAP[LOC + (map2 * XYZ_LIM)];
+      value = sum.dif;
+      stat_miss ++;
 
-            value = value + sqrt (num * num);
-            }
+      memo.gen[0] = map_gen[map1];
+      memo.gen[1] = map_gen[map2];
+      memo.gen[2] = (zone == 2) ? 0 : msk_gen[msk1];
+      memo.zone   = zone;
+      memo.value  = value;
+
+      if (rfac_seen.size() >= (size_t) RFAC_SEEN)  // Oldest out
+         rfac_seen.erase(rfac_seen.begin());
+      rfac_seen.push_back(memo);
+      }
+
+   FindParms(map1, zone, msk1);
+   FindParms(map2, zone, msk1);
+   FindRMS  (map1, zone, msk1);
+   FindRMS  (map2, zone, msk1);
+
+   return RfacOut(map1, map2, zone, value, type);
+
+   }
+
+//**************************************************************************
+//** RFAC OUTPUT function:  Prints the R factor table from the sum of     **
+//**    pixel differences and the stored map averages and RMS values.     **
+//**************************************************************************
+
+float RfacOut(int map1, int map2, int zone, double value, int type)
+   {
 
    cout  << "   RFAC  => -----------------------------------------------\n";
    cout  << "   RFAC  => | Average density for map 1    | "; 
    cout.width(12);
-   cout  << FindParms(map1, zone, msk1)
+   cout  << map_avg[map1][zone]
          << " |\n";
    cout  << "   RFAC  => | Average density for map 2    | "; 
    cout.width(12);
-   cout  << FindParms(map2, zone, msk1)
+   cout  << map_avg[map2][zone]
          << " |\n";
    cout  << "   RFAC  => | RMS value for map 1          | "; 
    cout.width(12);
-   cout  << FindRMS(map1, zone, msk1)
+   cout  << map_rms[map1][zone]
          << " |\n";
    cout  << "   RFAC  => | RMS value for map 2          | "; 
    cout.width(12);
-   cout  << FindRMS(map2, zone, msk1)
+   cout  << map_rms[map2][zone]
          << " |\n";
    cout  << "   RFAC  => | Sum of map pixel differences | "; 
    cout.width(12);
@@ -2832,16 +4766,12 @@ void  Smear(int map1, int map2, int map3, int N)
    register int   y2;
    register int   x2;
 
-   register int   z3;
-   register int   y3;
-   register int   x3;
-
    register int   z3a;
    register int   y3a;
    register int   x3a;
 
-   register int   LOC2;
-   register int   LOC3;
+   register long  LOC2;
+   register long  LOC3;
 
    register int   dx;
    register int   dy;
@@ -2849,6 +4779,7 @@ void  Smear(int map1, int map2, int map3, int N)
 
    register float X = 0;
    register float den;
+   register float miss;
 
    register float mod[20];
 
@@ -2866,6 +4797,9 @@ void  Smear(int map1, int map2, int map3, int N)
       }
 
    // ********** SMOOTH MAP1 BY SMEARING TO N PIXELS IN EACH DIRECTION *****
+   // Each point gathers from the points within N of it, so that beyond
+   // the edges of a map smaller than the cell their symmetry mates can
+   // be used.  Points with no mate in the map are left out.
 
    cout  << "   SMEAR => Copying maps and setting to zero.\n";
 
@@ -2876,36 +4810,47 @@ void  Smear(int map1, int map2, int map3, int N)
    cout  << "   SMEAR => SMOOTHING MAP IN X DIRECTION.\n";
    cout.flush();
 
+   if (brick_n) SmearBricks(0, map2, map3, N, mod);
+   else
    for (z2 = 1; z2 <= Z_LIM; z2 ++)
       for (y2 = 1; y2 <= Y_LIM; y2 ++)
          for (x2 = 1; x2 <= X_LIM; x2 ++)
             {
 
-            LOC2 = ((x2 - 1)          ) +
+            LOC3 = ((x2 - 1)          ) +
                    ((y2 - 1) * X_LIM  ) +
                    ((z2 - 1) * XY_LIM ) +
-                   (XYZ_LIM * map2);
+                   (XYZ_LIM * map3);
 
-            den = MAP[LOC2];
+            den  = 0;
+            miss = 0;
 
             for (x3a = (x2 - N + 1); x3a < (x2 + N); x3a ++)
                {
 
                dx = Abs(x2-x3a) + .01;
 
-                    if (x3a < 0    ) x3 = x3a + X_LIM;
-               else if (x3a > X_LIM) x3 = x3a - X_LIM;
-               else x3 = x3a;
+               if ((x3a < 1) || (x3a > X_LIM))     // Mate inside map
+                  LOC2 = SymWrap(x3a, y2, z2);
+               else
+                  LOC2 = ((x3a - 1)          ) +
+                         ((y2 - 1) * X_LIM  ) +
+                         ((z2 - 1) * XY_LIM );
 
-               LOC3 = ((x3 - 1)          ) +
-                      ((y2 - 1) * X_LIM  ) +
-                      ((z2 - 1) * XY_LIM ) +
-                      (XYZ_LIM * map3);
+               if (LOC2 < 0)
+                  {
+                  miss = miss + mod[dx];
+                  continue;
+                  }
+
+               den = den + (MAP[LOC2 + (XYZ_LIM * map2)] * mod[dx]);
 
-               MAP[LOC3] = MAP[LOC3] + (den * mod[dx]);
-                                     
                }
 
+            if (miss > 0) den = den / (1 - miss);  // Weights of the
+                                                   //    points found
+            MAP[LOC3] = den;
+
             }
 
    cout  << "   SMEAR => Copying maps and setting to zero.\n";
@@ -2917,36 +4862,47 @@ void  Smear(int map1, int map2, int map3, int N)
    cout  << "   SMEAR => SMOOTHING MAP IN Y DIRECTION.\n";
    cout.flush();
 
+   if (brick_n) SmearBricks(1, map2, map3, N, mod);
+   else
    for (z2 = 1; z2 <= Z_LIM; z2 ++)
       for (y2 = 1; y2 <= Y_LIM; y2 ++)
          for (x2 = 1; x2 <= X_LIM; x2 ++)
             {
 
-            LOC2 = ((x2 - 1)          ) +
+            LOC3 = ((x2 - 1)          ) +
                    ((y2 - 1) * X_LIM  ) +
                    ((z2 - 1) * XY_LIM ) +
-                   (XYZ_LIM * map2);
+                   (XYZ_LIM * map3);
 
-            den = MAP[LOC2];
+            den  = 0;
+            miss = 0;
 
             for (y3a = (y2 - N + 1); y3a < (y2 + N); y3a ++)
                {
 
                dy = Abs(y2-y3a) + .01;
 
-                    if (y3a < 0    ) y3 = y3a + Y_LIM;
-               else if (y3a > Y_LIM) y3 = y3a - Y_LIM;
-               else y3 = y3a;
+               if ((y3a < 1) || (y3a > Y_LIM))     // Mate inside map
+                  LOC2 = SymWrap(x2, y3a, z2);
+               else
+                  LOC2 = ((x2 - 1)          ) +
+                         ((y3a - 1) * X_LIM  ) +
+                         ((z2 - 1) * XY_LIM );
 
-               LOC3 = ((x2 - 1)          ) +
-                      ((y3 - 1) * X_LIM  ) +
-                      ((z2 - 1) * XY_LIM ) +
-                      (XYZ_LIM * map3);
+               if (LOC2 < 0)
+                  {
+                  miss = miss + mod[dy];
+                  continue;
+                  }
 
-               MAP[LOC3] = MAP[LOC3] + (den * mod[dy]);
+               den = den + (MAP[LOC2 + (XYZ_LIM * map2)] * mod[dy]);
 
                }
 
+            if (miss > 0) den = den / (1 - miss);  // Weights of the
+                                                   //    points found
+            MAP[LOC3] = den;
+
             }
 
    cout  << "   SMEAR => Copying maps and setting to zero.\n";
@@ -2958,42 +4914,58 @@ void  Smear(int map1, int map2, int map3, int N)
    cout  << "   SMEAR => SMOOTHING MAP IN Z DIRECTION.\n";
    cout.flush();
 
+   if (brick_n) SmearBricks(2, map2, map3, N, mod);
+   else
    for (z2 = 1; z2 <= Z_LIM; z2 ++)
       for (y2 = 1; y2 <= Y_LIM; y2 ++)
          for (x2 = 1; x2 <= X_LIM; x2 ++)
             {
 
-            LOC2 = ((x2 - 1)          ) +
+            LOC3 = ((x2 - 1)          ) +
                    ((y2 - 1) * X_LIM  ) +
                    ((z2 - 1) * XY_LIM ) +
-                   (XYZ_LIM * map2);
+                   (XYZ_LIM * map3);
 
-            den = MAP[LOC2];
+            den  = 0;
+            miss = 0;
 
             for (z3a = (z2 - N + 1); z3a < (z2 + N); z3a ++)
                {
 
                dz = Abs(z2-z3a) + .01;
 
-                    if (z3a < 0    ) z3 = z3a + Z_LIM;
-               else if (z3a > Z_LIM) z3 = z3a - Z_LIM;
-               else z3 = z3a;
+               if ((z3a < 1) || (z3a > Z_LIM))     // Mate inside map
+                  LOC2 = SymWrap(x2, y2, z3a);
+               else
+                  LOC2 = ((x2 - 1)          ) +
+                         ((y2 - 1) * X_LIM  ) +
+                         ((z3a - 1) * XY_LIM );
 
-               LOC3 = ((x2 - 1)          ) +
-                      ((y2 - 1) * X_LIM  ) +
-                      ((z3 - 1) * XY_LIM ) +
-                      (XYZ_LIM * map3);
+               if (LOC2 < 0)
+                  {
+                  miss = miss + mod[dz];
+                  continue;
+                  }
 
-               MAP[LOC3] = MAP[LOC3] + (den * mod[dz]);
+               den = den + (MAP[LOC2 + (XYZ_LIM * map2)] * mod[dz]);
 
                }
 
+            if (miss > 0) den = den / (1 - miss);  // Weights of the
+                                                   //    points found
+            MAP[LOC3] = den;
+
             }
 
    x2 = Zero(map2, 2, 0);
    MapMod(map2, map3, 2, 0, +1);
    x2 = Zero(map3, 2, 0);
 
+   map_symm[map2] = map_symm[map3] = 0;          // Kernel is not symmetric
+
+   MapTouch(map2);
+   MapTouch(map3);
+
    return;
 
    }
@@ -3017,8 +4989,8 @@ void  Rough(int map1, int map2, int N)
    register int   y2;
    register int   x2;
 
-   register int   LOC1;
-   register int   LOC2;
+   register long  LOC1;
+   register long  LOC2;
 
    register int   dx;
    register int   dy;
@@ -3049,6 +5021,8 @@ void  Rough(int map1, int map2, int N)
    cout  << "   ROUGH => CALCULATING ROUGHNESS OF MAP " << (map1+1) << " RADIUS " << N << " TO MAP " << (map2+1) << " ...\n";
    cout.flush();
 
+   if (brick_n) RoughBricks(map1, map2, N, &min_rough, &max_rough);
+   else
    for (z2 = 1; z2 <= Z_LIM; z2 ++)
       for (y2 = 1; y2 <= Y_LIM; y2 ++)
          for (x2 = 1; x2 <= X_LIM; x2 ++)
@@ -3083,19 +5057,19 @@ void  Rough(int map1, int map2, int N)
 
 //temp++;
 //if (!(temp%1)) cout << del << " ";
-                          if (x1a < 1    )  x1a = x1a + X_LIM;
-                     else if (x1a > X_LIM)  x1a = x1a - X_LIM;
-
-                          if (y1a < 1    )  y1a = y1a + Y_LIM;
-                     else if (y1a > Y_LIM)  y1a = y1a - Y_LIM;
-
-                          if (z1a < 1    )  z1a = z1a + Z_LIM;
-                     else if (z1a > Z_LIM)  z1a = z1a - Z_LIM;
-
-                     LOC1 = ((x1a - 1)          ) +
-                            ((y1a - 1) * X_LIM  ) +
-                            ((z1a - 1) * XY_LIM ) +
-                            (XYZ_LIM * map1);
+                     if ((x1a < 1) || (x1a > X_LIM) ||
+                         (y1a < 1) || (y1a > Y_LIM) ||
+                         (z1a < 1) || (z1a > Z_LIM))
+                        {                          // Mate inside map
+                        LOC1 = SymWrap(x1a, y1a, z1a);
+                        if (LOC1 < 0) continue;
+                        LOC1 = LOC1 + (XYZ_LIM * map1);
+                        }
+                     else
+                        LOC1 = ((x1a - 1)          ) +
+                               ((y1a - 1) * X_LIM  ) +
+                               ((z1a - 1) * XY_LIM ) +
+                               (XYZ_LIM * map1);
 //cout << " X=" << x1a << " Y=" << y1a << " Z=" << z1a << " loc=" << LOC1 << "  ";
 //cout.flush();
                      val[num] = MAP[LOC1];
@@ -3122,13 +5096,291 @@ void  Rough(int map1, int map2, int N)
    cout  << "   ROUGH => Roughness values between " << min_rough << " and " << max_rough 
 	 << " from " << map1 << " saved to " << map2 << "\n";
 
+   map_symm[map2] = 0;
+
+   MapTouch(map2);
+
+   return;
+
+   }
+
+
+
+
+
+//**************************************************************************
+//** BRICK SET function:  Places brick b at grid point X, Y, Z (1 based)  **
+//**    with brick_n points inside along each axis (fewer at the map      **
+//**    edges) and a halo of hx, hy, hz points on each side.              **
+//**************************************************************************
+
+void  BrickSet(brick_buf *b, int X, int Y, int Z, int hx, int hy, int hz)
+   {
+
+   int      lim[3] = {X_LIM, Y_LIM, Z_LIM};
+   int      i;
+
+   b->lo[0] = X;   b->h[0] = hx;
+   b->lo[1] = Y;   b->h[1] = hy;
+   b->lo[2] = Z;   b->h[2] = hz;
+
+   for (i = 0; i <= 2; i ++)
+      {
+      b->in[i] = lim[i] - b->lo[i] + 1;
+      if (b->in[i] > brick_n) b->in[i] = brick_n;
+      b->n[i]  = b->in[i] + (2 * b->h[i]);
+      }
+
+   b->v.resize ((long) b->n[0] * b->n[1] * b->n[2]);
+   b->ok.resize((long) b->n[0] * b->n[1] * b->n[2]);
+
+   return;
+
+   }
+
+//**************************************************************************
+//** BRICK FILL function:  Copies map1 into brick b, halo included.  Halo **
+//**    points beyond the map edges come from a symmetry or lattice mate  **
+//**    inside it (see SymWrap); those with none are marked in b->ok.     **
+//**************************************************************************
+
+void  BrickFill(brick_buf *b, int map1)
+   {
+
+   int      X0 = b->lo[0] - b->h[0];
+   int      X;
+   int      Y;
+   int      Z;
+   int      county;
+   int      countz;
+   int      countx;
+
+   long     LOC;
+   long     at = 0;
+
+   float    *src = MAP + (XYZ_LIM * map1);
+
+   for (countz = 0; countz < b->n[2]; countz ++)
+      for (county = 0; county < b->n[1]; county ++)
+         {
+         Y = b->lo[1] - b->h[1] + county;
+         Z = b->lo[2] - b->h[2] + countz;
+
+         if ((Y >= 1) && (Y <= Y_LIM) && (Z >= 1) && (Z <= Z_LIM) &&
+             (X0 >= 1) && (X0 + b->n[0] - 1 <= X_LIM))
+            {                                      // Whole row inside
+            LOC = (X0 - 1) + ((long) (Y - 1) * X_LIM) +
+                  ((long) (Z - 1) * XY_LIM);
+            memcpy(&b->v[at], src + LOC, b->n[0] * sizeof(float));
+            memset(&b->ok[at], 1, b->n[0]);
+            at = at + b->n[0];
+            continue;
+            }
+
+         for (countx = 0; countx < b->n[0]; countx ++, at ++)
+            {
+            X = X0 + countx;
+
+            if ((X < 1) || (X > X_LIM) || (Y < 1) || (Y > Y_LIM) ||
+                (Z < 1) || (Z > Z_LIM))            // Mate inside map
+               LOC = SymWrap(X, Y, Z);
+            else
+               LOC = (X - 1) + ((long) (Y - 1) * X_LIM) +
+                     ((long) (Z - 1) * XY_LIM);
+
+            b->ok[at] = (LOC >= 0);
+            b->v[at]  = (LOC >= 0) ? src[LOC] : 0;
+            }
+         }
+
+   return;
+
+   }
+
+//**************************************************************************
+//** SMEAR BRICKS function:  One pass of SMEAR along axis (0, 1, 2 for    **
+//**    x, y, z) from map2 into map3, a brick at a time.  Each brick      **
+//**    carries an N-1 halo along the axis only, so the 2N-1 points each  **
+//**    point gathers are close together, whatever the stride of the      **
+//**    axis.  The sums are made in the same order as the plain loops.    **
+//**************************************************************************
+
+void  SmearBricks(int axis, int map2, int map3, int N, const float *mod)
+   {
+
+   int      h[3] = {0, 0, 0};
+   int      step[3];
+   int      bx;
+   int      by;
+   int      bz;
+   int      countx;
+   int      county;
+   int      countz;
+   int      off;
+
+   long     at;
+   long     LOC3;
+
+   float    den;
+   float    miss;
+
+   brick_buf b;
+
+   h[axis] = N - 1;
+
+   for (bz = 1; bz <= Z_LIM; bz += brick_n)
+      for (by = 1; by <= Y_LIM; by += brick_n)
+         for (bx = 1; bx <= X_LIM; bx += brick_n)
+            {
+            BrickSet(&b, bx, by, bz, h[0], h[1], h[2]);
+            BrickFill(&b, map2);
+
+            step[0] = 1;
+            step[1] = b.n[0];
+            step[2] = b.n[0] * b.n[1];
+
+            for (countz = 0; countz < b.in[2]; countz ++)
+               for (county = 0; county < b.in[1]; county ++)
+                  for (countx = 0; countx < b.in[0]; countx ++)
+                     {
+                     at = (countx + h[0]) + ((county + h[1]) * step[1]) +
+                          ((countz + h[2]) * step[2]) - (h[axis] * step[axis]);
+
+                     den  = 0;
+                     miss = 0;
+
+                     for (off = -(N - 1); off < N; off ++, at += step[axis])
+                        {
+                        if (!b.ok[at])
+                           {
+                           miss = miss + mod[(off < 0) ? -off : off];
+                           continue;
+                           }
+
+                        den = den + (b.v[at] * mod[(off < 0) ? -off : off]);
+                        }
+
+                     if (miss > 0) den = den / (1 - miss);
+
+                     LOC3 = (bx + countx - 1) +
+                            ((long) (by + county - 1) * X_LIM) +
+                            ((long) (bz + countz - 1) * XY_LIM) +
+                            (XYZ_LIM * map3);
+
+                     MAP[LOC3] = den;
+                     }
+            }
+
    return;
 
    }
 
+//**************************************************************************
+//** ROUGH BRICKS function:  ROUGH of map1 into map2 a brick at a time,   **
+//**    each with a halo of N, so the sphere round each point is read     **
+//**    from a few thousand points in cache instead of 2N sections of     **
+//**    the map.  The sphere is worked out once as offsets in the brick.  **
+//**    The same points are used in the same order as the plain loops.    **
+//**************************************************************************
+
+void  RoughBricks(int map1, int map2, int N, float *min_rough,
+                  float *max_rough)
+   {
+
+   int      bx;
+   int      by;
+   int      bz;
+   int      x2;
+   int      y2;
+   int      z2;
+   int      dx;
+   int      dy;
+   int      dz;
+   int      num;
+
+   long     at;
+   long     LOC2;
+   long     step1 = 0;
+   long     step2 = 0;
+
+   float    del;
+   float    avg;
+   float    rms;
+   float    val[10000];
+
+   brick_buf b;
+
+   vector<long> sph;                               // Sphere in the brick
+
+   for (bz = 1; bz <= Z_LIM; bz += brick_n)
+      for (by = 1; by <= Y_LIM; by += brick_n)
+         for (bx = 1; bx <= X_LIM; bx += brick_n)
+            {
+            BrickSet(&b, bx, by, bz, N, N, N);
+            BrickFill(&b, map1);
+
+            if ((step1 != b.n[0]) || (step2 != (long) b.n[0] * b.n[1]))
+               {                                   // Edge bricks are less
+               step1 = b.n[0];                     //    wide
+               step2 = (long) b.n[0] * b.n[1];
+
+               sph.clear();
+
+               for (dx = N; dx > -N; dx --)
+                  for (dy = N; dy > -N; dy --)
+                     for (dz = N; dz > -N; dz --)
+                        {
+                        del = sqrt((dx*dx)+(dy*dy)+(dz*dz));
+
+                        if (del > N) continue;
+
+                        sph.push_back((N - dx) + ((N - dy) * step1) +
+                                      ((N - dz) * step2));
+                        }
+               }
+
+            for (z2 = 0; z2 < b.in[2]; z2 ++)
+               for (y2 = 0; y2 < b.in[1]; y2 ++)
+                  for (x2 = 0; x2 < b.in[0]; x2 ++)
+                     {
+                     num = 0;
+                     avg = 0;
+                     rms = 0;
+
+                     LOC2 = x2 + (y2 * step1) + (z2 * step2);
+
+                     for (dx = 0; dx < (int) sph.size(); dx ++)
+                        {
+                        at = LOC2 + sph[dx];
+
+                        if (!b.ok[at]) continue;
+
+                        val[num] = b.v[at];
+                        avg = avg + val[num];
+                        num ++;
+                        }
+
+                     avg = avg / num;
+
+                     for (dx = 0; dx < num; dx ++)
+                        rms = rms + pow((val[dx] - avg), 2.0);
+
+                     rms = sqrt(rms);
 
+                     LOC2 = (bx + x2 - 1) +
+                            ((long) (by + y2 - 1) * X_LIM) +
+                            ((long) (bz + z2 - 1) * XY_LIM) +
+                            (XYZ_LIM * map2);
 
+                     MAP[LOC2] = rms;
+                     if (*min_rough > rms) *min_rough = rms;
+                     if (*max_rough < rms) *max_rough = rms;
+                     }
+            }
+
+   return;
 
+   }
 
 //**************************************************************************
 //** SHAPE function: Expands a mask to inflection points                  **
@@ -3143,9 +5395,9 @@ void  Shape(int msk1, int msk2, int msk3, int map1, float MinDif, int N1, int N2
    register int   y2;
    register int   x2;
 
-   register int   LOC1;
-   register int   LOC2;
-   register int   LOC3;
+   register long  LOC1;
+   register long  LOC2;
+   register long  LOC3;
 
    register int   dx;
    register int   dy;
@@ -3214,6 +5466,8 @@ void  Shape(int msk1, int msk2, int msk3, int map1, float MinDif, int N1, int N2
       MskCopy(msk3, msk2);
       }
 
+   MskTouch(msk3);
+
    return;
 
    }
@@ -3224,16 +5478,16 @@ void  Shape(int msk1, int msk2, int msk3, int map1, float MinDif, int N1, int N2
 //** ZERO function:  Sets part of all of map to zero.                     **
 //**************************************************************************
 
-int   Zero(int map1, int zone, int msk1)
+long  Zero(int map1, int zone, int msk1)
    {
 
    register int   countz;
    register int   county;
    register int   countx;
 
-   register int   LOC;
+   register long  LOC;
 
-   register int   total = 0;
+   register long  total = 0;
 
    register float zone2;
 
@@ -3259,6 +5513,10 @@ int   Zero(int map1, int zone, int msk1)
             total ++;
             }
 
+   if (zone != 2) map_symm[map1] = 0;            // Masks break symmetry
+
+   MapTouch(map1);
+
    return total;
 
    }
@@ -3268,16 +5526,16 @@ int   Zero(int map1, int zone, int msk1)
 //**    it is bellow/above min/max density.                               **
 //**************************************************************************
 
-int   Cut(int map1, int zone, int msk1, float min, float max)
+long  Cut(int map1, int zone, int msk1, float min, float max)
    {
 
    register int   countz;
    register int   county;
    register int   countx;
 
-   register int   LOC;
+   register long  LOC;
 
-   register int   total = 0;
+   register long  total = 0;
 
    register float zone2;
 
@@ -3313,6 +5571,10 @@ int   Cut(int map1, int zone, int msk1, float min, float max)
 
             }
 
+   if (zone != 2) map_symm[map1] = 0;            // Masks break symmetry
+
+   MapTouch(map1);
+
    return total;
 
    }
@@ -3328,7 +5590,7 @@ void MaxOf(int map1, int map2, int map3)
    register int   county;
    register int   countx;
 
-   register int   LOC;
+   register long  LOC;
 
    register float val1;
    register float val2;
@@ -3350,6 +5612,10 @@ void MaxOf(int map1, int map2, int map3)
 
             }
 
+   map_symm[map1] = map_symm[map2] && map_symm[map3];
+
+   MapTouch(map1);
+
    return;
 
    }
@@ -3365,7 +5631,7 @@ void  MaxMs(int msk1, int msk2, int msk3)
    register int   county;
    register int   countx;
 
-   register int   LOC;
+   register long  LOC;
 
    for (countz = 1; countz <= Z_LIM; countz ++)
       for (county = 1; county <= Y_LIM; county ++)
@@ -3383,6 +5649,8 @@ void  MaxMs(int msk1, int msk2, int msk3)
                MSK[LOC + (XYZ_LIM * msk1)] = 0;
             }
 
+   MskTouch(msk1);
+
    return;
 
    }
@@ -3398,7 +5666,7 @@ void  MinMs(int msk1, int msk2, int msk3)
    register int   county;
    register int   countx;
 
-   register int   LOC;
+   register long  LOC;
 
    for (countz = 1; countz <= Z_LIM; countz ++)
       for (county = 1; county <= Y_LIM; county ++)
@@ -3416,6 +5684,8 @@ void  MinMs(int msk1, int msk2, int msk3)
                MSK[LOC + (XYZ_LIM * msk1)] = 1;
             }
 
+   MskTouch(msk1);
+
    return;
 
    }
@@ -3431,7 +5701,7 @@ void  Flip(int msk1, int msk2)
    register int   county;
    register int   countx;
 
-   register int   LOC;
+   register long  LOC;
 
    for (countz = 1; countz <= Z_LIM; countz ++)
       for (county = 1; county <= Y_LIM; county ++)
@@ -3448,6 +5718,8 @@ void  Flip(int msk1, int msk2)
                 MSK[LOC + (XYZ_LIM * msk1)] = 1;
             }
 
+   MskTouch(msk1);
+
    return;
 
    }
@@ -3463,7 +5735,7 @@ void MskCopy(int msk1, int msk2)     // Copy msk1 into msk2
    register int   county;
    register int   countx;
 
-   register int   LOC;
+   register long  LOC;
 
    for (countz = 1; countz <= Z_LIM; countz ++)
       for (county = 1; county <= Y_LIM; county ++)
@@ -3476,6 +5748,8 @@ void MskCopy(int msk1, int msk2)     // Copy msk1 into msk2
             MSK[LOC + (XYZ_LIM * msk2)] = MSK[LOC + (XYZ_LIM * msk1)];
             }
 
+   MskTouch(msk2);
+
    return;
 
    }
@@ -3492,7 +5766,7 @@ void MapCopy(int map1, int map2)     // Copy map1 into map2
    register int   county;
    register int   countx;
 
-   register int   LOC;
+   register long  LOC;
 
    for (countz = 1; countz <= Z_LIM; countz ++)
       for (county = 1; county <= Y_LIM; county ++)
@@ -3505,6 +5779,10 @@ void MapCopy(int map1, int map2)     // Copy map1 into map2
             MAP[LOC + (XYZ_LIM * map2)] = MAP[LOC + (XYZ_LIM * map1)];
             }
 
+   map_symm[map2] = map_symm[map1];
+
+   MapTouch(map2);
+
    return;
 
    }
@@ -3522,7 +5800,7 @@ void  MapMod(int map1, int map2, int zone, int msk1, float value)
    register int   county;
    register int   countx;
 
-   register int   LOC;
+   register long  LOC;
 
    register int   zone2;
 
@@ -3548,6 +5826,10 @@ void  MapMod(int map1, int map2, int zone, int msk1, float value)
                + (value *  MAP[LOC + (XYZ_LIM * map2)]);
             }
   
+   map_symm[map1] = map_symm[map1] && map_symm[map2] && (zone == 2);
+
+   MapTouch(map1);
+
    return;
 
    }
@@ -3560,58 +5842,29 @@ void  MapMod(int map1, int map2, int zone, int msk1, float value)
 float FindParms(int map1, int zone, int msk1)
    {
 
-   register int   countz;
-   register int   county;
-   register int   countx;
-
-   register int   LOC1;
-   register int   LOC2;
-
-   register float val;
-
    register int   zone2;
 
-   map_max[map1][zone] = -1000;
-   map_min[map1][zone] = +1000;
-   map_avg[map1][zone] = 0;
-   map_tot[map1][zone] = 0;
-   map_num[map1][zone] = 0;
+   sum_part       sum;
 
    if (zone == 0) zone2 = 1;
    if (zone == 1) zone2 = 0;
    if (zone == 2) zone2 = 2;
 
-   for (countz = 1; countz <= Z_LIM; countz ++)
-      for (county = 1; county <= Y_LIM; county ++)
-         for (countx = 1; countx <= X_LIM; countx ++)
-            {
-            LOC2 = ((countx - 1)          ) +
-                   ((county - 1) * X_LIM  ) +
-                   ((countz - 1) * XY_LIM ) +
-                   ( msk1   * XYZ_LIM     );
-
-            if ( (zone2 != 2) &&
-                 (MSK[LOC2] == zone2) )
-               continue;
-
-            LOC1 = ((countx - 1)          ) +
-                   ((county - 1) * X_LIM  ) +
-                   ((countz - 1) * XY_LIM ) +
-                   ( map1   * XYZ_LIM     );
-
-            val = MAP[LOC1];
+   if (!StatSeen(stat_key[map1][zone], map1, zone, msk1))
+      {
+      SumStats(SUM_PARMS, map1, -1, zone2, msk1, 0, &sum);
 
-            if (val > map_max[map1][zone] ) map_max[map1][zone] = val;
-            if (val < map_min[map1][zone] ) map_min[map1][zone] = val;
+      map_max[map1][zone] = sum.max;
+      map_min[map1][zone] = sum.min;
+      map_num[map1][zone] = sum.num;
 
-            map_tot[map1][zone] = map_tot[map1][zone] + val;
-            map_num[map1][zone] ++;
-            }
+      map_avg[map1][zone] = sum.tot 
+                            / (map_num[map1][zone] * 1.0);
+      map_tot[map1][zone] = sum.tot 
+                            * map_vol / (XYZ_LIM * 1.0);
 
-   map_avg[map1][zone] = map_tot[map1][zone] 
-                         / (map_num[map1][zone] * 1.0);
-   map_tot[map1][zone] = map_tot[map1][zone] 
-                         * map_vol / (XYZ_LIM * 1.0);
+      rms_key[map1][zone][0] = -1;                 // Made with the old
+      }                                            //    average
 
    if (zone2 == 2)
       {
@@ -3632,19 +5885,9 @@ float FindParms(int map1, int zone, int msk1)
 float FindRMS(int map1, int zone, int msk1)
    {
 
-   register int   countz;
-   register int   county;
-   register int   countx;
-
-   register int   LOC1;
-   register int   LOC2;
-
-   register float sum = 0;
-
    register int   zone2;
 
-   map_var[map1][zone] = 0;
-   map_rms[map1][zone] = 0;
+   sum_part       sum;
 
    if (zone == 0) zone2 = 1;
    if (zone == 1) zone2 = 0;
@@ -3653,31 +5896,16 @@ float FindRMS(int map1, int zone, int msk1)
    // map_var = ((1/N) sum ((density - average)^2)) => Standard Deviation
    // map_rms = sqrt (map_var)
 
-   for (countz = 1; countz <= Z_LIM; countz ++)
-      for (county = 1; county <= Y_LIM; county ++)
-         for (countx = 1; countx <= X_LIM; countx ++)
-            {
-            LOC2 = ((countx - 1)          ) +
-                   ((county - 1) * X_LIM  ) +
-                   ((countz - 1) * XY_LIM ) +
-                   ( msk1   * XYZ_LIM     );
-
-            if ( (zone2 != 2) &&
-                 (MSK[LOC2] == zone2) )
-               continue;
-
-            LOC1 = ((countx - 1)          ) +
-                   ((county - 1) * X_LIM  ) +
-                   ((countz - 1) * XY_LIM ) +
-                   ( map1   * XYZ_LIM     );
-
-            sum = sum + (  (MAP[LOC1] - map_avg[map1][zone]) * 
-                           (MAP[LOC1] - map_avg[map1][zone])   );
+   if (!StatSeen(rms_key[map1][zone], map1, zone, msk1))
+      {
+      map_var[map1][zone] = 0;
+      map_rms[map1][zone] = 0;
 
-            }
+      SumStats(SUM_RMS, map1, -1, zone2, msk1, map_avg[map1][zone], &sum);
 
-   map_var[map1][zone] = (sum/map_num[map1][zone]); // (1/N) sum((P-Po)^2)
-   map_rms[map1][zone] = sqrt(map_var[map1][zone]); // sqrt (var)
+      map_var[map1][zone] = (sum.sq/map_num[map1][zone]); // (1/N) sum((P-Po)^2)
+      map_rms[map1][zone] = sqrt(map_var[map1][zone]);    // sqrt (var)
+      }
 
    if (zone2 == 2)
       MAP_H[map1].REST[30] = map_rms[map1][zone];
@@ -3687,630 +5915,6442 @@ float FindRMS(int map1, int zone, int msk1)
    }
 
 //**************************************************************************
-//** MAP ADD function:  Adds a constant, or the variable in the memory    **
-//**    location, to a map in/out of a mask.                              **
+//** MAP TOUCH and MASK TOUCH functions:  Give map map1 or mask msk1 a    **
+//**    new generation, so statistics stored for it are not used again.   **
 //**************************************************************************
 
-void MapAdd(int map1, int zone, int msk1, float value)
+void  MapTouch(int map1)
    {
 
-   register int   countz;
-   register int   county;
-   register int   countx;
-
-   register int   LOC;
-
-   register int   zone2;
-
-   if (zone == 0) zone2 = 1;
-   if (zone == 1) zone2 = 0;
-   if (zone == 2) zone2 = 2;
+   map_gen[map1] = ++ gen_next;
 
-   // **********ADD/SUBTRACT CONSTANT FROM MAP1 IN/OUT OF MSK1 *************
+   return;
 
-   for (countz = 1; countz <= Z_LIM; countz ++)
-      for (county = 1; county <= Y_LIM; county ++)
-         for (countx = 1; countx <= X_LIM; countx ++)
-            {
-            LOC = ((countx - 1)          ) +
-                  ((county - 1) * X_LIM  ) +
-                  ((countz - 1) * XY_LIM );
+   }
 
-            if ( (zone2 != 2) &&
-                 (MSK[LOC + (msk1 * XYZ_LIM)] == zone2) )
-               continue;
+void  MskTouch(int msk1)
+   {
 
-            MAP[LOC + (map1 * XYZ_LIM)] =
-               MAP[LOC + (map1 * XYZ_LIM)] + value;
-            }
+   msk_gen[msk1] = ++ gen_next;
 
    return;
 
    }
 
-
 //**************************************************************************
-//** MAP ADD function:  Adds a constant, or the variable in the memory    **
-//**    location, to a map in/out of a mask.                              **
+//** STATISTICS SEEN function:  1 if key holds the generations of map1    **
+//**    and (unless zone is TOTAL) mask msk1, so the statistics stored    **
+//**    for them still hold.  If not, key is set to them and 0 returned.  **
 //**************************************************************************
 
-void MapMult(int map1, int zone, int msk1, float value)
+int   StatSeen(long key[2], int map1, int zone, int msk1)
    {
 
-   register int   countz;
-   register int   county;
-   register int   countx;
+   long     mgen = (zone == 2) ? 0 : msk_gen[msk1];
 
-   register int   LOC;
+   if ((key[0] == map_gen[map1]) && (key[1] == mgen))
+      {
+      stat_hit ++;
+      return 1;
+      }
 
-   register int   zone2;
+   key[0] = map_gen[map1];
+   key[1] = mgen;
 
-   if (zone == 0) zone2 = 1;
-   if (zone == 1) zone2 = 0;
-   if (zone == 2) zone2 = 2;
+   stat_miss ++;
 
-   // ********** MULTIPLY MAP1 BY CONSTANT VALUE IN/OUT OF MSK1 ************
+   return 0;
 
-   for (countz = 1; countz <= Z_LIM; countz ++)
-      for (county = 1; county <= Y_LIM; county ++)
-         for (countx = 1; countx <= X_LIM; countx ++)
-            {
-            LOC = ((countx - 1)          ) +
-                  ((county - 1) * X_LIM  ) +
-                  ((countz - 1) * XY_LIM );
+   }
+
+//**************************************************************************
+//** STATISTICS LIST function:  Prints how often stored statistics were   **
+//**    used, and those that still hold.                                  **
+//**************************************************************************
+
+void  StatList()
+   {
+
+   const char *name[3] = {"OUT", "IN", "TOTAL"};
+
+   int      count1;
+   int      count2;
+   int      msk1;
+
+   cout  << "   STATS => Statistics found stored:  " << stat_hit  << "\n"
+         << "   STATS => Statistics worked out:    " << stat_miss << "\n"
+         << "   STATS => RFAC sums stored:         " << rfac_seen.size()
+         << "\n";
+
+   cout  << "   STATS => ---------------------------------------------------\n"
+         << "   STATS => | Map | Zone  | Mask |    Average   |     RMS     |\n"
+         << "   STATS => |-----|-------|------|--------------|-------------|\n";
+
+   for (count1 = 0; count1 < map_mem; count1 ++)
+      for (count2 = 0; count2 <= 2; count2 ++)
+         {
+         if (stat_key[count1][count2][0] != map_gen[count1]) continue;
+
+         cout  << "   STATS => | ";
+         cout.width(3);   cout << (count1 + 1) << " | ";
+         cout.width(5);   cout << name[count2] << " | ";
+
+         cout.width(4);
+         if (count2 == 2) cout << "-";
+         else
+            {
+            for (msk1 = 0; msk1 < msk_mem; msk1 ++)
+               if (msk_gen[msk1] == stat_key[count1][count2][1]) break;
+
+            if (msk1 < msk_mem) cout << (msk1 + 1);
+            else                cout << "old";
+            }
+
+         cout  << " | ";
+         cout.width(12);  cout << map_avg[count1][count2] << " | ";
+         cout.width(11);
+
+         if ( (rms_key[count1][count2][0] == stat_key[count1][count2][0]) &&
+              (rms_key[count1][count2][1] == stat_key[count1][count2][1]) )
+            cout << map_rms[count1][count2];
+         else
+            cout << "-";
+
+         cout  << " |\n";
+         }
+
+   cout  << "   STATS => ---------------------------------------------------\n";
+
+   return;
+
+   }
+
+//**************************************************************************
+//** MASK LIST function:  The locations of the voxels of mask msk1 that   **
+//**    are not zone2 (0 for IN, 1 for OUT), found the first time they    **
+//**    are asked for and kept until the mask changes.  NULL if more than **
+//**    half the map is in the zone (a plain scan is as good), or when    **
+//**    streaming.                                                        **
+//**************************************************************************
+
+const vector<uint32_t> *MskList(int msk1, int zone2)
+   {
+
+   msk_list *list = &msk_idx[msk1][zone2];
+
+   const char *msk = MSK + (msk1 * XYZ_LIM);
+
+   long     LOC;
+   long     num = 0;
+
+   if (stream_on || !MSK || (XYZ_LIM > (long) UINT32_MAX))
+      return NULL;
+
+   if (list->gen != msk_gen[msk1])                 // Made anew
+      {
+      list->gen = msk_gen[msk1];
+      list->at.clear();
+
+      for (LOC = 0; LOC < XYZ_LIM; LOC ++)
+         num = num + (msk[LOC] != zone2);
+
+      list->big = (num > (XYZ_LIM / 2));
+
+      if (!list->big)
+         {
+         list->at.reserve(num);
+
+         for (LOC = 0; LOC < XYZ_LIM; LOC ++)
+            if (msk[LOC] != zone2) list->at.push_back(LOC);
+         }
+      }
+
+   return list->big ? NULL : &list->at;
+
+   }
+
+//**************************************************************************
+//** MAP GATHER function:  The gath slot holding the values of map1 at    **
+//**    MskList(msk1, zone2), side by side, made if there is none for the **
+//**    current generations.  Slot avoid is not reused.                   **
+//**************************************************************************
+
+int   MapGather(int map1, int msk1, int zone2, int avoid)
+   {
+
+   const vector<uint32_t> *at = MskList(msk1, zone2);
+
+   const float *map = MAP + (map1 * XYZ_LIM);
+
+   long     count;
+   int      slot;
+
+   for (slot = 0; slot < GATHER_MAX; slot ++)
+      if ( (gath[slot].gen[0] == map_gen[map1]) &&
+           (gath[slot].gen[1] == msk_gen[msk1]) &&
+           (gath[slot].zone2  == zone2) )
+         return slot;
+
+   slot = gath_next;                               // Oldest goes
+   if (slot == avoid) slot = (slot + 1) % GATHER_MAX;
+   gath_next = (slot + 1) % GATHER_MAX;
+
+   gath[slot].gen[0] = map_gen[map1];
+   gath[slot].gen[1] = msk_gen[msk1];
+   gath[slot].zone2  = zone2;
+   gath[slot].v.resize(at->size());
+
+   for (count = 0; count < (long) at->size(); count ++)
+      gath[slot].v[count] = map[(*at)[count]];
+
+   return slot;
+
+   }
+
+//**************************************************************************
+//** SUM SLAB function:  Thread body for SumStats.  Fills one sum_part    **
+//**    for each block from b0 to b1, adding up in double precision.      **
+//**************************************************************************
+
+void  *SumSlab(void *arg)
+   {
+
+   sum_job  *job = (sum_job *) arg;
+   sum_part *p;
+
+   long     blk;
+   long     first;
+   long     last;
+   long     count;
+   long     LOC;
+   long     base;
+
+   int      wt;
+
+   float    val;
+   float    num;
+
+   const float *map1 = MAP + (job->map1 * XYZ_LIM);
+   const float *map2 = MAP + ((job->map2 < 0 ? 0 : job->map2) * XYZ_LIM);
+   const char  *msk1 = MSK ? MSK + (job->msk1 * XYZ_LIM) : NULL;
+
+   if (job->at)                                    // Gathered, in the
+      {                                            //    order of at
+      map1 = job->g1;
+      map2 = job->g2;
+      }
+
+   for (blk = job->b0; blk < job->b1; blk ++)
+      {
+      p = &job->part[blk];
+
+      p->tot = p->sq = p->dif = 0;
+      p->num = 0;
+      p->max = -1000;
+      p->min = +1000;
+
+      if (job->asu || job->at)                     // Weighted asymmetric
+         {                                         //    unit points, or
+         first = blk * SUM_BLOCK;                  //    mask voxels
+         last  = first + SUM_BLOCK;
+         if (last > job->nvox) last = job->nvox;
+         }
+      else                                         // One section
+         {
+         first = 0;
+         last  = XY_LIM;
+         }
+
+      base = (job->asu || job->at) ? 0 : blk * XY_LIM;
+
+      for (count = first; count < last; count ++)
+         {
+         if (job->at)
+            {
+            LOC = count;
+            wt  = 1;
+            }
+         else if (job->asu)
+            {
+            LOC = asu_loc[count];
+            wt  = asu_wt[count];
+            }
+         else
+            {
+            LOC = base + count;
+            wt  = 1;
+
+            if ( (job->zone2 != 2) && (msk1[LOC] == job->zone2) )
+               continue;
+            }
+
+         val = map1[LOC];
+
+         if (job->op == SUM_PARMS)
+            {
+            if (val > p->max) p->max = val;
+            if (val < p->min) p->min = val;
+
+            p->tot = p->tot + (wt * (double) val);
+            p->num = p->num +  wt;
+            }
+         else if (job->op == SUM_RMS)
+            {
+            val   = val - job->avg;
+            p->sq = p->sq + (wt * (double) val * val);
+            }
+         else
+            {
+            num    = val - map2[LOC];
+            p->dif = p->dif + (wt * sqrt (num * num));
+            }
+         }
+      }
+
+   return NULL;
+
+   }
+
+//**************************************************************************
+//** SUM STATISTICS function:  Adds up op (see SUM_PARMS) for map1 over   **
+//**    zone2 of msk1, or over the asymmetric unit if map1 is symmetric   **
+//**    and the zone is TOTAL, or over MskList (gathered) if there are    **
+//**    few voxels in the zone.  The voxels are cut into blocks of fixed  **
+//**    size (sections), each summed in double precision by one thread,   **
+//**    and the blocks are then added in pairs in a fixed order, so the   **
+//**    answer is the same bit for bit however many threads are used.     **
+//**************************************************************************
+
+void  SumStats(int op, int map1, int map2, int zone2, int msk1, float avg,
+               sum_part *out)
+   {
+
+   sum_job     job[16];
+   pthread_t   tid[16];
+
+   int         made[16];
+   int         asu;
+   int         nth = sysconf(_SC_NPROCESSORS_ONLN);
+   int         count1;
+
+   long        nblk;
+   long        step;
+   long        blk;
+
+   int         g1 = -1;
+   int         g2 = -1;
+
+   long        nvox = 0;
+
+   const vector<uint32_t> *at = NULL;
+
+   asu  = (zone2 == 2) && map_symm[map1] &&
+          ((map2 < 0) || map_symm[map2]) && AsuBuild();
+
+   if (asu)
+      nvox = asu_loc.size();
+   else if ((zone2 != 2) && (at = MskList(msk1, zone2)))
+      {                                            // Few voxels in zone
+      nvox = at->size();
+      g1   = MapGather(map1, msk1, zone2, -1);
+      if (map2 >= 0) g2 = MapGather(map2, msk1, zone2, g1);
+      }
+
+   nblk = (asu || at) ? ((nvox + SUM_BLOCK - 1) / SUM_BLOCK) : Z_LIM;
+
+   vector<sum_part> part(nblk > 0 ? nblk : 1);
+
+   if (nth < 1)     nth = 1;
+   if (nth > 16)    nth = 16;
+   if (nth > nblk)  nth = nblk;
+   if (nth < 1)     nth = 1;
+
+   for (count1 = 0; count1 < nth; count1 ++)       // Blocks for each thread
+      {
+      job[count1].op    = op;
+      job[count1].map1  = map1;
+      job[count1].map2  = map2;
+      job[count1].zone2 = zone2;
+      job[count1].msk1  = msk1;
+      job[count1].asu   = asu;
+      job[count1].nvox  = nvox;
+      job[count1].at    = at ? (at->empty() ? NULL : &(*at)[0]) : NULL;
+      job[count1].g1    = (g1 >= 0) ? gath[g1].v.data() : NULL;
+      job[count1].g2    = (g2 >= 0) ? gath[g2].v.data() : NULL;
+      job[count1].avg   = avg;
+      job[count1].b0    = nblk *  count1      / nth;
+      job[count1].b1    = nblk * (count1 + 1) / nth;
+      job[count1].part  = &part[0];
+      }
+
+   for (count1 = 1; count1 < nth; count1 ++)
+      if ((made[count1] = !pthread_create(&tid[count1], NULL, SumSlab,
+                                          &job[count1])) == 0)
+         SumSlab(&job[count1]);
+
+   SumSlab(&job[0]);
+
+   for (count1 = 1; count1 < nth; count1 ++)
+      if (made[count1]) pthread_join(tid[count1], NULL);
+
+   if (nblk < 1)                                   // Nothing to add up
+      {
+      part[0].tot = part[0].sq = part[0].dif = 0;
+      part[0].num = 0;
+      part[0].max = -1000;
+      part[0].min = +1000;
+      }
+
+   for (step = 1; step < nblk; step = step * 2)    // Pairwise, fixed order
+      for (blk = 0; blk + step < nblk; blk = blk + (2 * step))
+         {
+         part[blk].tot = part[blk].tot + part[blk + step].tot;
+         part[blk].sq  = part[blk].sq  + part[blk + step].sq;
+         part[blk].dif = part[blk].dif + part[blk + step].dif;
+         part[blk].num = part[blk].num + part[blk + step].num;
+
+         if (part[blk + step].max > part[blk].max)
+            part[blk].max = part[blk + step].max;
+         if (part[blk + step].min < part[blk].min)
+            part[blk].min = part[blk + step].min;
+         }
+
+   *out = part[0];
+
+   return;
+
+   }
+
+
+//**************************************************************************
+//** MAP ADD function:  Adds a constant, or the variable in the memory    **
+//**    location, to a map in/out of a mask.                              **
+//**************************************************************************
+
+void MapAdd(int map1, int zone, int msk1, float value)
+   {
+
+   register int   countz;
+   register int   county;
+   register int   countx;
+
+   register long  LOC;
+
+   register int   zone2;
+
+   const vector<uint32_t> *at;
+
+   if (zone == 0) zone2 = 1;
+   if (zone == 1) zone2 = 0;
+   if (zone == 2) zone2 = 2;
+
+   // **********ADD/SUBTRACT CONSTANT FROM MAP1 IN/OUT OF MSK1 *************
+
+   if ((zone2 != 2) && (at = MskList(msk1, zone2)))
+      {                                            // Just the voxels of
+      for (LOC = 0; LOC < (long) at->size(); LOC ++)  //    the zone
+         MAP[(*at)[LOC] + (map1 * XYZ_LIM)] =
+            MAP[(*at)[LOC] + (map1 * XYZ_LIM)] + value;
+      }
+   else
+   for (countz = 1; countz <= Z_LIM; countz ++)
+      for (county = 1; county <= Y_LIM; county ++)
+         for (countx = 1; countx <= X_LIM; countx ++)
+            {
+            LOC = ((countx - 1)          ) +
+                  ((county - 1) * X_LIM  ) +
+                  ((countz - 1) * XY_LIM );
 
             if ( (zone2 != 2) &&
                  (MSK[LOC + (msk1 * XYZ_LIM)] == zone2) )
                continue;
 
             MAP[LOC + (map1 * XYZ_LIM)] =
-               MAP[LOC + (map1 * XYZ_LIM)] * value;
+               MAP[LOC + (map1 * XYZ_LIM)] + value;
             }
 
+   if (zone != 2) map_symm[map1] = 0;            // Masks break symmetry
+
+   MapTouch(map1);
+
    return;
 
    }
 
+
 //**************************************************************************
-//** CELL VOLUME function:  Calculates the unit cell volume               **
+//** MAP ADD function:  Adds a constant, or the variable in the memory    **
+//**    location, to a map in/out of a mask.                              **
 //**************************************************************************
 
-float cell_volume(float A, float B, float C, float a, float b, float c)
+void MapMult(int map1, int zone, int msk1, float value)
    {
-   return   (2*A*B*C) * pow(  (  (sin((+a+b+c)*PI/360))   *
-                                 (sin((-a+b+c)*PI/360))   *
-                                 (sin((+a-b+c)*PI/360))   *
-                                 (sin((+a+b-c)*PI/360))     ), 0.5);
+
+   register int   countz;
+   register int   county;
+   register int   countx;
+
+   register long  LOC;
+
+   register int   zone2;
+
+   const vector<uint32_t> *at;
+
+   if (zone == 0) zone2 = 1;
+   if (zone == 1) zone2 = 0;
+   if (zone == 2) zone2 = 2;
+
+   // ********** MULTIPLY MAP1 BY CONSTANT VALUE IN/OUT OF MSK1 ************
+
+   if ((zone2 != 2) && (at = MskList(msk1, zone2)))
+      {                                            // Just the voxels of
+      for (LOC = 0; LOC < (long) at->size(); LOC ++)  //    the zone
+         MAP[(*at)[LOC] + (map1 * XYZ_LIM)] =
+            MAP[(*at)[LOC] + (map1 * XYZ_LIM)] * value;
+      }
+   else
+   for (countz = 1; countz <= Z_LIM; countz ++)
+      for (county = 1; county <= Y_LIM; county ++)
+         for (countx = 1; countx <= X_LIM; countx ++)
+            {
+            LOC = ((countx - 1)          ) +
+                  ((county - 1) * X_LIM  ) +
+                  ((countz - 1) * XY_LIM );
+
+            if ( (zone2 != 2) &&
+                 (MSK[LOC + (msk1 * XYZ_LIM)] == zone2) )
+               continue;
+
+            MAP[LOC + (map1 * XYZ_LIM)] =
+               MAP[LOC + (map1 * XYZ_LIM)] * value;
+            }
+
+   if (zone != 2) map_symm[map1] = 0;            // Masks break symmetry
+
+   MapTouch(map1);
+
+   return;
+
    }
 
 //**************************************************************************
-//** KEYS function:  Displays control keys and arguments in a list.       **
+//** STREAM PASS function:  One pass over the maps and masks on disk in   **
+//**    slabs of stream_sec Z sections.  While a slab is processed the    **
+//**    next one is read in the background.  Each slab is handed to the   **
+//**    ordinary map functions by pointing MAP, MSK, Z_LIM and XYZ_LIM at **
+//**    the slab, with N sections of periodic halo on each side for the   **
+//**    stencil operations.  The changed map is written to a scratch file **
+//**    (or from the current offset of fd for WRITE and MASKO).           **
 //**************************************************************************
 
-void Keys()
+long  StreamPass(int op, int map1, int map2, int map3, int zone, int msk1,
+                 float value1, float value2, int N, stat_sum *acc, int fd)
    {
-   cout 
-   << "   KEYS  => HELP                          KEYS\n"
-   << "   KEYS  => LIST                          \n"
-   << "   KEYS  =>\n"
-   << "   KEYS  => MAPIN X1 'name'               MASKI X2 'name'\n"
-   << "   KEYS  => NAME {type}{loc} 'name'\n"
-   << "   KEYS  =>\n"
-   << "   KEYS  => MAXMS Y1 Y2 Y3                MINMS Y1 Y2 Y3\n"
-   << "   KEYS  => FLIP  Y1 Y2\n"
-   << "   KEYS  =>\n"
-   << "   KEYS  => PDBIN {num}{len} P1 'name'    PDBOU P1 'name'\n"
-   << "   KEYS  => PDBDA P1 'name'               OCCUP P1 X1\n" 
-   << "   KEYS  =>\n"
-   << "   KEYS  => RFAC X1 X2 IN/OUT/TOTAL Y1    RMS X1 IN/OUT/TOTAL Y1\n"
-   << "   KEYS  => SMEAR X1 X2 X3 N              MAXOF X1 X2 X3\n"
-   << "   KEYS  => SCALE X1 Y1 IN/OUT X2         ZERO X1 IN/OUT X2\n"
-   << "   KEYS  => ADD X1 Y1 IN/OUT X2           SUB X1 Y1 IN/OUT X2\n"
-   << "   KEYS  => COMB X1 Y1 IN/OUT/TOTAL X2 F  CUT X1 IN/OUT X2 MIN MAX\n"
-   << "   KEYS  => AVG X1 IN/OUT                 NEG\n"
-   << "   KEYS  => PLUS X1 IN/OUT X2 VALUE/F     MULT X1 IN/OUT/TOTAL X2 F\n"
-   << "   KEYS  =>\n"
-   << "   KEYS  => WRITE X1 'name'               END, QUIT, STOP, EXIT\n"
-   << "   KEYS  =>\n"
-   << "   KEYS  => GRAY 'name' n X1 X1Start X1Step ... Xn XnStart XnStep\n"
-   << "   KEYS  =>    x1 x2 y1 y2 z1 z2\n";
-   return;
+
+   register int   count1;
+   register int   count2;
+
+   register long  LOC;
+
+   int      in[4];                         // Locations read from disk
+   int      nin   = 0;
+   int      out   = -1;                    // Location written to disk
+   int      halo  = 0;
+   int      elem;
+   int      nslab;
+   int      nz;
+   int      cur;
+
+   long     total = 0;
+   long     slab;
+   long     first;
+   long     last;
+   long     out_off = 0;
+
+   str_load job[2];
+
+   pthread_t thread;
+
+   float    *map_save  = MAP;
+   char     *msk_save  = MSK;
+   int      z_save     = Z_LIM;
+   long     xyz_save   = XYZ_LIM;
+
+   streambuf *cout_save;
+
+   switch (op)
+      {
+      case S_STAT:  in[nin++] = map1;
+                    if (map2 >= 0) in[nin++] = map2;
+                    break;
+      case S_ZERO:
+      case S_CUT:
+      case S_ADD:
+      case S_MULT:  in[nin++] = map1;  out = map1;          break;
+      case S_MOD:   in[nin++] = map1;  in[nin++] = map2;
+                    out = map1;                             break;
+      case S_SMEAR:
+      case S_ROUGH: in[nin++] = map1;  out = map2;
+                    halo = N;                               break;
+      case S_COPY:  in[nin++] = map1;  out = map1;          break;
+      default:      return 0;
+      }
+
+   if ((zone != 2) && (op != S_SMEAR) && (op != S_ROUGH) && (op != S_COPY))
+      in[nin++] = map_mem + msk1;
+
+   // ************* SLAB BUFFERS FOR ALL LOCATIONS, TWO OF EACH ************
+
+   slab = XY_LIM * (stream_sec + 2*halo);
+
+   for (cur = 0; cur <= 1; cur ++)
+      {
+      job[cur].map = NULL;
+      job[cur].msk = NULL;
+
+      if (posix_memalign((void **) &job[cur].map, 4096,
+                         slab * map_mem * sizeof(float))                   ||
+          posix_memalign((void **) &job[cur].msk, 4096, slab * msk_mem) )
+         {
+         cout  << "\nINSUFFICIENT MEMORY!!!\n";
+         free(job[0].map);   free(job[0].msk);
+         free(job[1].map);   free(job[1].msk);
+         return 0;
+         }
+
+      job[cur].nslot = nin;
+      job[cur].zlim  = Z_LIM;
+
+      for (count1 = 0; count1 < nin; count1 ++)
+         {
+         job[cur].slot[count1] = in[count1];
+         job[cur].off[count1]  = str_off[in[count1]];
+         job[cur].fd[count1]   = -1;
+
+         if (str_file[in[count1]][0])
+            job[cur].fd[count1] = open(str_file[in[count1]], O_RDONLY);
+         }
+      }
+
+   if (out >= 0 && fd < 0)                     // New scratch file for output
+      fd = StreamScratch(out);
+
+   if (out >= 0 && fd >= 0)
+      out_off = lseek(fd, 0, SEEK_CUR);
+
+   if (out >= 0 && fd < 0)
+      {
+      cout  << "   STREAM=> CANNOT OPEN SCRATCH FILE!\n";
+      out = -1;
+      nslab = 0;
+      }
+   else
+      nslab = (Z_LIM + stream_sec - 1) / stream_sec;
+
+   job[0].z0 = -halo;
+   job[0].nz = Min(stream_sec, Z_LIM) + 2*halo;
+
+   if (nslab) StreamLoad(&job[0]);
+
+   // ********************** PROCESS SLAB BY SLAB **************************
+
+   for (count1 = 0; count1 < nslab; count1 ++)
+      {
+
+      cur = count1 % 2;
+
+      if (count1 + 1 < nslab)                 // Prefetch the next slab
+         {
+         job[1-cur].z0 = (count1 + 1) * stream_sec - halo;
+         job[1-cur].nz = Min(stream_sec, Z_LIM - (count1+1)*stream_sec)
+                         + 2*halo;
+
+         if (pthread_create(&thread, NULL, StreamLoad, &job[1-cur]))
+            StreamLoad(&job[1-cur]);
+         }
+
+      nz = job[cur].nz - 2*halo;
+
+      MAP     = job[cur].map;
+      MSK     = job[cur].msk;
+      Z_LIM   = job[cur].nz;
+      XYZ_LIM = XY_LIM * Z_LIM;
+
+      first   = halo * XY_LIM;
+      last    = first + nz * XY_LIM;
+
+      cout_save = cout.rdbuf(NULL);            // Silence per slab output
+
+      switch (op)
+         {
+         case S_STAT:  SlabStat(&acc[0], map1, zone, msk1, first, last);
+
+                       if (map2 < 0) break;
+
+                       SlabStat(&acc[1], map2, zone, msk1, first, last);
+
+                       for (LOC = first; LOC < last; LOC ++)
+                          {
+                          if ( (zone != 2) &&
+                               (MSK[LOC + (msk1 * XYZ_LIM)] == (zone == 0)) )
+                             continue;
+
+                          acc[2].tot = acc[2].tot + 
+                             fabs(MAP[LOC + (map1 * XYZ_LIM)] -
+                                  MAP[LOC + (map2 * XYZ_LIM)]);
+                          }
+                       break;
+
+         case S_ZERO:  total = total + Zero(map1, zone, msk1);          break;
+         case S_CUT:   total = total + Cut(map1, zone, msk1, value1, value2);
+                                                                        break;
+         case S_MOD:   MapMod (map1, map2, zone, msk1, value1);         break;
+         case S_ADD:   MapAdd (map1, zone, msk1, value1);               break;
+         case S_MULT:  MapMult(map1, zone, msk1, value1);               break;
+         case S_SMEAR: Smear  (map1, map2, map3, N);                    break;
+         case S_ROUGH: Rough  (map1, map2, N);                          break;
+
+         case S_COPY:  if (map1 < map_mem) break;
+
+                       for (LOC = first; LOC < last; LOC ++)
+                          total = total + MSK[LOC + ((map1-map_mem) * XYZ_LIM)];
+                       break;
+         }
+
+      cout.rdbuf(cout_save);
+      cout.clear();
+
+      // ******************* WRITE THE SLAB BACK TO DISK ********************
+
+      if (out >= 0)
+         {
+         elem = (out < map_mem) ? sizeof(float) : sizeof(char);
+
+         if (out < map_mem)
+            LOC = pwrite(fd, MAP + (out * XYZ_LIM) + first, nz * XY_LIM * elem,
+                         out_off + (count1 * stream_sec * XY_LIM * elem));
+         else
+            LOC = pwrite(fd, MSK + ((out-map_mem) * XYZ_LIM) + first,
+                         nz * XY_LIM * elem,
+                         out_off + (count1 * stream_sec * XY_LIM * elem));
+
+         if (LOC != nz * XY_LIM * elem)
+            cout  << "   STREAM=> WRITE FAILED AT SECTION "
+                  << (count1 * stream_sec + 1) << " !!!\n";
+         }
+
+      MAP     = map_save;
+      MSK     = msk_save;
+      Z_LIM   = z_save;
+      XYZ_LIM = xyz_save;
+
+      if (count1 + 1 < nslab)
+         pthread_join(thread, NULL);
+      }
+
+   for (cur = 0; cur <= 1; cur ++)
+      {
+      for (count2 = 0; count2 < nin; count2 ++)
+         if (job[cur].fd[count2] >= 0) close(job[cur].fd[count2]);
+
+      free(job[cur].map);
+      free(job[cur].msk);
+      }
+
+   if (out >= 0 && op != S_COPY)
+      close(fd);
+
+   return total;
+
+   }
+
+//**************************************************************************
+//** STREAM LOAD function:  Reads the sections of one slab for every      **
+//**    location in the job, wrapping periodically at the map edges.      **
+//**    Locations without a backing file read as zero.                    **
+//**************************************************************************
+
+void  *StreamLoad(void *arg)
+   {
+
+   str_load *job = (str_load *) arg;
+
+   int      count1;
+   int      count2;
+   int      slot;
+   int      elem;
+   int      run;
+   int      z;
+
+   long     slab  = XY_LIM * job->nz;
+   long     want;
+   long     got;
+
+   char     *dest;
+
+   for (count1 = 0; count1 < job->nslot; count1 ++)
+      {
+      slot = job->slot[count1];
+
+      if (slot < map_mem)
+         {
+         elem = sizeof(float);
+         dest = (char *) (job->map + (slot * slab));
+         }
+      else
+         {
+         elem = sizeof(char);
+         dest = job->msk + ((slot - map_mem) * slab);
+         }
+
+      if (job->fd[count1] < 0)
+         {
+         memset(dest, 0, slab * elem);
+         continue;
+         }
+
+      for (count2 = 0; count2 < job->nz; count2 += run)
+         {
+         z   = (((job->z0 + count2) % job->zlim) + job->zlim) % job->zlim;
+         run = job->zlim - z;
+         if (run > job->nz - count2) run = job->nz - count2;
+
+         want = run * XY_LIM * elem;
+         got  = pread(job->fd[count1], dest + (count2 * XY_LIM * elem), want,
+                      job->off[count1] + (z * XY_LIM * elem));
+
+         if (got < 0) got = 0;                 // Short file reads as zero
+         if (got < want)
+            memset(dest + (count2 * XY_LIM * elem) + got, 0, want - got);
+         }
+      }
+
+   return NULL;
+
+   }
+
+//**************************************************************************
+//** SLAB STATISTICS function:  Adds the pixels of map1 in/out of msk1    **
+//**    between first and last in the current slab to acc.  The slab     **
+//**    mean and squared deviations are found first and then merged, so  **
+//**    the variance does not depend on the slab size.                    **
+//**************************************************************************
+
+void  SlabStat(stat_sum *acc, int map1, int zone, int msk1,
+               long first, long last)
+   {
+
+   register long  LOC;
+
+   register float val;
+
+   long     num   = 0;
+   double   tot   = 0;
+   double   var   = 0;
+   double   mean;
+   double   delta;
+
+   for (LOC = first; LOC < last; LOC ++)
+      {
+      if ( (zone != 2) &&
+           (MSK[LOC + (msk1 * XYZ_LIM)] == (zone == 0)) )
+         continue;
+
+      val = MAP[LOC + (map1 * XYZ_LIM)];
+
+      if (val > acc->max) acc->max = val;
+      if (val < acc->min) acc->min = val;
+
+      tot = tot + val;
+      num ++;
+      }
+
+   if (!num) return;
+
+   mean = tot / num;
+
+   for (LOC = first; LOC < last; LOC ++)
+      {
+      if ( (zone != 2) &&
+           (MSK[LOC + (msk1 * XYZ_LIM)] == (zone == 0)) )
+         continue;
+
+      val = MAP[LOC + (map1 * XYZ_LIM)];
+      var = var + ((val - mean) * (val - mean));
+      }
+
+   if (acc->num)
+      {
+      delta    = mean - (acc->tot / acc->num);
+      var      = var + (delta * delta * acc->num * num) / (acc->num + num);
+      }
+
+   acc->var = acc->var + var;
+   acc->tot = acc->tot + tot;
+   acc->num = acc->num + num;
+
+   return;
+
+   }
+
+//**************************************************************************
+//** STREAM STATISTICS function:  Finds the maximum, minimum, total,      **
+//**    average and RMS of map1 (and map2 if it is not -1) in/out of msk1 **
+//**    in one pass, and returns the sum of map1-map2 pixel differences.  **
+//**************************************************************************
+
+double StreamStat(int map1, int map2, int zone, int msk1)
+   {
+
+   int      count1;
+   int      map;
+
+   stat_sum acc[3];
+
+   for (count1 = 0; count1 <= 2; count1 ++)
+      {
+      acc[count1].num = 0;
+      acc[count1].tot = 0;
+      acc[count1].var = 0;
+      acc[count1].max = -1000;
+      acc[count1].min = +1000;
+      }
+
+   StreamPass(S_STAT, map1, map2, 0, zone, msk1, 0, 0, 0, acc, -1);
+
+   for (count1 = 0; count1 <= 1; count1 ++)
+      {
+      map = count1 ? map2 : map1;
+
+      if (map < 0) continue;
+
+      map_max[map][zone] = acc[count1].max;
+      map_min[map][zone] = acc[count1].min;
+      map_num[map][zone] = acc[count1].num;
+      map_avg[map][zone] = acc[count1].tot / (acc[count1].num * 1.0);
+      map_tot[map][zone] = acc[count1].tot * map_vol / (XYZ_LIM * 1.0);
+      map_var[map][zone] = acc[count1].var / acc[count1].num;
+      map_rms[map][zone] = sqrt(map_var[map][zone]);
+
+      if (zone == 2)
+         {
+         MAP_H[map].AMAX     = map_max[map][zone];
+         MAP_H[map].AMIN     = map_min[map][zone];
+         MAP_H[map].AMEAN    = map_avg[map][zone];
+         MAP_H[map].REST[30] = map_rms[map][zone];
+         }
+      }
+
+   return acc[2].tot;
+
+   }
+
+//**************************************************************************
+//** STREAM SCALE function:  SCALE with the maps left on disk.            **
+//**************************************************************************
+
+float StreamScale(int map1, int map2, int zone, int msk1)
+   {
+
+   float    scale;
+
+   StreamStat(map1, map2, zone, msk1);
+
+   cout << "   SCALE => Average for map 1 is " << map_avg[map1][zone] << "\n";
+   cout << "   SCALE => Average for map 2 is " << map_avg[map2][zone] << "\n";
+
+   scale = (map_avg[map2][zone]/map_avg[map1][zone]);
+
+   StreamPass(S_MULT, map1, 0, 0, 2, 0, scale, 0, 0, NULL, -1);
+
+   return scale;
+
+   }
+
+//**************************************************************************
+//** STREAM WRITE function:  Copies a map or mask location (slot is its   **
+//**    MAP_H number) slab by slab to file.  For masks the fraction of    **
+//**    pixels in the mask is returned.                                   **
+//**************************************************************************
+
+float StreamWrite(const char *file, int slot)
+   {
+
+   FILE     *write1;
+
+   long     sum;
+
+   if (ZipType(file, 1))                           // Written with pwrite
+      {
+      cout << ((slot < map_mem) ? "   WRITE =>" : "   MASKO =>")
+           << " Compressed output is not streamed.\n";
+      return -1;
+      }
+
+   if ((write1 = fopen(file, "wb")) == NULL)        // Write failure
+      return -1;
+
+   if (slot < map_mem) WriteHead(write1, 0);
+   else                WriteHead(write1, map_mem + 0);
+
+   fflush(write1);                             // Voxels follow the header
+
+   sum = StreamPass(S_COPY, slot, 0, 0, 2, 0, 0, 0, 0, NULL, fileno(write1));
+
+   fclose(write1);
+
+   if (slot < map_mem) return 0;
+
+   cout  << "   MASKO => Total pixels in mask are " << XYZ_LIM << "\n";
+   cout  << "   MASKO => Pixels with value 1 =>   " << sum << "\n";
+   cout  << "   MASKO => Pixels with value 0 =>   " << (XYZ_LIM - sum) << "\n";
+
+   return ((sum * 1.0) / (XYZ_LIM * 1.0));
+
+   }
+
+//**************************************************************************
+//** STREAM FILE function:  Makes file (voxels starting at offset) the    **
+//**    backing file of location slot, removing any old scratch file.    **
+//**************************************************************************
+
+int   StreamFile(const char *file, int slot, long offset)
+   {
+
+   if (str_tmp[slot]) unlink(str_file[slot]);
+
+   snprintf(str_file[slot], sizeof(str_file[slot]), "%s", file);
+
+   str_off[slot] = offset;
+   str_tmp[slot] = 0;
+
+   return 0;
+
+   }
+
+//**************************************************************************
+//** STREAM SCRATCH function:  Opens a new scratch file for location slot **
+//**    with the header of the principal map (or first mask).  The old    **
+//**    backing file stays readable until the pass is over, because the   **
+//**    open descriptors of the pass keep it alive after the unlink.      **
+//**************************************************************************
+
+int   StreamScratch(int slot)
+   {
+
+   char     name[256];
+   const char *dir = getenv("TMPDIR");
+
+   FILE     *write1;
+
+   long     offset;
+
+   int      fd;
+
+   if (!dir) dir = ".";
+
+   stream_num ++;
+
+   snprintf(name, sizeof(name), "%s/RsRf.%d.%d.%d",
+            dir, (int) getpid(), slot, stream_num);
+
+   if ((write1 = fopen(name, "w+b")) == NULL)
+      return -1;
+
+   if (slot < map_mem) WriteHead(write1, 0);
+   else                WriteHead(write1, map_mem + 0);
+
+   fflush(write1);
+
+   offset = ftell(write1);
+
+   StreamFile(name, slot, offset);
+
+   str_tmp[slot] = 1;
+
+   fd = dup(fileno(write1));
+
+   fclose(write1);
+
+   return fd;
+
+   }
+
+//**************************************************************************
+//** STREAM CLEAN function:  Removes all scratch files.  Called on exit.  **
+//**************************************************************************
+
+void  StreamClean()
+   {
+
+   int      count1;
+
+   for (count1 = 0; count1 < 21; count1 ++)
+      if (str_tmp[count1])
+         {
+         unlink(str_file[count1]);
+         str_tmp[count1] = 0;
+         }
+
+   return;
+
+   }
+
+//**************************************************************************
+//** NO STREAM function:  Returns 1 (and says so) if a keyword cannot be  **
+//**    used in streaming mode.  Keywords match by prefix, as in the main **
+//**    loop, so a longer keyword that starts like a streamed one         **
+//**    (CUTSWEEP, like CUT) is refused first.                            **
+//**************************************************************************
+
+int   NoStream(const char *input)
+   {
+
+   int      count1;
+
+   const char *keys[] = { "HELP" , "KEYS" , "LIST" , "MAPIN", "MASKI",
+                          "SCALE", "RFAC" , "RMS"  , "SMEAR", "ZERO" ,
+                          "CUT"  , "ADD"  , "SUB"  , "COMB" , "AVG"  ,
+                          "PLUS" , "MULT" , "ROUG" , "NEG"  , "NAME" ,
+                          "WRITE", "MASKO", "END"  , "QUIT" , "STOP" ,
+                          "EXIT" , "SHUTD", "BRICK", NULL };
+
+   const char *whole[] = { "CUTSW", NULL };
+
+   for (count1 = 0; whole[count1]; count1 ++)
+      if (!(strncmp(input, whole[count1], strlen(whole[count1]))))
+         break;
+
+   if (!whole[count1])
+      for (count1 = 0; keys[count1]; count1 ++)
+         if (!(strncmp(input, keys[count1], strlen(keys[count1]))))
+            return 0;
+
+   cout  << "   MAIN  => " << input
+         << " is not available in streaming mode.\n";
+
+   return 1;
+
+   }
+
+//**************************************************************************
+//** SHARED MAP function:  Puts the voxels of map file in memory location **
+//**    map1 from a POSIX shared memory segment (/dev/shm/rsrf-<hash> of  **
+//**    the file name, size and date).  The first process to ask loads    **
+//**    the segment, the others wait for it.  The segment pages are then  **
+//**    mapped copy-on-write over the location, so all processes on a     **
+//**    node share one copy until a map is changed.  Pages only line up   **
+//**    for the same location as the loader used; other locations copy.  **
+//**    Returns 0 on success, 1 to load the map the ordinary way.         **
+//**************************************************************************
+
+int   ShmMap(const char *file, FILE *read1, int map1)
+   {
+
+   char     path[PATH_MAX];
+   char     name[64];
+
+   struct stat info;
+
+   shm_ctl  *ctl;
+
+   int      fd;
+   int      count1;
+   int      ready = 0;
+
+   long     page  = sysconf(_SC_PAGESIZE);
+   long     bytes = XYZ_LIM * sizeof(float);
+   long     start = ftell(read1);
+   long     data;
+   long     size;
+   long     head;
+   long     body;
+
+   uint64_t hash  = 14695981039346656037ULL;        // FNV-1a
+
+   char     *slot = (char *) (MAP + (map1 * XYZ_LIM));
+   char     *base;
+
+   if (!realpath(file, path) || stat(path, &info))
+      return 1;
+
+   for (count1 = 0; path[count1]; count1 ++)
+      hash = (hash ^ (unsigned char) path[count1]) * 1099511628211ULL;
+
+   hash = (hash ^ info.st_size)  * 1099511628211ULL;
+   hash = (hash ^ info.st_mtime) * 1099511628211ULL;
+   hash = (hash ^ XYZ_LIM)       * 1099511628211ULL;
+
+   snprintf(name, sizeof(name), "/rsrf-%016llx", (unsigned long long) hash);
+
+   // ************* FIRST PROCESS LOADS THE SEGMENT ************************
+
+   data = page + ((uintptr_t) slot % page);         // Same page offset as
+   size = data + bytes;                             //    the location
+
+   fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+
+   if (fd >= 0)
+      {
+      cout  << "   MAPIN => Loading shared map " << name << "\n";
+
+      if (ftruncate(fd, size) ||
+          (base = (char *) mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                MAP_SHARED, fd, 0)) == MAP_FAILED)
+         {
+         close(fd);
+         shm_unlink(name);
+         return 1;
+         }
+
+      ctl = (shm_ctl *) base;
+
+      if (fread(base + data, sizeof(float), XYZ_LIM, read1) !=
+          (size_t) XYZ_LIM)
+         {
+         munmap(base, size);
+         close(fd);
+         shm_unlink(name);
+         fseek(read1, start, SEEK_SET);
+         return 1;
+         }
+
+      ctl->magic = SHM_MAGIC;
+      ctl->nvox  = XYZ_LIM;
+      ctl->data  = data;
+
+      __atomic_store_n(&ctl->ready, 1, __ATOMIC_RELEASE);
+
+      munmap(base, size);
+      }
+
+   else if (errno == EEXIST)                        // Made by someone else
+      {
+      if ((fd = shm_open(name, O_RDONLY, 0)) < 0)
+         return 1;
+
+      for (count1 = 0; (count1 < 6000) && !ready; count1 ++)
+         {                                          // Wait up to a minute
+         if (count1) usleep(10000);                 //    for the loader
+
+         if (fstat(fd, &info) || (info.st_size < (off_t) sizeof(shm_ctl)))
+            continue;
+
+         base = (char *) mmap(NULL, sizeof(shm_ctl), PROT_READ,
+                              MAP_SHARED, fd, 0);
+         if (base == MAP_FAILED) break;
+
+         ctl  = (shm_ctl *) base;
+         data = ctl->data;
+
+         if (__atomic_load_n(&ctl->ready, __ATOMIC_ACQUIRE))
+            ready = ((ctl->magic == SHM_MAGIC) && (ctl->nvox == XYZ_LIM)) ?
+                    1 : -1;
+
+         munmap(base, sizeof(shm_ctl));
+         }
+
+      if (ready != 1)
+         {
+         cout  << "   MAPIN => Shared map " << name << " is not usable.\n";
+         close(fd);
+         return 1;
+         }
+
+      size = data + bytes;
+      }
+
+   else return 1;
+
+   // ************* MAP THE SEGMENT COPY-ON-WRITE OVER THE LOCATION ********
+
+   head = (page - ((uintptr_t) slot % page)) % page;
+   body = ((bytes - head) / page) * page;
+
+   base = (char *) mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+   if (base == MAP_FAILED)
+      {
+      close(fd);
+      return 1;
+      }
+
+   if ( ((data + head) % page) ||                  // Pages do not line up
+        (body <= 0)            ||
+        (mmap(slot + head, body, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_FIXED, fd, data + head) == MAP_FAILED) )
+      {
+      memcpy(slot, base + data, bytes);
+      cout  << "   MAPIN => Shared map " << name << " copied.\n";
+      }
+   else
+      {
+      memcpy(slot, base + data, head);
+      memcpy(slot + head + body, base + data + head + body,
+             bytes - head - body);
+      cout  << "   MAPIN => Shared map " << name << " attached.\n";
+      }
+
+   munmap(base, size);
+   close(fd);
+
+   return 0;
+
+   }
+
+//**************************************************************************
+//** SYMMETRY PARSE function:  Reads one operator such as "-X+1/2,-Y,Z"  **
+//**    (as in MTZ SYMM records and CCP4 symop.lib) into op.  Returns 1   **
+//**    if the text is not an operator.                                   **
+//**************************************************************************
+
+int   SymParse(const char *text, sym_op *op)
+   {
+
+   int      row  = 0;
+   int      sign = 1;
+   int      axis;
+
+   float    num;
+   float    den;
+
+   char     *end;
+
+   memset(op, 0, sizeof(sym_op));
+
+   for (; *text && (row < 3); text ++)
+      {
+      axis = toupper(*text) - 'X';
+
+      if      (*text == ',')  { row ++;  sign = 1; }
+      else if (*text == '-')  sign = -1;
+      else if (*text == '+')  sign = +1;
+      else if ((axis >= 0) && (axis <= 2))
+         {
+         op->R[row][axis] = sign;
+         sign = 1;
+         }
+      else if (isdigit(*text) || (*text == '.'))
+         {
+         num = strtod(text, &end);
+         den = 1;
+         if (*end == '/') den = strtod(end + 1, &end);
+         if (den == 0) return 1;
+
+         op->t[row] += sign * num / den;
+         sign = 1;
+         text = end - 1;
+         }
+      else if (!isspace(*text))
+         return 1;
+      }
+
+   return (row != 2);
+
+   }
+
+//**************************************************************************
+//** READ MTZ function:  Reads the reflections, column labels, cell and   **
+//**    symmetry operators of an MTZ file into mtz_last.  The last file   **
+//**    read is kept, so maps with other coefficients from the same file  **
+//**    need no second read.  Returns 1 on failure.                       **
+//**************************************************************************
+
+int   ReadMTZ(const char *file)
+   {
+
+   struct stat info;
+
+   vector<char> raw;
+
+   FILE     *read1;
+
+   char     line[81];
+   char     word[81];
+
+   long     hloc;
+   long     count;
+   long     size;
+
+   int      swap;
+   int      zip;
+   int      head;
+
+   sym_op   op;
+
+   if (stat(file, &info))
+      return 1;
+
+   if ((mtz_last.file == file) && (mtz_last.mtime == info.st_mtime) &&
+       (mtz_last.size  == info.st_size))
+      {
+      cout  << "   MTZIN => " << file << " already in memory.\n";
+      return 0;
+      }
+
+   mtz_last.file.clear();
+   mtz_last.label.clear();
+   mtz_last.data.clear();
+   mtz_last.sym.clear();
+
+   if ((read1 = ZipOpen(file, "rb", &zip)) == NULL)
+      return 1;
+
+   raw.resize(1 << 16);
+
+   for (size = 0; (count = fread(&raw[size], 1, raw.size() - size, read1)) > 0;)
+      if ((size += count) == (long) raw.size())
+         raw.resize(2 * raw.size());
+
+   ZipClose(read1, zip, 0);
+
+   if ((size < 80) || strncmp(&raw[0], "MTZ ", 4))
+      return 1;
+
+   swap = ((raw[8] & 0xf0) == 0x10);              // Big endian file
+
+   memcpy(&head, &raw[4], 4);                     // Header start, in words
+   if (swap) swap4((unsigned char *) &head);
+
+   hloc = (head - 1) * 4L;
+
+   if ((hloc < 80) || (hloc > size))
+      return 1;
+
+   mtz_last.ncol = 0;
+   mtz_last.nref = 0;
+   mtz_last.valm = 0;
+   mtz_last.nan  = 1;
+
+   for (count = hloc; count + 80 <= size; count += 80)
+      {
+      memcpy(line, &raw[count], 80);
+      line[80] = '\0';
+
+      if      (!strncmp(line, "END ", 4))
+         break;
+      else if (!strncmp(line, "NCOL", 4))
+         sscanf(line + 4, "%d %ld", &mtz_last.ncol, &mtz_last.nref);
+      else if (!strncmp(line, "CELL", 4))
+         sscanf(line + 4, "%f %f %f %f %f %f",
+                &mtz_last.cell[0], &mtz_last.cell[1], &mtz_last.cell[2],
+                &mtz_last.cell[3], &mtz_last.cell[4], &mtz_last.cell[5]);
+      else if (!strncmp(line, "SYMM", 4) && !SymParse(line + 4, &op))
+         mtz_last.sym.push_back(op);
+      else if (!strncmp(line, "VALM", 4) && (sscanf(line + 4, "%s", word) == 1))
+         {
+         mtz_last.nan  = !strncmp(word, "NAN", 3);
+         mtz_last.valm = atof(word);
+         }
+      else if (!strncmp(line, "COLUMN", 6) && (sscanf(line + 6, "%s", word) == 1))
+         mtz_last.label.push_back(word);
+      }
+
+   if ((mtz_last.ncol < 4) || ((long) mtz_last.label.size() != mtz_last.ncol) ||
+       (80 + mtz_last.ncol * mtz_last.nref * 4 > hloc))
+      return 1;
+
+   mtz_last.data.resize(mtz_last.ncol * mtz_last.nref);
+   memcpy(&mtz_last.data[0], &raw[80], mtz_last.data.size() * sizeof(float));
+
+   if (swap)
+      for (count = 0; count < (long) mtz_last.data.size(); count ++)
+         swap4((unsigned char *) &mtz_last.data[count]);
+
+   if (mtz_last.sym.empty())                      // P1
+      {
+      SymParse("X,Y,Z", &op);
+      mtz_last.sym.push_back(op);
+      }
+
+   mtz_last.file  = file;
+   mtz_last.mtime = info.st_mtime;
+   mtz_last.size  = info.st_size;
+
+   cout  << "   MTZIN => " << mtz_last.nref << " reflections, "
+         << mtz_last.ncol << " columns, "
+         << mtz_last.sym.size() << " symmetry operators.\n";
+
+   return 0;
+
+   }
+
+//**************************************************************************
+//** SWAP4 function:  Reverses the bytes of one four byte word.           **
+//**************************************************************************
+
+void  swap4(unsigned char *b)
+   {
+
+   unsigned char ch;
+
+   ch = b[0];  b[0] = b[3];  b[3] = ch;
+   ch = b[1];  b[1] = b[2];  b[2] = ch;
+
+   }
+
+//**************************************************************************
+//** FFT function:  One mixed radix complex transform of length n (any    **
+//**    n, fastest for products of 2, 3, 5 and 7), recursive decimation  **
+//**    in time.  in is read with stride, out is contiguous.  tw holds    **
+//**    exp(sign 2 pi i j / N) for the top level length N, and tmp is at  **
+//**    least as long as the largest prime factor.                        **
+//**************************************************************************
+
+void  FFT(const cplx *in, long stride, cplx *out, int n, int step,
+          const cplx *tw, int N, cplx *tmp)
+   {
+
+   int      p;
+   int      m;
+   int      r;
+   int      q;
+   int      k;
+
+   cplx     sum;
+
+   if (n == 1)
+      {
+      out[0] = in[0];
+      return;
+      }
+
+   for (p = 2; (p * p <= n) && (n % p); p ++) ;    // Smallest factor
+   if (n % p) p = n;
+
+   m = n / p;
+
+   for (r = 0; r < p; r ++)
+      FFT(in + r * stride, stride * p, out + r * m, m, step * p, tw, N, tmp);
+
+   for (k = 0; k < m; k ++)                        // p point butterflies
+      {
+      for (r = 0; r < p; r ++)
+         tmp[r] = out[r * m + k] * tw[((long) r * k * step) % N];
+
+      for (q = 0; q < p; q ++)
+         {
+         sum = tmp[0];
+         for (r = 1; r < p; r ++)
+            sum += tmp[r] * tw[((long) r * q * m * step) % N];
+         out[k + q * m] = sum;
+         }
+      }
+
+   }
+
+//**************************************************************************
+//** FFT LINES function:  Thread body for FFT3.  Transforms every nth    **
+//**    line of one axis of the half complex grid.  Axis 0 turns each    **
+//**    Hermitian row into real density.                                 **
+//**************************************************************************
+
+void  *FftLines(void *arg)
+   {
+
+   fft_job  *job = (fft_job *) arg;
+
+   int      NX   = job->n[0];
+   int      NY   = job->n[1];
+   int      NZ   = job->n[2];
+   int      NH   = NX / 2 + 1;
+   int      len  = job->n[job->axis];
+
+   long     line;
+   long     lines;
+   long     base;
+   long     stride;
+   long     count1;
+
+   vector<cplx> in (len);
+   vector<cplx> out(len);
+   vector<cplx> tmp(len);
+
+   const cplx *tw = job->tw[job->axis];
+
+   if      (job->axis == 2)  lines = (long) NH * NY;
+   else if (job->axis == 1)  lines = (long) NH * NZ;
+   else                      lines = (long) NY * NZ;
+
+   for (line = job->tid; line < lines; line += job->nth)
+      {
+      if (job->axis == 2)                          // Along L, for each h k
+         {
+         base   = line;
+         stride = (long) NH * NY;
+         }
+      else if (job->axis == 1)                     // Along K, for each h z
+         {
+         base   = (line / NH) * NH * NY + (line % NH);
+         stride = NH;
+         }
+      else                                         // Along H, for each y z
+         {
+         base   = line * NH;
+         stride = 1;
+         }
+
+      if (job->axis)
+         {
+         FFT(job->A + base, stride, &out[0], len, 1, tw, len, &tmp[0]);
+         for (count1 = 0; count1 < len; count1 ++)
+            job->A[base + count1 * stride] = out[count1];
+         }
+      else                                         // F(-h) = F(h)*
+         {
+         for (count1 = 0; count1 < len; count1 ++)
+            in[count1] = (count1 < NH) ? job->A[base + count1]
+                                       : conj(job->A[base + len - count1]);
+
+         FFT(&in[0], 1, &out[0], len, 1, tw, len, &tmp[0]);
+
+         for (count1 = 0; count1 < len; count1 ++)
+            job->rho[line * NX + count1] = out[count1].real();
+         }
+      }
+
+   return NULL;
+
+   }
+
+//**************************************************************************
+//** FFT3 function:  Real density rho[z][y][x] from the half complex      **
+//**    grid A[l][k][h] (h = 0 to NX/2), rho = sum F exp(-2 pi i h.x),    **
+//**    with the lines of each axis shared between threads.               **
+//**************************************************************************
+
+void  FFT3(cplx *A, float *rho, int NX, int NY, int NZ)
+   {
+
+   fft_job     job[16];
+   pthread_t   tid[16];
+
+   int         made[16];
+
+   vector<cplx> tw[3];
+
+   int         nth = sysconf(_SC_NPROCESSORS_ONLN);
+   int         n[3] = {NX, NY, NZ};
+   int         axis;
+   int         count1;
+
+   if (nth < 1)  nth = 1;
+   if (nth > 16) nth = 16;
+
+   for (axis = 0; axis <= 2; axis ++)
+      {
+      tw[axis].resize(n[axis]);
+      for (count1 = 0; count1 < n[axis]; count1 ++)
+         tw[axis][count1] = polar(1.0, -2 * M_PI * count1 / n[axis]);
+      }
+
+   for (axis = 2; axis >= 0; axis --)             // L, then K, then H
+      {
+      for (count1 = 0; count1 < nth; count1 ++)
+         {
+         job[count1].A     = A;
+         job[count1].rho   = rho;
+         job[count1].n[0]  = NX;
+         job[count1].n[1]  = NY;
+         job[count1].n[2]  = NZ;
+         job[count1].tw[0] = &tw[0][0];
+         job[count1].tw[1] = &tw[1][0];
+         job[count1].tw[2] = &tw[2][0];
+         job[count1].axis  = axis;
+         job[count1].tid   = count1;
+         job[count1].nth   = nth;
+         }
+
+      for (count1 = 1; count1 < nth; count1 ++)
+         if ((made[count1] = !pthread_create(&tid[count1], NULL, FftLines,
+                                             &job[count1])) == 0)
+            FftLines(&job[count1]);                // Do it here instead
+
+      FftLines(&job[0]);
+
+      for (count1 = 1; count1 < nth; count1 ++)
+         if (made[count1]) pthread_join(tid[count1], NULL);
+      }
+
+   }
+
+//**************************************************************************
+//** MTZ MAP function:  Calculates a map into location map1 from columns  **
+//**    fcol (amplitude) and pcol (phase, degrees) of an MTZ file, as the **
+//**    CCP4 program fft would:  rho(x) = 1/V sum |F| cos(2 pi h.x - phi) **
+//**    over every reflection of the sphere.  The reflections are first   **
+//**    expanded by the symmetry operators of the file and by Friedel's   **
+//**    law, then transformed on the grid of the principal map (NX, NY,   **
+//**    NZ).  The part of the unit cell covered by the principal map (its **
+//**    start, size and axis order) is put in map1.                       **
+//**************************************************************************
+
+int   MtzMap(const char *file, int map1, const char *fcol, const char *pcol)
+   {
+
+   int      N[3] = {MAP_H[0].NX, MAP_H[0].NY, MAP_H[0].NZ};
+   int      NH   = N[0] / 2 + 1;
+   int      col[5];
+   int      axis[3];
+   int      start[3];
+   int      g[3];
+   int      h[3];
+   int      hr[3];
+   int      count1;
+   int      count2;
+   int      count3;
+   int      mate;
+
+   long     ref;
+   long     used = 0;
+   long     lost = 0;
+   long     pix;
+
+   float    *rec;
+   float    val;
+   float    vol;
+   float    min  = +1e30;
+   float    max  = -1e30;
+
+   double   sum  = 0;
+   double   phi;
+
+   const char *want[5] = {"H", "K", "L", fcol, pcol};
+
+   cplx     F;
+
+   if (ReadMTZ(file))
+      {
+      cout  << "   MTZIN => Not a readable MTZ file.\n";
+      return 1;
+      }
+
+   for (count1 = 0; count1 <= 4; count1 ++)
+      {
+      for (col[count1] = 0; col[count1] < mtz_last.ncol; col[count1] ++)
+         if (mtz_last.label[col[count1]] == want[count1]) break;
+
+      if (col[count1] == mtz_last.ncol)
+         {
+         cout  << "   MTZIN => No column labelled " << want[count1] << ".\n";
+         return 1;
+         }
+      }
+
+   vector<cplx>  A((long) NH * N[1] * N[2]);
+   vector<float> rho((long) N[0] * N[1] * N[2]);
+
+   // ****** EXPAND TO THE WHOLE SPHERE AND FILL THE HALF GRID *************
+
+   for (ref = 0; ref < mtz_last.nref; ref ++)
+      {
+      rec = &mtz_last.data[ref * mtz_last.ncol];
+
+      if (isnan(rec[col[3]]) || isnan(rec[col[4]]) ||
+          (!mtz_last.nan && ((rec[col[3]] == mtz_last.valm) ||
+                             (rec[col[4]] == mtz_last.valm))))
+         continue;                                 // Missing
+
+      for (count1 = 0; count1 <= 2; count1 ++)
+         h[count1] = (int) lrint(rec[col[count1]]);
+
+      for (count1 = 0; count1 < (int) mtz_last.sym.size(); count1 ++)
+         {
+         const sym_op &op = mtz_last.sym[count1];
+
+         phi = rec[col[4]] * M_PI / 180;           // F(hR) = F(h) e(-2 pi i h.t)
+
+         for (count2 = 0; count2 <= 2; count2 ++)
+            {
+            hr[count2] = 0;
+            for (count3 = 0; count3 <= 2; count3 ++)
+               hr[count2] += h[count3] * op.R[count3][count2];
+            phi -= 2 * M_PI * h[count2] * op.t[count2];
+            }
+
+         for (mate = 0; mate <= 1; mate ++)        // hR, then -hR
+            {
+            if (mate)
+               {
+               for (count2 = 0; count2 <= 2; count2 ++) hr[count2] = -hr[count2];
+               phi = -phi;
+               }
+
+            if (hr[0] < 0) continue;               // Half grid only
+
+            if ((2 * hr[0] > N[0]) || (2 * abs(hr[1]) > N[1]) ||
+                (2 * abs(hr[2]) > N[2]))
+               {
+               lost ++;                            // Finer than the grid
+               continue;
+               }
+
+            F = polar((double) rec[col[3]], phi);
+
+            A[((long) ((hr[2] + N[2]) % N[2]) * N[1] +
+                       ((hr[1] + N[1]) % N[1])) * NH + hr[0]] = F;
+            }
+         }
+
+      used ++;
+      }
+
+   if (lost)
+      cout  << "   MTZIN => " << lost
+            << " reflections beyond the map grid were left out.\n";
+
+   FFT3(&A[0], &rho[0], N[0], N[1], N[2]);
+
+   // ****** COPY THE PART OF THE CELL COVERED BY THE MAP ******************
+
+   vol = cell_volume(mtz_last.cell[0], mtz_last.cell[1], mtz_last.cell[2],
+                     mtz_last.cell[3], mtz_last.cell[4], mtz_last.cell[5]);
+
+   axis[0]  = MAP_H[0].MAPC - 1;   start[0] = MAP_H[0].NCSTART;
+   axis[1]  = MAP_H[0].MAPR - 1;   start[1] = MAP_H[0].NRSTART;
+   axis[2]  = MAP_H[0].MAPS - 1;   start[2] = MAP_H[0].NSSTART;
+
+   pix = map1 * XYZ_LIM;
+
+   for (count3 = 0; count3 < Z_LIM; count3 ++)
+      for (count2 = 0; count2 < Y_LIM; count2 ++)
+         for (count1 = 0; count1 < X_LIM; count1 ++)
+            {
+            g[axis[0]] = start[0] + count1;
+            g[axis[1]] = start[1] + count2;
+            g[axis[2]] = start[2] + count3;
+
+            g[0] = ((g[0] % N[0]) + N[0]) % N[0];
+            g[1] = ((g[1] % N[1]) + N[1]) % N[1];
+            g[2] = ((g[2] % N[2]) + N[2]) % N[2];
+
+            val = rho[((long) g[2] * N[1] + g[1]) * N[0] + g[0]] / vol;
+
+            MAP[pix ++] = val;
+
+            if (val < min) min = val;
+            if (val > max) max = val;
+            sum += val;
+            }
+
+   MAP_H[map1]       = MAP_H[0];                   // Same grid as principal
+   MAP_H[map1].AMIN  = min;
+   MAP_H[map1].AMAX  = max;
+   MAP_H[map1].AMEAN = sum / XYZ_LIM;
+
+   MapTouch(map1);
+
+   SymLoad();                                      // Symmetric if the MTZ
+                                                   //    has every operator
+   map_symm[map1] = 1;                             //    of the map group
+   for (count1 = 0; count1 < (int) sym_ops.size(); count1 ++)
+      {
+      for (count2 = 0; count2 < (int) mtz_last.sym.size(); count2 ++)
+         if (SymSame(sym_ops[count1], mtz_last.sym[count2])) break;
+
+      if (count2 == (int) mtz_last.sym.size()) map_symm[map1] = 0;
+      }
+
+   cout  << "   MTZIN => " << used << " reflections used, density "
+         << min << " to " << max << ".\n";
+
+   return 0;
+
+   }
+
+//**************************************************************************
+//** CELL MATRIX function:  Orthogonalisation matrix O (a along X, b in   **
+//**    the XY plane, as in PDB files) and its inverse F, so that         **
+//**    x = O f and f = F x for fractional f and orthogonal x.            **
+//**************************************************************************
+
+void  CellMatrix(const float *cell, double O[3][3], double F[3][3])
+   {
+
+   double   ca  = cos(cell[3] * M_PI / 180);
+   double   cb  = cos(cell[4] * M_PI / 180);
+   double   cg  = cos(cell[5] * M_PI / 180);
+   double   sg  = sin(cell[5] * M_PI / 180);
+   double   vol = cell[0] * cell[1] * cell[2] *
+                  sqrt(1 - ca*ca - cb*cb - cg*cg + 2*ca*cb*cg);
+
+   memset(O, 0, 9 * sizeof(double));
+   memset(F, 0, 9 * sizeof(double));
+
+   O[0][0] = cell[0];
+   O[0][1] = cell[1] * cg;
+   O[0][2] = cell[2] * cb;
+   O[1][1] = cell[1] * sg;
+   O[1][2] = cell[2] * (ca - cb * cg) / sg;
+   O[2][2] = vol / (cell[0] * cell[1] * sg);
+
+   F[0][0] =  1 / O[0][0];                         // Upper triangular
+   F[0][1] = -O[0][1] / (O[0][0] * O[1][1]);
+   F[0][2] = (O[0][1] * O[1][2] - O[0][2] * O[1][1]) /
+             (O[0][0] * O[1][1] * O[2][2]);
+   F[1][1] =  1 / O[1][1];
+   F[1][2] = -O[1][2] / (O[1][1] * O[2][2]);
+   F[2][2] =  1 / O[2][2];
+
+   }
+
+//**************************************************************************
+//** FORM FACTOR function:  Cromer-Mann coefficients (International       **
+//**    Tables C, 6.1.1.4) for the element of a PDB atom, taken from      **
+//**    columns 77-78 if present, else from the atom name.  f(s) = sum    **
+//**    a exp(-b s^2) + c, s = sin(theta)/lambda.  Unknown elements are   **
+//**    treated as carbon and 1 is returned.                              **
+//**************************************************************************
+
+int   FormFactor(const pdb_file *atom, float a[5], float b[5])
+   {
+
+   static const struct
+      {
+      const char *sym;
+      float      a[4];
+      float      b[4];
+      float      c;
+      } table[] = {
+   { "H" , { 0.4899, 0.2620, 0.1968, 0.0499}, {20.6593,  7.7404, 49.5519,  2.2016},  0.0013},
+   { "C" , { 2.3100, 1.0200, 1.5886, 0.8650}, {20.8439, 10.2075,  0.5687, 51.6512},  0.2156},
+   { "N" , {12.2126, 3.1322, 2.0125, 1.1663}, { 0.0057,  9.8933, 28.9975,  0.5826}, -11.529},
+   { "O" , { 3.0485, 2.2868, 1.5463, 0.8670}, {13.2771,  5.7011,  0.3239, 32.9089},  0.2508},
+   { "NA", { 4.7626, 3.1736, 1.2674, 1.1128}, { 3.2850,  8.8422,  0.3136,129.4240},  0.6760},
+   { "MG", { 5.4204, 2.1735, 1.2269, 2.3073}, { 2.8275, 79.2611,  0.3808,  7.1937},  0.8584},
+   { "P" , { 6.4345, 4.1791, 1.7800, 1.4908}, { 1.9067, 27.1570,  0.5260, 68.1645},  1.1149},
+   { "S" , { 6.9053, 5.2034, 1.4379, 1.5863}, { 1.4679, 22.2151,  0.2536, 56.1720},  0.8669},
+   { "CL", {11.4604, 7.1962, 6.2556, 1.6455}, { 0.0104,  1.1662, 18.5194, 47.7784}, -9.5574},
+   { "K" , { 8.2186, 7.4398, 1.0519, 0.8659}, {12.7949,  0.7748,213.1870, 41.6841},  1.4228},
+   { "CA", { 8.6266, 7.3873, 1.5899, 1.0211}, {10.4421,  0.6599, 85.7484,178.4370},  1.3751},
+   { "MN", {11.2819, 7.3573, 3.0193, 2.2441}, { 5.3409,  0.3432, 17.8674, 83.7543},  1.0896},
+   { "FE", {11.7695, 7.3573, 3.5222, 2.3045}, { 4.7611,  0.3072, 15.3535, 76.8805},  1.0369},
+   { "ZN", {14.0743, 7.0318, 5.1652, 2.4100}, { 3.2655,  0.2333, 10.3163, 58.7097},  1.3041},
+   { "SE", {17.0006, 5.8196, 3.9731, 4.3543}, { 2.4098,  0.2726, 15.2372, 43.8163},  2.8409},
+   { NULL, {0, 0, 0, 0}, {0, 0, 0, 0}, 0} };
+
+   char     sym[3] = "";
+
+   int      count1;
+   int      count2 = 0;
+
+   if (strlen(atom->END) > 10)                     // Element, columns 77-78
+      for (count1 = 10, count2 = 0; (count1 <= 11) && atom->END[count1];
+           count1 ++)
+         if (isalpha(atom->END[count1]))
+            sym[count2 ++] = toupper(atom->END[count1]);
+
+   sym[count2] = '\0';
+
+   if (!sym[0])                                    // Atom name, columns 13-14:
+      {                                            //    " CA " carbon, "CA  "
+      sym[0] = toupper(atom->Nam[1]);              //    calcium
+      sym[1] = (atom->Nam[1] == ' ') ? '\0' : toupper(atom->Nam[2]);
+      if (sym[0] == ' ') { sym[0] = toupper(atom->Nam[2]); sym[1] = '\0'; }
+      sym[2] = '\0';
+      }
+
+   for (count1 = 0; table[count1].sym; count1 ++)
+      if (!strcmp(table[count1].sym, sym)) break;
+
+   if (!table[count1].sym)
+      count1 = 1;
+
+   for (count2 = 0; count2 <= 3; count2 ++)
+      {
+      a[count2] = table[count1].a[count2];
+      b[count2] = table[count1].b[count2];
+      }
+
+   a[4] = table[count1].c;
+   b[4] = 0;
+
+   return (count1 == 1) && strcmp(sym, "C");
+
+   }
+
+//**************************************************************************
+//** MODEL SLAB function:  Thread body for ModelMap.  Adds every atom to  **
+//**    the sections z0 to z1 of the map, which belong to this thread     **
+//**    alone, so no locks are needed and the sums do not depend on the   **
+//**    number of threads.  Each atom is a sum of five Gaussians, cut off **
+//**    at the radius where the widest has fallen to 1/1000.              **
+//**************************************************************************
+
+void  *ModelSlab(void *arg)
+   {
+
+   model_job *job = (model_job *) arg;
+
+   const model_atom *atom;
+
+   int      N[3]  = {MAP_H[0].NX, MAP_H[0].NY, MAP_H[0].NZ};
+   int      st[3] = {MAP_H[0].NCSTART, MAP_H[0].NRSTART, MAP_H[0].NSSTART};
+   int      ax[3] = {MAP_H[0].MAPC - 1, MAP_H[0].MAPR - 1, MAP_H[0].MAPS - 1};
+   int      lo[3];
+   int      hi[3];
+   int      u[3];
+   int      c;
+   int      r;
+   int      s;
+   int      k;
+
+   long     count1;
+
+   double   df[3];
+   double   d[3];
+   double   r2;
+   double   sum;
+
+   float    *slot = MAP + (job->map1 * XYZ_LIM);
+
+   for (count1 = 0; count1 < job->num; count1 ++)
+      {
+      atom = &job->atom[count1];
+
+      for (k = 0; k <= 2; k ++)                    // Box of grid points
+         {
+         lo[k] = (int) floor((atom->f[k] - atom->reach[k]) * N[k]);
+         hi[k] = (int) ceil ((atom->f[k] + atom->reach[k]) * N[k]);
+         }
+
+      for (u[ax[2]] = lo[ax[2]]; u[ax[2]] <= hi[ax[2]]; u[ax[2]] ++)
+         {
+         s = (((u[ax[2]] - st[2]) % N[ax[2]]) + N[ax[2]]) % N[ax[2]];
+         if ((s < job->z0) || (s >= job->z1)) continue;
+
+         for (u[ax[1]] = lo[ax[1]]; u[ax[1]] <= hi[ax[1]]; u[ax[1]] ++)
+            {
+            r = (((u[ax[1]] - st[1]) % N[ax[1]]) + N[ax[1]]) % N[ax[1]];
+            if (r >= Y_LIM) continue;
+
+            for (u[ax[0]] = lo[ax[0]]; u[ax[0]] <= hi[ax[0]]; u[ax[0]] ++)
+               {
+               c = (((u[ax[0]] - st[0]) % N[ax[0]]) + N[ax[0]]) % N[ax[0]];
+               if (c >= X_LIM) continue;
+
+               for (k = 0; k <= 2; k ++)
+                  df[k] = (double) u[k] / N[k] - atom->f[k];
+
+               for (k = 0; k <= 2; k ++)
+                  d[k] = job->O[k][0] * df[0] + job->O[k][1] * df[1] +
+                         job->O[k][2] * df[2];
+
+               r2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+
+               if (r2 > atom->cut2) continue;
+
+               for (k = 0, sum = 0; k <= 4; k ++)
+                  sum += atom->amp[k] * exp(-atom->wid[k] * r2);
+
+               slot[c + (r * X_LIM) + (s * XY_LIM)] += sum;
+               }
+            }
+         }
+      }
+
+   return NULL;
+
+   }
+
+//**************************************************************************
+//** MODEL MAP function:  Calculates the density of the atoms of PDB file **
+//**    pdb1 straight onto the grid of map1, with no structure factors.   **
+//**    Each atom is its form factor blurred by its B factor (plus badd): **
+//**    rho(r) = occ sum a (4 pi / (b+B))^1.5 exp(-4 pi^2 r^2 / (b+B)).   **
+//**    The map wraps around the unit cell; the part covered by map1 is   **
+//**    kept.  The result is on an absolute scale (e/A^3, F000 included). **
+//**************************************************************************
+
+int   ModelMap(int map1, int pdb1, float badd)
+   {
+
+   model_job   job[16];
+   pthread_t   tid[16];
+
+   int         made[16];
+
+   vector<model_atom> atom(pdb_len[pdb1]);
+
+   double      O[3][3];
+   double      F[3][3];
+   double      x[3];
+   double      bt;
+   double      wmax;
+
+   float       a[5];
+   float       b[5];
+
+   int         nth = sysconf(_SC_NPROCESSORS_ONLN);
+   int         odd = 0;
+   int         LOC;
+   int         count1;
+   int         count2;
+
+   long        pix;
+
+   if (nth < 1)     nth = 1;
+   if (nth > 16)    nth = 16;
+   if (nth > Z_LIM) nth = Z_LIM;
+
+   CellMatrix(MAP_H[0].CELL, O, F);
+
+   for (count1 = 0; count1 < pdb_len[pdb1]; count1 ++)
+      {
+      LOC = (pdb_max * pdb1) + count1 + 1;
+
+      odd += FormFactor(&PDB[LOC], a, b);
+
+      x[0] = PDB[LOC].x;   x[1] = PDB[LOC].y;   x[2] = PDB[LOC].z;
+
+      for (count2 = 0; count2 <= 2; count2 ++)
+         atom[count1].f[count2] = F[count2][0] * x[0] + F[count2][1] * x[1] +
+                                  F[count2][2] * x[2];
+
+      wmax = 0;
+
+      for (count2 = 0; count2 <= 4; count2 ++)
+         {
+         bt = b[count2] + PDB[LOC].B + badd;
+         if (bt < 1) bt = 1;                       // Keep it on the grid
+
+         atom[count1].amp[count2] = PDB[LOC].O * a[count2] *
+                                    pow(4 * M_PI / bt, 1.5);
+         atom[count1].wid[count2] = 4 * M_PI * M_PI / bt;
+
+         if ((fabs(a[count2]) > 0.1) && (bt > wmax)) wmax = bt;
+         }
+
+      atom[count1].cut2 = wmax * log(1000.0) / (4 * M_PI * M_PI);
+
+      for (count2 = 0; count2 <= 2; count2 ++)     // |a*| r, in fractions
+         atom[count1].reach[count2] = sqrt(atom[count1].cut2) *
+            sqrt(F[count2][0] * F[count2][0] + F[count2][1] * F[count2][1] +
+                 F[count2][2] * F[count2][2]);
+      }
+
+   if (odd)
+      cout  << "   MODEL => " << odd
+            << " atoms of unknown element were treated as carbon.\n";
+
+   for (pix = map1 * XYZ_LIM; pix < (map1 + 1) * XYZ_LIM; pix ++)
+      MAP[pix] = 0;
+
+   for (count1 = 0; count1 < nth; count1 ++)       // Sections for each thread
+      {
+      job[count1].map1 = map1;
+      job[count1].atom = atom.empty() ? NULL : &atom[0];
+      job[count1].num  = atom.size();
+      job[count1].z0   = (long) Z_LIM *  count1      / nth;
+      job[count1].z1   = (long) Z_LIM * (count1 + 1) / nth;
+      memcpy(job[count1].O, O, sizeof(O));
+      }
+
+   for (count1 = 1; count1 < nth; count1 ++)
+      if ((made[count1] = !pthread_create(&tid[count1], NULL, ModelSlab,
+                                          &job[count1])) == 0)
+         ModelSlab(&job[count1]);
+
+   ModelSlab(&job[0]);
+
+   for (count1 = 1; count1 < nth; count1 ++)
+      if (made[count1]) pthread_join(tid[count1], NULL);
+
+   MAP_H[map1] = MAP_H[0];
+
+   map_symm[map1] = 0;                           // Atoms as given only
+
+   MapTouch(map1);
+
+   return 0;
+
+   }
+
+//**************************************************************************
+//** SPACE GROUP function:  Fills ops with every symmetry operator of     **
+//**    space group ispg (the 65 groups that chiral molecules crystallise **
+//**    in, standard settings, R groups on hexagonal axes), made from the **
+//**    generators in the table below, then the centring translations.    **
+//**    Returns 1 for a space group not in the table.                     **
+//**************************************************************************
+
+int   SymGroup(int ispg, vector<sym_op> &ops)
+   {
+
+   static const struct
+      {
+      int        num;
+      const char *name;
+      char       cen;                 // P, C, I, F or R
+      const char *gen;                // Generators, separated by ;
+      } table[] = {
+   {   1, "P 1"        , 'P', "" },
+   {   3, "P 1 2 1"    , 'P', "-X,Y,-Z" },
+   {   4, "P 1 21 1"   , 'P', "-X,Y+1/2,-Z" },
+   {   5, "C 1 2 1"    , 'C', "-X,Y,-Z" },
+   {  16, "P 2 2 2"    , 'P', "-X,-Y,Z;-X,Y,-Z" },
+   {  17, "P 2 2 21"   , 'P', "-X,-Y,Z+1/2;-X,Y,-Z+1/2" },
+   {  18, "P 21 21 2"  , 'P', "-X,-Y,Z;-X+1/2,Y+1/2,-Z" },
+   {  19, "P 21 21 21" , 'P', "-X+1/2,-Y,Z+1/2;-X,Y+1/2,-Z+1/2" },
+   {  20, "C 2 2 21"   , 'C', "-X,-Y,Z+1/2;-X,Y,-Z+1/2" },
+   {  21, "C 2 2 2"    , 'C', "-X,-Y,Z;-X,Y,-Z" },
+   {  22, "F 2 2 2"    , 'F', "-X,-Y,Z;-X,Y,-Z" },
+   {  23, "I 2 2 2"    , 'I', "-X,-Y,Z;-X,Y,-Z" },
+   {  24, "I 21 21 21" , 'I', "-X+1/2,-Y,Z+1/2;-X,Y+1/2,-Z+1/2" },
+   {  75, "P 4"        , 'P', "-Y,X,Z" },
+   {  76, "P 41"       , 'P', "-Y,X,Z+1/4" },
+   {  77, "P 42"       , 'P', "-Y,X,Z+1/2" },
+   {  78, "P 43"       , 'P', "-Y,X,Z+3/4" },
+   {  79, "I 4"        , 'I', "-Y,X,Z" },
+   {  80, "I 41"       , 'I', "-Y,X+1/2,Z+1/4" },
+   {  89, "P 4 2 2"    , 'P', "-Y,X,Z;-X,Y,-Z" },
+   {  90, "P 4 21 2"   , 'P', "-Y+1/2,X+1/2,Z;-X+1/2,Y+1/2,-Z" },
+   {  91, "P 41 2 2"   , 'P', "-Y,X,Z+1/4;-X,Y,-Z" },
+   {  92, "P 41 21 2"  , 'P', "-Y+1/2,X+1/2,Z+1/4;Y,X,-Z" },
+   {  93, "P 42 2 2"   , 'P', "-Y,X,Z+1/2;-X,Y,-Z" },
+   {  94, "P 42 21 2"  , 'P', "-Y+1/2,X+1/2,Z+1/2;-X+1/2,Y+1/2,-Z+1/2" },
+   {  95, "P 43 2 2"   , 'P', "-Y,X,Z+3/4;-X,Y,-Z" },
+   {  96, "P 43 21 2"  , 'P', "-Y+1/2,X+1/2,Z+3/4;Y,X,-Z" },
+   {  97, "I 4 2 2"    , 'I', "-Y,X,Z;-X,Y,-Z" },
+   {  98, "I 41 2 2"   , 'I', "-Y,X+1/2,Z+1/4;-X+1/2,Y,-Z+3/4" },
+   { 143, "P 3"        , 'P', "-Y,X-Y,Z" },
+   { 144, "P 31"       , 'P', "-Y,X-Y,Z+1/3" },
+   { 145, "P 32"       , 'P', "-Y,X-Y,Z+2/3" },
+   { 146, "H 3"        , 'R', "-Y,X-Y,Z" },
+   { 149, "P 3 1 2"    , 'P', "-Y,X-Y,Z;-Y,-X,-Z" },
+   { 150, "P 3 2 1"    , 'P', "-Y,X-Y,Z;Y,X,-Z" },
+   { 151, "P 31 1 2"   , 'P', "-Y,X-Y,Z+1/3;-Y,-X,-Z+2/3" },
+   { 152, "P 31 2 1"   , 'P', "-Y,X-Y,Z+1/3;Y,X,-Z" },
+   { 153, "P 32 1 2"   , 'P', "-Y,X-Y,Z+2/3;-Y,-X,-Z+1/3" },
+   { 154, "P 32 2 1"   , 'P', "-Y,X-Y,Z+2/3;Y,X,-Z" },
+   { 155, "H 3 2"      , 'R', "-Y,X-Y,Z;Y,X,-Z" },
+   { 168, "P 6"        , 'P', "X-Y,X,Z" },
+   { 169, "P 61"       , 'P', "X-Y,X,Z+1/6" },
+   { 170, "P 65"       , 'P', "X-Y,X,Z+5/6" },
+   { 171, "P 62"       , 'P', "X-Y,X,Z+1/3" },
+   { 172, "P 64"       , 'P', "X-Y,X,Z+2/3" },
+   { 173, "P 63"       , 'P', "X-Y,X,Z+1/2" },
+   { 177, "P 6 2 2"    , 'P', "X-Y,X,Z;Y,X,-Z" },
+   { 178, "P 61 2 2"   , 'P', "X-Y,X,Z+1/6;Y,X,-Z+1/3" },
+   { 179, "P 65 2 2"   , 'P', "X-Y,X,Z+5/6;Y,X,-Z+2/3" },
+   { 180, "P 62 2 2"   , 'P', "X-Y,X,Z+1/3;Y,X,-Z+2/3" },
+   { 181, "P 64 2 2"   , 'P', "X-Y,X,Z+2/3;Y,X,-Z+1/3" },
+   { 182, "P 63 2 2"   , 'P', "X-Y,X,Z+1/2;Y,X,-Z" },
+   { 195, "P 2 3"      , 'P', "Z,X,Y;-X,-Y,Z;-X,Y,-Z" },
+   { 196, "F 2 3"      , 'F', "Z,X,Y;-X,-Y,Z;-X,Y,-Z" },
+   { 197, "I 2 3"      , 'I', "Z,X,Y;-X,-Y,Z;-X,Y,-Z" },
+   { 198, "P 21 3"     , 'P', "Z,X,Y;-X+1/2,-Y,Z+1/2;-X,Y+1/2,-Z+1/2" },
+   { 199, "I 21 3"     , 'I', "Z,X,Y;-X+1/2,-Y,Z+1/2;-X,Y+1/2,-Z+1/2" },
+   { 207, "P 4 3 2"    , 'P', "Z,X,Y;-X,-Y,Z;-X,Y,-Z;Y,X,-Z" },
+   { 208, "P 42 3 2"   , 'P', "Z,X,Y;-X,-Y,Z;-X,Y,-Z;Y+1/2,X+1/2,-Z+1/2" },
+   { 209, "F 4 3 2"    , 'F', "Z,X,Y;-X,-Y,Z;-X,Y,-Z;Y,X,-Z" },
+   { 210, "F 41 3 2"   , 'F', "Z,X,Y;-X,-Y+1/2,Z+1/2;-X+1/2,Y+1/2,-Z;"
+                              "Y+3/4,X+1/4,-Z+3/4" },
+   { 211, "I 4 3 2"    , 'I', "Z,X,Y;-X,-Y,Z;-X,Y,-Z;Y,X,-Z" },
+   { 212, "P 43 3 2"   , 'P', "Z,X,Y;-X+1/2,-Y,Z+1/2;-X,Y+1/2,-Z+1/2;"
+                              "Y+1/4,X+3/4,-Z+3/4" },
+   { 213, "P 41 3 2"   , 'P', "Z,X,Y;-X+1/2,-Y,Z+1/2;-X,Y+1/2,-Z+1/2;"
+                              "Y+3/4,X+1/4,-Z+1/4" },
+   { 214, "I 41 3 2"   , 'I', "Z,X,Y;-X+1/2,-Y,Z+1/2;-X,Y+1/2,-Z+1/2;"
+                              "Y+3/4,X+1/4,-Z+1/4" },
+   {   0, NULL, 'P', NULL } };
+
+   static const float cen_t[][4][3] = {
+      {{0, 0, 0}},                                             // P
+      {{0, 0, 0}, {0.5, 0.5, 0}},                              // C
+      {{0, 0, 0}, {0.5, 0.5, 0.5}},                            // I
+      {{0, 0, 0}, {0, 0.5, 0.5}, {0.5, 0, 0.5}, {0.5, 0.5, 0}},// F
+      {{0, 0, 0}, {2/3.0, 1/3.0, 1/3.0}, {1/3.0, 2/3.0, 2/3.0}} };// R
+
+   static const int   cen_n[] = {1, 2, 2, 4, 3};
+
+   vector<sym_op> gen;
+
+   sym_op   op;
+   sym_op   pr;
+
+   const char *text;
+
+   char     buf[200];
+
+   int      grp;
+   int      cen;
+   int      count1;
+   int      count2;
+   int      count3;
+   int      i;
+   int      j;
+   int      k;
+
+   unsigned int   old;
+
+   for (grp = 0; table[grp].name; grp ++)
+      if (table[grp].num == ispg) break;
+
+   if (!table[grp].name)
+      return 1;
+
+   for (text = table[grp].gen; *text; )            // Generators
+      {
+      for (count1 = 0; *text && (*text != ';'); text ++)
+         buf[count1 ++] = *text;
+      buf[count1] = '\0';
+      if (*text) text ++;
+
+      if (!SymParse(buf, &op)) gen.push_back(op);
+      }
+
+   ops.clear();
+   SymParse("X,Y,Z", &op);
+   ops.push_back(op);
+
+   do                                              // Products until closed
+      {
+      old = ops.size();
+
+      for (count1 = 0; count1 < (int) ops.size(); count1 ++)
+         for (count2 = 0; count2 < (int) gen.size(); count2 ++)
+            {
+            for (i = 0; i <= 2; i ++)              // pr = gen * ops
+               {
+               pr.t[i] = gen[count2].t[i];
+               for (j = 0; j <= 2; j ++)
+                  {
+                  pr.R[i][j] = 0;
+                  for (k = 0; k <= 2; k ++)
+                     pr.R[i][j] += gen[count2].R[i][k] * ops[count1].R[k][j];
+                  pr.t[i] += gen[count2].R[i][j] * ops[count1].t[j];
+                  }
+               pr.t[i] -= floor(pr.t[i] + 0.001);
+               }
+
+            for (count3 = 0; count3 < (int) ops.size(); count3 ++)
+               if (SymSame(pr, ops[count3])) break;
+
+            if (count3 == (int) ops.size())
+               ops.push_back(pr);
+            }
+      }
+   while (ops.size() != old);
+
+   cen = strchr("PCIFR", table[grp].cen) - "PCIFR";
+   old = ops.size();
+
+   for (count1 = 1; count1 < cen_n[cen]; count1 ++) // Centring
+      for (count2 = 0; count2 < (int) old; count2 ++)
+         {
+         pr = ops[count2];
+         for (i = 0; i <= 2; i ++)
+            {
+            pr.t[i] += cen_t[cen][count1][i];
+            pr.t[i] -= floor(pr.t[i] + 0.001);
+            }
+         ops.push_back(pr);
+         }
+
+   sym_name = table[grp].name;
+
+   return 0;
+
+   }
+
+//**************************************************************************
+//** SYMMETRY SAME function:  1 if two operators are equal, translations  **
+//**    taken modulo whole cells.                                         **
+//**************************************************************************
+
+int   SymSame(const sym_op &op1, const sym_op &op2)
+   {
+
+   int      i;
+   int      j;
+
+   float    dt;
+
+   for (i = 0; i <= 2; i ++)
+      {
+      for (j = 0; j <= 2; j ++)
+         if (op1.R[i][j] != op2.R[i][j]) return 0;
+
+      dt = op1.t[i] - op2.t[i];
+      if (fabs(dt - floor(dt + 0.5)) > 0.001) return 0;
+      }
+
+   return 1;
+
+   }
+
+//**************************************************************************
+//** SYMMETRY LOAD function:  Makes sym_ops the operators of the space    **
+//**    group of the principal map, once for each space group.  A group   **
+//**    not in the SymGroup table gives the identity alone.               **
+//**************************************************************************
+
+void  SymLoad()
+   {
+
+   sym_op   op;
+
+   if (sym_ispg == MAP_H[0].ISPG) return;
+
+   sym_ispg = MAP_H[0].ISPG;
+   sym_name = "P 1";
+
+   if (SymGroup(sym_ispg, sym_ops))
+      {
+      sym_ops.clear();
+      SymParse("X,Y,Z", &op);
+      sym_ops.push_back(op);
+      }
+
+   return;
+
+   }
+
+//**************************************************************************
+//** SYMMETRY GRID function:  Writes the operators of sym_ops that carry  **
+//**    the grid of the principal map onto itself in grid units (grid_M,  **
+//**    grid_T), identity first, and notes which cell axis and start go   **
+//**    with each map axis.  grid_all says whether every operator fits.   **
+//**    Returns 0 if the header gives no cell grid.                       **
+//**************************************************************************
+
+int   SymGrid()
+   {
+
+   int      count1;
+   int      i;
+   int      j;
+   int      fit;
+
+   float    t;
+
+   if (grid_ok >= 0) return grid_ok;
+
+   grid_ok  = 0;
+   grid_all = 0;
+   grid_M.clear();
+   grid_T.clear();
+
+   grid_n[0]  = MAP_H[0].NX;        grid_n[1]  = MAP_H[0].NY;
+   grid_n[2]  = MAP_H[0].NZ;
+
+   grid_ax[0] = MAP_H[0].MAPC - 1;  grid_st[0] = MAP_H[0].NCSTART;
+   grid_ax[1] = MAP_H[0].MAPR - 1;  grid_st[1] = MAP_H[0].NRSTART;
+   grid_ax[2] = MAP_H[0].MAPS - 1;  grid_st[2] = MAP_H[0].NSSTART;
+
+   for (i = 0; i <= 2; i ++)
+      if ((grid_ax[i] < 0) || (grid_ax[i] > 2) || (grid_n[i] <= 0) ||
+          (grid_ax[i] == grid_ax[(i + 1) % 3]))
+         return 0;
+
+   SymLoad();
+
+   grid_all = 1;
+
+   for (count1 = 0; count1 < (int) sym_ops.size(); count1 ++)
+      {
+      fit = 1;
+
+      for (i = 0; i <= 2; i ++)
+         {
+         t = sym_ops[count1].t[i] * grid_n[i];
+         if (fabs(t - lrint(t)) > 0.001) fit = 0;
+
+         for (j = 0; j <= 2; j ++)
+            if ((sym_ops[count1].R[i][j] * grid_n[i]) % grid_n[j]) fit = 0;
+         }
+
+      if (!fit)
+         {
+         grid_all = 0;
+         continue;
+         }
+
+      for (i = 0; i <= 2; i ++)
+         {
+         grid_T.push_back(lrint(sym_ops[count1].t[i] * grid_n[i]));
+
+         for (j = 0; j <= 2; j ++)
+            grid_M.push_back(sym_ops[count1].R[i][j] * grid_n[i] / grid_n[j]);
+         }
+      }
+
+   grid_ok = 1;
+
+   return 1;
+
+   }
+
+//**************************************************************************
+//** SYMMETRY WRAP function:  Location in a map (0 based, add map*XYZ_LIM)**
+//**    of grid point X, Y, Z (1 based, may lie outside the map) or of a  **
+//**    symmetry or lattice mate of it that lies inside.  -1 if there is  **
+//**    none.  When streaming, or with no cell grid in the header, the    **
+//**    map itself is taken to repeat.                                    **
+//**************************************************************************
+
+long  SymWrap(int X, int Y, int Z)
+   {
+
+   int      lim[3] = {X_LIM, Y_LIM, Z_LIM};
+   int      c[3]   = {X - 1, Y - 1, Z - 1};
+   int      g[3];
+   int      h[3];
+   int      nop;
+   int      count1;
+   int      i;
+
+   const int *M;
+
+   if (stream_on || !SymGrid())                    // Box repeats
+      {
+      for (i = 0; i <= 2; i ++)
+         c[i] = ((c[i] % lim[i]) + lim[i]) % lim[i];
+
+      return c[0] + ((long) c[1] * X_LIM) + ((long) c[2] * XY_LIM);
+      }
+
+   for (i = 0; i <= 2; i ++)                       // Cell grid point
+      g[grid_ax[i]] = c[i] + grid_st[i];
+
+   nop = grid_T.size() / 3;
+
+   for (count1 = 0; count1 < nop; count1 ++)
+      {
+      M = &grid_M[count1 * 9];
+
+      for (i = 0; i <= 2; i ++)
+         h[i] = M[i * 3] * g[0] + M[i * 3 + 1] * g[1] + M[i * 3 + 2] * g[2] +
+                grid_T[count1 * 3 + i];
+
+      for (i = 0; i <= 2; i ++)                    // Moved by whole cells
+         {
+         c[i] = h[grid_ax[i]] - grid_st[i];
+         c[i] = ((c[i] % grid_n[grid_ax[i]]) + grid_n[grid_ax[i]]) %
+                grid_n[grid_ax[i]];
+         if (c[i] >= lim[i]) break;
+         }
+
+      if (i == 3)
+         return c[0] + ((long) c[1] * X_LIM) + ((long) c[2] * XY_LIM);
+      }
+
+   return -1;
+
+   }
+
+//**************************************************************************
+//** ASU BUILD function:  Finds one grid point of each set of symmetry    **
+//**    equivalent points (asu_loc) and the size of the set (asu_wt), so  **
+//**    that sums over a symmetric map need only visit the asymmetric     **
+//**    unit.  The map must cover exactly one cell, and every operator    **
+//**    must carry the grid onto itself.  Returns 1 when asu_loc can be   **
+//**    used; the answer is kept until the principal map changes.         **
+//**************************************************************************
+
+int   AsuBuild()
+   {
+
+   int      lim[3] = {X_LIM, Y_LIM, Z_LIM};
+   int      g[3];
+   int      h[3];
+   int      c[3];
+   int      nop;
+   int      count1;
+   int      i;
+   int      wt;
+
+   long     loc;
+   long     img;
+
+   const int *M;
+
+   if (asu_ok >= 0) return asu_ok;
+
+   asu_ok = 0;
+   asu_loc.clear();
+   asu_wt.clear();
+
+   if (stream_on || !MAP || !SymGrid() || !grid_all) return 0;
+
+   nop = grid_T.size() / 3;
+
+   if (nop < 2) return 0;                          // P1, nothing to gain
+
+   for (i = 0; i <= 2; i ++)                       // One whole cell
+      if (lim[i] != grid_n[grid_ax[i]]) return 0;
+
+   vector<char> seen(XYZ_LIM, 0);
+
+   for (loc = 0; loc < XYZ_LIM; loc ++)
+      {
+      if (seen[loc]) continue;
+
+      g[grid_ax[0]] = grid_st[0] + (loc % X_LIM);
+      g[grid_ax[1]] = grid_st[1] + (loc / X_LIM) % Y_LIM;
+      g[grid_ax[2]] = grid_st[2] + (loc / XY_LIM);
+
+      wt = 0;
+
+      for (count1 = 0; count1 < nop; count1 ++)    // The set of loc
+         {
+         M = &grid_M[count1 * 9];
+
+         for (i = 0; i <= 2; i ++)
+            h[i] = M[i * 3] * g[0] + M[i * 3 + 1] * g[1] +
+                   M[i * 3 + 2] * g[2] + grid_T[count1 * 3 + i];
+
+         for (i = 0; i <= 2; i ++)
+            c[i] = (((h[grid_ax[i]] - grid_st[i]) % lim[i]) + lim[i]) % lim[i];
+
+         img = c[0] + (long) c[1] * X_LIM + (long) c[2] * XY_LIM;
+
+         if (!seen[img])
+            {
+            seen[img] = 1;
+            wt ++;
+            }
+         }
+
+      asu_loc.push_back(loc);
+      asu_wt.push_back(wt);
+      }
+
+   cout  << "   ASU   => " << sym_name << ":  " << asu_loc.size()
+         << " of " << XYZ_LIM << " grid points are unique.\n";
+
+   asu_ok = 1;
+
+   return 1;
+
+   }
+
+//**************************************************************************
+//** SYMMETRY INSIDE function:  Grid point (1 based map index) of the     **
+//**    fractional position frac, or of a symmetry mate of it, that lies  **
+//**    inside the map.  Returns 0 if no mate is inside, leaving the      **
+//**    point frac itself (which INT then finds no density around).       **
+//**************************************************************************
+
+int   SymInside(const double frac[3], int slot[3])
+   {
+
+   int      N[3]     = {MAP_H[0].NX, MAP_H[0].NY, MAP_H[0].NZ};
+   int      lim[3]   = {X_LIM, Y_LIM, Z_LIM};
+   int      axis[3]  = {MAP_H[0].MAPC - 1, MAP_H[0].MAPR - 1,
+                        MAP_H[0].MAPS - 1};
+   int      start[3] = {MAP_H[0].NCSTART, MAP_H[0].NRSTART,
+                        MAP_H[0].NSSTART};
+   int      g[3];
+   int      c[3];
+   int      count1;
+   int      i;
+   int      j;
+
+   double   f;
+
+   for (i = 0; i <= 2; i ++)
+      if ((axis[i] < 0) || (axis[i] > 2) || (N[axis[i]] <= 0))
+         {
+         slot[0] = slot[1] = slot[2] = 0;
+         return 0;
+         }
+
+   for (i = 0; i <= 2; i ++)                       // The atom itself
+      g[i] = lrint(frac[i] * N[i]);
+
+   for (i = 0; i <= 2; i ++)
+      slot[i] = g[axis[i]] - start[i] + 1;
+
+   if ((slot[0] >= 1) && (slot[0] <= lim[0]) &&
+       (slot[1] >= 1) && (slot[1] <= lim[1]) &&
+       (slot[2] >= 1) && (slot[2] <= lim[2]))
+      return 1;
+
+   SymLoad();
+
+   for (count1 = 0; count1 < (int) sym_ops.size(); count1 ++)
+      {                                            // Mates, moved by whole
+      for (i = 0; i <= 2; i ++)                    //    cells into the map
+         {
+         f = sym_ops[count1].t[i];
+         for (j = 0; j <= 2; j ++)
+            f += sym_ops[count1].R[i][j] * frac[j];
+         g[i] = lrint(f * N[i]);
+         }
+
+      for (i = 0; i <= 2; i ++)
+         {
+         c[i] = g[axis[i]] - start[i];
+         c[i] = ((c[i] % N[axis[i]]) + N[axis[i]]) % N[axis[i]];
+         }
+
+      if ((c[0] < lim[0]) && (c[1] < lim[1]) && (c[2] < lim[2]))
+         {
+         for (i = 0; i <= 2; i ++) slot[i] = c[i] + 1;
+         return 1;
+         }
+      }
+
+   return 0;
+
+   }
+
+//**************************************************************************
+//** ZIP TYPE function:  Says whether a file is compressed.  Input files  **
+//**    are known by their first bytes, output files by their name.       **
+//**    0 => plain, 1 => gzip (.gz), 2 => zstd (.zst).                    **
+//**************************************************************************
+
+int   ZipType(const char *file, int write)
+   {
+
+   unsigned char magic[4] = {0, 0, 0, 0};
+
+   int   len;
+
+   FILE  *read1;
+
+   if (write)
+      {
+      len = strlen(file);
+
+      if ((len > 3) && !strcmp(file + len - 3, ".gz"))  return 1;
+      if ((len > 4) && !strcmp(file + len - 4, ".zst")) return 2;
+
+      return 0;
+      }
+
+   if ((read1 = fopen(file, "rb")) == NULL)
+      return 0;
+
+   len = fread(magic, 1, 4, read1);
+   fclose(read1);
+
+   if ((len >= 2) && (magic[0] == 0x1f) && (magic[1] == 0x8b))
+      return 1;
+
+   if ((len == 4) && (magic[0] == 0x28) && (magic[1] == 0xb5) &&
+                     (magic[2] == 0x2f) && (magic[3] == 0xfd))
+      return 2;
+
+   return 0;
+
+   }
+
+//**************************************************************************
+//** ZIP OPEN function:  Opens a map or mask for reading ("rb") or        **
+//**    writing ("wb").  Compressed files are read and written through a  **
+//**    gzip or zstd process, so the voxels go straight to or from the    **
+//**    memory location with no temporary file.  pigz is used for gzip   **
+//**    when it is installed, and zstd compresses with one thread per     **
+//**    CPU.  *zip is set to the ZipType of the file, for ZipClose.       **
+//**************************************************************************
+
+FILE  *ZipOpen(const char *file, const char *mode, int *zip)
+   {
+
+   string   name  = "'";
+   string   cmd;
+
+   FILE     *file1;
+
+   int      count1;
+   int      write = (mode[0] == 'w');
+
+   *zip = ZipType(file, write);
+
+   if (!*zip)
+      return fopen(file, mode);
+
+   for (count1 = 0; file[count1]; count1 ++)      // Quoted for the shell
+      if (file[count1] == '\'') name += "'\\''";
+      else                      name += file[count1];
+   name += "'";
+
+   if      (!write && (*zip == 1))
+      cmd = "if command -v pigz >/dev/null 2>&1; "
+            "then exec pigz -dc -- " + name + "; "
+            "else exec gzip -dc -- " + name + "; fi";
+   else if (!write)
+      cmd = "exec zstd -dcq -- " + name;
+   else if (*zip == 1)
+      cmd = "if command -v pigz >/dev/null 2>&1; "
+            "then exec pigz -c > "   + name + "; "
+            "else exec gzip -c > "   + name + "; fi";
+   else
+      cmd = "exec zstd -q -T0 -c > " + name;
+
+   if (write)                                      // A dead compressor is
+      zip_pipe = signal(SIGPIPE, SIG_IGN);         //    an error, not a kill
+
+   if ((file1 = popen(cmd.c_str(), write ? "w" : "r")) == NULL && write)
+      signal(SIGPIPE, zip_pipe);
+
+   return file1;
+
+   }
+
+//**************************************************************************
+//** ZIP CLOSE function:  Closes a file opened by ZipOpen.  Returns non-  **
+//**    zero if the file could not be finished (or the decoder failed).  **
+//**************************************************************************
+
+int   ZipClose(FILE *file1, int zip, int write)
+   {
+
+   int   status;
+
+   if (!zip)
+      return (fclose(file1) != 0);
+
+   status = pclose(file1);
+
+   if (write)
+      signal(SIGPIPE, zip_pipe);
+
+   return (status != 0);
+
+   }
+
+//**************************************************************************
+//** PRE SCAN function:  Reads the whole keyword script from cin, finds   **
+//**    the maps and masks named by MAPIN and MASKI, and starts reading   **
+//**    them all at once in the background.  cin is then given the saved **
+//**    script.  Files also named by WRITE, MASKO or SAVE are left alone, **
+//**    since the script may change them before they are read.           **
+//**************************************************************************
+
+void  PreScan()
+   {
+
+   ostringstream        all;
+
+   vector<string>       word;
+   vector<string>       made;
+
+   vector<long>         at;                        // Offset past each word
+
+   string               tok;
+
+   unsigned int         count1;
+   unsigned int         count2;
+
+   all << cin.rdbuf();                             // Whole script
+   pre_buf.str(all.str());
+   cin.clear();
+   cin.rdbuf(&pre_buf);
+
+   istringstream        list(all.str());
+
+   while (list >> tok)
+      {
+      word.push_back(tok);
+      at.push_back(list.eof() ? (long) all.str().size() : (long) list.tellg());
+      }
+
+   for (count1 = 0; count1 < word.size(); count1 ++)
+      if      ((!strncasecmp(word[count1].c_str(), "WRITE", 5) ||
+                !strncasecmp(word[count1].c_str(), "MASKO", 5))
+               && (count1 + 2 < word.size()))
+         made.push_back(word[count1 + 2]);
+      else if (!strncasecmp(word[count1].c_str(), "SAVE", 4)
+               && (count1 + 1 < word.size()))
+         made.push_back(word[count1 + 1]);
+
+   for (count1 = 0; count1 + 2 < word.size(); count1 ++)
+      if (!strncasecmp(word[count1].c_str(), "MAPIN", 5) ||
+          !strncasecmp(word[count1].c_str(), "MASKI", 5))
+         {
+         for (count2 = 0; count2 < made.size(); count2 ++)
+            if (made[count2] == word[count1 + 2]) break;
+
+         if (count2 == made.size())
+            PreAdd(word[count1 + 2].c_str(), at[count1 + 2]);
+         }
+
+   if (pre_num)
+      cout  << "\n\n   MAIN  => Reading " << pre_num
+            << " maps and masks ahead of the script.";
+
+   }
+
+//**************************************************************************
+//** PRE ADD function:  Starts a background read of file, unless it is   **
+//**    already being read.  pos is the script offset just past the name. **
+//**    Returns 1 if no thread was started.                               **
+//**************************************************************************
+
+int   PreAdd(const char *file, long pos)
+   {
+
+   int      count1;
+
+   if ((pre_num >= PRE_MAX) || (strlen(file) >= sizeof(pre_list[0].file)))
+      return 1;
+
+   for (count1 = 0; count1 < pre_num; count1 ++)
+      if (!strcmp(pre_list[count1].file, file))
+         {
+         pre_list[count1].pos = pos;               // Kept to the last name
+         return 1;
+         }
+
+   strcpy(pre_list[pre_num].file, file);
+   pre_list[pre_num].fd   = -1;
+   pre_list[pre_num].used = 0;
+   pre_list[pre_num].pos  = pos;
+
+   if (pthread_create(&pre_list[pre_num].tid, NULL, PreLoad,
+                      &pre_list[pre_num]))
+      return 1;
+
+   pre_num ++;
+
+   return 0;
+
+   }
+
+//**************************************************************************
+//** PRE LOAD function:  Background thread.  Checks the header of one     **
+//**    file first, and leaves files of the wrong size to MAPIN or MASKI. **
+//**    A plain file is read through once, so it is in the page cache     **
+//**    when asked for, with no copy.  A compressed file is decoded into  **
+//**    an anonymous memory file.                                         **
+//**************************************************************************
+
+void  *PreLoad(void *arg)
+   {
+
+   pre_job  *job = (pre_job *) arg;
+
+   char     *buf;
+
+   size_t   len;
+
+   long     vox;
+
+   int      fd = -1;
+   int      zip;
+   int      word[56];
+
+   FILE     *read1;
+
+   if ((read1 = ZipOpen(job->file, "rb", &zip)) == NULL)
+      return NULL;
+
+   vox = PreHead(read1, word);
+
+   if ( (vox <= 0) || (pre_vox && (vox != pre_vox)) ||
+        (buf = new (nothrow) char[1 << 20]) == NULL )
+      {
+      ZipClose(read1, zip, 0);                     // MAPIN or MASKI will
+      return NULL;                                 //    say what is wrong
+      }
+
+   if (!zip)                                       // Into the page cache
+      {
+      while (fread(buf, 1, 1 << 20, read1) > 0);
+
+      ZipClose(read1, zip, 0);
+      delete [] buf;
+      return NULL;
+      }
+
+   if ( ((fd = memfd_create("rsrf-pre", 0)) < 0) ||
+        (write(fd, word, HEAD_LEN * sizeof(int)) !=
+         (ssize_t) (HEAD_LEN * sizeof(int)))            )
+      {
+      if (fd >= 0) close(fd);
+      ZipClose(read1, zip, 0);
+      delete [] buf;
+      return NULL;
+      }
+
+   while ((len = fread(buf, 1, 1 << 20, read1)) > 0)
+      if (write(fd, buf, len) != (ssize_t) len)
+         break;
+
+   if (ferror(read1) || ZipClose(read1, zip, 0) || len)
+      close(fd);
+   else
+      job->fd = fd;
+
+   delete [] buf;
+
+   return NULL;
+
+   }
+
+//**************************************************************************
+//** PRE HEAD function:  Reads the header words of a map or mask file     **
+//**    being read ahead.  Returns the number of voxels, or 0 if it is    **
+//**    short or makes no sense.                                          **
+//**************************************************************************
+
+long  PreHead(FILE *read1, int *word)
+   {
+
+   if (fread(word, sizeof(int), HEAD_LEN, read1) != (size_t) HEAD_LEN)
+      return 0;
+
+   if ((word[0] <= 0) || (word[1] <= 0) || (word[2] <= 0) || (word[23] < 0))
+      return 0;
+
+   return (long) word[0] * word[1] * word[2];
+
+   }
+
+//**************************************************************************
+//** PRE DROP function:  Closes the reads ahead whose last MAPIN or MASKI **
+//**    the script has passed without using them (the command failed      **
+//**    first), so their memory is not held to the end.                   **
+//**************************************************************************
+
+void  PreDrop()
+   {
+
+   long     at = pre_buf.pubseekoff(0, ios::cur, ios::in);
+
+   int      count1;
+
+   for (count1 = 0; count1 < pre_num; count1 ++)
+      if (!pre_list[count1].used && (pre_list[count1].pos <= at))
+         {
+         pre_list[count1].used = 1;
+         pthread_join(pre_list[count1].tid, NULL);
+
+         if (pre_list[count1].fd >= 0) close(pre_list[count1].fd);
+         pre_list[count1].fd = -1;
+         }
+
+   return;
+
+   }
+
+//**************************************************************************
+//** PRE OPEN function:  Opens a map or mask for MAPIN or MASKI.  If it   **
+//**    is being read ahead, waits for that read and opens the copy in   **
+//**    memory (already decoded, so *zip is 0).  Otherwise as ZipOpen.   **
+//**************************************************************************
+
+FILE  *PreOpen(const char *file, int *zip)
+   {
+
+   int      count1;
+
+   FILE     *read1;
+
+   for (count1 = 0; count1 < pre_num; count1 ++)
+      if (!pre_list[count1].used && !strcmp(pre_list[count1].file, file))
+         {
+         pre_list[count1].used = 1;
+         pthread_join(pre_list[count1].tid, NULL);
+
+         if (pre_list[count1].fd < 0)              // Plain, or read failed:
+            break;                                 //    from the file
+
+         lseek(pre_list[count1].fd, 0, SEEK_SET);
+
+         if ((read1 = fdopen(pre_list[count1].fd, "rb")) == NULL)
+            {
+            close(pre_list[count1].fd);
+            break;
+            }
+
+         *zip = 0;
+         return read1;
+         }
+
+   return ZipOpen(file, "rb", zip);
+
+   }
+
+//**************************************************************************
+//** BOX FULL function:  Before the header of map1 is made that of the    **
+//**    box, checks the whole map in the file has the size and cell grid  **
+//**    of the whole principal map (or notes them, for the principal      **
+//**    map).  Returns 1, with a table, when they differ.                 **
+//**************************************************************************
+
+int   BoxFull(int map1, const char *name, int mem)
+   {
+
+   int      full[6];
+   int      n[3]    = { MAP_H[map1].NC,   MAP_H[map1].NR,   MAP_H[map1].NS   };
+   int      axis[3] = { MAP_H[map1].MAPC, MAP_H[map1].MAPR, MAP_H[map1].MAPS };
+   int      count1;
+
+   const char *row[6] = {"COLUMNS ", "ROWS    ", "SECTIONS",
+                         "CELL X  ", "CELL Y  ", "CELL Z  "};
+
+   for (count1 = 0; count1 <= 2; count1 ++)        // In the layout held
+      if (axis_on && AxisValid(axis))
+         full[axis[count1] - 1] = n[count1];
+      else
+         full[count1] = n[count1];
+
+   full[3] = MAP_H[map1].NX;
+   full[4] = MAP_H[map1].NY;
+   full[5] = MAP_H[map1].NZ;
+
+   if (mem)
+      {
+      memcpy(box_full, full, sizeof(box_full));
+      return 0;
+      }
+
+   if (!memcmp(box_full, full, sizeof(box_full)))
+      return 0;
+
+   cout  << "   " << name << " => MAP SIZES DO NOT MATCH !!!\n"
+         << "   " << name << " =>          CORRECT     CURRENT\n";
+
+   for (count1 = 0; count1 <= 5; count1 ++)
+      {
+      cout  << "   " << name << " => " << row[count1] << " ";
+      cout.width(7); cout << box_full[count1] << "     ";
+      cout.width(7); cout << full[count1] << "\n";
+      }
+
+   return 1;
+
+   }
+
+//**************************************************************************
+//** BOX HEADER function:  Notes where the MAPBOX box lies in the file    **
+//**    just opened, then makes the header of location map1 that of the  **
+//**    box, with the box origin in NCSTART, NRSTART and NSSTART.         **
+//**************************************************************************
+
+void  BoxHead(FILE *read1, int map1, box_src *src)
+   {
+
+   int      count1;
+   int      count2;
+
+   int      grid[3] = { MAP_H[map1].NX,   MAP_H[map1].NY,   MAP_H[map1].NZ   };
+   int      axis[3] = { MAP_H[map1].MAPC, MAP_H[map1].MAPR, MAP_H[map1].MAPS };
+
+   src->n[0]  = MAP_H[map1].NC;
+   src->n[1]  = MAP_H[map1].NR;
+   src->n[2]  = MAP_H[map1].NS;
+
+   src->lo[0] = MAP_H[map1].NCSTART;
+   src->lo[1] = MAP_H[map1].NRSTART;
+   src->lo[2] = MAP_H[map1].NSSTART;
+
+   for (count1 = 0; count1 <= 2; count1 ++)        // Cell repeat along
+      {                                            //    each file axis
+      if ((axis[count1] >= 1) && (axis[count1] <= 3))
+         src->per[count1] = grid[axis[count1] - 1];
+      else
+         src->per[count1] = src->n[count1];
+
+      if (src->per[count1] < 1) src->per[count1] = src->n[count1];
+      }
+
+   src->data = ftell(read1);
+
+   for (count1 = 0; count1 <= 2; count1 ++)        // Box given along the
+      {                                            //    principal file axes
+      src->blo[count1] = box_lo[count1];
+      src->bn[count1]  = box_n[count1];
+      }
+
+   if (axis_on && AxisValid(axis))                 // This file may differ
+      for (count1 = 0; count1 <= 2; count1 ++)
+         for (count2 = 0; count2 <= 2; count2 ++)
+            if (file_ax[count2] == axis[count1])
+               {
+               src->blo[count1] = box_lo[count2];
+               src->bn[count1]  = box_n[count2];
+               }
+
+   MAP_H[map1].NC      = src->bn[0];
+   MAP_H[map1].NR      = src->bn[1];
+   MAP_H[map1].NS      = src->bn[2];
+
+   MAP_H[map1].NCSTART = src->blo[0];
+   MAP_H[map1].NRSTART = src->blo[1];
+   MAP_H[map1].NSSTART = src->blo[2];
+
+   return;
+
+   }
+
+//**************************************************************************
+//** BOX WRAP function:  Index in the file of box grid point g along file **
+//**    axis c, moving g by whole unit cells if needed.  -1 if the point  **
+//**    is not in the file.                                               **
+//**************************************************************************
+
+int   BoxWrap(const box_src *src, int c, int g)
+   {
+
+   int      i = (((g - src->lo[c]) % src->per[c]) + src->per[c]) % src->per[c];
+
+   return (i < src->n[c]) ? i : -1;
+
+   }
+
+//**************************************************************************
+//** READ BOX function:  Reads the MAPBOX box from file descriptor fd     **
+//**    into dest, elem bytes per voxel.  Each row is read with one pread **
+//**    per run of neighbouring file columns, so only the box is read.    **
+//**    Points outside the file are set to zero.                          **
+//**************************************************************************
+
+int   ReadBox(int fd, const box_src *src, char *dest, int elem)
+   {
+
+   int      x;
+   int      y;
+   int      z;
+
+   int      ix;
+   int      iy;
+   int      iz;
+
+   int      run;
+
+   long     want;
+
+   char     *row;
+
+   for (z = 0; z < src->bn[2]; z ++)
+      for (y = 0; y < src->bn[1]; y ++)
+         {
+         row = dest + (((((long) z * src->bn[1]) + y) * src->bn[0]) * elem);
+
+         iz  = BoxWrap(src, 2, src->blo[2] + z);
+         iy  = BoxWrap(src, 1, src->blo[1] + y);
+
+         if ((iy < 0) || (iz < 0))
+            {
+            memset(row, 0, (long) src->bn[0] * elem);
+            continue;
+            }
+
+         for (x = 0; x < src->bn[0]; x += run)
+            {
+            ix  = BoxWrap(src, 0, src->blo[0] + x);
+            run = 1;
+
+            if (ix < 0)
+               {
+               memset(row + ((long) x * elem), 0, elem);
+               continue;
+               }
+
+            while ( (x + run < src->bn[0]) &&
+                    (BoxWrap(src, 0, src->blo[0] + x + run) == ix + run) )
+               run ++;
+
+            want = (long) run * elem;
+
+            if (pread(fd, row + ((long) x * elem), want,
+                      src->data + ((((((long) iz * src->n[1]) + iy)
+                                     * src->n[0]) + ix) * elem)) != want)
+               return 1;
+            }
+         }
+
+   return 0;
+
+   }
+
+//**************************************************************************
+//** AXIS VALID function:  1 if MAPC, MAPR and MAPS (ax) are 1, 2 and 3   **
+//**    in some order.                                                    **
+//**************************************************************************
+
+int   AxisValid(const int ax[3])
+   {
+
+   return (ax[0] >= 1) && (ax[0] <= 3) && (ax[1] >= 1) && (ax[1] <= 3) &&
+          (ax[2] >= 1) && (ax[2] <= 3) && (ax[0] != ax[1]) &&
+          (ax[0] != ax[2]) && (ax[1] != ax[2]);
+
+   }
+
+//**************************************************************************
+//** AXIS HEADER function:  Rewrites the sizes and starts of a header     **
+//**    for the axis order ax (MAPC, MAPR, MAPS).  {1, 2, 3} is the x     **
+//**    fastest layout maps are held in; the file order is put back for   **
+//**    writing.                                                          **
+//**************************************************************************
+
+void  AxisHead(map_header *head, const int ax[3])
+   {
+
+   int      now[3] = {head->MAPC, head->MAPR, head->MAPS};
+   int      n[3];
+   int      st[3];
+
+   if (!AxisValid(now) || !AxisValid(ax)) return;
+
+   n[now[0] - 1] = head->NC;   st[now[0] - 1] = head->NCSTART;
+   n[now[1] - 1] = head->NR;   st[now[1] - 1] = head->NRSTART;
+   n[now[2] - 1] = head->NS;   st[now[2] - 1] = head->NSSTART;
+
+   head->NC   = n[ax[0] - 1];   head->NCSTART = st[ax[0] - 1];
+   head->NR   = n[ax[1] - 1];   head->NRSTART = st[ax[1] - 1];
+   head->NS   = n[ax[2] - 1];   head->NSSTART = st[ax[2] - 1];
+
+   head->MAPC = ax[0];
+   head->MAPR = ax[1];
+   head->MAPS = ax[2];
+
+   return;
+
+   }
+
+//**************************************************************************
+//** AXIS STRIDE function:  For a file with axis order ax, its number of  **
+//**    columns, rows and sections (n) and the step in the x fastest      **
+//**    layout that each of them takes (stride).                          **
+//**************************************************************************
+
+void  AxisStride(const int ax[3], int n[3], long stride[3])
+   {
+
+   int      lim[3]  = {X_LIM, Y_LIM, Z_LIM};
+   long     step[3] = {1, X_LIM, XY_LIM};
+
+   int      count1;
+
+   for (count1 = 0; count1 <= 2; count1 ++)
+      {
+      n[count1]      = lim [ax[count1] - 1];
+      stride[count1] = step[ax[count1] - 1];
+      }
+
+   return;
+
+   }
+
+//**************************************************************************
+//** AXIS COPY function:  Copies one section of nc columns by nr rows     **
+//**    from in (file order) to out, where a column step is sc and a row  **
+//**    step sr elements.  Done in AXIS_TILE square blocks, so that both  **
+//**    the reads and the scattered writes stay in cache.                 **
+//**************************************************************************
+
+void  AxisCopy(const char *in, int nc, int nr, long sc, long sr,
+               char *out, int elem)
+   {
+
+   int      c0;
+   int      r0;
+   int      c1;
+   int      r1;
+   int      c;
+   int      r;
+
+   if (sc == 1)                                    // Rows stay whole
+      {
+      for (r = 0; r < nr; r ++)
+         memcpy(out + (r * sr * elem), in + ((long) r * nc * elem),
+                (long) nc * elem);
+      return;
+      }
+
+   for (r0 = 0; r0 < nr; r0 += AXIS_TILE)
+      for (c0 = 0; c0 < nc; c0 += AXIS_TILE)
+         {
+         r1 = (r0 + AXIS_TILE < nr) ? r0 + AXIS_TILE : nr;
+         c1 = (c0 + AXIS_TILE < nc) ? c0 + AXIS_TILE : nc;
+
+         if (elem == sizeof(float))
+            for (c = c0; c < c1; c ++)
+               for (r = r0; r < r1; r ++)
+                  ((float *) out)[c * sc + r * sr] =
+                     ((const float *) in)[(long) r * nc + c];
+         else
+            for (c = c0; c < c1; c ++)
+               for (r = r0; r < r1; r ++)
+                  out[c * sc + r * sr] = in[(long) r * nc + c];
+         }
+
+   return;
+
+   }
+
+//**************************************************************************
+//** READ AXES function:  Reads the voxels of a file with axis order ax   **
+//**    one section at a time, putting each into dest in the x fastest    **
+//**    layout.  Returns 1 if the file is short.                          **
+//**************************************************************************
+
+int   ReadAxes(FILE *read1, const int ax[3], char *dest, int elem)
+   {
+
+   int      n[3];
+   int      count1;
+
+   long     stride[3];
+   long     len;
+
+   AxisStride(ax, n, stride);
+
+   len = (long) n[0] * n[1];
+
+   vector<char> sec(len * elem);
+
+   for (count1 = 0; count1 < n[2]; count1 ++)
+      {
+      if (fread(&sec[0], elem, len, read1) != (size_t) len)
+         return 1;
+
+      AxisCopy(&sec[0], n[0], n[1], stride[0], stride[1],
+               dest + (count1 * stride[2] * elem), elem);
+      }
+
+   return 0;
+
+   }
+
+//**************************************************************************
+//** AXIS LOAD function:  As READ AXES, from a copy of the voxels         **
+//**    already in memory (a MAPBOX box, read in file order).             **
+//**************************************************************************
+
+void  AxisLoad(const char *in, const int ax[3], char *dest, int elem)
+   {
+
+   int      n[3];
+   int      count1;
+
+   long     stride[3];
+   long     len;
+
+   AxisStride(ax, n, stride);
+
+   len = (long) n[0] * n[1];
+
+   for (count1 = 0; count1 < n[2]; count1 ++)
+      AxisCopy(in + (count1 * len * elem), n[0], n[1], stride[0], stride[1],
+               dest + (count1 * stride[2] * elem), elem);
+
+   return;
+
+   }
+
+//**************************************************************************
+//** WRITE AXES function:  Writes src (x fastest) to a file with axis     **
+//**    order ax, one row at a time.  Returns 1 if the disk is full.      **
+//**************************************************************************
+
+int   WriteAxes(FILE *write1, const int ax[3], const char *src, int elem)
+   {
+
+   int      n[3];
+   int      count1;
+   int      count2;
+   int      count3;
+
+   long     stride[3];
+   const char *at;
+
+   AxisStride(ax, n, stride);
+
+   vector<char> row(n[0] * elem);
+
+   for (count1 = 0; count1 < n[2]; count1 ++)
+      for (count2 = 0; count2 < n[1]; count2 ++)
+         {
+         at = src + ((count1 * stride[2]) + (count2 * stride[1])) * elem;
+
+         if (stride[0] == 1)
+            memcpy(&row[0], at, n[0] * elem);
+         else if (elem == sizeof(float))
+            for (count3 = 0; count3 < n[0]; count3 ++)
+               ((float *) &row[0])[count3] =
+                  ((const float *) at)[count3 * stride[0]];
+         else
+            for (count3 = 0; count3 < n[0]; count3 ++)
+               row[count3] = at[count3 * stride[0]];
+
+         if (fwrite(&row[0], elem, n[0], write1) != (size_t) n[0])
+            return 1;
+         }
+
+   return 0;
+
+   }
+
+//**************************************************************************
+//** FREE MAPS function:  Releases MAP and MSK however they were made.    **
+//**************************************************************************
+
+void  FreeMaps()
+   {
+
+   long     map_len = ((XYZ_LIM * map_mem) + map_mem) * sizeof(float);
+   long     msk_len =  (XYZ_LIM * msk_mem) + msk_mem;
+
+   int      count1;
+
+   if ( MSK && !((MSK >= work_base) && (MSK < work_base + work_len)) )
+      munmap(MSK, msk_len);                        // Assigned by MASKI
+
+   if      (work_base) munmap(work_base, work_len);
+   else if (MAP)       munmap(MAP, map_len);
+
+   MAP       = NULL;
+   MSK       = NULL;
+
+   work_base = NULL;
+   work_len  = 0;
+
+   memset(map_symm, 0, sizeof(map_symm));
+   asu_ok    = -1;
+   grid_ok   = -1;
+
+   cell_list.pdb1 = -1;                            // Principal map, and for
+   part_list.pdb1 = -1;                            //    RESTORE the PDB
+                                                   //    files, replaced
+
+   for (count1 = 0; count1 < 21; count1 ++) MapTouch(count1);
+   for (count1 = 0; count1 < 11; count1 ++) MskTouch(count1);
+
+   return;
+
+   }
+
+//**************************************************************************
+//** SAVE WORKSPACE function:  Writes every map and mask location, the    **
+//**    headers, the stored statistics, the PDB files and the names of    **
+//**    everything to one file.  MAP and MSK start on page boundaries so  **
+//**    RESTORE can map them straight back into memory.                   **
+//**************************************************************************
+
+int   SaveWork(const char *file, char map[][50], char msk[][50],
+               char pdb[][50], float value)
+   {
+
+   FILE     *write1;
+
+   work_head head;
+
+   long     page    = sysconf(_SC_PAGESIZE);
+   long     map_len = ((XYZ_LIM * map_mem) + map_mem) * sizeof(float);
+   long     msk_len = MSK ? ((XYZ_LIM * msk_mem) + msk_mem) : 0;
+
+   int      ok;
+
+   if ((write1 = fopen(file, "wb")) == NULL)       // Write failure
+      return 1;
+
+   memset(&head, 0, sizeof(head));
+
+   head.magic     = WORK_MAGIC;
+   head.version   = 2;
+   head.X_LIM     = X_LIM;
+   head.Y_LIM     = Y_LIM;
+   head.Z_LIM     = Z_LIM;
+   head.X_CELL    = X_CELL;
+   head.Y_CELL    = Y_CELL;
+   head.Z_CELL    = Z_CELL;
+   head.map_mem   = map_mem;
+   head.msk_mem   = msk_mem;
+   head.pdb_mem   = pdb_mem;
+   head.pdb_max   = pdb_max;
+   head.msk_num_1 = msk_num_1;
+   head.DatNum    = DatNum;
+   head.X_GRID    = X_GRID;
+   head.Y_GRID    = Y_GRID;
+   head.Z_GRID    = Z_GRID;
+   head.cel_vol   = cel_vol;
+   head.map_vol   = map_vol;
+   head.vox_vol   = vox_vol;
+   head.value     = value;
+   head.axis_on   = axis_on;
+
+   memcpy(head.file_ax, file_ax, sizeof(file_ax));
+
+   head.pdb_num   = pdb_mem ? ((pdb_max * pdb_mem) + pdb_mem) : 0;
+
+   head.pdb_off   = sizeof(head)    + sizeof(MAP_H)  +
+                    sizeof(map_max) + sizeof(map_min) + sizeof(map_avg) +
+                    sizeof(map_tot) + sizeof(map_num) + sizeof(map_var) +
+                    sizeof(map_rms) + sizeof(PDBdat)  + sizeof(pdb_len) +
+                    (21 * 50) + (11 * 50) + (21 * 50);
+
+   head.map_off   = head.pdb_off + (head.pdb_num * sizeof(pdb_file));
+   head.map_off   = ((head.map_off + page - 1) / page) * page;
+
+   head.msk_off   = head.map_off + map_len;
+   head.msk_off   = ((head.msk_off + page - 1) / page) * page;
+
+   head.len       = msk_len ? (head.msk_off + msk_len)   // No masks yet,
+                            : (head.map_off + map_len);  //    ends at MAP
+
+   fwrite(&head,   sizeof(head),    1, write1);
+   fwrite(MAP_H,   sizeof(MAP_H),   1, write1);
+   fwrite(map_max, sizeof(map_max), 1, write1);
+   fwrite(map_min, sizeof(map_min), 1, write1);
+   fwrite(map_avg, sizeof(map_avg), 1, write1);
+   fwrite(map_tot, sizeof(map_tot), 1, write1);
+   fwrite(map_num, sizeof(map_num), 1, write1);
+   fwrite(map_var, sizeof(map_var), 1, write1);
+   fwrite(map_rms, sizeof(map_rms), 1, write1);
+   fwrite(PDBdat,  sizeof(PDBdat),  1, write1);
+   fwrite(pdb_len, sizeof(pdb_len), 1, write1);
+   fwrite(map,     21 * 50,         1, write1);
+   fwrite(msk,     11 * 50,         1, write1);
+   fwrite(pdb,     21 * 50,         1, write1);
+
+   if (head.pdb_num)
+      fwrite(PDB, sizeof(pdb_file), head.pdb_num, write1);
+
+   fseek (write1, head.map_off, SEEK_SET);
+   fwrite(MAP, 1, map_len, write1);
+
+   if (msk_len)
+      {
+      fseek (write1, head.msk_off, SEEK_SET);
+      fwrite(MSK, 1, msk_len, write1);
+      }
+
+   ok = !ferror(write1);
+
+   if (fclose(write1) || !ok)
+      return 1;
+
+   return 0;
+
+   }
+
+//**************************************************************************
+//** RESTORE WORKSPACE function:  Maps a SAVE file copy-on-write in place **
+//**    of MAP and MSK, so no voxel is read until it is used, and copies  **
+//**    back the headers, statistics, names and PDB files.                **
+//**************************************************************************
+
+int   RestWork(const char *file, char map[][50], char msk[][50],
+               char pdb[][50], float *value)
+   {
+
+   work_head head;
+
+   struct stat info;
+
+   int      fd;
+   int      count1;
+   int      lens[10];                      // pdb_len in the file
+
+   long     map_len;
+   long     msk_len;
+
+   double   xyz;
+
+   char     *base;
+   char     *at;
+
+   if ((fd = open(file, O_RDONLY)) < 0)            // Read failure
+      return 1;
+
+   if ( (pread(fd, &head, sizeof(head), 0) != (ssize_t) sizeof(head)) ||
+        (head.magic != WORK_MAGIC) || (head.version != 2)              ||
+        fstat(fd, &info) || (info.st_size < head.len)                   )
+      {
+      close(fd);
+      return 1;
+      }
+
+   // ************** CHECK THE SIZES AGAINST MEMORY AND FILE **************
+
+   xyz     = (double) head.X_LIM * head.Y_LIM * head.Z_LIM;
+   map_len = ((long) (xyz * head.map_mem) + head.map_mem) * sizeof(float);
+   msk_len =  (long) (xyz * head.msk_mem) + head.msk_mem;
+
+   if ( (head.X_LIM < 1) || (head.Y_LIM < 1) || (head.Z_LIM < 1)      ||
+        (xyz * (head.map_mem + 1) * sizeof(float) > head.len)         ||
+        (head.map_mem < 1) || (head.msk_mem < 0)                      ||
+        (head.msk_mem > 10) || (head.map_mem + head.msk_mem > 21)     ||
+        (head.pdb_mem < 0)  || (head.pdb_mem > 10) || (head.pdb_max < 0) ||
+        (head.DatNum < 0)   || (head.DatNum > 99)                     ||
+        (head.pdb_num != (head.pdb_mem ? ((long) head.pdb_max *
+                          head.pdb_mem) + head.pdb_mem : 0))          ||
+        (head.pdb_off != (long) (sizeof(head) + sizeof(MAP_H) +
+                          sizeof(map_max) + sizeof(map_min) +
+                          sizeof(map_avg) + sizeof(map_tot) +
+                          sizeof(map_num) + sizeof(map_var) +
+                          sizeof(map_rms) + sizeof(PDBdat)  +
+                          sizeof(pdb_len) + (21 * 50) + (11 * 50) +
+                          (21 * 50)))                                 ||
+        (head.map_off < head.pdb_off + (head.pdb_num * (long)
+                                        sizeof(pdb_file)))            ||
+        (head.map_off + map_len > head.len)                           ||
+        ( (head.len > head.msk_off) &&
+          ((head.msk_off < head.map_off + map_len) ||
+           (head.msk_off + msk_len > head.len)) )                       )
+      {
+      close(fd);                                   // Damaged or foreign
+      return 1;
+      }
+
+   base = (char *) mmap(NULL, head.len, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE, fd, 0);
+
+   close(fd);
+
+   if (base == MAP_FAILED)
+      return 1;
+
+   memcpy(lens, base + head.pdb_off - (21 * 50) - (11 * 50) - (21 * 50) -
+                sizeof(pdb_len), sizeof(lens));
+
+   for (count1 = 0; count1 < head.pdb_mem; count1 ++)
+      if ((lens[count1] < 0) || (lens[count1] > head.pdb_max))
+         {
+         munmap(base, head.len);
+         return 1;
+         }
+
+   // ****************** LET GO OF THE OLD MAPS AND MASKS ******************
+
+   FreeMaps();
+
+   if (PDB) delete [] PDB;
+
+   PDB       = NULL;
+
+   cell_list.pdb1 = -1;                            // Both lists held atoms
+   part_list.pdb1 = -1;                            //    of the old files
+
+   work_base = base;
+   work_len  = head.len;
+
+   // ************************* COPY BACK THE REST *************************
+
+   X_LIM     = head.X_LIM;
+   Y_LIM     = head.Y_LIM;
+   Z_LIM     = head.Z_LIM;
+   X_CELL    = head.X_CELL;
+   Y_CELL    = head.Y_CELL;
+   Z_CELL    = head.Z_CELL;
+   map_mem   = head.map_mem;
+   msk_mem   = head.msk_mem;
+   pdb_mem   = head.pdb_mem;
+   pdb_max   = head.pdb_max;
+   msk_num_1 = head.msk_num_1;
+   DatNum    = head.DatNum;
+   X_GRID    = head.X_GRID;
+   Y_GRID    = head.Y_GRID;
+   Z_GRID    = head.Z_GRID;
+   cel_vol   = head.cel_vol;
+   map_vol   = head.map_vol;
+   vox_vol   = head.vox_vol;
+   *value    = head.value;
+   axis_on   = head.axis_on;
+
+   memcpy(file_ax, head.file_ax, sizeof(file_ax));
+
+   XY_LIM    = ((long) X_LIM * Y_LIM);
+   XYZ_LIM   = ((long) X_LIM * Y_LIM * Z_LIM);
+   XYZ_CELL  = ((long) X_CELL * Y_CELL * Z_CELL);
+
+   at = base + sizeof(head);
+
+   memcpy(MAP_H,   at, sizeof(MAP_H));     at = at + sizeof(MAP_H);
+   memcpy(map_max, at, sizeof(map_max));   at = at + sizeof(map_max);
+   memcpy(map_min, at, sizeof(map_min));   at = at + sizeof(map_min);
+   memcpy(map_avg, at, sizeof(map_avg));   at = at + sizeof(map_avg);
+   memcpy(map_tot, at, sizeof(map_tot));   at = at + sizeof(map_tot);
+   memcpy(map_num, at, sizeof(map_num));   at = at + sizeof(map_num);
+   memcpy(map_var, at, sizeof(map_var));   at = at + sizeof(map_var);
+   memcpy(map_rms, at, sizeof(map_rms));   at = at + sizeof(map_rms);
+   memcpy(PDBdat,  at, sizeof(PDBdat));    at = at + sizeof(PDBdat);
+   memcpy(pdb_len, at, sizeof(pdb_len));   at = at + sizeof(pdb_len);
+   memcpy(map,     at, 21 * 50);           at = at + (21 * 50);
+   memcpy(msk,     at, 11 * 50);           at = at + (11 * 50);
+   memcpy(pdb,     at, 21 * 50);
+
+   if (head.pdb_num)
+      {
+      PDB = new pdb_file [head.pdb_num];
+      memcpy(PDB, base + head.pdb_off, head.pdb_num * sizeof(pdb_file));
+      }
+
+   MAP = (float *) (base + head.map_off);
+   MSK = (head.len > head.msk_off) ? (base + head.msk_off) : NULL;
+
+   return 0;
+
+   }
+
+//**************************************************************************
+//** SERVER OPEN function:  Listens on the Unix domain socket name.  The  **
+//**    principal map is already in memory, so every client starts with  **
+//**    the maps, masks and PDB files left by the one before it.          **
+//**************************************************************************
+
+int   ServerOpen(const char *name)
+   {
+
+   struct sockaddr_un addr;
+
+   if (strlen(name) >= sizeof(addr.sun_path))      // Name too long
+      return 1;
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strcpy(addr.sun_path, name);
+
+   if ((server_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+      return 1;
+
+   unlink(name);                                   // Left by an old server
+
+   if ( bind(server_fd, (struct sockaddr *) &addr, sizeof(addr)) ||
+        listen(server_fd, 8) )
+      {
+      close(server_fd);
+      server_fd = -1;
+      return 1;
+      }
+
+   server_in  = dup(0);
+   server_out = dup(1);
+
+   signal(SIGPIPE, SIG_IGN);                       // Client may hang up
+   atexit(ServerClean);
+
+   server_buf.attach(cin.rdbuf());
+   cin.rdbuf(&server_buf);
+
+   return 0;
+
+   }
+
+//**************************************************************************
+//** SERVER ACCEPT function:  Waits for the next client and makes its     **
+//**    connection the standard input and output of the program.          **
+//**************************************************************************
+
+int   ServerAccept()
+   {
+
+   int      client;
+
+   cout  << "   MAIN  => Waiting for client on " << server_name << "\n";
+   cout.flush();
+
+   do client = accept(server_fd, NULL, NULL);
+   while ((client < 0) && (errno == EINTR));
+
+   if (client < 0)
+      return 1;
+
+   dup2(client, 0);
+   dup2(client, 1);
+   close(client);
+
+   __fpurge(stdin);                                // Nothing from last client
+   clearerr(stdin);
+   clearerr(stdout);
+
+   server_buf.reset();
+
+   cin.clear();
+   cout.clear();
+
+   server_live = 1;
+
+   return 0;
+
+   }
+
+//**************************************************************************
+//** SERVER NEXT function:  Called on END/QUIT/STOP/EXIT.  In server mode **
+//**    the client is disconnected and 1 is returned unless SHUTDOWN was  **
+//**    given, so that the main loop waits for the next client.           **
+//**************************************************************************
+
+int   ServerNext(const char *input)
+   {
+
+   if (server_fd < 0) return 0;
+
+   if (server_live)
+      {
+      cout  << "\n";
+      cout.flush();
+
+      dup2(server_in,  0);                         // Closes the client
+      dup2(server_out, 1);
+
+      __fpurge(stdin);
+      clearerr(stdin);
+      clearerr(stdout);
+
+      cin.clear();
+      cout.clear();
+
+      server_live = 0;
+
+      cout  << "   MAIN  => Client finished with " << input << "\n";
+      }
+
+   return !server_end;
+
+   }
+
+//**************************************************************************
+//** SERVER CLEAN function:  Removes the socket.  Called on exit.         **
+//**************************************************************************
+
+void  ServerClean()
+   {
+
+   if (server_fd >= 0)
+      {
+      close(server_fd);
+      unlink(server_name);
+      server_fd = -1;
+      }
+
+   return;
+
+   }
+
+//**************************************************************************
+//** COMMAND BUFFER underflow:  Reads the next line from the client.  A   **
+//**    line starting with { is a JSON command and is handed on as the    **
+//**    keyword line Json2Key makes of it.                                **
+//**************************************************************************
+
+int   cmd_buf::underflow()
+   {
+
+   int      ch;
+
+   size_t   first;
+
+   if (gptr() < egptr())
+      return traits_type::to_int_type(*gptr());
+
+   line.clear();
+
+   while ((ch = source->sbumpc()) != traits_type::eof())
+      {
+      line += (char) ch;
+      if (ch == '\n') break;
+      }
+
+   if (line.empty())
+      return traits_type::eof();
+
+   first = line.find_first_not_of(" \t");
+
+   if ((first != string::npos) && (line[first] == '{'))
+      line = Json2Key(line);
+
+   setg(&line[0], &line[0], &line[0] + line.size());
+
+   return traits_type::to_int_type(*gptr());
+
+   }
+
+//**************************************************************************
+//** JSON TO KEYWORD function:  Turns one JSON command such as            **
+//**       {"cmd":"RFAC","args":[1,2,"IN",1,6]}                           **
+//**    into the keyword line "RFAC 1 2 IN 1 6".  Strings and numbers are **
+//**    copied as they are, so the arguments follow the keyword prompts.  **
+//**************************************************************************
+
+string Json2Key(const string &line)
+   {
+
+   string   key;                                   // Last object key
+   string   tok;
+   string   cmd;
+   string   args;
+
+   size_t   pos = 0;
+   size_t   next;
+
+   while (pos < line.size())
+      {
+      if (line[pos] == '"')                        // String
+         {
+         tok = "";
+
+         for (pos ++; (pos < line.size()) && (line[pos] != '"'); pos ++)
+            {
+            if ((line[pos] == '\\') && (pos + 1 < line.size())) pos ++;
+            tok += line[pos];
+            }
+
+         pos ++;
+         }
+
+      else if (isalnum(line[pos]) || strchr("+-.", line[pos]))
+         {                                         // Number, true, false
+         tok = "";
+
+         while ( (pos < line.size()) &&
+                 (isalnum(line[pos]) || strchr("+-.", line[pos])) )
+            tok += line[pos ++];
+         }
+
+      else                                         // Brackets, commas
+         {
+         pos ++;
+         continue;
+         }
+
+      next = line.find_first_not_of(" \t\r\n", pos);
+
+      if ((next != string::npos) && (line[next] == ':'))
+         {
+         key = tok;
+         pos = next + 1;
+         }
+      else if (key == "cmd")  cmd  = tok;
+      else if (key == "args") args = args + " " + tok;
+      }
+
+   if (cmd.empty())
+      cout  << "   MAIN  => JSON command has no \"cmd\".\n";
+
+   return cmd + args + "\n";
+
+   }
+
+//**************************************************************************
+//** CELL VOLUME function:  Calculates the unit cell volume               **
+//**************************************************************************
+
+float cell_volume(float A, float B, float C, float a, float b, float c)
+   {
+   return   (2*A*B*C) * pow(  (  (sin((+a+b+c)*PI/360))   *
+                                 (sin((-a+b+c)*PI/360))   *
+                                 (sin((+a-b+c)*PI/360))   *
+                                 (sin((+a+b-c)*PI/360))     ), 0.5);
+   }
+
+//**************************************************************************
+//** KEYS function:  Displays control keys and arguments in a list.       **
+//**************************************************************************
+
+void Keys()
+   {
+   cout 
+   << "   KEYS  => HELP                          KEYS\n"
+   << "   KEYS  => LIST                          STATS\n"
+   << "   KEYS  =>\n"
+   << "   KEYS  => MAPIN X1 'name'               MASKI X2 'name'\n"
+   << "   KEYS  => MAPBOX x y z nx ny nz         MTZIN X1 'name' F PHI\n"
+   << "   KEYS  => NAME {type}{loc} 'name'\n"
+   << "   KEYS  =>\n"
+   << "   KEYS  => MAXMS Y1 Y2 Y3                MINMS Y1 Y2 Y3\n"
+   << "   KEYS  => FLIP  Y1 Y2\n"
+   << "   KEYS  =>\n"
+   << "   KEYS  => PDBIN {num}{len} P1 'name'    PDBOU P1 'name'\n"
+   << "   KEYS  => PDBDA P1 'name'               OCCUP P1 X1\n" 
+   << "   KEYS  => MODELMAP X1 P1 B              SYMMETRIC X1 YES/NO\n"
+   << "   KEYS  => WINDOW X1 X2 P1 N R           PAINT Y1 P1 R\n"
+   << "   KEYS  => NEAR P1 A R                   PARTITION P1 R YES/NO\n"
+   << "   KEYS  => DISTMAP X1 P1 A1 A2 D         BELOW Y1 X1 V\n"
+   << "   KEYS  => RFSWEEP X1 X2 X3 D N T\n"
+   << "   KEYS  => CUTSWEEP X1 X2 IN/OUT/TOTAL Y1 MIN MAX N T\n"
+   << "   KEYS  => LABEL MASK Y1/MAP X2 V C N X1 X3\n"
+   << "   KEYS  => REGIONSTATS X1 X3\n"
+   << "   KEYS  =>\n"
+   << "   KEYS  => RFAC X1 X2 IN/OUT/TOTAL Y1    RMS X1 IN/OUT/TOTAL Y1\n"
+   << "   KEYS  => SMEAR X1 X2 X3 N              MAXOF X1 X2 X3\n"
+   << "   KEYS  => ROUGH X1 X2 N                 BRICK n\n"
+   << "   KEYS  => SCALE X1 Y1 IN/OUT X2         ZERO X1 IN/OUT X2\n"
+   << "   KEYS  => ADD X1 Y1 IN/OUT X2           SUB X1 Y1 IN/OUT X2\n"
+   << "   KEYS  => COMB X1 Y1 IN/OUT/TOTAL X2 F  CUT X1 IN/OUT X2 MIN MAX\n"
+   << "   KEYS  => AVG X1 IN/OUT                 NEG\n"
+   << "   KEYS  => PLUS X1 IN/OUT X2 VALUE/F     MULT X1 IN/OUT/TOTAL X2 F\n"
+   << "   KEYS  =>\n"
+   << "   KEYS  => WRITE X1 'name'               END, QUIT, STOP, EXIT\n"
+   << "   KEYS  => MASKO Y1 'name'               SHUTDOWN (server mode)\n"
+   << "   KEYS  => SAVE 'name'                   RESTORE 'name'\n"
+   << "   KEYS  =>\n"
+   << "   KEYS  => GRAY 'name' n X1 X1Start X1Step ... Xn XnStart XnStep\n"
+   << "   KEYS  =>    x1 x2 y1 y2 z1 z2\n";
+   return;
+   }
+
+//**************************************************************************
+//** GET ENTRY function:  Gets an entry from the console (like cin), but  **
+//**    won't go beyond the end of the line (returns null if an entry is  **
+//**    requested but a line feed is the next character in the stream).   **
+//**************************************************************************
+
+char *get_entry()
+   {
+   int         len = 0;
+   char        ch;
+   static char input[20] = "";
+
+   while (cin.get(ch))
+      {
+      if (ch == '\n')
+         {
+         cin.putback(ch);
+         input[len] = '\0';
+         return input;
+         }
+
+      if (isgraph(ch))
+         {
+         input[len] = ch;
+         len ++;
+
+         ch = cin.peek();
+         if (ch == ' ')
+            {
+            input[len] = '\0';
+            return input;
+            }
+         }
+      }
+   return 0;
+   }
+
+//**************************************************************************
+//** UPPER function:  Transforms a string to ALL CAPS.                    **
+//**************************************************************************
+
+char  *upper(char input[20])
+   {
+
+   static char output[20];
+   strcpy(output, input);
+
+   int         count1;
+   int         end         = strlen(output) - 1;
+
+   for (count1 = 0; count1 <= end; count1 ++)
+      if ((output[count1] >= 97) && (output[count1] <= 122))
+         output[count1] = (output[count1] - 32);
+
+   return output;
+
+   }
+
+//**************************************************************************
+//** Change a string to its float equivalent, discarding any              **
+//** non-numericals (so that 12.5, +12.5, **12.5**, and A12b.5 will all   **
+//** return as 12.5).                                                     **
+//**************************************************************************
+
+float Ch2float(char input[15])
+   {
+
+   int      count1;
+
+   int      number      = 0;
+   float    result      = 0;
+
+   int      digits      = 0;
+   float    digit[10];
+
+   int      mult        = +1;
+   int      dec         = 0;
+
+   for (count1 = 0; (count1 < 15 && input[count1]); count1 ++)
+      {
+      if ((input[count1] >= 48) && (input[count1] <=57))
+         {
+         number ++;
+         digit[number] = input[count1] - 48;
+         }
+      else if (input[count1] == '.')   // Keep track of the decimal location
+         {
+         digits = number;
+         dec    = 1;
+         }
+
+      else if (input[count1] == '-')   // Negative numbers
+         mult = -1;
+      }
+
+   if (!dec) digits = number;
+
+   for (count1 = 1; count1 <= number; count1 ++)
+      result = result + (  digit[count1]                 *
+                           pow(10.0, (digits - count1))     );
+
+   return (result * mult);
+
+   }
+
+//**************************************************************************
+//** ZONE FIND function:  Find zone in mask region.                       **
+//**************************************************************************
+
+int   zone_find(char input[15])
+   {
+
+   char key[10];
+   int  zone;
+
+   cout  << "   " << input << "Operate IN/OUT of mask, or TOTAL? ";
+   cin   >> key;
+
+        if (key[0] == 'I' || key[0] == 'i') zone = 1;
+   else if (key[0] == 'O' || key[0] == 'o') zone = 0;
+   else zone = 2;
+
+   return zone;
+   }
+
+//**************************************************************************
+//** DISTANCE function:  X, Y, Z distance => Returns angstrom distance    **
+//** between two points separated by X grid points, Y grid points, and    **
+//** Z grid points in the x, y, and z directions.                         **
+//**************************************************************************
+
+float distance(int X, int Y, int Z)
+   {
+   float x1 = ((X * 1.0)/ X_CELL);
+   float y1 = ((Y * 1.0)/ Y_CELL);
+   float z1 = ((Z * 1.0)/ Z_CELL);
+
+   float x2 = MAP_H[0].CELL[0];
+   float y2 = MAP_H[0].CELL[1];
+   float z2 = MAP_H[0].CELL[2];
+
+   float a  = MAP_H[0].CELL[3];
+   float b  = MAP_H[0].CELL[4];
+   float c  = MAP_H[0].CELL[5];
+
+   float answer;
+
+   answer = x1 * x1 * x2 * x2                         +
+            y1 * y1 * y2 * y2                         +
+            z1 * z1 * z2 * z2                         +
+            x1 * y1 * x2 * y2 * 2 * cos(c * PI / 360) +
+            x1 * z1 * x2 * z2 * 2 * cos(b * PI / 360) +
+            y1 * z1 * y2 * z2 * 2 * cos(a * PI / 360)   ;
+
+   return (sqrt(answer));
+   }
+
+//**************************************************************************
+//** MINIMUM VALUE function: Finds the smallest of two numbers.           **
+//**************************************************************************
+
+float Min(float v1, float v2)
+   {
+   if (v1 < v2) return v1;
+   return v2;
+   }
+
+//**************************************************************************
+//** ABSOLUTE VALUE function: Finds the absolute value of a float.        **
+//**************************************************************************
+
+float Abs(float value)
+   {
+   return sqrt(value * value);
+   }
+
+//**************************************************************************
+//** GAUSSIAN function:  Returns value of a gaussian of width B at dist.  **
+//**************************************************************************
+
+float Gauss(float S, float X)
+   {
+   return (  (1/(sqrt(PI)*S)) * (pow(E,-((X*X)/(S*S)))   )   );
+   }
+
+//**************************************************************************
+//** FIND XYZ COORDINATE FUNCTION: X=(M)x and x=(M-1)X                    **
+//** Both X and x are positions vectors in real space, but:               **
+//**    X is a position vector in cartesian  coordinates (Angstroms)      **
+//**    x is a position vector in fractional coordinates (dimensionless)  **
+//**************************************************************************
+
+//**************************************************************************
+//** Calculate X in fractional coordinates from X in real coordinates     **
+//**************************************************************************
+
+int      C2C_X( int type,
+                float X1, float Y1, float Z1,
+                float A , float B , float C ,
+                float a , float b , float c   )
+   {
+
+   float value;
+
+   float G = sqrt( 1 - cos(a)*cos(a)
+                     - cos(b)*cos(b)
+                     - cos(c)*cos(c)
+                     + 2*cos(a)*cos(b)*cos(c)  );
+
+   float P = 1 / ( sqrt (1 + (2 * cos (a)) ) );
+   float Q = 1 / ( sqrt (1 - (1 * cos (a)) ) );
+
+   if      (type == 0)
+      value = ( X1 * sin(a) / (A * G) );
+
+   else if (type == 1)
+      value = ( + ( X1 / A                                          )
+                - ( Y1 / (A * tan(c) )                              )
+                + ( Z1 * ( cos(a)*cos(c)-cos(b) )/(A * G * sin (c)) ) );
+
+   else
+      value = (  ( + X1 * ((1/P) + (2/Q))
+                   + Y1 * ((1/P) - (1/Q))
+                   + Z1 * ((1/P) - (1/Q))  )
+                   / (3 * A)                  );
+
+   return (value * X_CELL);
+
+   }
+
+//**************************************************************************
+//** Calculate X in real coordinates from X in fractional coordinates     **
+//**************************************************************************
+
+float    C2C_x( int type,
+                float x1, float y1, float z1,
+                float A , float B , float C ,
+                float a , float b , float c   )
+   {
+
+   float G = sqrt( 1 - cos(a)*cos(a)
+                     - cos(b)*cos(b)
+                     - cos(c)*cos(c)
+                     + 2*cos(a)*cos(b)*cos(c)  );
+
+   float P = 1 / ( sqrt (1 + (2 * cos (a)) ) );
+   float Q = 1 / ( sqrt (1 - (1 * cos (a)) ) );
+
+   if      (type == 0)
+      return ( x1 * A * G / sin(a));
+
+   else if (type == 1)
+      return ( + ( x1 * A            )
+               + ( y1 * B * cos(c)   )
+               + ( z1 * C * cos(b)   )  );
+
+   else
+      return (  ( + x1 * ((1*P) + (2*Q))
+                  + y1 * ((1*P) - (1*Q))
+                  + z1 * ((1*P) - (1*Q))  )
+                  * (A / 3)                  );
+   }
+
+//**************************************************************************
+//** Calculate Y in fractional coordinates from Y in real coordinates     **
+//**************************************************************************
+
+int      C2C_Y( int type,
+                float X1, float Y1, float Z1,
+                float A , float B , float C ,
+                float a , float b , float c   )
+   {
+
+   float value;
+
+   float G = sqrt( 1 - cos(a)*cos(a)
+                     - cos(b)*cos(b)
+                     - cos(c)*cos(c)
+                     + 2*cos(a)*cos(b)*cos(c)  );
+
+   float P = 1 / ( sqrt (1 + (2 * cos (a)) ) );
+   float Q = 1 / ( sqrt (1 - (1 * cos (a)) ) );
+
+   if      (type == 0)
+      value = ( + ( X1 * ( cos(a)*cos(b) - cos(c) ) / (B * G * sin(a)) )
+                + ( Y1 / (B * sin(a) )                                 ) );
+
+   else if (type == 1)
+      value = ( + ( Y1 / (B * sin(c) )                                 )
+                + ( Z1 * ( cos(b)*cos(c) - cos(a) ) / (B * G * sin(c)) ) );
+
+   else
+      value = (  ( + X1 * ((1/P) - (1/Q))
+                   + Y1 * ((1/P) + (2/Q))
+                  + Z1 * ((1/P) - (1/Q))  )
+                  / (3 * A)                  );
+
+   return (value * Y_CELL);
+
+   }
+
+//**************************************************************************
+//** Calculate Y in real coordinates from Y in fractional coordinates     **
+//**************************************************************************
+
+float    C2C_y( int type,
+                float x1, float y1, float z1,
+                float A , float B , float C ,
+                float a , float b , float c   )
+   {
+
+   float G = sqrt( 1 - cos(a)*cos(a)
+                     - cos(b)*cos(b)
+                     - cos(c)*cos(c)
+                     + 2*cos(a)*cos(b)*cos(c)  );
+
+   float P = 1 / ( sqrt (1 + (2 * cos (a)) ) );
+   float Q = 1 / ( sqrt (1 - (1 * cos (a)) ) );
+
+   if      (type == 0)
+      return ( + ( x1 * A * ( cos(c) - cos(a)*cos(b) ) / sin(a) )
+               + ( y1 * B * sin(a)                              ) );
+
+   else if (type == 1)
+      return ( + ( y1 * B * sin(c)                              )
+               + ( z1 * C * ( cos(a) - cos(b)*cos(c) ) / sin(c) ) );
+
+   else
+      return (  ( + x1 * ((1*P) - (1*Q))
+                  + y1 * ((1*P) + (2*Q))
+                  + z1 * ((1*P) - (1*Q))  )
+                  * (A / 3)                  );
+   }
+
+//**************************************************************************
+//** Calculate Z in fractional coordinates from Z in real coordinates     **
+//**************************************************************************
+
+int      C2C_Z( int type,
+                float X1, float Y1, float Z1,
+                float A , float B , float C ,
+                float a , float b , float c   )
+   {
+
+   float value;
+
+   float G = sqrt( 1 - cos(a)*cos(a)
+                     - cos(b)*cos(b)
+                     - cos(c)*cos(c)
+                     + 2*cos(a)*cos(b)*cos(c)  );
+
+   float P = 1 / ( sqrt (1 + (2 * cos (a)) ) );
+   float Q = 1 / ( sqrt (1 - (1 * cos (a)) ) );
+
+   if      (type == 0)
+      value = ( + ( X1 * ( cos(a)*cos(c)-cos(b) ) / (C * G * sin (a)) )
+                - ( Y1 / (C * tan(a) )                                )
+                + ( Z1 / C                                            ) );
+
+   else if (type == 1)
+      value = ( Z1 * sin(c) / (C * G) );
+
+   else
+      value = (  ( + X1 * ((1/P) - (1/Q))
+                   + Y1 * ((1/P) - (1/Q))
+                   + Z1 * ((1/P) + (2/Q))  )
+                   / (3 * A)                  );
+
+   return (value * Z_CELL);
+
+   }
+
+//**************************************************************************
+//** Calculate Z in real coordinates from Z in fractional coordinates     **
+//**************************************************************************
+
+float    C2C_z( int type,
+                float x1, float y1, float z1,
+                float A , float B , float C ,
+                float a , float b , float c   )
+   {
+
+   float G = sqrt( 1 - cos(a)*cos(a)
+                     - cos(b)*cos(b)
+                     - cos(c)*cos(c)
+                     + 2*cos(a)*cos(b)*cos(c)  );
+
+   float P = 1 / ( sqrt (1 + (2 * cos (a)) ) );
+   float Q = 1 / ( sqrt (1 - (1 * cos (a)) ) );
+
+   if      (type == 0)
+      return ( + ( x1 * A * cos(b)  )
+               + ( y1 * B * cos(a)  )
+               + ( z1 * C           ) );
+
+   else if (type == 1)
+      return ( z1 * C * G / sin(c)  );
+
+   else
+      return (  ( + z1 * ((1*P) - (1*Q))
+                  + y1 * ((1*P) - (1*Q))
+                  + z1 * ((1*P) + (2*Q))  )
+                  * (A / 3)                  );
+   }
+
+//**************************************************************************
+//** INT function:  Integrates electron density for sphere.               **
+//**************************************************************************
+
+float Int(int X, int Y, int Z, float r, int map1)
+   {
+
+   register int   countz;
+   register int   county;
+   register int   countx;
+
+   register int   dZ;
+   register int   dY;
+   register int   dX;
+
+   register int   maxX;
+   register int   minX;
+
+   register int   maxY;
+   register int   minY;
+
+   register int   maxZ;
+   register int   minZ;
+
+   register long  LOC;
+
+   register int   num;
+
+   register double value = 0;
+
+   minX = X - (r/X_GRID) - 1;   maxX = X + (r/X_GRID) + 1;
+   minY = Y - (r/Y_GRID) - 1;   maxY = Y + (r/Y_GRID) + 1;
+   minZ = Z - (r/Z_GRID) - 1;   maxZ = Z + (r/Z_GRID) + 1;
+
+   for (countz = minZ; countz <= maxZ; countz ++)
+      for (county = minY; county <= maxY; county ++)
+         for (countx = minX; countx <= maxX; countx ++)
+            {
+            dX = Abs(X-countx);
+            dY = Abs(Y-county);
+            dZ = Abs(Z-countz);
+
+            if (distance(dX, dY, dZ) > r) continue;
+
+            if ((countx < 1) || (countx > X_LIM) ||    // Mate inside map
+                (county < 1) || (county > Y_LIM) ||
+                (countz < 1) || (countz > Z_LIM))
+               {
+               if ((LOC = SymWrap(countx, county, countz)) < 0) continue;
+               }
+            else
+               LOC = ((countx - 1)          ) +
+                     ((county - 1) * X_LIM  ) +
+                     ((countz - 1) * XY_LIM );
+
+            num ++;
+
+            value = value + MAP[LOC + (map1 * XYZ_LIM)];
+            }
+
+   value = value * vox_vol;
+
+   return value;
+
+   }
+
+//**************************************************************************
+//** INTEGRATE function:  Integrates density for all atoms in pdb file.   **
+//**    When PARTITION was made for the file, each atom takes the points  **
+//**    given to it, so no point is counted twice.                        **
+//**************************************************************************
+
+void  Integrate(int pdb1, int map1)
+   {
+
+   register int count1;
+   register int LOC;
+
+   register long  count2;
+
+   register double value;
+
+   const float *rho = MAP + (map1 * XYZ_LIM);
+
+   if (part_list.pdb1 == pdb1)                     // Disjoint points
+      {
+      for (count1 = 1; count1 <= pdb_len[pdb1]; count1 ++)
+         {
+         value = 0;
+
+         for (count2 = part_list.start[count1];
+              count2 < part_list.start[count1 + 1]; count2 ++)
+            value += rho[part_list.vox[count2]];
+
+         PDB[(pdb_max * pdb1) + count1].Enum = value * vox_vol;
+         }
+
+      return;
+      }
+
+   for (count1 = 1; count1 <= pdb_len[pdb1]; count1 ++)
+      {
+
+      LOC = ((pdb_max * pdb1) + count1);
+
+      if (!PDB[LOC].Type) continue;
+
+      PDB[LOC].Enum = Int(   PDB[LOC].X,
+                             PDB[LOC].Y,
+                             PDB[LOC].Z,
+                             PDBdat[PDB[LOC].Type].r,
+                             map1                      );
+
+      }
+
+   }
+
+//**************************************************************************
+//** RESIDUE VOXELS function:  The sorted locations of the grid points    **
+//**    within r angstroms of atoms first to last of PDB file pdb1 (the   **
+//**    atom radius in the PDB data when r is 0), as INT would visit.     **
+//**    When r is negative, the points PARTITION gave to those atoms.     **
+//**************************************************************************
+
+void  ResVoxels(int pdb1, int first, int last, float r,
+                vector<uint32_t> &list)
+   {
+
+   int      count1;
+   int      countx;
+   int      county;
+   int      countz;
+
+   int      X, Y, Z;
+   int      dX, dY, dZ;
+
+   long     LOC;
+   float    rad;
+
+   list.clear();
+
+   if (r < 0)                                      // Disjoint points
+      {
+      list.assign(part_list.vox.begin() + part_list.start[first],
+                  part_list.vox.begin() + part_list.start[last + 1]);
+
+      sort(list.begin(), list.end());
+
+      return;
+      }
+
+   for (count1 = first; count1 <= last; count1 ++)
+      {
+      LOC = (pdb_max * pdb1) + count1;
+
+      if      (r > 0)            rad = r;
+      else if (PDB[LOC].Type)    rad = PDBdat[PDB[LOC].Type].r;
+      else                       continue;
+
+      X = PDB[LOC].X;   dX = (int) (rad / X_GRID) + 1;
+      Y = PDB[LOC].Y;   dY = (int) (rad / Y_GRID) + 1;
+      Z = PDB[LOC].Z;   dZ = (int) (rad / Z_GRID) + 1;
+
+      for (countz = Z - dZ; countz <= Z + dZ; countz ++)
+         for (county = Y - dY; county <= Y + dY; county ++)
+            for (countx = X - dX; countx <= X + dX; countx ++)
+               {
+               if (distance(Abs(X-countx), Abs(Y-county), Abs(Z-countz))
+                   > rad) continue;
+
+               if ((countx < 1) || (countx > X_LIM) ||    // Mate inside
+                   (county < 1) || (county > Y_LIM) ||    //    the map
+                   (countz < 1) || (countz > Z_LIM))
+                  {
+                  if ((LOC = SymWrap(countx, county, countz)) < 0) continue;
+                  }
+               else
+                  LOC = ((countx - 1)          ) +
+                        ((county - 1) * X_LIM  ) +
+                        ((countz - 1) * XY_LIM );
+
+               list.push_back((uint32_t) LOC);
+               }
+
+      }
+
+   sort(list.begin(), list.end());
+   list.erase(unique(list.begin(), list.end()), list.end());
+
+   return;
+
+   }
+
+//**************************************************************************
+//** WINDOW function:  Real space R factor and correlation of map map1    **
+//**    against map2 over windows of N residues along PDB file pdb1, one  **
+//**    window centred on each residue and cut at chain ends.  A count    **
+//**    of the residues covering each grid point is kept, so from one     **
+//**    window to the next only the points that enter (count up from 0)   **
+//**    or leave (count down to 0) the window change the running sums.    **
+//**************************************************************************
+
+void  Window(int map1, int map2, int pdb1, int N, float r)
+   {
+
+   const float *rho1 = MAP + (map1 * XYZ_LIM);
+   const float *rho2 = MAP + (map2 * XYZ_LIM);
+
+   vector<int>                res;       // First atom of each residue
+   vector<char>               chain;     // Chain of each residue
+   vector< vector<uint32_t> > vox;       // Points of residues in window
+   vector<unsigned char>      cover (XYZ_LIM, 0);
+
+   double   num  = 0;                    // Running sums over the window
+   double   dif  = 0;                    //    sum |r1 - r2|
+   double   tot  = 0;                    //    sum |r1 + r2|
+   double   s1   = 0,   s2 = 0;          //    sum r1, sum r2
+   double   q1   = 0,   q2 = 0;          //    sum r1^2, sum r2^2
+   double   p12  = 0;                    //    sum r1 r2
+
+   double   v1, v2;
+   double   cc;
+   double   var;
+
+   long     moved = 0;                   // Points added or taken away
+   long     seen  = 0;                   // Points in all the windows
+
+   int      count1;
+   int      count2;
+   int      half = (N - 1) / 2;
+   int      lo   = 0,   hi  = -1;        // Residues now in the window
+   int      lo2,        hi2;
+   int      c0   = 0,   c1  = -1;        // Chain of the centre residue
+   long     count3;
+
+   const char *mid;
+   const char *old = NULL;
+
+   for (count1 = 1; count1 <= pdb_len[pdb1]; count1 ++)
+      {                                  // Residues:  columns 18 to 27
+      mid = PDB[(pdb_max * pdb1) + count1].MID;
+
+      if (!old || strncmp(mid + 1, old + 1, 10))
+         {
+         res.push_back(count1);
+         chain.push_back(mid[4]);
+         }
+
+      old = mid;
+      }
+
+   res.push_back(pdb_len[pdb1] + 1);
+   vox.resize(res.size());
+
+   cout  << "   WINDO => -----------------------------------------------\n"
+         << "   WINDO => | Residue    | Points |      RSR     |    CC    |\n"
+         << "   WINDO => |------------|--------|--------------|----------|\n";
+
+   for (count1 = 0; count1 + 1 < (int) res.size(); count1 ++)
+      {
+      if (!count1 || (count1 > c1))     // Next chain
+         for (c0 = c1 = count1; (c1 + 2 < (int) res.size()) &&
+                                (chain[c1+1] == chain[c0]); c1 ++);
+
+      lo2 = count1 - half;          if (lo2 < c0) lo2 = c0;
+      hi2 = count1 - half + N - 1;  if (hi2 > c1) hi2 = c1;
+
+      for (count2 = (hi + 1 > lo2) ? hi + 1 : lo2; count2 <= hi2; count2 ++)
+         {                               // Residues coming in
+         ResVoxels(pdb1, res[count2], res[count2+1] - 1, r, vox[count2]);
+
+         for (count3 = 0; count3 < (long) vox[count2].size(); count3 ++)
+            if (!(cover[vox[count2][count3]] ++))
+               {
+               v1 = rho1[vox[count2][count3]];
+               v2 = rho2[vox[count2][count3]];
+
+               num ++;   dif += fabs(v1 - v2);   tot += fabs(v1 + v2);
+               s1  += v1;   q1 += v1 * v1;   p12 += v1 * v2;
+               s2  += v2;   q2 += v2 * v2;   moved ++;
+               }
+         }
+
+      for (count2 = lo; count2 < lo2 && count2 <= hi; count2 ++)
+         {                               // Residues going out
+         for (count3 = 0; count3 < (long) vox[count2].size(); count3 ++)
+            if (!(-- cover[vox[count2][count3]]))
+               {
+               v1 = rho1[vox[count2][count3]];
+               v2 = rho2[vox[count2][count3]];
+
+               num --;   dif -= fabs(v1 - v2);   tot -= fabs(v1 + v2);
+               s1  -= v1;   q1 -= v1 * v1;   p12 -= v1 * v2;
+               s2  -= v2;   q2 -= v2 * v2;   moved ++;
+               }
+
+         vector<uint32_t>().swap(vox[count2]);
+         }
+
+      if (num == 0)                      // Nothing left:  start clean
+         dif = tot = s1 = s2 = q1 = q2 = p12 = 0;
+
+      lo = lo2;   hi = hi2;   seen += (long) num;
+
+      mid = PDB[(pdb_max * pdb1) + res[count1]].MID;
+
+      cout  << "   WINDO => | ";
+      cout.write(mid + 1, 10);
+      cout  << " | ";
+      cout.width(6);    cout << (long) num << " | ";
+      cout.width(12);
+      if (tot > 0) cout << (dif / tot);  else cout << "-";
+      cout  << " | ";
+
+      var = (num * q1 - s1 * s1) * (num * q2 - s2 * s2);
+      cc  = (var > 0) ? (num * p12 - s1 * s2) / sqrt(var) : 0;
+
+      cout.width(8);    cout << cc << " |\n";
+      }
+
+   cout  << "   WINDO => -----------------------------------------------\n"
+         << "   WINDO => " << (res.size() - 1) << " windows, "
+         << moved << " points added or taken away for " << seen
+         << " points in the windows.\n";
+
+   return;
+
+   }
+
+//**************************************************************************
+//** CELL BUILD function:  The cell list of PDB file pdb1, with cells of  **
+//**    at least edge angstroms across.  Every symmetry mate of every     **
+//**    atom is moved into the unit cell (mates on special positions are  **
+//**    kept once), then the mates are sorted into cells by a count and   **
+//**    a running sum, in time proportional to their number.  The list is **
+//**    kept until PDB file pdb1, the cell or the cell size changes.      **
+//**************************************************************************
+
+atom_cells *CellBuild(int pdb1, float edge)
+   {
+
+   atom_cells *cl = &cell_list;
+
+   vector<float>  f;
+   vector<int>    atom;
+   vector<int>    key;
+
+   double   x[3];
+   double   g[3];
+   double   e;
+
+   int      nop;
+   int      num;
+   int      count1;
+   int      count2;
+   int      count3;
+   int      k;
+   int      j;
+   int      LOC;
+
+   if (edge < 1) edge = 1;
+
+   SymLoad();
+
+   if ((cl->pdb1 == pdb1) && (cl->edge == edge) && (cl->ispg == sym_ispg) &&
+       !memcmp(cl->cell, MAP_H[0].CELL, sizeof(cl->cell)))
+      return cl;
+
+   cl->pdb1 = pdb1;
+   cl->edge = edge;
+   cl->ispg = sym_ispg;
+   memcpy(cl->cell, MAP_H[0].CELL, sizeof(cl->cell));
+
+   CellMatrix(MAP_H[0].CELL, cl->O, cl->F);
+
+   for (k = 0; k <= 2; k ++)                       // Planes of a, b, c are
+      {                                            //    1 / |row of F| apart
+      cl->len[k] = sqrt(cl->F[k][0] * cl->F[k][0] +
+                        cl->F[k][1] * cl->F[k][1] +
+                        cl->F[k][2] * cl->F[k][2]);
+      cl->n[k]   = (int) (1 / (cl->len[k] * edge));
+
+      if (cl->n[k] < 1)   cl->n[k] = 1;
+      if (cl->n[k] > 256) cl->n[k] = 256;
+      }
+
+   nop = sym_ops.size();
+
+   for (count1 = 1; count1 <= pdb_len[pdb1]; count1 ++)
+      {
+      LOC = (pdb_max * pdb1) + count1;
+
+      x[0] = PDB[LOC].x;   x[1] = PDB[LOC].y;   x[2] = PDB[LOC].z;
+
+      for (k = 0; k <= 2; k ++)
+         g[k] = cl->F[k][0] * x[0] + cl->F[k][1] * x[1] + cl->F[k][2] * x[2];
+
+      num = f.size();
+
+      for (count2 = 0; count2 < nop; count2 ++)
+         {
+         for (k = 0; k <= 2; k ++)
+            {
+            x[k] = sym_ops[count2].t[k];
+            for (j = 0; j <= 2; j ++)
+               x[k] += sym_ops[count2].R[k][j] * g[j];
+            x[k] -= floor(x[k]);
+            if (x[k] >= 1) x[k] = 0;
+            }
+
+         for (count3 = num; count3 < (int) f.size(); count3 += 3)
+            {                                      // Same as an earlier mate?
+            for (k = 0; k <= 2; k ++)
+               {
+               e = fabs(x[k] - f[count3 + k]);
+               if ((e > 1e-4) && (e < 1 - 1e-4)) break;
+               }
+            if (k == 3) break;
+            }
+
+         if (count3 < (int) f.size()) continue;
+
+         for (k = 0; k <= 2; k ++) f.push_back(x[k]);
+
+         atom.push_back(count1);
+         key.push_back( (int) (x[0] * cl->n[0]) +
+                       ((int) (x[1] * cl->n[1]) * cl->n[0]) +
+                       ((int) (x[2] * cl->n[2]) * cl->n[0] * cl->n[1]));
+         }
+      }
+
+   num = cl->n[0] * cl->n[1] * cl->n[2];
+
+   cl->start.assign(num + 1, 0);
+   cl->atom.resize(atom.size());
+   cl->f.resize(f.size());
+
+   for (count1 = 0; count1 < (int) key.size(); count1 ++)
+      cl->start[key[count1] + 1] ++;               // Count of each cell
+
+   for (count1 = 0; count1 < num; count1 ++)       // Running sum => first
+      cl->start[count1 + 1] += cl->start[count1];  //    entry of each cell
+
+   vector<int> next(cl->start.begin(), cl->start.end() - 1);
+
+   for (count1 = 0; count1 < (int) key.size(); count1 ++)
+      {
+      count2 = next[key[count1]] ++;
+
+      cl->atom[count2] = atom[count1];
+      for (k = 0; k <= 2; k ++)
+         cl->f[count2 * 3 + k] = f[count1 * 3 + k];
+      }
+
+   return cl;
+
+   }
+
+//**************************************************************************
+//** CELL BOX function:  Appends to hits every atom mate in the cells     **
+//**    that meet the fractional box lo to hi, which may reach outside    **
+//**    the unit cell; each mate is moved by the whole cells needed to    **
+//**    put it next to the box.  Returns the number of hits.              **
+//**************************************************************************
+
+int   CellBox(const atom_cells *cl, const double lo[3], const double hi[3],
+              vector<cell_hit> &hits)
+   {
+
+   int      a[3];
+   int      b[3];
+   int      c[3];
+   int      w[3];
+   int      s[3];
+   int      cell;
+   int      count1;
+   int      k;
+
+   cell_hit hit;
+
+   for (k = 0; k <= 2; k ++)
+      {
+      a[k] = (int) floor(lo[k] * cl->n[k]);
+      b[k] = (int) floor(hi[k] * cl->n[k]);
+      }
+
+   for (c[2] = a[2]; c[2] <= b[2]; c[2] ++)
+      for (c[1] = a[1]; c[1] <= b[1]; c[1] ++)
+         for (c[0] = a[0]; c[0] <= b[0]; c[0] ++)
+            {
+            for (k = 0; k <= 2; k ++)              // Cell in the unit cell
+               {                                   //    and lattice shift
+               w[k] = ((c[k] % cl->n[k]) + cl->n[k]) % cl->n[k];
+               s[k] = (c[k] - w[k]) / cl->n[k];
+               }
+
+            cell = w[0] + (w[1] * cl->n[0]) + (w[2] * cl->n[0] * cl->n[1]);
+
+            for (count1 = cl->start[cell]; count1 < cl->start[cell + 1];
+                 count1 ++)
+               {
+               hit.atom = cl->atom[count1];
+               for (k = 0; k <= 2; k ++)
+                  hit.f[k] = cl->f[count1 * 3 + k] + s[k];
+               hit.d = 0;
+
+               hits.push_back(hit);
+               }
+            }
+
+   return hits.size();
+
+   }
+
+//**************************************************************************
+//** CELL SPHERE function:  Puts in hits the atom mates within r          **
+//**    angstroms of fractional position f0, with their distances, using  **
+//**    the cell metric.  The distance is compared as a float, as DISTMAP **
+//**    stores it, so a mask from PAINT and one from BELOW agree at r.    **
+//**    Returns the number of hits.                                       **
+//**************************************************************************
+
+int   CellSphere(const atom_cells *cl, const double f0[3], float r,
+                 vector<cell_hit> &hits)
+   {
+
+   double   lo[3];
+   double   hi[3];
+   double   df[3];
+   double   d[3];
+   double   d2;
+
+   int      count1;
+   int      num = 0;
+   int      k;
+
+   for (k = 0; k <= 2; k ++)                       // A little wider, for
+      {                                            //    mates on the edge
+      lo[k] = f0[k] - (r + 0.001) * cl->len[k];    //    of a cell
+      hi[k] = f0[k] + (r + 0.001) * cl->len[k];
+      }
+
+   hits.clear();
+
+   CellBox(cl, lo, hi, hits);
+
+   for (count1 = 0; count1 < (int) hits.size(); count1 ++)
+      {
+      for (k = 0; k <= 2; k ++)
+         df[k] = hits[count1].f[k] - f0[k];
+
+      for (k = 0; k <= 2; k ++)
+         d[k] = cl->O[k][0] * df[0] + cl->O[k][1] * df[1] +
+                cl->O[k][2] * df[2];
+
+      d2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+
+      if ((float) sqrt(d2) > r) continue;          // As a map holds it
+
+      hits[num] = hits[count1];
+      hits[num].d = sqrt(d2);
+      num ++;
+      }
+
+   hits.resize(num);
+
+   return num;
+
+   }
+
+//**************************************************************************
+//** PAINT SLAB function:  Thread body for Paint.  Sets the mask points   **
+//**    of sections z0 to z1 that lie within reach of an atom.            **
+//**************************************************************************
+
+void  *PaintSlab(void *arg)
+   {
+
+   paint_job *job = (paint_job *) arg;
+
+   vector<cell_hit> hits;
+
+   int      N[3]  = {MAP_H[0].NX, MAP_H[0].NY, MAP_H[0].NZ};
+   int      st[3] = {MAP_H[0].NCSTART, MAP_H[0].NRSTART, MAP_H[0].NSSTART};
+   int      ax[3] = {MAP_H[0].MAPC - 1, MAP_H[0].MAPR - 1, MAP_H[0].MAPS - 1};
+   int      u[3];
+   int      countx;
+   int      county;
+   int      countz;
+   int      count1;
+   int      k;
+
+   double   f[3];
+
+   float    rad;
+
+   char     *slot = MSK + (job->msk1 * XYZ_LIM);
+   char     in;
+
+   long     LOC;
+
+   job->num = 0;
+
+   for (countz = job->z0; countz < job->z1; countz ++)
+      for (county = 0; county < Y_LIM; county ++)
+         for (countx = 0; countx < X_LIM; countx ++)
+            {
+            u[ax[0]] = countx + st[0];
+            u[ax[1]] = county + st[1];
+            u[ax[2]] = countz + st[2];
+
+            for (k = 0; k <= 2; k ++) f[k] = (double) u[k] / N[k];
+
+            CellSphere(job->cl, f, job->reach, hits);
+
+            for (count1 = 0, in = 0; !in && count1 < (int) hits.size();
+                 count1 ++)
+               {
+               if (job->r > 0) rad = job->r;
+               else
+                  {
+                  LOC = (pdb_max * job->pdb1) + hits[count1].atom;
+                  if (!PDB[LOC].Type) continue;
+                  rad = PDBdat[PDB[LOC].Type].r;
+                  }
+
+               in = ((float) hits[count1].d <= rad);
+               }
+
+            LOC = countx + (county * X_LIM) + (countz * XY_LIM);
+
+            slot[LOC] = in;
+            job->num += in;
+            }
+
+   return NULL;
+
+   }
+
+//**************************************************************************
+//** PAINT function:  Makes mask msk1 the points within r angstroms of an **
+//**    atom of PDB file pdb1, or of a symmetry mate (the radii of the    **
+//**    PDB data when r is 0).  Each point asks the cell list for the     **
+//**    atoms near it, so the time goes with the map, not the atoms.      **
+//**    Returns the number of points in the mask.                         **
+//**************************************************************************
+
+long  Paint(int msk1, int pdb1, float r)
+   {
+
+   paint_job   job[16];
+   pthread_t   tid[16];
+
+   int         made[16];
+
+   int         nth = sysconf(_SC_NPROCESSORS_ONLN);
+   int         count1;
+   int         LOC;
+
+   float       reach = r;
+
+   long        num = 0;
+
+   if (nth < 1)     nth = 1;
+   if (nth > 16)    nth = 16;
+   if (nth > Z_LIM) nth = Z_LIM;
+
+   if (r <= 0)                                     // Largest PDB data radius
+      for (count1 = 1, reach = 0; count1 <= pdb_len[pdb1]; count1 ++)
+         {
+         LOC = (pdb_max * pdb1) + count1;
+         if (PDB[LOC].Type && (PDBdat[PDB[LOC].Type].r > reach))
+            reach = PDBdat[PDB[LOC].Type].r;
+         }
+
+   atom_cells *cl = CellBuild(pdb1, reach);
+
+   for (count1 = 0; count1 < nth; count1 ++)       // Sections for each thread
+      {
+      job[count1].cl    = cl;
+      job[count1].msk1  = msk1;
+      job[count1].pdb1  = pdb1;
+      job[count1].r     = r;
+      job[count1].reach = reach;
+      job[count1].z0    = (long) Z_LIM *  count1      / nth;
+      job[count1].z1    = (long) Z_LIM * (count1 + 1) / nth;
+      }
+
+   for (count1 = 1; count1 < nth; count1 ++)
+      if ((made[count1] = !pthread_create(&tid[count1], NULL, PaintSlab,
+                                          &job[count1])) == 0)
+         PaintSlab(&job[count1]);
+
+   PaintSlab(&job[0]);
+
+   for (count1 = 1; count1 < nth; count1 ++)
+      if (made[count1]) pthread_join(tid[count1], NULL);
+
+   for (count1 = 0; count1 < nth; count1 ++)
+      num += job[count1].num;
+
+   MskTouch(msk1);
+
+   return num;
+
+   }
+
+//**************************************************************************
+//** NEAR function:  Lists the atoms of PDB file pdb1, and their symmetry **
+//**    mates, within r angstroms of atom atom1, nearest first.           **
+//**************************************************************************
+
+void  Near(int pdb1, int atom1, float r)
+   {
+
+   atom_cells *cl = CellBuild(pdb1, r);
+
+   vector<cell_hit> hits;
+
+   double   x[3];
+   double   f0[3];
+
+   int      count1;
+   int      count2;
+   int      k;
+   int      LOC = (pdb_max * pdb1) + atom1;
+
+   x[0] = PDB[LOC].x;   x[1] = PDB[LOC].y;   x[2] = PDB[LOC].z;
+
+   for (k = 0; k <= 2; k ++)
+      f0[k] = cl->F[k][0] * x[0] + cl->F[k][1] * x[1] + cl->F[k][2] * x[2];
+
+   CellSphere(cl, f0, r, hits);
+
+   for (count1 = 1; count1 < (int) hits.size(); count1 ++)
+      for (count2 = count1; (count2 > 0) &&                // Nearest first
+                            (hits[count2].d < hits[count2 - 1].d); count2 --)
+         swap(hits[count2], hits[count2 - 1]);
+
+   cout  << "   NEAR  => -----------------------------------------\n"
+         << "   NEAR  => |  Atom | Name  | Residue     | Distance |\n"
+         << "   NEAR  => |-------|-------|-------------|----------|\n";
+
+   for (count1 = 0; count1 < (int) hits.size(); count1 ++)
+      {
+      if ((hits[count1].atom == atom1) && (hits[count1].d < 0.01)) continue;
+
+      LOC = (pdb_max * pdb1) + hits[count1].atom;
+
+      cout  << "   NEAR  => | ";
+      cout.width(5);    cout << PDB[LOC].Num << " | ";
+      cout.width(5);    cout << PDB[LOC].Nam << " | ";
+      cout.write(PDB[LOC].MID + 1, 11);
+      cout  << " | ";
+      cout.width(8);    cout << hits[count1].d << " |\n";
+      }
+
+   cout  << "   NEAR  => -----------------------------------------\n";
+
+   return;
+
+   }
+
+//**************************************************************************
+//** PARTITION SLAB function:  Thread body for Partition.  Labels each    **
+//**    point of sections z0 to z1 with the nearest atom within reach     **
+//**    (the lowest atom number of equals), or 0.                         **
+//**************************************************************************
+
+void  *PartSlab(void *arg)
+   {
+
+   part_job *job = (part_job *) arg;
+
+   vector<cell_hit> hits;
+
+   int      N[3]  = {MAP_H[0].NX, MAP_H[0].NY, MAP_H[0].NZ};
+   int      st[3] = {MAP_H[0].NCSTART, MAP_H[0].NRSTART, MAP_H[0].NSSTART};
+   int      ax[3] = {MAP_H[0].MAPC - 1, MAP_H[0].MAPR - 1, MAP_H[0].MAPS - 1};
+   int      u[3];
+   int      countx;
+   int      county;
+   int      countz;
+   int      count1;
+   int      best;
+   int      k;
+
+   double   f[3];
+   double   score;
+   double   low;
+
+   long     LOC;
+
+   job->num = 0;
+
+   for (countz = job->z0; countz < job->z1; countz ++)
+      for (county = 0; county < Y_LIM; county ++)
+         for (countx = 0; countx < X_LIM; countx ++)
+            {
+            u[ax[0]] = countx + st[0];
+            u[ax[1]] = county + st[1];
+            u[ax[2]] = countz + st[2];
+
+            for (k = 0; k <= 2; k ++) f[k] = (double) u[k] / N[k];
+
+            CellSphere(job->cl, f, job->r, hits);
+
+            for (count1 = 0, best = 0, low = 0; count1 < (int) hits.size();
+                 count1 ++)
+               {
+               score = hits[count1].d;
+
+               if (job->weigh)                     // Less the atom radius
+                  {
+                  LOC = (pdb_max * job->pdb1) + hits[count1].atom;
+                  if (PDB[LOC].Type) score -= PDBdat[PDB[LOC].Type].r;
+                  }
+
+               if (!best || (score < low) ||
+                   ((score == low) && (hits[count1].atom < best)))
+                  {
+                  best = hits[count1].atom;
+                  low  = score;
+                  }
+               }
+
+            job->lab[countx + (county * X_LIM) + (countz * XY_LIM)] = best;
+            job->num += (best != 0);
+            }
+
+   return NULL;
+
+   }
+
+//**************************************************************************
+//** PARTITION function:  Gives every grid point within r angstroms of an **
+//**    atom of PDB file pdb1 (or a symmetry mate) to the nearest atom,   **
+//**    measured less the atom radius when weigh is set, in one threaded  **
+//**    pass using the cell list.  The labels are then sorted by atom, so **
+//**    the points of each atom are a run of part_list.vox.  Returns the  **
+//**    number of points given to an atom.                                **
+//**************************************************************************
+
+long  Partition(int pdb1, float r, int weigh)
+   {
+
+   atom_parts  *pt = &part_list;
+
+   part_job    job[16];
+   pthread_t   tid[16];
+
+   int         made[16];
+
+   int         nth = sysconf(_SC_NPROCESSORS_ONLN);
+   int         count1;
+
+   long        LOC;
+   long        num = 0;
+
+   if (nth < 1)     nth = 1;
+   if (nth > 16)    nth = 16;
+   if (nth > Z_LIM) nth = Z_LIM;
+
+   atom_cells *cl = CellBuild(pdb1, r);
+
+   pt->pdb1  = -1;
+   pt->r     = r;
+   pt->weigh = weigh;
+   pt->lab.assign(XYZ_LIM, 0);
+
+   for (count1 = 0; count1 < nth; count1 ++)       // Sections for each thread
+      {
+      job[count1].cl    = cl;
+      job[count1].lab   = &pt->lab[0];
+      job[count1].pdb1  = pdb1;
+      job[count1].r     = r;
+      job[count1].weigh = weigh;
+      job[count1].z0    = (long) Z_LIM *  count1      / nth;
+      job[count1].z1    = (long) Z_LIM * (count1 + 1) / nth;
+      }
+
+   for (count1 = 1; count1 < nth; count1 ++)
+      if ((made[count1] = !pthread_create(&tid[count1], NULL, PartSlab,
+                                          &job[count1])) == 0)
+         PartSlab(&job[count1]);
+
+   PartSlab(&job[0]);
+
+   for (count1 = 1; count1 < nth; count1 ++)
+      if (made[count1]) pthread_join(tid[count1], NULL);
+
+   for (count1 = 0; count1 < nth; count1 ++)
+      num += job[count1].num;
+
+   pt->start.assign(pdb_len[pdb1] + 2, 0);         // Points of each atom,
+   pt->vox.resize(num);                            //    in map order
+
+   for (LOC = 0; LOC < XYZ_LIM; LOC ++)
+      if (pt->lab[LOC]) pt->start[pt->lab[LOC] + 1] ++;
+
+   for (count1 = 1; count1 <= pdb_len[pdb1]; count1 ++)
+      pt->start[count1 + 1] += pt->start[count1];
+
+   vector<long> next(pt->start);
+
+   for (LOC = 0; LOC < XYZ_LIM; LOC ++)
+      if (pt->lab[LOC]) pt->vox[next[pt->lab[LOC]] ++] = (uint32_t) LOC;
+
+   pt->pdb1 = pdb1;
+
+   return num;
+
    }
 
 //**************************************************************************
-//** GET ENTRY function:  Gets an entry from the console (like cin), but  **
-//**    won't go beyond the end of the line (returns null if an entry is  **
-//**    requested but a line feed is the next character in the stream).   **
+//** DISTANCE LINES function:  Thread body for DistMap.  Every nth line   **
+//**    along one cell axis of the squared distances d2 (and labels lab)  **
+//**    is replaced by the lower envelope of parabolas (Felzenszwalb and  **
+//**    Huttenlocher), in time proportional to the line.  Each parabola   **
+//**    is centred on the mate of its label, not on the grid point, so    **
+//**    atoms between grid points keep their true distance.  The line is  **
+//**    taken three times over, so the envelope wraps around the cell.    **
 //**************************************************************************
 
-char *get_entry()
+void  *DistLines(void *arg)
    {
-   int         len = 0;
-   char        ch;
-   static char input[20] = "";
 
-   while (cin.get(ch))
+   dist_job *job = (dist_job *) arg;
+
+   int      n     = job->n[job->axis];
+   int      m     = 3 * n;
+   int      k;
+   int      j;
+   int      q;
+   int      skip;
+
+   long     line;
+   long     lines;
+   long     base;
+   long     stride;
+   long     count1;
+
+   double   h     = job->h[job->axis];
+   double   cq;
+   double   fq;
+   double   t;
+   double   x;
+   double   s;
+
+   vector<double> f  (n);
+   vector<int>    l  (n);
+   vector<int>    v  (m);
+   vector<double> c  (m);                // Centre of each parabola
+   vector<double> z  (m + 1);
+
+   if      (job->axis == 0) stride = 1;
+   else if (job->axis == 1) stride = job->n[0];
+   else                     stride = (long) job->n[0] * job->n[1];
+
+   lines = (long) job->n[0] * job->n[1] * job->n[2] / n;
+
+   for (line = job->tid; line < lines; line += job->nth)
       {
-      if (ch == '\n')
+      if      (job->axis == 0) base = line * n;
+      else if (job->axis == 1) base = (line % job->n[0]) +
+                                      (line / job->n[0]) * job->n[0] * n;
+      else                     base = line;
+
+      for (count1 = 0; count1 < n; count1 ++)
          {
-         cin.putback(ch);
-         input[len] = '\0';
-         return input;
+         f[count1] = job->d2 [base + count1 * stride];
+         l[count1] = job->lab[base + count1 * stride];
          }
 
-      if (isgraph(ch))
+      for (q = 0, k = -1; q < m; q ++)             // Lower envelope
          {
-         input[len] = ch;
-         len ++;
+         if (!l[q % n]) continue;                  // No atom yet
 
-         ch = cin.peek();
-         if (ch == ' ')
+         t  = job->f[(l[q % n] - 1) * 3 + job->axis] * n - (q % n);
+         cq = (q + t - n * floor(t / n + 0.5)) * h;
+         fq = f[q % n];
+
+         for (s = 0, skip = 0; k >= 0; k --)
             {
-            input[len] = '\0';
-            return input;
+            if (cq - c[k] < 1e-9 * h)              // Same centre:  keep
+               {                                   //    the lower one
+               if (fq >= f[v[k] % n]) skip = 1;
+               if (skip) break;
+               continue;
+               }
+
+            s = ((fq + cq * cq) - (f[v[k] % n] + c[k] * c[k])) /
+                (2 * (cq - c[k]));
+            if (s > z[k]) break;
             }
+
+         if (skip) continue;
+
+         k ++;
+         v[k] = q;
+         c[k] = cq;
+         z[k] = k ? s : -HUGE_VAL;
+         }
+
+      if (k < 0) continue;                         // Line with no atom
+
+      z[k + 1] = HUGE_VAL;
+
+      for (count1 = 0, j = 0; count1 < n; count1 ++)
+         {
+         x = (count1 + n) * h;
+
+         while (z[j + 1] < x) j ++;
+
+         job->d2 [base + count1 * stride] = (x - c[j]) * (x - c[j]) +
+                                            f[v[j] % n];
+         job->lab[base + count1 * stride] = l[v[j] % n];
          }
       }
-   return 0;
+
+   return NULL;
+
    }
 
 //**************************************************************************
-//** UPPER function:  Transforms a string to ALL CAPS.                    **
+//** DISTANCE SLAB function:  Thread body for DistMap.  Puts the distance **
+//**    to the nearest mate in sections z0 to z1 of the map, asking the   **
+//**    cell list for the mates within the bound the passes found.        **
 //**************************************************************************
 
-char  *upper(char input[20])
+void  *DistSlab(void *arg)
    {
 
-   static char output[20];
-   strcpy(output, input);
+   dist_slab *job = (dist_slab *) arg;
 
-   int         count1;
-   int         end         = strlen(output) - 1;
+   vector<cell_hit> hits;
 
-   for (count1 = 0; count1 <= end; count1 ++)
-      if ((output[count1] >= 97) && (output[count1] <= 122))
-         output[count1] = (output[count1] - 32);
+   int      N[3]  = {MAP_H[0].NX, MAP_H[0].NY, MAP_H[0].NZ};
+   int      st[3] = {MAP_H[0].NCSTART, MAP_H[0].NRSTART, MAP_H[0].NSSTART};
+   int      ax[3] = {MAP_H[0].MAPC - 1, MAP_H[0].MAPR - 1, MAP_H[0].MAPS - 1};
+   int      u[3];
+   int      g[3];
+   int      countx;
+   int      county;
+   int      countz;
+   int      count1;
+   int      e;
+   int      k;
 
-   return output;
+   long     LOC;
+
+   double   f[3];
+   double   df[3];
+   double   d2;
+
+   float    *slot = MAP + (job->map1 * XYZ_LIM);
+   float    far   = nextafterf(job->dmax, FLT_MAX);
+   float    r;
+
+   for (countz = job->z0; countz < job->z1; countz ++)
+      for (county = 0; county < Y_LIM; county ++)
+         for (countx = 0; countx < X_LIM; countx ++)
+            {
+            u[ax[0]] = countx + st[0];
+            u[ax[1]] = county + st[1];
+            u[ax[2]] = countz + st[2];
+
+            for (k = 0; k <= 2; k ++) f[k] = (double) u[k] / N[k];
+
+            LOC = countx + (county * X_LIM) + (countz * XY_LIM);
+
+            slot[LOC] = far;                       // Beyond dmax:  BELOW
+                                                   //    dmax leaves it out
+            r = job->dmax;
+
+            for (k = 0; k <= 2; k ++) g[k] = ((u[k] % N[k]) + N[k]) % N[k];
+
+            e = job->lab ? job->lab[g[0] + (long) N[0] *
+                                    (g[1] + (long) N[1] * g[2])] : 0;
+
+            if (e)                                 // Distance to the mate
+               {                                   //    the passes found
+               for (k = 0; k <= 2; k ++)
+                  {
+                  df[k] = job->cl->f[(e - 1) * 3 + k] - f[k];
+                  df[k] = (df[k] - floor(df[k] + 0.5)) * MAP_H[0].CELL[k];
+                  }
+
+               d2 = df[0] * df[0] + df[1] * df[1] + df[2] * df[2];
+
+               if (sqrt(d2) + 0.001 < r) r = sqrt(d2) + 0.001;
+               }
+
+            CellSphere(job->cl, f, r, hits);       // Nearest within bound
+
+            for (count1 = 0; count1 < (int) hits.size(); count1 ++)
+               if ((hits[count1].atom >= job->first) &&
+                   (hits[count1].atom <= job->last)  &&
+                   (hits[count1].d < slot[LOC]))
+                  slot[LOC] = hits[count1].d;
+            }
+
+   return NULL;
 
    }
 
 //**************************************************************************
-//** Change a string to its float equivalent, discarding any              **
-//** non-numericals (so that 12.5, +12.5, **12.5**, and A12b.5 will all   **
-//** return as 12.5).                                                     **
+//** DISTANCE MAP function:  Puts in map1 the distance from each point to **
+//**    the nearest of atoms first to last of PDB file pdb1 and their     **
+//**    symmetry mates, up to dmax (points further away get the next      **
+//**    float above dmax).  Each mate marks a point of the whole cell     **
+//**    grid, then three passes of DistLines (one for each axis, threaded **
+//**    over lines) carry a near mate to every point.  A point keeps only **
+//**    one mate, so the distance to it is only a bound; DistSlab         **
+//**    (threaded over sections) asks the cell list for the mates within  **
+//**    that bound, which gives the exact distance.  The passes need a    **
+//**    cell with right angles and work on the whole cell, even for a     **
+//**    boxed map; for other cells the bound is dmax.  Returns 1 if the   **
+//**    header gives no cell grid.                                        **
 //**************************************************************************
 
-float Ch2float(char input[15])
+int   DistMap(int map1, int pdb1, int first, int last, float dmax)
    {
 
-   int      count1;
+   dist_job    job[16];
+   dist_slab   slab[16];
+   pthread_t   tid[16];
 
-   int      number      = 0;
-   float    result      = 0;
+   int         made[16];
 
-   int      digits      = 0;
-   float    digit[10];
+   int         N[3]  = {MAP_H[0].NX, MAP_H[0].NY, MAP_H[0].NZ};
+   int         ax[3] = {MAP_H[0].MAPC - 1, MAP_H[0].MAPR - 1,
+                        MAP_H[0].MAPS - 1};
+   int         nth   = sysconf(_SC_NPROCESSORS_ONLN);
+   int         right = 1;
+   int         g[3];
+   int         count1;
+   int         axis;
+   int         e;
+   int         k;
 
-   int      mult        = +1;
-   int      dec         = 0;
+   long        cell;
 
-   for (count1 = 0; (count1 < 15 && input[count1]); count1 ++)
+   for (k = 0; k <= 2; k ++)
+      if ((ax[k] < 0) || (ax[k] > 2) || (N[k] <= 0)) return 1;
+
+   for (k = 3; k <= 5; k ++)
+      if (fabs(MAP_H[0].CELL[k] - 90) > 0.001) right = 0;
+
+   if (nth < 1)     nth = 1;
+   if (nth > 16)    nth = 16;
+
+   atom_cells *cl = CellBuild(pdb1, right ? 4 : dmax);
+
+   long        num = (long) N[0] * N[1] * N[2];
+
+   vector<double> dd (right ? num : 0, 0);
+   vector<int>    lab(right ? num : 0, 0);
+
+   if (right)
       {
-      if ((input[count1] >= 48) && (input[count1] <=57))
+      for (e = 0; e < (int) cl->atom.size(); e ++)  // Mates onto the grid
          {
-         number ++;
-         digit[number] = input[count1] - 48;
+         if ((cl->atom[e] < first) || (cl->atom[e] > last)) continue;
+
+         for (k = 0; k <= 2; k ++)
+            g[k] = (int) lrint(cl->f[e * 3 + k] * N[k]) % N[k];
+
+         cell = g[0] + (long) N[0] * (g[1] + (long) N[1] * g[2]);
+
+         if (!lab[cell]) lab[cell] = e + 1;        // Any mate is a bound
          }
-      else if (input[count1] == '.')   // Keep track of the decimal location
+
+      for (axis = 0; axis <= 2; axis ++)
          {
-         digits = number;
-         dec    = 1;
+         for (count1 = 0; count1 < nth; count1 ++)
+            {
+            job[count1].d2   = &dd[0];
+            job[count1].lab  = &lab[0];
+            job[count1].f    = cl->f.empty() ? NULL : &cl->f[0];
+            job[count1].axis = axis;
+            job[count1].tid  = count1;
+            job[count1].nth  = nth;
+
+            for (k = 0; k <= 2; k ++)
+               {
+               job[count1].n[k] = N[k];
+               job[count1].h[k] = MAP_H[0].CELL[k] / N[k];
+               }
+            }
+
+         for (count1 = 1; count1 < nth; count1 ++)
+            if ((made[count1] = !pthread_create(&tid[count1], NULL, DistLines,
+                                                &job[count1])) == 0)
+               DistLines(&job[count1]);
+
+         DistLines(&job[0]);
+
+         for (count1 = 1; count1 < nth; count1 ++)
+            if (made[count1]) pthread_join(tid[count1], NULL);
          }
+      }
 
-      else if (input[count1] == '-')   // Negative numbers
-         mult = -1;
+   if (nth > Z_LIM) nth = Z_LIM;
+
+   for (count1 = 0; count1 < nth; count1 ++)       // Sections for each thread
+      {
+      slab[count1].cl    = cl;
+      slab[count1].lab   = right ? &lab[0] : NULL;
+      slab[count1].map1  = map1;
+      slab[count1].first = first;
+      slab[count1].last  = last;
+      slab[count1].dmax  = dmax;
+      slab[count1].z0    = (long) Z_LIM *  count1      / nth;
+      slab[count1].z1    = (long) Z_LIM * (count1 + 1) / nth;
       }
 
-   if (!dec) digits = number;
+   for (count1 = 1; count1 < nth; count1 ++)
+      if ((made[count1] = !pthread_create(&tid[count1], NULL, DistSlab,
+                                          &slab[count1])) == 0)
+         DistSlab(&slab[count1]);
 
-   for (count1 = 1; count1 <= number; count1 ++)
-      result = result + (  digit[count1]                 *
-                           pow(10.0, (digits - count1))     );
+   DistSlab(&slab[0]);
 
-   return (result * mult);
+   for (count1 = 1; count1 < nth; count1 ++)
+      if (made[count1]) pthread_join(tid[count1], NULL);
+
+   MAP_H[map1] = MAP_H[0];
+
+   map_symm[map1] = 0;
+
+   MapTouch(map1);
+
+   return 0;
 
    }
 
 //**************************************************************************
-//** ZONE FIND function:  Find zone in mask region.                       **
+//** BELOW function:  Makes mask msk1 the points where map map1 is at     **
+//**    most value (with a distance map from DISTMAP, the points within   **
+//**    value angstroms of the atoms).  Returns the number of points.     **
 //**************************************************************************
 
-int   zone_find(char input[15])
+long  Below(int msk1, int map1, float value)
    {
 
-   char key[10];
-   int  zone;
+   const float *rho  = MAP + (map1 * XYZ_LIM);
 
-   cout  << "   " << input << "Operate IN/OUT of mask, or TOTAL? ";
-   cin   >> key;
+   char        *slot = MSK + (msk1 * XYZ_LIM);
 
-        if (key[0] == 'I' || key[0] == 'i') zone = 1;
-   else if (key[0] == 'O' || key[0] == 'o') zone = 0;
-   else zone = 2;
+   long        LOC;
+   long        num = 0;
+
+   for (LOC = 0; LOC < XYZ_LIM; LOC ++)
+      {
+      slot[LOC] = (rho[LOC] <= value);
+      num += slot[LOC];
+      }
+
+   MskTouch(msk1);
+
+   return num;
 
-   return zone;
    }
 
 //**************************************************************************
-//** DISTANCE function:  X, Y, Z distance => Returns angstrom distance    **
-//** between two points separated by X grid points, Y grid points, and    **
-//** Z grid points in the x, y, and z directions.                         **
+//** SWEEP SLAB function:  Thread body for Sweep.  Adds the points of     **
+//**    every nth section (not zone2 of the mask, unless zone2 is 2) to   **
+//**    the bins of that section, chosen by the value of the key map      **
+//**    against the edges of SweepEdge, so a point at a printed edge goes **
+//**    where the table says.                                             **
 //**************************************************************************
 
-float distance(int X, int Y, int Z)
+void  *SweepSlab(void *arg)
    {
-   float x1 = ((X * 1.0)/ X_CELL);
-   float y1 = ((Y * 1.0)/ Y_CELL);
-   float z1 = ((Z * 1.0)/ Z_CELL);
 
-   float x2 = MAP_H[0].CELL[0];
-   float y2 = MAP_H[0].CELL[1];
-   float z2 = MAP_H[0].CELL[2];
+   sweep_job *job = (sweep_job *) arg;
 
-   float a  = MAP_H[0].CELL[3];
-   float b  = MAP_H[0].CELL[4];
-   float c  = MAP_H[0].CELL[5];
+   sweep_bin *bin;
 
-   float answer;
+   int      countz;
+   int      b;
 
-   answer = x1 * x1 * x2 * x2                         +
-            y1 * y1 * y2 * y2                         +
-            z1 * z1 * z2 * z2                         +
-            x1 * y1 * x2 * y2 * 2 * cos(c * PI / 360) +
-            x1 * z1 * x2 * z2 * 2 * cos(b * PI / 360) +
-            y1 * z1 * y2 * z2 * 2 * cos(a * PI / 360)   ;
+   long     LOC;
+   long     end;
+
+   double   v1;
+   double   v2;
+   double   t;
+
+   for (countz = job->tid; countz < Z_LIM; countz += job->nth)
+      {
+      end = (countz + 1) * XY_LIM;
+
+      for (LOC = countz * XY_LIM; LOC < end; LOC ++)
+         {
+         if ((job->zone2 != 2) && (job->msk[LOC] == job->zone2)) continue;
+
+         v1 = job->key[LOC];
+
+         if (!(v1 >= job->lo)) continue;
+
+         t  = (v1 - job->lo) / (job->hi - job->lo) * job->steps;
+         b  = (t < job->nbin) ? (int) t : job->nbin;
+
+         if (job->upper)                           // Upper edge in the bin,
+            {                                      //    and lo in bin 0
+            while ((b > 0) &&
+                   (v1 <= SweepEdge(job->lo, job->hi, job->steps, b)))
+               b --;
+            while ((b < job->nbin) &&
+                   (v1 >  SweepEdge(job->lo, job->hi, job->steps, b + 1)))
+               b ++;
+            }
+         else                                      // Lower edge in the bin
+            {
+            while ((b > 0) &&
+                   (v1 <  SweepEdge(job->lo, job->hi, job->steps, b)))
+               b --;
+            while ((b < job->nbin) &&
+                   (v1 >= SweepEdge(job->lo, job->hi, job->steps, b + 1)))
+               b ++;
+            }
+
+         if (b >= job->nbin)
+            {
+            if (!job->top) continue;
+            b = job->nbin - 1;
+            }
+
+         bin = &job->bins[(long) countz * job->nbin + b];
+
+         v1  = job->rho1[LOC];
+         v2  = job->rho2[LOC];
+
+         bin->num ++;
+         bin->dif += fabs(v1 - v2);
+         bin->s1  += v1;   bin->q1 += v1 * v1;
+         bin->s2  += v2;   bin->q2 += v2 * v2;
+         }
+      }
+
+   return NULL;
 
-   return (sqrt(answer));
    }
 
 //**************************************************************************
-//** MINIMUM VALUE function: Finds the smallest of two numbers.           **
+//** SWEEP function:  Sums for RFAC of map1 against map2 in nbin bins of  **
+//**    the value of map key (bin b holds edge b to edge b+1 of           **
+//**    SweepEdge, with the lower edge, or the upper edge when upper is   **
+//**    set, and the last bin all above when top is set), in one threaded **
+//**    pass.  Each section has bins of its own, added up in section      **
+//**    order, so the sums do not depend on the number of threads.        **
 //**************************************************************************
 
-float Min(float v1, float v2)
+void  Sweep(int map1, int map2, int key, float lo, float hi, int steps,
+            int nbin, int top, int upper, int zone2, int msk1,
+            vector<sweep_bin> &out)
    {
-   if (v1 < v2) return v1;
-   return v2;
+
+   sweep_job   job[16];
+   pthread_t   tid[16];
+
+   int         made[16];
+
+   int         nth = sysconf(_SC_NPROCESSORS_ONLN);
+   int         count1;
+   int         countz;
+
+   sweep_bin   zero = {0, 0, 0, 0, 0, 0};
+
+   vector<sweep_bin> bins((long) Z_LIM * nbin, zero);
+
+   if (nth < 1)     nth = 1;
+   if (nth > 16)    nth = 16;
+   if (nth > Z_LIM) nth = Z_LIM;
+
+   for (count1 = 0; count1 < nth; count1 ++)
+      {
+      job[count1].rho1  = MAP + (map1 * XYZ_LIM);
+      job[count1].rho2  = MAP + (map2 * XYZ_LIM);
+      job[count1].key   = MAP + (key  * XYZ_LIM);
+      job[count1].msk   = (zone2 == 2) ? NULL : MSK + (msk1 * XYZ_LIM);
+      job[count1].zone2 = zone2;
+      job[count1].lo    = lo;
+      job[count1].hi    = hi;
+      job[count1].steps = steps;
+      job[count1].nbin  = nbin;
+      job[count1].top   = top;
+      job[count1].upper = upper;
+      job[count1].bins  = &bins[0];
+      job[count1].tid   = count1;
+      job[count1].nth   = nth;
+      }
+
+   for (count1 = 1; count1 < nth; count1 ++)
+      if ((made[count1] = !pthread_create(&tid[count1], NULL, SweepSlab,
+                                          &job[count1])) == 0)
+         SweepSlab(&job[count1]);
+
+   SweepSlab(&job[0]);
+
+   for (count1 = 1; count1 < nth; count1 ++)
+      if (made[count1]) pthread_join(tid[count1], NULL);
+
+   out.assign(nbin, zero);
+
+   for (countz = 0; countz < Z_LIM; countz ++)
+      for (count1 = 0; count1 < nbin; count1 ++)
+         SweepAdd(&out[count1], &bins[(long) countz * nbin + count1]);
+
+   return;
+
    }
 
 //**************************************************************************
-//** ABSOLUTE VALUE function: Finds the absolute value of a float.        **
+//** SWEEP ADD function:  Adds the sums of bin b to bin a.                **
 //**************************************************************************
 
-float Abs(float value)
+void  SweepAdd(sweep_bin *a, const sweep_bin *b)
    {
-   return sqrt(value * value);
+
+   a->num += b->num;
+   a->dif += b->dif;
+   a->s1  += b->s1;   a->q1 += b->q1;
+   a->s2  += b->s2;   a->q2 += b->q2;
+
+   return;
+
    }
 
 //**************************************************************************
-//** GAUSSIAN function:  Returns value of a gaussian of width B at dist.  **
+//** SWEEP EDGE function:  Edge k of bins that split lo to hi in steps,   **
+//**    in float as the tables print it; edge steps is hi itself.         **
 //**************************************************************************
 
-float Gauss(float S, float X)
+float SweepEdge(float lo, float hi, int steps, int k)
    {
-   return (  (1/(sqrt(PI)*S)) * (pow(E,-((X*X)/(S*S)))   )   );
-   }
 
-//**************************************************************************
-//** FIND XYZ COORDINATE FUNCTION: X=(M)x and x=(M-1)X                    **
-//** Both X and x are positions vectors in real space, but:               **
-//**    X is a position vector in cartesian  coordinates (Angstroms)      **
-//**    x is a position vector in fractional coordinates (dimensionless)  **
-//**************************************************************************
+   if (k == steps) return hi;
+
+   return lo + (hi - lo) * k / steps;
+
+   }
 
 //**************************************************************************
-//** Calculate X in fractional coordinates from X in real coordinates     **
+//** SWEEP R function:  The R factor of type 1 to 6 (as for RFAC) of the  **
+//**    sums in a bin:  average difference over the averages or RMS       **
+//**    values of map 1, map 2, or their mean.                            **
 //**************************************************************************
 
-int      C2C_X( int type,
-                float X1, float Y1, float Z1,
-                float A , float B , float C ,
-                float a , float b , float c   )
+double SweepR(const sweep_bin *b, int type)
    {
 
-   float value;
-
-   float G = sqrt( 1 - cos(a)*cos(a)
-                     - cos(b)*cos(b)
-                     - cos(c)*cos(c)
-                     + 2*cos(a)*cos(b)*cos(c)  );
-
-   float P = 1 / ( sqrt (1 + (2 * cos (a)) ) );
-   float Q = 1 / ( sqrt (1 - (1 * cos (a)) ) );
-
-   if      (type == 0)
-      value = ( X1 * sin(a) / (A * G) );
+   double   avg1;
+   double   avg2;
+   double   rms1;
+   double   rms2;
+   double   dif;
 
-   else if (type == 1)
-      value = ( + ( X1 / A                                          )
-                - ( Y1 / (A * tan(c) )                              )
-                + ( Z1 * ( cos(a)*cos(c)-cos(b) )/(A * G * sin (c)) ) );
+   if (b->num <= 0) return 0;
 
-   else
-      value = (  ( + X1 * ((1/P) + (2/Q))
-                   + Y1 * ((1/P) - (1/Q))
-                   + Z1 * ((1/P) - (1/Q))  )
-                   / (3 * A)                  );
+   avg1 = b->s1 / b->num;
+   avg2 = b->s2 / b->num;
+   rms1 = b->q1 / b->num - avg1 * avg1;
+   rms2 = b->q2 / b->num - avg2 * avg2;
+   rms1 = (rms1 > 0) ? sqrt(rms1) : 0;
+   rms2 = (rms2 > 0) ? sqrt(rms2) : 0;
+   dif  = b->dif / b->num;
 
-   return (value * X_CELL);
+   switch (type)
+      {
+      case 1:  return dif / avg1;
+      case 2:  return dif / avg2;
+      case 3:  return dif / ((avg1 + avg2) / 2);
+      case 4:  return dif / rms1;
+      case 5:  return dif / rms2;
+      default: return dif / ((rms1 + rms2) / 2);
+      }
 
    }
 
 //**************************************************************************
-//** Calculate X in real coordinates from X in fractional coordinates     **
+//** RFSWEEP function:  R factor of map1 against map2 as a function of    **
+//**    mask radius:  the points are binned by the distance in map dist   **
+//**    (from DISTMAP) in one pass, and the curve for every radius is the **
+//**    running sum of the bins.                                          **
 //**************************************************************************
 
-float    C2C_x( int type,
-                float x1, float y1, float z1,
-                float A , float B , float C ,
-                float a , float b , float c   )
+void  RfSweep(int map1, int map2, int dist, float dmax, int nbin, int type)
    {
 
-   float G = sqrt( 1 - cos(a)*cos(a)
-                     - cos(b)*cos(b)
-                     - cos(c)*cos(c)
-                     + 2*cos(a)*cos(b)*cos(c)  );
+   vector<sweep_bin> bins;
 
-   float P = 1 / ( sqrt (1 + (2 * cos (a)) ) );
-   float Q = 1 / ( sqrt (1 - (1 * cos (a)) ) );
+   sweep_bin   run = {0, 0, 0, 0, 0, 0};
 
-   if      (type == 0)
-      return ( x1 * A * G / sin(a));
+   int         count1;
 
-   else if (type == 1)
-      return ( + ( x1 * A            )
-               + ( y1 * B * cos(c)   )
-               + ( z1 * C * cos(b)   )  );
+   Sweep(map1, map2, dist, 0, dmax, nbin, nbin, 0, 1, 2, 0, bins);
+
+   cout  << "   RFSWE => ------------------------------------------------"
+         << "---------\n"
+         << "   RFSWE => |  Radius  |  Points  | R (type " << type
+         << ") | Shell pts | Shell R |\n"
+         << "   RFSWE => |----------|----------|------------|-----------|"
+         << "---------|\n";
+
+   for (count1 = 0; count1 < nbin; count1 ++)
+      {
+      SweepAdd(&run, &bins[count1]);               // Running sum
+
+      cout  << "   RFSWE => | ";
+      cout.width(8);    cout << SweepEdge(0, dmax, nbin, count1 + 1) << " | ";
+      cout.width(8);    cout << (long) run.num << " | ";
+      cout.width(10);   cout << SweepR(&run, type) << " | ";
+      cout.width(9);    cout << (long) bins[count1].num << " | ";
+      cout.width(7);    cout << SweepR(&bins[count1], type) << " |\n";
+      }
+
+   cout  << "   RFSWE => ------------------------------------------------"
+         << "---------\n";
+
+   return;
 
-   else
-      return (  ( + x1 * ((1*P) + (2*Q))
-                  + y1 * ((1*P) - (1*Q))
-                  + z1 * ((1*P) - (1*Q))  )
-                  * (A / 3)                  );
    }
 
 //**************************************************************************
-//** Calculate Y in fractional coordinates from Y in real coordinates     **
+//** CUT SWEEP function:  R factor of map1 against map2 (zone of mask     **
+//**    msk1) over the points where map2 is at least each of nbin         **
+//**    thresholds from min to max, both included (min alone for one),    **
+//**    as a mask cut from map2 would give.  The points are binned by     **
+//**    map2 in one pass, and each threshold takes the running sum of the **
+//**    bins from the top down.                                           **
 //**************************************************************************
 
-int      C2C_Y( int type,
-                float X1, float Y1, float Z1,
-                float A , float B , float C ,
-                float a , float b , float c   )
+void  CutSweep(int map1, int map2, int zone, int msk1, float min, float max,
+               int nbin, int type)
    {
 
-   float value;
+   vector<sweep_bin> bins;
+   vector<sweep_bin> run;
 
-   float G = sqrt( 1 - cos(a)*cos(a)
-                     - cos(b)*cos(b)
-                     - cos(c)*cos(c)
-                     + 2*cos(a)*cos(b)*cos(c)  );
+   int         zone2  = 2;
+   int         steps  = (nbin > 1) ? nbin - 1 : 1;
+   int         count1;
 
-   float P = 1 / ( sqrt (1 + (2 * cos (a)) ) );
-   float Q = 1 / ( sqrt (1 - (1 * cos (a)) ) );
+   if (zone == 0) zone2 = 1;
+   if (zone == 1) zone2 = 0;
 
-   if      (type == 0)
-      value = ( + ( X1 * ( cos(a)*cos(b) - cos(c) ) / (B * G * sin(a)) )
-                + ( Y1 / (B * sin(a) )                                 ) );
+   Sweep(map1, map2, map2, min, max, steps, nbin, 1, 0, zone2, msk1, bins);
 
-   else if (type == 1)
-      value = ( + ( Y1 / (B * sin(c) )                                 )
-                + ( Z1 * ( cos(b)*cos(c) - cos(a) ) / (B * G * sin(c)) ) );
+   run = bins;
 
-   else
-      value = (  ( + X1 * ((1/P) - (1/Q))
-                   + Y1 * ((1/P) + (2/Q))
-                  + Z1 * ((1/P) - (1/Q))  )
-                  / (3 * A)                  );
+   for (count1 = nbin - 2; count1 >= 0; count1 --)  // At least threshold
+      SweepAdd(&run[count1], &run[count1 + 1]);
 
-   return (value * Y_CELL);
+   cout  << "   CUTSW => ---------------------------------------\n"
+         << "   CUTSW => | Map 2 at least |  Points  | R (type " << type
+         << ") |\n"
+         << "   CUTSW => |----------------|----------|------------|\n";
+
+   for (count1 = 0; count1 < nbin; count1 ++)
+      {
+      cout  << "   CUTSW => | ";
+      cout.width(14);   cout << SweepEdge(min, max, steps, count1) << " | ";
+      cout.width(8);    cout << (long) run[count1].num << " | ";
+      cout.width(10);   cout << SweepR(&run[count1], type) << " |\n";
+      }
+
+   cout  << "   CUTSW => ---------------------------------------\n";
+
+   return;
 
    }
 
 //**************************************************************************
-//** Calculate Y in real coordinates from Y in fractional coordinates     **
+//** LABEL FIND function:  The root of point a in the union-find forest   **
+//**    up, halving the path on the way.                                  **
 //**************************************************************************
 
-float    C2C_y( int type,
-                float x1, float y1, float z1,
-                float A , float B , float C ,
-                float a , float b , float c   )
+long  LabFind(int *up, long a)
    {
 
-   float G = sqrt( 1 - cos(a)*cos(a)
-                     - cos(b)*cos(b)
-                     - cos(c)*cos(c)
-                     + 2*cos(a)*cos(b)*cos(c)  );
+   while (up[a] != a)
+      {
+      up[a] = up[up[a]];
+      a     = up[a];
+      }
 
-   float P = 1 / ( sqrt (1 + (2 * cos (a)) ) );
-   float Q = 1 / ( sqrt (1 - (1 * cos (a)) ) );
+   return a;
 
-   if      (type == 0)
-      return ( + ( x1 * A * ( cos(c) - cos(a)*cos(b) ) / sin(a) )
-               + ( y1 * B * sin(a)                              ) );
+   }
 
-   else if (type == 1)
-      return ( + ( y1 * B * sin(c)                              )
-               + ( z1 * C * ( cos(a) - cos(b)*cos(c) ) / sin(c) ) );
+//**************************************************************************
+//** LABEL JOIN function:  Joins the sets of points a and b.  The lower   **
+//**    root wins, so every root is the first point of its region and the **
+//**    result does not depend on the order of the joins.                 **
+//**************************************************************************
+
+void  LabJoin(int *up, long a, long b)
+   {
+
+   a = LabFind(up, a);
+   b = LabFind(up, b);
+
+   if      (a < b) up[b] = a;
+   else if (b < a) up[a] = b;
+
+   return;
 
-   else
-      return (  ( + x1 * ((1*P) - (1*Q))
-                  + y1 * ((1*P) + (2*Q))
-                  + z1 * ((1*P) - (1*Q))  )
-                  * (A / 3)                  );
    }
 
 //**************************************************************************
-//** Calculate Z in fractional coordinates from Z in real coordinates     **
+//** LABEL SLAB function:  Thread body for Label.  Joins each point of    **
+//**    sections z0 to z1 that is in with its neighbours before it        **
+//**    (lower z, then y, then x) that are in, for sections z0 + 1 on, or **
+//**    within the same section.  Sections z0 belong to the seam pass, so **
+//**    each thread only touches its own points.                          **
 //**************************************************************************
 
-int      C2C_Z( int type,
-                float X1, float Y1, float Z1,
-                float A , float B , float C ,
-                float a , float b , float c   )
+void  *LabelSlab(void *arg)
    {
 
-   float value;
+   label_job *job = (label_job *) arg;
 
-   float G = sqrt( 1 - cos(a)*cos(a)
-                     - cos(b)*cos(b)
-                     - cos(c)*cos(c)
-                     + 2*cos(a)*cos(b)*cos(c)  );
+   int      lim[3] = {X_LIM, Y_LIM, Z_LIM};
+   int      c[3];
+   int      n[3];
+   int      count1;
+   int      k;
 
-   float P = 1 / ( sqrt (1 + (2 * cos (a)) ) );
-   float Q = 1 / ( sqrt (1 - (1 * cos (a)) ) );
+   long     LOC;
+   long     NEXT;
 
-   if      (type == 0)
-      value = ( + ( X1 * ( cos(a)*cos(c)-cos(b) ) / (C * G * sin (a)) )
-                - ( Y1 / (C * tan(a) )                                )
-                + ( Z1 / C                                            ) );
+   for (c[2] = job->z0; c[2] < job->z1; c[2] ++)
+      for (c[1] = 0; c[1] < Y_LIM; c[1] ++)
+         for (c[0] = 0; c[0] < X_LIM; c[0] ++)
+            {
+            LOC = c[0] + (c[1] * X_LIM) + (c[2] * XY_LIM);
 
-   else if (type == 1)
-      value = ( Z1 * sin(c) / (C * G) );
+            if (!job->in[LOC]) continue;
 
-   else
-      value = (  ( + X1 * ((1/P) - (1/Q))
-                   + Y1 * ((1/P) - (1/Q))
-                   + Z1 * ((1/P) + (2/Q))  )
-                   / (3 * A)                  );
+            for (count1 = 0; count1 < job->noff; count1 ++)
+               {
+               if ((c[2] == job->z0) && job->off[count1][2]) continue;
 
-   return (value * Z_CELL);
+               for (k = 0; k <= 2; k ++)
+                  {
+                  n[k] = c[k] + job->off[count1][k];
+
+                  if ((n[k] < 0) || (n[k] >= lim[k]))
+                     {
+                     if (!job->wrap[k]) break;
+                     n[k] = (n[k] + lim[k]) % lim[k];
+                     }
+                  }
+
+               if (k < 3) continue;
+
+               NEXT = n[0] + (n[1] * X_LIM) + (n[2] * XY_LIM);
+
+               if (job->in[NEXT]) LabJoin(job->up, LOC, NEXT);
+               }
+            }
+
+   return NULL;
 
    }
 
 //**************************************************************************
-//** Calculate Z in real coordinates from Z in fractional coordinates     **
+//** LABEL function:  Numbers the connected regions of the points that    **
+//**    are in (a mask, or a map at least some level) in map3, with 6, 18 **
+//**    or 26 neighbours.  The map wraps around along each axis that      **
+//**    covers the whole cell.  The sections are split among threads,     **
+//**    each joining the points of its own slab, then the seams between   **
+//**    slabs are joined in one pass.  Regions of fewer than least points **
+//**    are dropped; the others are numbered from 1 in the order of their **
+//**    first point, and listed with their size, box, and the sum and     **
+//**    largest value of map1.  Returns the number of regions kept.       **
 //**************************************************************************
 
-float    C2C_z( int type,
-                float x1, float y1, float z1,
-                float A , float B , float C ,
-                float a , float b , float c   )
+long  Label(const char *in, int map3, int conn, long least, int map1)
    {
 
-   float G = sqrt( 1 - cos(a)*cos(a)
-                     - cos(b)*cos(b)
-                     - cos(c)*cos(c)
-                     + 2*cos(a)*cos(b)*cos(c)  );
+   label_job   job[16];
+   pthread_t   tid[16];
+
+   int         made[16];
+
+   int         N[3]  = {MAP_H[0].NX, MAP_H[0].NY, MAP_H[0].NZ};
+   int         ax[3] = {MAP_H[0].MAPC - 1, MAP_H[0].MAPR - 1,
+                        MAP_H[0].MAPS - 1};
+   int         lim[3] = {X_LIM, Y_LIM, Z_LIM};
+   int         off[13][3];
+   int         wrap[3];
+   int         noff = 0;
+   int         nth  = sysconf(_SC_NPROCESSORS_ONLN);
+   int         c[3];
+   int         n[3];
+   int         count1;
+   int         dx;
+   int         dy;
+   int         dz;
+   int         j;
+   int         k;
+
+   long        LOC;
+   long        NEXT;
+   long        num = 0;
+
+   vector<int>    up(XYZ_LIM);
+   vector<long>   id;                  // Region of each root, or 0
+   vector<long>   size;
+
+   float       *lab = MAP + (map3 * XYZ_LIM);
+   const float *rho = MAP + (map1 * XYZ_LIM);
+
+   for (dz = -1; dz <= 0; dz ++)                   // Neighbours before
+      for (dy = -1; dy <= 1; dy ++)
+         for (dx = -1; dx <= 1; dx ++)
+            {
+            if ((dz == 0) && ((dy > 0) || ((dy == 0) && (dx >= 0))))
+               continue;
 
-   float P = 1 / ( sqrt (1 + (2 * cos (a)) ) );
-   float Q = 1 / ( sqrt (1 - (1 * cos (a)) ) );
+            k = (dx != 0) + (dy != 0) + (dz != 0);
 
-   if      (type == 0)
-      return ( + ( x1 * A * cos(b)  )
-               + ( y1 * B * cos(a)  )
-               + ( z1 * C           ) );
+            if ((k == 2 && conn < 18) || (k == 3 && conn < 26)) continue;
 
-   else if (type == 1)
-      return ( z1 * C * G / sin(c)  );
+            off[noff][0] = dx;   off[noff][1] = dy;   off[noff][2] = dz;
+            noff ++;
+            }
 
-   else
-      return (  ( + z1 * ((1*P) - (1*Q))
-                  + y1 * ((1*P) - (1*Q))
-                  + z1 * ((1*P) + (2*Q))  )
-                  * (A / 3)                  );
-   }
+   for (k = 0; k <= 2; k ++)                       // Whole cell along k
+      wrap[k] = (ax[k] >= 0) && (ax[k] <= 2) && (lim[k] == N[ax[k]]);
 
-//**************************************************************************
-//** INT function:  Integrates electron density for sphere.               **
-//**************************************************************************
+   if (nth < 1)     nth = 1;
+   if (nth > 16)    nth = 16;
+   if (nth > Z_LIM) nth = Z_LIM;
 
-float Int(int X, int Y, int Z, float r, int map1)
-   {
+   for (LOC = 0; LOC < XYZ_LIM; LOC ++) up[LOC] = LOC;
 
-   register int   countz;
-   register int   county;
-   register int   countx;
+   for (count1 = 0; count1 < nth; count1 ++)       // Sections for each thread
+      {
+      job[count1].in   = in;
+      job[count1].up   = &up[0];
+      job[count1].off  = off;
+      job[count1].noff = noff;
+      job[count1].z0   = (long) Z_LIM *  count1      / nth;
+      job[count1].z1   = (long) Z_LIM * (count1 + 1) / nth;
+
+      for (k = 0; k <= 2; k ++) job[count1].wrap[k] = wrap[k];
+      }
 
-   register int   dZ;
-   register int   dY;
-   register int   dX;
+   for (count1 = 1; count1 < nth; count1 ++)
+      if ((made[count1] = !pthread_create(&tid[count1], NULL, LabelSlab,
+                                          &job[count1])) == 0)
+         LabelSlab(&job[count1]);
 
-   register int   maxX;
-   register int   minX;
+   LabelSlab(&job[0]);
 
-   register int   maxY;
-   register int   minY;
+   for (count1 = 1; count1 < nth; count1 ++)
+      if (made[count1]) pthread_join(tid[count1], NULL);
 
-   register int   maxZ;
-   register int   minZ;
+   for (count1 = 0; count1 < nth; count1 ++)       // The seams:  first
+      {                                            //    section of each
+      c[2] = job[count1].z0;                       //    slab to the one
+      n[2] = c[2] - 1;                             //    before it
 
-   register int   LOC;
+      if ((n[2] < 0) && !wrap[2]) continue;
 
-   register int   num;
+      n[2] = (n[2] + Z_LIM) % Z_LIM;
 
-   register double value = 0;
+      for (c[1] = 0; c[1] < Y_LIM; c[1] ++)
+         for (c[0] = 0; c[0] < X_LIM; c[0] ++)
+            {
+            LOC = c[0] + (c[1] * X_LIM) + (c[2] * XY_LIM);
 
-   minX = X - (r/X_GRID) - 1;   if (minX < 1)     minX = 1;
-   maxX = X + (r/X_GRID) + 1;   if (maxX > X_LIM) maxX = X_LIM;
+            if (!in[LOC]) continue;
 
-   minY = Y - (r/Y_GRID) - 1;   if (minY < 1)     minY = 1;
-   maxY = Y + (r/Y_GRID) + 1;   if (maxY > Y_LIM) maxY = Y_LIM;
+            for (j = 0; j < noff; j ++)
+               {
+               if (!off[j][2]) continue;
 
-   minZ = Z - (r/Z_GRID) - 1;   if (minZ < 1)     minZ = 1;
-   maxZ = Z + (r/Z_GRID) + 1;   if (maxZ > Z_LIM) maxZ = Z_LIM;
+               for (k = 0; k <= 1; k ++)
+                  {
+                  n[k] = c[k] + off[j][k];
 
-   for (countz = minZ; countz <= maxZ; countz ++)
-      for (county = minY; county <= maxY; county ++)
-         for (countx = minX; countx <= maxX; countx ++)
-            {
-            LOC = ((countx - 1)          ) +
-                  ((county - 1) * X_LIM  ) +
-                  ((countz - 1) * XY_LIM );
+                  if ((n[k] < 0) || (n[k] >= lim[k]))
+                     {
+                     if (!wrap[k]) break;
+                     n[k] = (n[k] + lim[k]) % lim[k];
+                     }
+                  }
 
-            dX = Abs(X-countx);
-            dY = Abs(Y-county);
-            dZ = Abs(Z-countz);
+               if (k < 2) continue;
 
-            if (distance(dX, dY, dZ) > r) continue;
+               NEXT = n[0] + (n[1] * X_LIM) + (n[2] * XY_LIM);
 
-            num ++;
+               if (in[NEXT]) LabJoin(&up[0], LOC, NEXT);
+               }
+            }
+      }
 
-            value = value + MAP[LOC + (map1 * XYZ_LIM)];
+   id.assign(XYZ_LIM, 0);
+   size.assign(1, 0);
+
+   for (LOC = 0; LOC < XYZ_LIM; LOC ++)            // Sizes, by root
+      if (in[LOC])
+         {
+         up[LOC] = LabFind(&up[0], LOC);
+         id[up[LOC]] ++;
+         }
+
+   for (LOC = 0; LOC < XYZ_LIM; LOC ++)            // Number the roots
+      if (in[LOC] && (up[LOC] == LOC))
+         {
+         if (id[LOC] < least) id[LOC] = 0;
+         else
+            {
+            size.push_back(id[LOC]);
+            id[LOC] = ++ num;
             }
+         }
 
-   value = value * vox_vol;
+   vector<double> sum (num + 1, 0);
+   vector<float>  big (num + 1, 0);
+   vector<int>    box ((num + 1) * 6, 0);
 
-   return value;
+   for (count1 = 1; count1 <= num; count1 ++)
+      {
+      box[count1 * 6 + 0] = box[count1 * 6 + 2] = box[count1 * 6 + 4] =
+         INT_MAX;
+      big[count1] = -HUGE_VALF;
+      }
+
+   for (LOC = 0; LOC < XYZ_LIM; LOC ++)
+      {
+      count1   = in[LOC] ? id[up[LOC]] : 0;
+      lab[LOC] = count1;
+
+      if (!count1) continue;
+
+      c[0] = LOC % X_LIM;
+      c[1] = (LOC / X_LIM) % Y_LIM;
+      c[2] = LOC / XY_LIM;
+
+      for (k = 0; k <= 2; k ++)
+         {
+         if (c[k] + 1 < box[count1 * 6 + k * 2])
+            box[count1 * 6 + k * 2] = c[k] + 1;
+         if (c[k] + 1 > box[count1 * 6 + k * 2 + 1])
+            box[count1 * 6 + k * 2 + 1] = c[k] + 1;
+         }
+
+      sum[count1] += rho[LOC];
+      if (rho[LOC] > big[count1]) big[count1] = rho[LOC];
+      }
+
+   MAP_H[map3] = MAP_H[0];
+
+   map_symm[map3] = 0;
+
+   MapTouch(map3);
+
+   cout  << "   LABEL => -------------------------------------------------"
+         << "---------------------------------------\n"
+         << "   LABEL => | Region |  Points  |  X from-to  |  Y from-to  |"
+         << "  Z from-to  |  Density sum | Largest |\n"
+         << "   LABEL => |--------|----------|-------------|-------------|"
+         << "-------------|--------------|---------|\n";
+
+   for (count1 = 1; count1 <= num; count1 ++)
+      {
+      cout  << "   LABEL => | ";
+      cout.width(6);    cout << count1 << " | ";
+      cout.width(8);    cout << size[count1] << " |";
+
+      for (k = 0; k <= 2; k ++)
+         {
+         cout  << " ";
+         cout.width(5);    cout << box[count1 * 6 + k * 2] << "-";
+         cout.width(5);    cout << box[count1 * 6 + k * 2 + 1] << " |";
+         }
+
+      cout  << " ";
+      cout.width(12);   cout << sum[count1] << " | ";
+      cout.width(7);    cout << big[count1] << " |\n";
+      }
+
+   cout  << "   LABEL => -------------------------------------------------"
+         << "---------------------------------------\n";
+
+   return num;
 
    }
 
 //**************************************************************************
-//** INTEGRATE function:  Integrates density for all atoms in pdb file    **
+//** REGION STATISTICS function:  Number of points, average, RMS, least   **
+//**    and largest value of map1 in every region numbered in map3 (by    **
+//**    LABEL), all in one pass.                                          **
 //**************************************************************************
 
-void  Integrate(int pdb1, int map1)
+void  RegionStats(int map1, int map3)
    {
 
-   register int count1;
-   register int LOC;
+   const float *rho = MAP + (map1 * XYZ_LIM);
+   const float *lab = MAP + (map3 * XYZ_LIM);
 
-   for (count1 = 1; count1 <= pdb_len[pdb1]; count1 ++)
+   region_sum  zero = {0, 0, 0, HUGE_VALF, -HUGE_VALF};
+
+   long        LOC;
+   long        count1;
+   long        num = 0;
+
+   double      avg;
+   double      var;
+
+   vector<region_sum> reg;
+
+   for (LOC = 0; LOC < XYZ_LIM; LOC ++)            // Highest region
+      if (lab[LOC] > num) num = (long) lab[LOC];
+
+   reg.assign(num + 1, zero);
+
+   for (LOC = 0; LOC < XYZ_LIM; LOC ++)
       {
+      if (!(lab[LOC] >= 1)) continue;
 
-      LOC = ((pdb_mem * pdb1) + count1);
+      region_sum *r = &reg[(long) lab[LOC]];
 
-      if (!PDB[LOC].Type) continue;
+      r->num ++;
+      r->s1 += rho[LOC];
+      r->q1 += (double) rho[LOC] * rho[LOC];
 
-      PDB[LOC].Enum = Int(   PDB[LOC].X,
-                             PDB[LOC].Y,
-                             PDB[LOC].Z,
-                             PDBdat[PDB[LOC].Type].r,
-                             map1                      );
+      if (rho[LOC] < r->min) r->min = rho[LOC];
+      if (rho[LOC] > r->max) r->max = rho[LOC];
+      }
 
+   cout  << "   REGIO => ------------------------------------------------"
+         << "-------------------\n"
+         << "   REGIO => | Region |  Points  |   Average  |     RMS    |"
+         << "  Least  | Largest |\n"
+         << "   REGIO => |--------|----------|------------|------------|"
+         << "---------|---------|\n";
+
+   for (count1 = 1; count1 <= num; count1 ++)
+      {
+      if (!reg[count1].num) continue;
+
+      avg = reg[count1].s1 / reg[count1].num;
+      var = reg[count1].q1 / reg[count1].num - avg * avg;
+
+      cout  << "   REGIO => | ";
+      cout.width(6);    cout << count1 << " | ";
+      cout.width(8);    cout << reg[count1].num << " | ";
+      cout.width(10);   cout << avg << " | ";
+      cout.width(10);   cout << ((var > 0) ? sqrt(var) : 0) << " | ";
+      cout.width(7);    cout << reg[count1].min << " | ";
+      cout.width(7);    cout << reg[count1].max << " |\n";
       }
 
+   cout  << "   REGIO => ------------------------------------------------"
+         << "-------------------\n";
+
+   return;
+
    }
 
 //**************************************************************************
@@ -4334,6 +12374,11 @@ void  Help()
 <<"*    HELP  => Displays this information to screen.                     *\n"
 <<"*    KEYS  => Displays just the keys and command formats to screen.    *\n"
 <<"*    LIST  => Lists maps and masks in memory, with original load name. *\n"
+<<"*    STATS => Lists the map statistics (AVG, RMS, RFAC) kept from      *\n"
+<<"*             earlier commands.  Every map and mask carries a          *\n"
+<<"*             generation, renewed by any command that changes it, so   *\n"
+<<"*             asking again for the statistics of an unchanged map and  *\n"
+<<"*             mask costs nothing.  Also shows how often that happened. *\n"
 <<"*                                                                      *\n"
 <<"*    MAPIN X1 'name'                                                   *\n"
 <<"*          => Input a map of name 'name' into variable location X1.    *\n"
@@ -4345,7 +12390,151 @@ void  Help()
 <<"*             by the RsRf program is to input a map with the name given*\n"
 <<"*             at the command line.  ALL OTHER MAPS AND MASKS INPUT TO  *\n"
 <<"*             THE PROGRAM MUST HAVE THE SAME NUMBER OF ROWS, COLUMNS,  *\n"
-<<"*             AND SECTIONS AS THIS FIRST COMMAND LINE INPUT MAP.       *\n"
+<<"*             AND SECTIONS AS THIS FIRST COMMAND LINE INPUT MAP,       *\n"
+<<"*             though the axis order (MAPC, MAPR, MAPS) may differ.     *\n"
+<<"*             Maps are held with x fastest, whatever their axis order, *\n"
+<<"*             and are written back in the axis order of the first map  *\n"
+<<"*             (not so with -stream or -shm, where maps stay in the     *\n"
+<<"*             order of their files and must all share it).             *\n"
+<<"*    MAPBOX x y z nx ny nz                                             *\n"
+<<"*          => Work on a box of the maps only.  From now on MAPIN and   *\n"
+<<"*             MASKI read just the nx*ny*nz grid points starting at     *\n"
+<<"*             grid point x y z (columns, rows, sections of the         *\n"
+<<"*             principal map file, in the grid units of its header),    *\n"
+<<"*             wrapping across unit cell edges.  The principal map is   *\n"
+<<"*             read again as a box and all other maps and masks must be *\n"
+<<"*             read again.  The box origin is kept in the map header, so*\n"
+<<"*             written maps are boxes too.  SMEAR, ROUGH and INT take   *\n"
+<<"*             points beyond the box from their symmetry or lattice     *\n"
+<<"*             mates inside it, as for any map smaller than the cell    *\n"
+<<"*             (see SMEAR).  MAPBOX 0 0 0 0 0 0 returns to whole maps.  *\n"
+<<"*          => Example:  ?MAPBOX 30 -3 25 10 8 9                        *\n"
+<<"*    MTZIN X1 'name' F PHI                                             *\n"
+<<"*          => Calculate a map into location X1 from the amplitude and  *\n"
+<<"*             phase (degrees) columns labelled F and PHI of the MTZ    *\n"
+<<"*             file 'name', as the CCP4 program fft does.  The          *\n"
+<<"*             reflections are expanded with the symmetry operators in  *\n"
+<<"*             the file and transformed on the grid of the principal    *\n"
+<<"*             map, and X1 covers the same part of the cell, with the   *\n"
+<<"*             same axis order, as the principal map.  Reflections      *\n"
+<<"*             finer than the grid are left out.  The last MTZ file is  *\n"
+<<"*             kept in memory, so maps with other columns are fast.     *\n"
+<<"*          => Example:  ?MTZIN 2 final.mtz FC PHIC                     *\n"
+<<"*    MODELMAP X1 P1 B                                                  *\n"
+<<"*          => Calculate the density of the atoms of PDB file P1 (read  *\n"
+<<"*             with PDBIN) straight onto the grid of map X1, with no    *\n"
+<<"*             structure factors.  Each atom is a sum of Gaussians for  *\n"
+<<"*             its element (columns 77-78, or the atom name), blurred   *\n"
+<<"*             by its B factor plus B, and weighted by its occupancy.   *\n"
+<<"*             The map wraps around the unit cell, and is in e/A^3      *\n"
+<<"*             with F000 included.  Much faster than sfall and fft for  *\n"
+<<"*             a few residues.                                          *\n"
+<<"*          => Example:  ?MODELMAP 3 1 0.0                              *\n"
+<<"*    WINDOW X1 X2 P1 N R                                               *\n"
+<<"*          => Real space R factor, sum |X1-X2| / sum |X1+X2|, and      *\n"
+<<"*             correlation of map X1 against map X2 in windows of N     *\n"
+<<"*             residues along PDB file P1, one window centred on each   *\n"
+<<"*             residue and cut at chain ends.  A window holds the grid  *\n"
+<<"*             points within R angstroms of its atoms (the radii of     *\n"
+<<"*             the PDB data, as for OCCUP, when R is 0).  From one      *\n"
+<<"*             window to the next only the points that come in or go    *\n"
+<<"*             out are visited, so long chains cost little more than    *\n"
+<<"*             the residues themselves.  Not in streaming mode.         *\n"
+<<"*          => Example:  ?WINDOW 1 2 1 3 1.5                            *\n"
+<<"*    PAINT Y1 P1 R                                                     *\n"
+<<"*          => Make mask Y1 the grid points within R angstroms (the     *\n"
+<<"*             radii of the PDB data when R is 0) of an atom of PDB     *\n"
+<<"*             file P1 or of one of its symmetry or lattice mates.  The *\n"
+<<"*             atoms are sorted once into a grid of cells over the unit *\n"
+<<"*             cell, so each point only looks at the atoms of the cells *\n"
+<<"*             around it, and large models cost little more than small  *\n"
+<<"*             ones.  Mask memory must exist (read a mask with MASKI).  *\n"
+<<"*          => Example:  ?PAINT 1 1 2.5                                 *\n"
+<<"*    NEAR P1 A R                                                       *\n"
+<<"*          => List the atoms of PDB file P1, and their symmetry mates, *\n"
+<<"*             within R angstroms of atom A (counting from 1 in the     *\n"
+<<"*             file), nearest first.  Uses the same cell list as PAINT. *\n"
+<<"*          => Example:  ?NEAR 1 25 4.0                                 *\n"
+<<"*    PARTITION P1 R YES/NO                                             *\n"
+<<"*          => Give every grid point within R angstroms of an atom of   *\n"
+<<"*             PDB file P1 (or a symmetry mate) to the nearest atom,    *\n"
+<<"*             in one threaded pass using the cell list of PAINT.  With *\n"
+<<"*             YES the distance less the atom radius of the PDB data    *\n"
+<<"*             is used, so large atoms take more.  No point belongs to  *\n"
+<<"*             two atoms.  Afterwards OCCUP on P1 sums the density of   *\n"
+<<"*             the points of each atom instead of a sphere, and WINDOW  *\n"
+<<"*             with R of -1 uses the points of the window's atoms.      *\n"
+<<"*             Kept until P1 is read again.                             *\n"
+<<"*          => Example:  ?PARTITION 1 3.0 NO                            *\n"
+<<"*    DISTMAP X1 P1 A1 A2 D                                             *\n"
+<<"*          => Put in map X1 the distance from each grid point to the   *\n"
+<<"*             nearest of atoms A1 to A2 of PDB file P1 (0 0 for all),  *\n"
+<<"*             or their symmetry mates, up to D angstroms (points       *\n"
+<<"*             further away get just over D, so BELOW D leaves them     *\n"
+<<"*             out).  For cells with right angles a distance transform  *\n"
+<<"*             on the whole cell grid (even for a boxed map) gives each *\n"
+<<"*             point a bound, and each point then searches the cell     *\n"
+<<"*             list of PAINT within its bound for the exact distance;   *\n"
+<<"*             other cells search up to D.  The searches are threaded   *\n"
+<<"*             over sections and cost about as much as PAINT with the   *\n"
+<<"*             bound as radius.  A mask of any radius is then one BELOW.*\n"
+<<"*          => Example:  ?DISTMAP 3 1 0 0 8.0                           *\n"
+<<"*    BELOW Y1 X1 V                                                     *\n"
+<<"*          => Make mask Y1 the points where map X1 is at most V.       *\n"
+<<"*          => Example:  ?BELOW 1 3 2.5 (with map 3 from DISTMAP, the   *\n"
+<<"*             points within 2.5 angstroms of the atoms).               *\n"
+<<"*    RFSWEEP X1 X2 X3 D N T                                            *\n"
+<<"*          => R factor of type T (1 to 6, as for RFAC) of map X1       *\n"
+<<"*             against map X2 inside radii D/N, 2D/N, ... D of the      *\n"
+<<"*             atoms, where X3 is a distance map from DISTMAP.  One     *\n"
+<<"*             threaded pass sorts the points into N shells by their    *\n"
+<<"*             distance (a point at a radius is inside it, as for       *\n"
+<<"*             PAINT), and the R factor for each radius comes from      *\n"
+<<"*             the running sum of the shells, so the whole curve costs  *\n"
+<<"*             one RFAC.  The R factor of each shell is also given.     *\n"
+<<"*             Make X3 from one residue's atoms for its own curve.      *\n"
+<<"*          => Example:  ?RFSWEEP 1 2 3 5.0 10 6                        *\n"
+<<"*    CUTSWEEP X1 X2 IN/OUT/TOTAL Y1 MIN MAX N T                        *\n"
+<<"*          => R factor of type T (1 to 6, as for RFAC) of map X1       *\n"
+<<"*             against map X2, IN/OUT of mask Y1, over the points where *\n"
+<<"*             X2 is at least each of N thresholds from MIN up to MAX,  *\n"
+<<"*             both included (MIN alone when N is 1), as a mask cut     *\n"
+<<"*             from X2 at that level would give.  One threaded pass     *\n"
+<<"*             sorts the points into N bins by X2, and each threshold   *\n"
+<<"*             takes the running sum of the bins above it, so any       *\n"
+<<"*             number of thresholds costs one RFAC.                     *\n"
+<<"*          => Example:  ?CUTSWEEP 1 2 TOTAL 0.1 0.5 8 6                *\n"
+<<"*    LABEL MASK Y1 / MAP X2 V, C N X1 X3                               *\n"
+<<"*          => Number the connected regions of the IN points of mask    *\n"
+<<"*             Y1, or of the points of map X2 at or above V, with C     *\n"
+<<"*             (6, 18 or 26) neighbours, into map X3 (0 outside).       *\n"
+<<"*             Regions of fewer than N points are dropped.  Each        *\n"
+<<"*             region is listed with its points, box, and the sum and   *\n"
+<<"*             largest value of map X1.  The map wraps around along     *\n"
+<<"*             each axis that covers the whole cell.  Threads join the  *\n"
+<<"*             points of their own sections and the seams are joined    *\n"
+<<"*             after, so the numbers, in order of each region's first   *\n"
+<<"*             point, do not depend on the number of threads.  Write    *\n"
+<<"*             X3 out to keep the regions.                              *\n"
+<<"*          => Example:  ?LABEL MASK 1 6 10 1 3                         *\n"
+<<"*          => Example:  ?LABEL MAP 2 0.5 26 1 1 3                      *\n"
+<<"*    REGIONSTATS X1 X3                                                 *\n"
+<<"*          => Points, average, RMS, least and largest value of map     *\n"
+<<"*             X1 in every region numbered in map X3 by LABEL, in one   *\n"
+<<"*             pass.                                                    *\n"
+<<"*          => Example:  ?REGIONSTATS 1 3                               *\n"
+<<"*    SYMMETRIC X1 YES/NO                                               *\n"
+<<"*          => Say whether map X1 has the symmetry of the space group   *\n"
+<<"*             of the principal map (ISPG in its header).  Maps from    *\n"
+<<"*             MTZIN are marked YES, and maps read with MAPIN or        *\n"
+<<"*             MODELMAP NO.  When the map covers one whole cell and its *\n"
+<<"*             grid fits the group, TOTAL statistics (AVG, RMS, SCALE,  *\n"
+<<"*             and RFAC of two such maps) only visit one point of each  *\n"
+<<"*             set of symmetry related points, weighted by the size of  *\n"
+<<"*             the set.  IN/OUT operations on the map, SMEAR and ROUGH  *\n"
+<<"*             mark it NO.  PDB atoms outside the map are placed on a   *\n"
+<<"*             symmetry mate that lies inside it.                       *\n"
+<<"*          => Example:  ?SYMMETRIC 2 YES                               *\n"
 <<"*    MASKI Y1 'name'                                                   *\n"
 <<"*          => Input a mask of name 'name' into variable location Y1.   *\n"
 <<"*             This mask will from then on be referenced by its number  *\n"
@@ -4377,11 +12566,26 @@ void  Help()
 <<"*    SMEAR X1 X2 X3 N                                                  *\n"
 <<"*          => Smooth map X1 by convolution with linear density         *\n"
 <<"*             sphere and save in location X2.  Memory location X3 is   *\n"
-<<"*             used for temporary calculations.                         *\n"
+<<"*             used for temporary calculations.  Maps need not cover    *\n"
+<<"*             the unit cell:  beyond the map edges (NCSTART etc. in    *\n"
+<<"*             the header) density is taken from a symmetry or lattice  *\n"
+<<"*             mate inside the map, and points with none are left out.  *\n"
+<<"*             The same holds for ROUGH and INT.                        *\n"
+<<"*             INTEGRATE and OCCUP sum density with INT, so they take   *\n"
+<<"*             points beyond the map edges from their symmetry mates,   *\n"
+<<"*             even for a whole-cell map.                               *\n"
 <<"*          => Example:  ?SMEAR 1 3 4 3                                 *\n"
 <<"*             Smooths map 1 by spreading out density in one pixel to   *\n"
 <<"*             three additional pixels in all directions, and saves in  *\n"
 <<"*             memory location 3.                                       *\n"
+<<"*    BRICK n                                                           *\n"
+<<"*          => SMEAR and ROUGH work through the maps in bricks of       *\n"
+<<"*             n x n x n grid points, each copied out with the halo of  *\n"
+<<"*             neighbours its points need, so that the points gathered  *\n"
+<<"*             stay in cache however large the map.  Results are the    *\n"
+<<"*             same as without.  BRICK 0 (the default) goes back to     *\n"
+<<"*             the plain loops over whole maps.                         *\n"
+<<"*          => Example:  ?BRICK 8                                       *\n"
 <<"*                                                                      *\n"
 <<"*    ZERO X1 IN/OUT/TOTAL Y1                                           *\n"
 <<"*          => Assigns zero to all pixels in map X1 which are IN/OUT of *\n"
@@ -4458,6 +12662,21 @@ void  Help()
 <<"*          => Example:  ?WRITE 3 out.map                               *\n"
 <<"*    MASKO Y1 'name'                                                   *\n"
 <<"*          => Write mask number Y1 to file named 'name'.               *\n"
+<<"*    Compressed files:  MAPIN and MASKI (and the command line map)     *\n"
+<<"*             also read maps and masks compressed with gzip or zstd,   *\n"
+<<"*             known by their first bytes.  WRITE and MASKO compress    *\n"
+<<"*             when the name ends in .gz or .zst.  The data passes      *\n"
+<<"*             through a gzip (pigz if installed) or zstd process       *\n"
+<<"*             straight into memory, with no temporary file.  Masks     *\n"
+<<"*             compress very well.  Compressed files can not be used    *\n"
+<<"*             with MAPBOX, -stream or -shm.                            *\n"
+<<"*    SAVE 'name'                                                       *\n"
+<<"*          => Save the whole workspace (all maps, masks, headers,      *\n"
+<<"*             statistics, PDB files and names) to one binary file.     *\n"
+<<"*    RESTORE 'name'                                                    *\n"
+<<"*          => Restore a workspace written by SAVE.  The maps and masks *\n"
+<<"*             are mapped from the file, not read, so this is immediate *\n"
+<<"*             and a long preparation need only be run once.            *\n"
 <<"*                                                                      *\n"
 <<"*    GRAY 'name' n X1 X1Start X1Step ... Xn XnStart XnStep             *\n"
 <<"*         x1 x2 y1 y2 z1 z2                                            *\n"
@@ -4482,6 +12701,56 @@ void  Help()
 <<"*    END/QUIT/STOP                                                     *\n"
 <<"*          => Quits program.                                           *\n"
 <<"*                                                                      *\n"
+<<"*    COMMAND LINE OPTIONS                                              *\n"
+<<"*          => RsRf 'map' [maps] [masks] [-stream] [-slab N]            *\n"
+<<"*                  [-server 'socket'] [-shm] [-box x y z nx ny nz]     *\n"
+<<"*                  [-prefetch] [-quiet]                                *\n"
+<<"*             'map' is the principal map, maps and masks are the       *\n"
+<<"*             number of memory locations (default 3 and 1).            *\n"
+<<"*    -stream  Streaming mode for maps larger than memory.  Maps and    *\n"
+<<"*             masks are left on disk and RFAC, RMS, AVG, SCALE, ADD,   *\n"
+<<"*             SUB, COMB, PLUS, MULT, CUT, ZERO, SMEAR, ROUGH, WRITE    *\n"
+<<"*             and MASKO read them in slabs of Z sections, with the     *\n"
+<<"*             next slab read while the current one is processed.       *\n"
+<<"*             Modified maps are kept in scratch files (in $TMPDIR or   *\n"
+<<"*             the current directory) which are removed on exit.  Other *\n"
+<<"*             keywords are not available in this mode.                 *\n"
+<<"*    -slab N  Number of Z sections in each streamed slab (default 16). *\n"
+<<"*    -server 'socket'                                                  *\n"
+<<"*             Server mode.  After the principal map is read RsRf waits *\n"
+<<"*             for clients on the Unix domain socket 'socket'.  Each    *\n"
+<<"*             client sends keywords exactly as on standard input, or   *\n"
+<<"*             one JSON command per line, e.g.                          *\n"
+<<"*                {\"cmd\":\"RFAC\",\"args\":[1,2,\"IN\",1,6]}                  *\n"
+<<"*             and reads the replies.  Maps, masks and PDB files stay   *\n"
+<<"*             in memory between clients.  END/QUIT/STOP/EXIT (or       *\n"
+<<"*             closing the connection) ends the client, SHUTDOWN stops  *\n"
+<<"*             the server.                                              *\n"
+<<"*    -shm     Shared maps.  MAPIN keeps each map file in a POSIX       *\n"
+<<"*             shared memory segment (/dev/shm/rsrf-<hash>).  The       *\n"
+<<"*             first RsRf on the node to read a map fills the segment,  *\n"
+<<"*             later ones map it copy-on-write, so any number of RsRf   *\n"
+<<"*             processes share one copy of start.map and model.map.     *\n"
+<<"*             Segments outlive the processes; remove them with         *\n"
+<<"*             rm /dev/shm/rsrf-*.                                      *\n"
+<<"*    -box x y z nx ny nz                                               *\n"
+<<"*             Read the principal map (and all later maps and masks) as *\n"
+<<"*             a box, as for MAPBOX.  Not used with -stream.            *\n"
+<<"*    -prefetch                                                         *\n"
+<<"*             Read the whole keyword script from standard input first, *\n"
+<<"*             then read every map and mask named by MAPIN and MASKI    *\n"
+<<"*             (and the principal map) at the same time, in background  *\n"
+<<"*             threads.  Each MAPIN or MASKI waits only for its own     *\n"
+<<"*             file.  Plain files are read into the page cache, and     *\n"
+<<"*             compressed ones decoded into memory, which is let go     *\n"
+<<"*             once the script is past their MAPIN or MASKI.  Files     *\n"
+<<"*             with a short header, or not the size of the principal    *\n"
+<<"*             map, are left to MAPIN and MASKI.  Files also named by   *\n"
+<<"*             WRITE, MASKO or SAVE are read when asked for.  Not used  *\n"
+<<"*             with -stream or -server.                                 *\n"
+<<"*    -quiet   No banner, principal map header or map size tables, for  *\n"
+<<"*             short runs driven by another program.                    *\n"
+<<"*                                                                      *\n"
 <<"************************************************************************\n"
 <<"************************************************************************\n"
 <<"\n\n";